@@ -31,17 +31,26 @@
 // Protocol based on http://code.google.com/p/memcached/wiki/MemcacheBinaryProtocol
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
 #include <string>
 
 #include "cachebash/config.h"
 #include "cachebash/connection.h"
+#include "cachebash/distribution.h"
+#include "cachebash/fanout_request.h"
 #include "cachebash/generator.h"
+#include "cachebash/ketama.h"
+#include "cachebash/latency_breakdown.h"
 #include "cachebash/request.h"
 #include "cachebash/response.h"
 #include "cachebash/size_key_distribution.h"
 #include "cachebash/scoped_ptr.h"
 #include "cachebash/statistic.h"
 #include "cachebash/statistic_manager.h"
+#include "cachebash/perf_counters.h"
+#include "cachebash/tcp_info.h"
+#include "cachebash/trace.h"
 #include "cachebash/util.h"
 #include "cachebash/warmup_sequence.h"
 #include "cachebash/worker_thread.h"
@@ -51,32 +60,91 @@ namespace cachebash {
 
 void PrintUsage() {
   printf("usage: loader [-option]\n"
+    "     [-a arg  fill GET misses after a backend delay in seconds drawn\n"
+    "              from fixed:V, uniform:MIN:MAX or exp:MEAN]\n"
+    "     [-b break latency down by server, opcode and log2 of value\n"
+    "        size]\n"
     "     [-c arg  connections per worker]\n"
+    "     [-C also break latency down per connection]\n"
     "     [-d enable packet debugging]\n"
+    "     [-e arg  item TTL in seconds drawn from fixed:V, uniform:MIN:MAX\n"
+    "              or exp:MEAN, unless the -f file gives a TTL column;\n"
+    "              capped at 30 days, memcached's longest relative TTL]\n"
     "     [-f arg  size/key object distribution file]\n"
     "     [-F arg  fixed object size]\n"
     "     [-g arg  fraction of requests that are gets (The rest are sets)]\n"
     "     [-h prints this message]\n"
+    "     [-K record wire latency from kernel socket timestamps]\n"
+    "     [-j arg  trace one in arg responses with -R (default: 1000, 0 for\n"
+    "              none)]\n"
+    "     [-J arg  also trace every response slower than arg seconds]\n"
+    "     [-k arg  how -b and -C statistics keep quantiles: ddsketch, in\n"
+    "              bounded memory, or hdr, which hlog:FILE can record\n"
+    "              (default: ddsketch)]\n"
+    "     [-i sample TCP_INFO of every connection: rtt, retransmits, cwnd\n"
+    "        and bytes in flight, per server (and per worker with -O and\n"
+    "        -P)]\n"
+    "     [-H arg  hedge GETs outstanding for arg seconds, or for the\n"
+    "              pNN percentile of observed latency, e.g. p95. With\n"
+    "              several servers, backups go to the key's replica and\n"
+    "              every write is mirrored there; a backup's miss waits\n"
+    "              for the primary. With one server, backups go out on\n"
+    "              another connection, so -c must be at least 2]\n"
     "     [-l arg use a fixed number of gets per multiget]\n"
-    "     [-m arg fraction of requests that are multiget]\n"
+    "     [-m arg fraction of requests that are multigets fanned out\n"
+    "             across the servers]\n"
     "     [-n enable naggle's algorithm]\n"
+    "     [-O arg  also write each stats interval to csv:FILE,\n"
+    "              jsonl:FILE, binary:FILE or hlog:FILE (repeatable)]\n"
+    "     [-o arg  split of the non-get requests, e.g. add:0.1,touch:0.2\n"
+    "              (The rest are sets)]\n"
+    "     [-P arg  serve Prometheus metrics at [host:]port/metrics\n"
+    "              (host default: 127.0.0.1)]\n"
+    "     [-p arg  significant digits of latency histograms (default: 2)]\n"
     "     [-r ATTEMPTED requests per second (default: max out rps)]\n"
-    "     [-s server to load]\n"
+    "     [-R arg  trace requests to FILE, which cachebash-trace decodes\n"
+    "              (with stage times under -S and wire latency under -K)]\n"
+    "     [-s arg  comma separated servers to load, host[:port[:weight]]]\n"
+    "     [-S split latency into client stages: generate, write, wait and\n"
+    "        read]\n"
     "     [-t arg  runtime of loadtesting in seconds (default: run forever)]\n"
     "     [-T arg  interval between stats printing (default: 1)]\n"
-    "     [-w number of worker threads]\n");
+    "     [-u count each worker's cycles per request, instructions per\n"
+    "        cycle and CPU time with perf_event_open (CPU time and context\n"
+    "        switches only without hardware counters)]\n"
+    "     [-V check that get hits return the stored flags]\n"
+    "     [-w number of worker threads]\n"
+    "     [-y arg  report the arg most requested keys each interval]\n"
+    "     [-Y arg  with -y, also report the keys and connections most often\n"
+    "              slower than arg seconds]\n"
+    "     [-x arg  flags stored with every item (default: 0xdeadbeef)]\n");
 }
 
 void ParseArguments(int argc, char** argv, Config* config) {
   int c;
-  while ((c = getopt(argc, argv, "c:dg:hf:F:l:m:nr:s:t:T:w:")) != -1) {
+  const char* options = "a:bc:Cde:g:hH:f:F:ij:J:k:Kl:m:no:O:p:P:r:R:s:St:T:"
+                        "uVw:x:y:Y:";
+  while ((c = getopt(argc, argv, options)) != -1) {
     switch (c) {
+      case 'a':
+        config->backend_delay_distribution_
+          = Distribution::Parse(string(optarg));
+        break;
+      case 'b':
+        config->latency_breakdown_ = true;
+        break;
       case 'c':
         config->n_connections_per_worker_ = atoi(optarg);
         break;
+      case 'C':
+        config->connection_latency_ = true;
+        break;
       case 'd':
         config->debug_ = true;
         break;
+      case 'e':
+        config->ttl_distribution_ = Distribution::Parse(string(optarg));
+        break;
       case 'f':
         config->size_key_distribution_
           = SizeKeyDistribution::LoadFile(string(optarg));
@@ -93,6 +161,34 @@ void ParseArguments(int argc, char** argv, Config* config) {
       case 'h':
         PrintUsage();
         exit(0);
+      case 'H':
+        if (optarg[0] == 'p') {
+          config->hedge_percentile_ = atof(optarg + 1) / 100.0;
+        } else {
+          config->hedge_delay_ = atof(optarg);
+        }
+        break;
+      case 'i':
+        config->tcp_info_ = true;
+        break;
+      case 'j':
+        config->trace_sample_every_ = atoi(optarg);
+        break;
+      case 'J':
+        config->trace_latency_threshold_ = atof(optarg);
+        break;
+      case 'k':
+        if (string(optarg) == "ddsketch") {
+          config->breakdown_backend_ = kDDSketchBackend;
+        } else if (string(optarg) == "hdr") {
+          config->breakdown_backend_ = kHistogramBackend;
+        } else {
+          LOG_FATAL("Unknown quantile backend " + string(optarg));
+        }
+        break;
+      case 'K':
+        config->kernel_timestamps_ = true;
+        break;
       case 'l':
         config->multiget_n_gets_ = atoi(optarg);
         break;
@@ -102,11 +198,29 @@ void ParseArguments(int argc, char** argv, Config* config) {
       case 'n':
         config->use_naggles_ = true;
         break;
+      case 'o':
+        config->ParseStorageMix(string(optarg));
+        break;
+      case 'O':
+        config->interval_outputs_.push_back(optarg);
+        break;
+      case 'p':
+        config->histogram_significant_digits_ = atoi(optarg);
+        break;
+      case 'P':
+        config->metrics_address_ = optarg;
+        break;
       case 'r':
         config->rps_ = atof(optarg);
         break;
+      case 'R':
+        config->trace_output_ = optarg;
+        break;
       case 's':
-        config->server_ip_address_ = nslookup(string(optarg));
+        ParseServerList(string(optarg), &config->servers_);
+        break;
+      case 'S':
+        config->stage_timestamps_ = true;
         break;
       case 't':
         config->runtime_ = atof(optarg);
@@ -114,11 +228,145 @@ void ParseArguments(int argc, char** argv, Config* config) {
       case 'T':
         config->stat_print_interval_ = atof(optarg);
         break;
+      case 'u':
+        config->perf_counters_ = true;
+        break;
+      case 'V':
+        config->validate_flags_ = true;
+        break;
       case 'w':
         config->n_worker_threads_ = atoi(optarg);
         break;
+      case 'x':
+        config->flags_ = strtoul(optarg, NULL, 0);
+        break;
+      case 'y':
+        config->top_keys_ = atoi(optarg);
+        break;
+      case 'Y':
+        config->slow_key_threshold_ = atof(optarg);
+        break;
     }
   }
+  if (config->servers_.empty()) {
+    ParseServerList("127.0.0.1", &config->servers_);
+  }
+  if (config->fraction_multiget_ > 0 && config->multiget_n_gets_ < 1) {
+    LOG_FATAL("Multigets (-m) need the number of gets per multiget (-l)");
+  }
+  if (config->hedge_percentile_ > 1.0) {
+    LOG_FATAL("Hedge percentile must be at most p100");
+  }
+  // With a single server, backup requests go out on another connection.
+  if (config->IsHedgingEnabled()
+      && config->servers_.size() == 1
+      && config->n_connections_per_worker_ < 2) {
+    LOG_FATAL("Hedging (-H) a single server needs at least two "
+              "connections per worker (-c)");
+  }
+  config->ketama_continuum_ = new KetamaContinuum(config->servers_);
+}
+
+// Registers the latency, throughput and hit ratio statistics that are
+// broken down per server.
+void RegisterServerStatistics(const Config& config,
+                              StatisticsCollection* collection) {
+  for (vector<Server>::const_iterator it = config.servers_.begin();
+       it != config.servers_.end();
+       it++) {
+    string latency = it->GetStatisticName("latency");
+    collection->RegisterStatistic(latency, false);
+    collection->AddStatisticPrinter(latency, new AveragePrinter());
+    collection->AddStatisticPrinter(latency, new QuantilePrinter(0.50));
+    collection->AddStatisticPrinter(latency, new QuantilePrinter(0.99));
+
+    string requests = it->GetStatisticName("requests");
+    collection->RegisterStatistic(requests, false);
+    collection->AddStatisticPrinter(requests, new CountPrinter());
+
+    string hit_ratio = it->GetStatisticName("hit_ratio");
+    collection->RegisterStatistic(hit_ratio, false);
+    collection->AddStatisticPrinter(hit_ratio, new AveragePrinter());
+  }
+}
+
+// Prints the fan-out latency statistics, and registers the completion
+// latency for each possible number of shards a multiget can touch.
+void RegisterFanoutStatistics(const Config& config,
+                              StatisticsCollection* collection) {
+  collection->AddStatisticPrinter("fanout_latency", new AveragePrinter());
+  collection->AddStatisticPrinter("fanout_latency", new QuantilePrinter(0.50));
+  collection->AddStatisticPrinter("fanout_latency", new QuantilePrinter(0.99));
+
+  collection->AddStatisticPrinter("fanout_shard_latency",
+                                  new AveragePrinter());
+  collection->AddStatisticPrinter("fanout_shard_latency",
+                                  new QuantilePrinter(0.50));
+  collection->AddStatisticPrinter("fanout_shard_latency",
+                                  new QuantilePrinter(0.99));
+
+  collection->AddStatisticPrinter("fanout_shards", new CountPrinter());
+  collection->AddStatisticPrinter("fanout_shards", new AveragePrinter());
+
+  int max_shards = std::min(static_cast<int>(config.servers_.size()),
+                            config.multiget_n_gets_);
+  for (int i = 1; i <= max_shards; i++) {
+    string name = FanoutRequest::GetLatencyStatisticName(i);
+    collection->RegisterStatistic(name, false);
+    collection->AddStatisticPrinter(name, new CountPrinter());
+    collection->AddStatisticPrinter(name, new QuantilePrinter(0.50));
+    collection->AddStatisticPrinter(name, new QuantilePrinter(0.99));
+  }
+}
+
+// Prints the statistics that compare latency with and without hedging,
+// along with how often GETs were hedged and the extra load that caused.
+void RegisterHedgeStatistics(StatisticsCollection* collection) {
+  const char* latencies[] = { "hedged_latency", "unhedged_latency" };
+  for (int i = 0; i < 2; i++) {
+    collection->AddStatisticPrinter(latencies[i], new AveragePrinter());
+    collection->AddStatisticPrinter(latencies[i], new QuantilePrinter(0.50));
+    collection->AddStatisticPrinter(latencies[i], new QuantilePrinter(0.99));
+    collection->AddStatisticPrinter(latencies[i], new QuantilePrinter(0.999));
+  }
+
+  collection->AddStatisticPrinter("hedge_rate", new AveragePrinter());
+
+  collection->AddStatisticPrinter("hedge_requests", new CountPrinter());
+
+  collection->AddStatisticPrinter("hedge_discarded_responses",
+                                  new CountPrinter());
+}
+
+// Prints the statistics of cache-aside filling: the latency seen by the
+// application (including the backend delay on a miss) and the hit ratio
+// since the start of the run, which converges as fills warm the cache.
+void RegisterCacheAsideStatistics(StatisticsCollection* collection) {
+  collection->AddStatisticPrinter("application_latency", new AveragePrinter());
+  collection->AddStatisticPrinter("application_latency",
+                                  new QuantilePrinter(0.50));
+  collection->AddStatisticPrinter("application_latency",
+                                  new QuantilePrinter(0.99));
+  collection->AddStatisticPrinter("application_latency",
+                                  new QuantilePrinter(0.999));
+
+  collection->AddStatisticPrinter("cumulative_hit_ratio",
+                                  new AveragePrinter());
+
+  collection->AddStatisticPrinter("fill_requests", new CountPrinter());
+}
+
+// Prints where on the client each request spent its time: waiting to be
+// generated after it was due, being written, waiting for the first byte of
+// its response and reading the rest.
+void RegisterStageStatistics(StatisticsCollection* collection) {
+  const char* stages[] = { "stage_generate", "stage_write", "stage_wait",
+                           "stage_read" };
+  for (int i = 0; i < 4; i++) {
+    collection->AddStatisticPrinter(stages[i], new AveragePrinter());
+    collection->AddStatisticPrinter(stages[i], new QuantilePrinter(0.50));
+    collection->AddStatisticPrinter(stages[i], new QuantilePrinter(0.99));
+  }
 }
 
 void CacheBash(int argc, char** argv) {
@@ -136,36 +384,87 @@ void CacheBash(int argc, char** argv) {
                                &config);
 
   StatisticsCollection base_collection(&config);
+  base_collection.RegisterStandardStatistics();
 
-  base_collection.RegisterStatistic("get_requests", false);
   base_collection.AddStatisticPrinter("get_requests", new CountPrinter());
 
-  base_collection.RegisterStatistic("get_request_size", false);
   base_collection.AddStatisticPrinter("get_request_size",
                                       new AveragePrinter());
   base_collection.AddStatisticPrinter("get_request_size", new MinPrinter());
   base_collection.AddStatisticPrinter("get_request_size", new MaxPrinter());
 
-  base_collection.RegisterStatistic("set_requests", false);
   base_collection.AddStatisticPrinter("set_requests", new CountPrinter());
 
-  base_collection.RegisterStatistic("set_request_size", false);
   base_collection.AddStatisticPrinter("set_request_size",
                                       new AveragePrinter());
   base_collection.AddStatisticPrinter("set_request_size", new MinPrinter());
   base_collection.AddStatisticPrinter("set_request_size", new MaxPrinter());
 
-  base_collection.RegisterStatistic("latency", false);
+  const char* storage_requests[] = { "add_requests", "replace_requests",
+                                     "touch_requests" };
+  for (int i = 0; i < 3; i++) {
+    base_collection.AddStatisticPrinter(storage_requests[i],
+                                        new CountPrinter());
+  }
+
   base_collection.AddStatisticPrinter("latency", new AveragePrinter());
   base_collection.AddStatisticPrinter("latency", new QuantilePrinter(0.50));
   base_collection.AddStatisticPrinter("latency", new QuantilePrinter(0.90));
   base_collection.AddStatisticPrinter("latency", new QuantilePrinter(0.95));
   base_collection.AddStatisticPrinter("latency", new QuantilePrinter(0.99));
 
+  base_collection.AddStatisticPrinter("hit_ratio", new AveragePrinter());
+
+  if (config.validate_flags_) {
+    base_collection.AddStatisticPrinter("flag_mismatch_ratio",
+                                        new AveragePrinter());
+  }
+
+  RegisterServerStatistics(config, &base_collection);
+  LatencyBreakdown::RegisterStatistics(config, &base_collection);
+  if (config.fraction_multiget_ > 0) {
+    RegisterFanoutStatistics(config, &base_collection);
+  }
+  if (config.IsHedgingEnabled()) {
+    RegisterHedgeStatistics(&base_collection);
+  }
+  if (config.backend_delay_distribution_ != NULL) {
+    RegisterCacheAsideStatistics(&base_collection);
+  }
+  if (config.stage_timestamps_) {
+    RegisterStageStatistics(&base_collection);
+  }
+  if (config.tcp_info_) {
+    TcpInfoSampler::RegisterStatistics(config, &base_collection);
+  }
+  if (config.perf_counters_) {
+    PerfCounterSampler::RegisterStatistics(config, &base_collection);
+  }
+  if (config.top_keys_ > 0) {
+    base_collection.TrackKeys(config.top_keys_ * kKeyTrackerCountersPerKey,
+                              config.slow_key_threshold_);
+  }
+  if (config.kernel_timestamps_) {
+    base_collection.AddStatisticPrinter("wire_latency", new AveragePrinter());
+    base_collection.AddStatisticPrinter("wire_latency",
+                                        new QuantilePrinter(0.50));
+    base_collection.AddStatisticPrinter("wire_latency",
+                                        new QuantilePrinter(0.99));
+  }
+
   StatisticManager statistic_manager(&base_collection,
                                        &config,
                                        &worker_manager);
-  worker_manager.CreateAndInitializeWorkerThreads(base_collection);
+  // Workers may outlive the stats loop, so the trace writer and its rings
+  // are never freed.
+  TraceWriter* trace_writer = NULL;
+  if (!config.trace_output_.empty()) {
+    trace_writer = new TraceWriter(config.trace_output_,
+                                   config.n_worker_threads_);
+    trace_writer->Start();
+  }
+  worker_manager.CreateAndInitializeWorkerThreads(base_collection,
+                                                  trace_writer);
 
   // Perform a warmup with only one thread.
   worker_manager.Warmup();
@@ -173,6 +472,13 @@ void CacheBash(int argc, char** argv) {
   // Now that everything is setup, we can start.
   worker_manager.StartWorkerThreads();
   statistic_manager.StatisticsLoop();
+  if (trace_writer != NULL) {
+    trace_writer->Stop();
+    printf("Traced %lld requests to %s (%lld dropped)\n",
+           static_cast<long long>(trace_writer->n_written()),
+           config.trace_output_.c_str(),
+           static_cast<long long>(trace_writer->n_dropped()));
+  }
 }
 
 }  // namespace cachebash
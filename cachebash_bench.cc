@@ -0,0 +1,609 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// cachebash_bench.cc
+//
+// cachebash-bench times the client's own hot paths: building request
+// packets, parsing responses off a connection, picking keys from the
+// size/key distribution, generating requests, recording samples and
+// merging statistics. Each benchmark is repeated and its fastest run
+// kept, and the results are written as JSON. Given the JSON of an earlier
+// build, it reports the change of each benchmark and exits with status 1
+// if any slowed down by more than the threshold.
+//
+
+#include <arpa/inet.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cachebash/config.h"
+#include "cachebash/connection.h"
+#include "cachebash/generator.h"
+#include "cachebash/request.h"
+#include "cachebash/response.h"
+#include "cachebash/scoped_ptr.h"
+#include "cachebash/size_key_distribution.h"
+#include "cachebash/statistic.h"
+#include "cachebash/util.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace cachebash {
+
+static const double kDefaultMinTime = 0.5;
+static const int kDefaultRepetitions = 3;
+static const float kDefaultRegressionThreshold = 10.0;
+static const char* kDefaultDistributionSizes = "1000,1000000";
+// Responses queued on the connection before they are parsed.
+static const int kResponsesPerBatch = 64;
+static const int kResponseValueSize = 100;
+// Inputs are drawn up front and cycled through, so drawing them isn't
+// timed.
+static const int kNumInputs = 4096;
+
+// Results are folded into this so the compiler can't drop the work.
+static volatile uint64_t sink;
+
+// What a benchmark is run for: how many iterations, and how long the
+// timed part of them took.
+class BenchmarkState {
+ public:
+  explicit BenchmarkState(int64_t n_iterations)
+      : n_iterations_(n_iterations), elapsed_(0.0) {}
+  int64_t n_iterations() const { return n_iterations_; }
+  // Only the time between StartTiming and StopTiming counts.
+  void StartTiming() { clock_gettime(CLOCK_MONOTONIC, &start_); }
+  void StopTiming() {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed_ += (end.tv_sec - start_.tv_sec)
+                + (end.tv_nsec - start_.tv_nsec) * 1e-9;
+  }
+  double elapsed() const { return elapsed_; }
+
+ private:
+  int64_t n_iterations_;
+  double elapsed_;
+  struct timespec start_;
+
+  DISALLOW_COPY_AND_ASSIGN(BenchmarkState);
+};
+
+typedef void (*BenchmarkFunction)(BenchmarkState* state, int arg);
+
+struct Benchmark {
+  string name;
+  BenchmarkFunction function;
+  int arg;
+};
+
+struct BenchmarkResult {
+  string name;
+  int64_t n_iterations;
+  // The fastest and slowest of the repetitions.
+  double min_ns_per_op;
+  double max_ns_per_op;
+};
+
+void BenchmarkConstructGetPacket(BenchmarkState* state, int) {
+  GetRequest request("bench:0000000001");
+  state->StartTiming();
+  for (int64_t i = 0; i < state->n_iterations(); i++) {
+    int size;
+    char* packet = request.ConstructRequestPacket(&size);
+    sink += size + packet[0];
+    delete[] packet;
+  }
+  state->StopTiming();
+}
+
+// |arg| is the size of the value.
+void BenchmarkConstructSetPacket(BenchmarkState* state, int arg) {
+  SetRequest request("bench:0000000001", string(arg, 'v'), kDefaultFlags, 0);
+  state->StartTiming();
+  for (int64_t i = 0; i < state->n_iterations(); i++) {
+    int size;
+    char* packet = request.ConstructRequestPacket(&size);
+    sink += size + packet[0];
+    delete[] packet;
+  }
+  state->StopTiming();
+}
+
+// Appends a GET hit answering |opaque|, with flags and a value, to
+// |buffer|.
+static void AppendGetHit(uint32_t opaque, string* buffer) {
+  ResponseHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kMagicResponse;
+  header.opcode = OPCODE_GET;
+  header.extras_size = 4;
+  int body_size = header.extras_size + kResponseValueSize;
+  header.total_body_size[2] = (body_size >> 8) & 0xff;
+  header.total_body_size[3] = body_size & 0xff;
+  header.opaque[0] = (opaque >> 24) & 0xff;
+  header.opaque[1] = (opaque >> 16) & 0xff;
+  header.opaque[2] = (opaque >> 8) & 0xff;
+  header.opaque[3] = opaque & 0xff;
+  buffer->append(reinterpret_cast<char*>(&header), sizeof(header));
+  buffer->append("\xde\xad\xbe\xef", 4);
+  buffer->append(kResponseValueSize, 'v');
+}
+
+static void ReadFully(int fd, char* buffer, int size) {
+  while (size > 0) {
+    ssize_t n_read = read(fd, buffer, size);
+    if (n_read <= 0) {
+      LOG_FATAL("Couldn't read what the connection sent");
+    }
+    buffer += n_read;
+    size -= n_read;
+  }
+}
+
+// Responses are queued on a loopback connection a batch at a time and
+// then parsed, so only reading them off the socket and parsing them is
+// timed.
+void BenchmarkReceiveResponse(BenchmarkState* state, int) {
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+  socklen_t address_size = sizeof(address);
+  if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&address),
+           sizeof(address)) < 0
+      || listen(listen_fd, 1) < 0
+      || getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&address),
+                     &address_size) < 0) {
+    LOG_FATAL("Couldn't listen on loopback");
+  }
+  Connection connection(TCP, false, 0, 0);
+  connection.OpenTcpSocket("127.0.0.1", ntohs(address.sin_port), true);
+  int peer_fd = accept(listen_fd, NULL, NULL);
+
+  uint32_t opaque = 1;
+  for (int64_t i = 0; i < state->n_iterations(); i += kResponsesPerBatch) {
+    int n_responses = kResponsesPerBatch;
+    if (state->n_iterations() - i < n_responses) {
+      n_responses = state->n_iterations() - i;
+    }
+    string responses;
+    int request_bytes = 0;
+    for (int j = 0; j < n_responses; j++) {
+      GetRequest* request = new GetRequest("bench:0000000001");
+      request->set_opaque(opaque);
+      request_bytes += connection.SendRequest(request);
+      AppendGetHit(opaque++, &responses);
+    }
+    scoped_array<char> requests(new char[request_bytes]);
+    ReadFully(peer_fd, requests.Get(), request_bytes);
+    if (write(peer_fd, responses.data(), responses.size())
+        != static_cast<ssize_t>(responses.size())) {
+      LOG_FATAL("Couldn't queue the responses");
+    }
+
+    state->StartTiming();
+    for (int j = 0; j < n_responses; j++) {
+      Response* response = connection.ReceiveResponse();
+      sink += response->value_size();
+      delete response;
+    }
+    state->StopTiming();
+  }
+  close(connection.GetSocketFd());
+  close(peer_fd);
+  close(listen_fd);
+}
+
+// Loads a distribution of |n_entries| keys with a uniform popularity. It
+// is written out first since distributions are only loaded from files.
+static SizeKeyDistribution* LoadUniformDistribution(int n_entries) {
+  char filename[] = "/tmp/cachebash-bench-XXXXXX";
+  int fd = mkstemp(filename);
+  FILE* file = fd < 0 ? NULL : fdopen(fd, "w");
+  if (file == NULL) {
+    LOG_FATAL("Couldn't write a size/key distribution");
+  }
+  for (int i = 0; i < n_entries; i++) {
+    fprintf(file, "%f, %d, key:%010d\n",
+            static_cast<double>(i + 1) / n_entries, 100 + i % 1000, i);
+  }
+  fclose(file);
+  SizeKeyDistribution* distribution = SizeKeyDistribution::LoadFile(filename);
+  unlink(filename);
+  return distribution;
+}
+
+// Distributions don't free their entries.
+static void DeleteDistribution(SizeKeyDistribution* distribution) {
+  for (int i = 0; i < distribution->n_entries(); i++) {
+    delete distribution->size_key_entries()[i];
+  }
+  delete[] distribution->size_key_entries();
+  delete distribution;
+}
+
+// Keeps the distribution of the last size asked for, since big ones take
+// a while to load and each benchmark is run several times.
+static SizeKeyDistribution* GetDistribution(int n_entries) {
+  static SizeKeyDistribution* distribution = NULL;
+  if (distribution != NULL && distribution->n_entries() != n_entries) {
+    DeleteDistribution(distribution);
+    distribution = NULL;
+  }
+  if (distribution == NULL) {
+    distribution = LoadUniformDistribution(n_entries);
+  }
+  return distribution;
+}
+
+// |arg| is the number of entries.
+void BenchmarkGetRandomEntry(BenchmarkState* state, int arg) {
+  SizeKeyDistribution* distribution = GetDistribution(arg);
+  vector<int> random_ints(kNumInputs);
+  for (int i = 0; i < kNumInputs; i++) {
+    random_ints[i] = RandomInt();
+  }
+  state->StartTiming();
+  for (int64_t i = 0; i < state->n_iterations(); i++) {
+    sink += distribution->GetRandomEntry(
+              random_ints[i % kNumInputs])->size;
+  }
+  state->StopTiming();
+}
+
+// The default mix of GETs and SETs over a distribution of |arg| keys.
+void BenchmarkGenerateNextRequest(BenchmarkState* state, int arg) {
+  Config config;
+  config.size_key_distribution_ = GetDistribution(arg);
+  Generator generator(&config);
+  state->StartTiming();
+  for (int64_t i = 0; i < state->n_iterations(); i++) {
+    Request* request = generator.GenerateNextRequest();
+    sink += request->value_size();
+    delete request;
+  }
+  state->StopTiming();
+  config.size_key_distribution_ = NULL;
+}
+
+// Latencies spread from 10 us to 10 ms, as a run would record.
+static void DrawLatencies(vector<float>* latencies) {
+  for (int i = 0; i < kNumInputs; i++) {
+    latencies->push_back(1e-5 * pow(1000.0, RandomFloat()));
+  }
+}
+
+void BenchmarkHistogramAddSample(BenchmarkState* state, int) {
+  Histogram histogram(kDefaultSignificantDigits);
+  vector<float> latencies;
+  DrawLatencies(&latencies);
+  state->StartTiming();
+  for (int64_t i = 0; i < state->n_iterations(); i++) {
+    histogram.AddSample(latencies[i % kNumInputs]);
+  }
+  state->StopTiming();
+  sink += histogram.n_samples();
+}
+
+// Recorded one at a time, as before samples were buffered.
+void BenchmarkStatisticAddSampleUnbatched(BenchmarkState* state, int) {
+  Statistic statistic("latency", false);
+  vector<float> latencies;
+  DrawLatencies(&latencies);
+  state->StartTiming();
+  for (int64_t i = 0; i < state->n_iterations(); i++) {
+    statistic.AddSample(latencies[i % kNumInputs]);
+    statistic.FlushSamples();
+  }
+  state->StopTiming();
+  sink += statistic.GetCount();
+}
+
+// Buffered, as the workers add them.
+void BenchmarkStatisticAddSample(BenchmarkState* state, int) {
+  Statistic statistic("latency", false);
+  vector<float> latencies;
+  DrawLatencies(&latencies);
+  state->StartTiming();
+  for (int64_t i = 0; i < state->n_iterations(); i++) {
+    statistic.AddSample(latencies[i % kNumInputs]);
+  }
+  statistic.FlushSamples();
+  state->StopTiming();
+  sink += statistic.GetCount();
+}
+
+// Merges a worker's interval of the standard statistics, as the
+// statistics thread does for every worker each interval.
+void BenchmarkMergeStatisticsCollection(BenchmarkState* state, int) {
+  StatisticsCollection worker_collection(NULL);
+  worker_collection.RegisterStandardStatistics();
+  vector<float> latencies;
+  DrawLatencies(&latencies);
+  for (int i = 0; i < worker_collection.n_statistics(); i++) {
+    for (int j = 0; j < kNumInputs; j++) {
+      worker_collection.AddSample(i, latencies[j]);
+    }
+  }
+  worker_collection.FlushSamples();
+  scoped_ptr<StatisticsCollection> interval_collection(
+                                     worker_collection.Copy());
+  state->StartTiming();
+  for (int64_t i = 0; i < state->n_iterations(); i++) {
+    interval_collection->MergeWithStatisticsCollection(worker_collection);
+  }
+  state->StopTiming();
+  sink += interval_collection->n_statistics();
+}
+
+// Runs |benchmark| with more and more iterations until the timed part
+// takes at least |min_time| seconds, and returns the nanoseconds per
+// iteration of that run.
+static double RunBenchmark(const Benchmark& benchmark, double min_time,
+                           int64_t* n_iterations) {
+  int64_t n = 1;
+  while (true) {
+    BenchmarkState state(n);
+    benchmark.function(&state, benchmark.arg);
+    if (state.elapsed() >= min_time || n >= (1LL << 40)) {
+      *n_iterations = n;
+      return state.elapsed() * 1e9 / n;
+    }
+    // Aim past |min_time|, but grow by at most 10 times a run.
+    double scale = state.elapsed() > 0.0 ? 1.4 * min_time / state.elapsed()
+                                         : 10.0;
+    n = static_cast<int64_t>(n * (scale > 10.0 ? 10.0 : scale)) + 1;
+  }
+}
+
+static void WriteResults(const vector<BenchmarkResult>& results,
+                         FILE* file) {
+  fprintf(file, "{\"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    fprintf(file, "  {\"name\": \"%s\", \"iterations\": %lld, "
+            "\"ns_per_op\": %.3f, \"max_ns_per_op\": %.3f}%s\n",
+            results[i].name.c_str(),
+            static_cast<long long>(results[i].n_iterations),
+            results[i].min_ns_per_op, results[i].max_ns_per_op,
+            i + 1 < results.size() ? "," : "");
+  }
+  fprintf(file, "]}\n");
+}
+
+// Reads the ns_per_op of each benchmark from JSON WriteResults wrote,
+// which has one benchmark per line.
+static void ReadResults(const string& filename, map<string, double>* results) {
+  FILE* file = fopen(filename.c_str(), "r");
+  if (file == NULL) {
+    LOG_FATAL("Couldn't open " + filename);
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char name[256];
+    long long n_iterations;
+    double ns_per_op;
+    if (sscanf(line, " {\"name\": \"%255[^\"]\", \"iterations\": %lld, "
+               "\"ns_per_op\": %lf", name, &n_iterations, &ns_per_op) == 3) {
+      (*results)[name] = ns_per_op;
+    }
+  }
+  fclose(file);
+}
+
+// Reports how each benchmark changed from |baseline_filename|, and
+// returns how many slowed down by more than |threshold| percent.
+static int CompareResults(const vector<BenchmarkResult>& results,
+                          const string& baseline_filename, float threshold) {
+  map<string, double> baseline;
+  ReadResults(baseline_filename, &baseline);
+  int n_regressions = 0;
+  for (size_t i = 0; i < results.size(); i++) {
+    map<string, double>::const_iterator it = baseline.find(results[i].name);
+    if (it == baseline.end() || it->second <= 0.0) {
+      fprintf(stderr, "%s: %.1f ns (not in the baseline)\n",
+              results[i].name.c_str(), results[i].min_ns_per_op);
+      continue;
+    }
+    double change = 100.0 * (results[i].min_ns_per_op - it->second)
+                    / it->second;
+    bool regressed = change > threshold;
+    fprintf(stderr, "%s: %.1f ns, was %.1f ns (%+.1f%%)%s\n",
+            results[i].name.c_str(), results[i].min_ns_per_op, it->second,
+            change, regressed ? " REGRESSED" : "");
+    if (regressed) {
+      n_regressions++;
+    }
+  }
+  return n_regressions;
+}
+
+void PrintUsage() {
+  printf("usage: cachebash-bench [-option]\n"
+         "     [-b arg  compare against the JSON of an earlier run, and\n"
+         "              exit with status 1 if anything regressed]\n"
+         "     [-e arg  comma separated sizes of the size/key distributions\n"
+         "              to pick keys from (default: 1000,1000000; 100000000\n"
+         "              needs around 10 GB)]\n"
+         "     [-f arg  only run benchmarks whose name contains arg]\n"
+         "     [-h prints this message]\n"
+         "     [-n arg  repetitions of each benchmark (default: 3)]\n"
+         "     [-o arg  write the JSON results to arg (default: stdout)]\n"
+         "     [-r arg  percent slowdown that counts as a regression\n"
+         "              (default: 10)]\n"
+         "     [-t arg  minimum seconds timed per repetition (default: "
+         "0.5)]\n");
+}
+
+int CacheBashBench(int argc, char** argv) {
+  string baseline_filename;
+  string distribution_sizes = kDefaultDistributionSizes;
+  string filter;
+  int n_repetitions = kDefaultRepetitions;
+  string output_filename;
+  float regression_threshold = kDefaultRegressionThreshold;
+  double min_time = kDefaultMinTime;
+  int c;
+  while ((c = getopt(argc, argv, "b:e:f:hn:o:r:t:")) != -1) {
+    switch (c) {
+      case 'b':
+        baseline_filename = optarg;
+        break;
+      case 'e':
+        distribution_sizes = optarg;
+        break;
+      case 'f':
+        filter = optarg;
+        break;
+      case 'h':
+        PrintUsage();
+        exit(0);
+      case 'n':
+        n_repetitions = atoi(optarg);
+        break;
+      case 'o':
+        output_filename = optarg;
+        break;
+      case 'r':
+        regression_threshold = atof(optarg);
+        break;
+      case 't':
+        min_time = atof(optarg);
+        break;
+      default:
+        PrintUsage();
+        exit(2);
+    }
+  }
+  if (n_repetitions < 1) {
+    PrintUsage();
+    exit(2);
+  }
+
+  vector<Benchmark> benchmarks;
+  Benchmark get_packet = { "request/construct_get_packet",
+                           BenchmarkConstructGetPacket, 0 };
+  benchmarks.push_back(get_packet);
+  Benchmark set_packet = { "request/construct_set_packet/1024",
+                           BenchmarkConstructSetPacket, 1024 };
+  benchmarks.push_back(set_packet);
+  Benchmark receive = { "connection/receive_response",
+                        BenchmarkReceiveResponse, 0 };
+  benchmarks.push_back(receive);
+  size_t start = 0;
+  while (start <= distribution_sizes.size()) {
+    size_t end = distribution_sizes.find(',', start);
+    if (end == string::npos) {
+      end = distribution_sizes.size();
+    }
+    string size = distribution_sizes.substr(start, end - start);
+    start = end + 1;
+    if (size.empty()) {
+      continue;
+    }
+    Benchmark get_random_entry = {
+      "size_key_distribution/get_random_entry/" + size,
+      BenchmarkGetRandomEntry, atoi(size.c_str()) };
+    benchmarks.push_back(get_random_entry);
+  }
+  Benchmark generate = { "generator/generate_next_request/1000",
+                         BenchmarkGenerateNextRequest, 1000 };
+  benchmarks.push_back(generate);
+  Benchmark histogram = { "histogram/add_sample",
+                          BenchmarkHistogramAddSample, 0 };
+  benchmarks.push_back(histogram);
+  Benchmark statistic = { "statistic/add_sample",
+                          BenchmarkStatisticAddSample, 0 };
+  benchmarks.push_back(statistic);
+  Benchmark unbatched_statistic = { "statistic/add_sample_unbatched",
+                                    BenchmarkStatisticAddSampleUnbatched, 0 };
+  benchmarks.push_back(unbatched_statistic);
+  Benchmark merge = { "statistics_collection/merge",
+                      BenchmarkMergeStatisticsCollection, 0 };
+  benchmarks.push_back(merge);
+
+  vector<BenchmarkResult> results;
+  for (size_t i = 0; i < benchmarks.size(); i++) {
+    if (benchmarks[i].name.find(filter) == string::npos) {
+      continue;
+    }
+    BenchmarkResult result;
+    result.name = benchmarks[i].name;
+    for (int j = 0; j < n_repetitions; j++) {
+      int64_t n_iterations;
+      double ns_per_op = RunBenchmark(benchmarks[i], min_time,
+                                      &n_iterations);
+      if (j == 0 || ns_per_op < result.min_ns_per_op) {
+        result.min_ns_per_op = ns_per_op;
+        result.n_iterations = n_iterations;
+      }
+      if (j == 0 || ns_per_op > result.max_ns_per_op) {
+        result.max_ns_per_op = ns_per_op;
+      }
+    }
+    fprintf(stderr, "%-48s %12.1f ns/op\n", result.name.c_str(),
+            result.min_ns_per_op);
+    results.push_back(result);
+  }
+
+  FILE* output = stdout;
+  if (!output_filename.empty()) {
+    output = fopen(output_filename.c_str(), "w");
+    if (output == NULL) {
+      LOG_FATAL("Couldn't open " + output_filename);
+    }
+  }
+  WriteResults(results, output);
+  if (output != stdout) {
+    fclose(output);
+  }
+
+  if (!baseline_filename.empty()
+      && CompareResults(results, baseline_filename,
+                        regression_threshold) > 0) {
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace cachebash
+
+int main(int argc, char** argv) {
+  return cachebash::CacheBashBench(argc, argv);
+}
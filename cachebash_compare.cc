@@ -0,0 +1,267 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// cachebash_compare.cc
+//
+// cachebash-compare checks candidate runs against a baseline run, from the
+// histogram logs they saved (-O hlog:FILE). For every compared statistic
+// it reports the change in throughput and quantiles, and tests whether the
+// latency distributions differ with a two-sample Kolmogorov-Smirnov test.
+// It exits with status 1 if any candidate regressed past the thresholds:
+// a quantile rising by more than its threshold while the distributions
+// differ significantly, or throughput falling by more than its threshold.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "cachebash/histogram_log.h"
+#include "cachebash/interval_writer.h"
+#include "cachebash/statistic.h"
+#include "cachebash/util.h"
+
+namespace cachebash {
+
+static const float kDefaultQuantileThreshold = 10.0;
+static const float kDefaultThroughputThreshold = 5.0;
+static const double kDefaultSignificanceLevel = 0.01;
+
+// Fails the comparison if |quantile| rises by more than |percent|.
+struct QuantileThreshold {
+  float quantile;
+  float percent;
+};
+
+void PrintUsage() {
+  printf("usage: cachebash-compare [-option] baseline_log candidate_log...\n"
+    "     [-a arg  significance level of the Kolmogorov-Smirnov test\n"
+    "              (default: 0.01)]\n"
+    "     [-h prints this message]\n"
+    "     [-q arg  fail if a quantile rises by more than a percentage,\n"
+    "              e.g. p99:10 (repeatable, default: p50:10 and p99:10)]\n"
+    "     [-r arg  fail if throughput falls by more than a percentage\n"
+    "              (default: 5)]\n"
+    "     [-s arg  statistic to compare (repeatable, default: latency)]\n");
+}
+
+QuantileThreshold ParseQuantileThreshold(const string& specification) {
+  size_t colon = specification.find(':');
+  if (specification.empty() || specification[0] != 'p'
+      || colon == string::npos) {
+    LOG_FATAL("Quantile thresholds must be pNN:PERCENT, got "
+              + specification);
+  }
+  QuantileThreshold threshold;
+  threshold.quantile = atof(specification.substr(1, colon - 1).c_str())
+                       / 100.0;
+  threshold.percent = atof(specification.substr(colon + 1).c_str());
+  if (threshold.quantile < 0.0 || threshold.quantile > 1.0) {
+    LOG_FATAL("Invalid quantile in " + specification);
+  }
+  return threshold;
+}
+
+// How much |candidate| differs from |baseline|, in percent.
+double PercentChange(double baseline, double candidate) {
+  if (baseline == 0.0) {
+    return candidate == 0.0 ? 0.0 : INFINITY;
+  }
+  return (candidate - baseline) / baseline * 100.0;
+}
+
+// Whole-run histograms are compared where both logs have them, and every
+// interval merged together otherwise.
+const MergedHistogram& FindStatistic(const MergedHistogramMap& histograms,
+                                     const MergedHistogramMap& others,
+                                     const string& statistic,
+                                     const string& filename) {
+  string run_tag = "run/" + statistic;
+  MergedHistogramMap::const_iterator it = histograms.find(run_tag);
+  if (it != histograms.end() && others.count(run_tag) > 0) {
+    return it->second;
+  }
+  it = histograms.find(statistic);
+  if (it == histograms.end()) {
+    LOG_FATAL("No " + statistic + " histograms in " + filename);
+  }
+  return it->second;
+}
+
+// Prints how |candidate| compares with |baseline| and returns the number
+// of regressions found.
+int CompareStatistic(const string& statistic,
+                     const MergedHistogram& baseline,
+                     const MergedHistogram& candidate,
+                     const vector<QuantileThreshold>& quantile_thresholds,
+                     float throughput_threshold,
+                     double significance_level) {
+  const Histogram& baseline_histogram = *baseline.histogram;
+  const Histogram& candidate_histogram = *candidate.histogram;
+  int n_regressions = 0;
+  printf("%s\n", statistic.c_str());
+
+  double baseline_duration = baseline.end_time - baseline.start_time;
+  double candidate_duration = candidate.end_time - candidate.start_time;
+  double baseline_throughput = baseline_duration > 0.0
+      ? baseline_histogram.n_samples() / baseline_duration : 0.0;
+  double candidate_throughput = candidate_duration > 0.0
+      ? candidate_histogram.n_samples() / candidate_duration : 0.0;
+  double throughput_change = PercentChange(baseline_throughput,
+                                           candidate_throughput);
+  printf("  throughput: %.1f/s -> %.1f/s (%+.2f%%)\n", baseline_throughput,
+         candidate_throughput, throughput_change);
+
+  vector<float> quantiles(kRecordedQuantiles,
+                          kRecordedQuantiles + kNumRecordedQuantiles);
+  for (size_t i = 0; i < quantile_thresholds.size(); i++) {
+    quantiles.push_back(quantile_thresholds[i].quantile);
+  }
+  vector<float> baseline_values;
+  vector<float> candidate_values;
+  baseline_histogram.GetQuantiles(quantiles, &baseline_values);
+  candidate_histogram.GetQuantiles(quantiles, &candidate_values);
+  for (int i = 0; i < kNumRecordedQuantiles; i++) {
+    printf("  p%g: %f -> %f (%+.2f%%)\n", quantiles[i] * 100.0,
+           baseline_values[i], candidate_values[i],
+           PercentChange(baseline_values[i], candidate_values[i]));
+  }
+
+  double d = KolmogorovSmirnovStatistic(baseline_histogram,
+                                        candidate_histogram);
+  double p_value = KolmogorovSmirnovPValue(d, baseline_histogram.n_samples(),
+                                           candidate_histogram.n_samples());
+  bool distributions_differ = p_value < significance_level;
+  printf("  Kolmogorov-Smirnov: D %.4f p-value %.3g (%s)\n", d, p_value,
+         distributions_differ ? "distributions differ"
+                              : "no significant difference");
+
+  for (size_t i = 0; i < quantile_thresholds.size(); i++) {
+    int index = kNumRecordedQuantiles + i;
+    double change = PercentChange(baseline_values[index],
+                                  candidate_values[index]);
+    if (distributions_differ && change > quantile_thresholds[i].percent) {
+      printf("REGRESSION: %s p%g rose %.2f%% (threshold %g%%)\n",
+             statistic.c_str(), quantile_thresholds[i].quantile * 100.0,
+             change, quantile_thresholds[i].percent);
+      n_regressions++;
+    }
+  }
+  if (-throughput_change > throughput_threshold) {
+    printf("REGRESSION: %s throughput fell %.2f%% (threshold %g%%)\n",
+           statistic.c_str(), -throughput_change, throughput_threshold);
+    n_regressions++;
+  }
+  return n_regressions;
+}
+
+int CacheBashCompare(int argc, char** argv) {
+  vector<QuantileThreshold> quantile_thresholds;
+  float throughput_threshold = kDefaultThroughputThreshold;
+  double significance_level = kDefaultSignificanceLevel;
+  vector<string> statistics;
+  int c;
+  while ((c = getopt(argc, argv, "a:hq:r:s:")) != -1) {
+    switch (c) {
+      case 'a':
+        significance_level = atof(optarg);
+        break;
+      case 'h':
+        PrintUsage();
+        exit(0);
+      case 'q':
+        quantile_thresholds.push_back(ParseQuantileThreshold(optarg));
+        break;
+      case 'r':
+        throughput_threshold = atof(optarg);
+        break;
+      case 's':
+        statistics.push_back(optarg);
+        break;
+      default:
+        PrintUsage();
+        exit(2);
+    }
+  }
+  if (argc - optind < 2) {
+    PrintUsage();
+    exit(2);
+  }
+  if (quantile_thresholds.empty()) {
+    QuantileThreshold median = { 0.5, kDefaultQuantileThreshold };
+    QuantileThreshold tail = { 0.99, kDefaultQuantileThreshold };
+    quantile_thresholds.push_back(median);
+    quantile_thresholds.push_back(tail);
+  }
+  if (statistics.empty()) {
+    statistics.push_back("latency");
+  }
+
+  string baseline_filename = argv[optind];
+  MergedHistogramMap baseline_histograms;
+  MergeHistogramLog(baseline_filename, "", &baseline_histograms);
+  int n_regressions = 0;
+  for (int i = optind + 1; i < argc; i++) {
+    string candidate_filename = argv[i];
+    MergedHistogramMap candidate_histograms;
+    MergeHistogramLog(candidate_filename, "", &candidate_histograms);
+    printf("Comparing %s against %s\n", candidate_filename.c_str(),
+           baseline_filename.c_str());
+    for (vector<string>::const_iterator it = statistics.begin();
+         it != statistics.end();
+         it++) {
+      n_regressions += CompareStatistic(
+                         *it,
+                         FindStatistic(baseline_histograms,
+                                       candidate_histograms, *it,
+                                       baseline_filename),
+                         FindStatistic(candidate_histograms,
+                                       baseline_histograms, *it,
+                                       candidate_filename),
+                         quantile_thresholds, throughput_threshold,
+                         significance_level);
+    }
+    DeleteMergedHistograms(&candidate_histograms);
+  }
+  DeleteMergedHistograms(&baseline_histograms);
+
+  if (n_regressions > 0) {
+    printf("%d regression%s\n", n_regressions, n_regressions == 1 ? "" : "s");
+    return 1;
+  }
+  printf("No regressions\n");
+  return 0;
+}
+
+}  // namespace cachebash
+
+int main(int argc, char** argv) {
+  return cachebash::CacheBashCompare(argc, argv);
+}
@@ -0,0 +1,134 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// cachebash_merge.cc
+//
+// cachebash-merge combines the histogram logs (-O hlog:FILE) of several
+// runs or load generator hosts. Histograms with the same tag are merged
+// exactly, so the quantiles it prints are those of all the samples
+// together, unlike any average of the per-log quantiles.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "cachebash/histogram_log.h"
+#include "cachebash/interval_writer.h"
+#include "cachebash/statistic.h"
+#include "cachebash/util.h"
+
+namespace cachebash {
+
+void PrintUsage() {
+  printf("usage: cachebash-merge [-option] log...\n"
+    "     [-h prints this message]\n"
+    "     [-o arg  also write the merged histograms to a histogram log]\n"
+    "     [-t arg  only merge tags that start with arg, e.g. run/]\n");
+}
+
+void CacheBashMerge(int argc, char** argv) {
+  string output_filename;
+  string tag_prefix;
+  int c;
+  while ((c = getopt(argc, argv, "ho:t:")) != -1) {
+    switch (c) {
+      case 'h':
+        PrintUsage();
+        exit(0);
+      case 'o':
+        output_filename = optarg;
+        break;
+      case 't':
+        tag_prefix = optarg;
+        break;
+      default:
+        PrintUsage();
+        exit(1);
+    }
+  }
+  if (optind == argc) {
+    PrintUsage();
+    exit(1);
+  }
+
+  MergedHistogramMap merged_histograms;
+  for (int i = optind; i < argc; i++) {
+    MergeHistogramLog(argv[i], tag_prefix, &merged_histograms);
+  }
+
+  vector<float> quantiles(kRecordedQuantiles,
+                          kRecordedQuantiles + kNumRecordedQuantiles);
+  vector<float> values;
+  double start_time = 0.0;
+  for (MergedHistogramMap::iterator it = merged_histograms.begin();
+       it != merged_histograms.end();
+       it++) {
+    const Histogram& histogram = *it->second.histogram;
+    histogram.GetQuantiles(quantiles, &values);
+    printf("%s - Count: %lld Max: %f ", it->first.c_str(),
+           static_cast<long long>(histogram.n_samples()),
+           histogram.GetMaxValue() * kHistogramUnit);
+    for (size_t i = 0; i < quantiles.size(); i++) {
+      printf("%.4fth: %f ", quantiles[i], values[i]);
+    }
+    printf("\n");
+    if (it == merged_histograms.begin() || it->second.start_time < start_time) {
+      start_time = it->second.start_time;
+    }
+  }
+
+  if (!output_filename.empty()) {
+    FILE* file = fopen(output_filename.c_str(), "w");
+    if (file == NULL) {
+      LOG_FATAL("Couldn't open " + output_filename);
+    }
+    WriteHistogramLogHeader(file, start_time);
+    for (MergedHistogramMap::iterator it = merged_histograms.begin();
+         it != merged_histograms.end();
+         it++) {
+      const Histogram& histogram = *it->second.histogram;
+      WriteHistogramLogEntry(file, it->first,
+                             it->second.start_time - start_time,
+                             it->second.end_time - it->second.start_time,
+                             histogram.GetMaxValue() * kHistogramUnit,
+                             EncodeHistogram(histogram));
+    }
+    fclose(file);
+  }
+
+  DeleteMergedHistograms(&merged_histograms);
+}
+
+}  // namespace cachebash
+
+int main(int argc, char** argv) {
+  cachebash::CacheBashMerge(argc, argv);
+  return 0;
+}
@@ -0,0 +1,95 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// cachebash_trace.cc
+//
+// cachebash-trace decodes the trace files cachebash writes with -R,
+// printing one line per traced request.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+#include "cachebash/trace.h"
+#include "cachebash/util.h"
+
+namespace cachebash {
+
+void PrintUsage() {
+  printf("usage: cachebash-trace [-option] trace_file...\n"
+         "     [-s only print requests traced for being slow]\n"
+         "     [-h prints this message]\n");
+}
+
+int CacheBashTrace(int argc, char** argv) {
+  bool only_slow = false;
+  int c;
+  while ((c = getopt(argc, argv, "hs")) != -1) {
+    switch (c) {
+      case 'h':
+        PrintUsage();
+        exit(0);
+      case 's':
+        only_slow = true;
+        break;
+      default:
+        PrintUsage();
+        exit(2);
+    }
+  }
+  if (optind == argc) {
+    PrintUsage();
+    exit(2);
+  }
+
+  for (int i = optind; i < argc; i++) {
+    FILE* file = fopen(argv[i], "rb");
+    if (file == NULL) {
+      LOG_FATAL("Couldn't open trace file " + string(argv[i]));
+    }
+    if (!ReadTraceHeader(file)) {
+      LOG_FATAL(string(argv[i]) + " isn't a trace this version can read");
+    }
+    TraceRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+      if (only_slow && !(record.flags & kTraceSlow)) {
+        continue;
+      }
+      printf("%s\n", FormatTraceRecord(record).c_str());
+    }
+    fclose(file);
+  }
+  return 0;
+}
+
+}  // namespace cachebash
+
+int main(int argc, char** argv) {
+  return cachebash::CacheBashTrace(argc, argv);
+}
@@ -32,37 +32,201 @@
 #include "cachebash/config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+
+#include "cachebash/distribution.h"
+#include "cachebash/request.h"
+#include "cachebash/statistic.h"
+#include "cachebash/util.h"
 
 namespace cachebash {
 
+string Server::GetName() const {
+  char name[512];
+  snprintf(name, sizeof(name), "%s:%d", hostname.c_str(), port);
+  return string(name);
+}
+
+// The name under which |statistic| is broken down for this server.
+string Server::GetStatisticName(const string& statistic) const {
+  return GetName() + "/" + statistic;
+}
+
+// Parses a comma separated list of servers of the form
+// host[:port[:weight]] and appends them to |servers|.
+void ParseServerList(const string& server_list, vector<Server>* servers) {
+  size_t start = 0;
+  while (start <= server_list.size()) {
+    size_t end = server_list.find(',', start);
+    if (end == string::npos) {
+      end = server_list.size();
+    }
+    string spec = server_list.substr(start, end - start);
+    start = end + 1;
+    if (spec.empty()) {
+      continue;
+    }
+
+    Server server;
+    server.port = kDefaultMemcachedPort;
+    server.weight = 1;
+    size_t port_start = spec.find(':');
+    server.hostname = spec.substr(0, port_start);
+    if (port_start != string::npos) {
+      size_t weight_start = spec.find(':', port_start + 1);
+      server.port = atoi(spec.substr(port_start + 1,
+                                     weight_start - port_start - 1).c_str());
+      if (weight_start != string::npos) {
+        server.weight = atoi(spec.substr(weight_start + 1).c_str());
+      }
+    }
+    if (server.port <= 0 || server.weight <= 0) {
+      LOG_FATAL("Invalid server specification: " + spec);
+    }
+    server.ip_address = nslookup(server.hostname);
+    servers->push_back(server);
+  }
+}
+
 Config::Config() {
   // Set the default values.
+  backend_delay_distribution_ = NULL;
+  breakdown_backend_ = kDDSketchBackend;
+  connection_latency_ = false;
   debug_ = false;
   fixed_object_size_ = 1024;
+  fraction_adds_ = 0.0;
   fraction_gets_ = 0.9;
   fraction_multiget_ = MULTIGET_DISABLED;
+  fraction_replaces_ = 0.0;
+  fraction_touches_ = 0.0;
+  flags_ = kDefaultFlags;
+  hedge_delay_ = -1.0;
+  hedge_percentile_ = -1.0;
+  histogram_significant_digits_ = kDefaultSignificantDigits;
+  kernel_timestamps_ = false;
+  latency_breakdown_ = false;
   multiget_n_gets_ = MULTIGET_DISABLED;
   n_cpus_ = 1;
   n_connections_per_worker_ = 1;
   n_worker_threads_ = 1;
-  server_ip_address_ = "127.0.0.1";
+  perf_counters_ = false;
+  ketama_continuum_ = NULL;
   size_key_distribution_ = NULL;
   runtime_ = NO_RUNTIME_LIMIT;
   rps_ = -1.0;
+  slow_key_threshold_ = -1.0;
+  stage_timestamps_ = false;
   stat_print_interval_ = 1.0;
+  tcp_info_ = false;
+  top_keys_ = 0;
+  trace_sample_every_ = kDefaultTraceSampleEvery;
+  trace_latency_threshold_ = -1.0;
+  ttl_distribution_ = NULL;
   use_naggles_ = false;
+  validate_flags_ = false;
+  warmup_sequence_ = NULL;
+}
+
+bool Config::IsHedgingEnabled() const {
+  return hedge_delay_ > 0 || hedge_percentile_ > 0;
+}
+
+// Parses a comma separated list of op:fraction pairs, e.g.
+// "add:0.1,touch:0.2", giving how the requests that aren't GETs are split
+// between ADD, REPLACE, TOUCH and SET.
+void Config::ParseStorageMix(const string& storage_mix) {
+  size_t start = 0;
+  while (start < storage_mix.size()) {
+    size_t end = storage_mix.find(',', start);
+    if (end == string::npos) {
+      end = storage_mix.size();
+    }
+    string entry = storage_mix.substr(start, end - start);
+    start = end + 1;
+
+    size_t colon = entry.find(':');
+    if (colon == string::npos) {
+      LOG_FATAL("Storage mix entries must be op:fraction, got " + entry);
+    }
+    string op = entry.substr(0, colon);
+    float fraction = atof(entry.substr(colon + 1).c_str());
+    if (op == "add") {
+      fraction_adds_ = fraction;
+    } else if (op == "replace") {
+      fraction_replaces_ = fraction;
+    } else if (op == "touch") {
+      fraction_touches_ = fraction;
+    } else if (op != "set") {
+      LOG_FATAL("Unknown storage op " + op);
+    }
+  }
+  if (fraction_adds_ + fraction_replaces_ + fraction_touches_ > 1.0) {
+    LOG_FATAL("Storage mix fractions add up to more than 1");
+  }
 }
 
 void Config::Print() {
   printf("Configuration:\n");
+  if (backend_delay_distribution_ != NULL) {
+    printf("backend_delay_distribution: ");
+    backend_delay_distribution_->Print();
+    printf("\n");
+  }
   printf("fraction_gets_: %f\n", fraction_gets_);
+  printf("storage mix: add %f replace %f touch %f\n",
+         fraction_adds_, fraction_replaces_, fraction_touches_);
+  printf("flags: 0x%08x%s\n", flags_, validate_flags_ ? " (validated)" : "");
+  if (hedge_percentile_ > 0) {
+    printf("hedge_percentile: %f\n", hedge_percentile_);
+  } else if (hedge_delay_ > 0) {
+    printf("hedge_delay: %f\n", hedge_delay_);
+  }
+  printf("histogram_significant_digits: %d\n",
+         histogram_significant_digits_);
+  for (vector<string>::const_iterator it = interval_outputs_.begin();
+       it != interval_outputs_.end();
+       it++) {
+    printf("interval_output: %s\n", it->c_str());
+  }
+  printf("kernel_timestamps: %d\n", kernel_timestamps_);
+  printf("latency_breakdown: %s%s (%s)\n",
+         latency_breakdown_ ? "opcode,value_size" : "none",
+         connection_latency_ ? " (and per connection)" : "",
+         breakdown_backend_ == kDDSketchBackend ? "ddsketch" : "hdr");
+  if (!metrics_address_.empty()) {
+    printf("metrics_address: %s\n", metrics_address_.c_str());
+  }
   printf("n_cpus: %d\n", n_cpus_);
   printf("n_connections_per_worker: %d\n", n_connections_per_worker_);
   printf("n_worker_threads: %d\n", n_worker_threads_);
-  printf("server_ip_address: %s\n", server_ip_address_.c_str());
+  printf("perf_counters: %d\n", perf_counters_);
+  for (vector<Server>::const_iterator it = servers_.begin();
+       it != servers_.end();
+       it++) {
+    printf("server: %s (%s) weight %d\n",
+           it->GetName().c_str(), it->ip_address.c_str(), it->weight);
+  }
   // TODO(davidmax@gmail.com) Replace this with something more meaningful.
   printf("size_key_distribution: %p\n", size_key_distribution_);
+  printf("stage_timestamps: %d\n", stage_timestamps_);
   printf("stat_print_interval: %f\n", stat_print_interval_);
+  printf("tcp_info: %d\n", tcp_info_);
+  if (top_keys_ > 0) {
+    printf("top_keys: %d (slow above %f)\n", top_keys_, slow_key_threshold_);
+  }
+  if (!trace_output_.empty()) {
+    printf("trace: %s (1 in %d", trace_output_.c_str(), trace_sample_every_);
+    if (trace_latency_threshold_ > 0) {
+      printf(" and slower than %f", trace_latency_threshold_);
+    }
+    printf(")\n");
+  }
+  if (ttl_distribution_ != NULL) {
+    printf("ttl_distribution: ");
+    ttl_distribution_->Print();
+    printf("\n");
+  }
   printf("runtime: %f\n", runtime_);
   printf("use_naggles: %d\n", use_naggles_);
   printf("\n");
@@ -32,38 +32,124 @@
 #ifndef CONFIG_H_
 #define CONFIG_H_
 
+#include <stdint.h>
 #include <map>
 #include <string>
+#include <vector>
+
+#include "cachebash/statistic.h"
 
 #define MULTIGET_DISABLED -1
 #define NO_RUNTIME_LIMIT -1
 
+using std::vector;
+
 namespace cachebash {
 
+static const int kDefaultMemcachedPort = 11211;
+static const int kDefaultTraceSampleEvery = 1000;
+// Counters kept per reported top key, which bounds how far off the
+// reported counts can be.
+static const int kKeyTrackerCountersPerKey = 10;
+
+class Distribution;
+class KetamaContinuum;
 class Parameter;
 class SizeKeyDistribution;
 class WarmupSequence;
 
+// A memcached server in the pool being loaded.
+struct Server {
+  std::string hostname;
+  std::string ip_address;
+  int port;
+  // Relative share of the ketama continuum owned by this server.
+  int weight;
+
+  std::string GetName() const;
+  std::string GetStatisticName(const std::string& statistic) const;
+};
+
+void ParseServerList(const std::string& server_list, vector<Server>* servers);
+
 // A class to store configuration parameters for the load tester.
 class Config {
  public:
+  // When set, GET misses are filled cache-aside after a simulated backend
+  // delay drawn from this distribution.
+  Distribution* backend_delay_distribution_;
+  // How the latency breakdown statistics keep their distributions.
+  StatisticBackend breakdown_backend_;
+  // Records latency per connection, as well as per server.
+  bool connection_latency_;
   bool debug_;
   int fixed_object_size_;
   float fraction_gets_;
   float fraction_multiget_;
+  // Of the requests that aren't GETs, the fractions that are ADDs,
+  // REPLACEs and TOUCHes. The rest are SETs.
+  float fraction_adds_;
+  float fraction_replaces_;
+  float fraction_touches_;
+  // The flags stored with every item.
+  uint32_t flags_;
+  // GETs still outstanding after |hedge_delay_| seconds, or after the
+  // |hedge_percentile_| quantile of observed latency, are re-issued.
+  float hedge_delay_;
+  float hedge_percentile_;
+  // The precision of latency histograms, in significant decimal digits.
+  int histogram_significant_digits_;
+  // Breaks latency down by server, opcode and value size.
+  bool latency_breakdown_;
+  // Where to write machine-readable interval records, each as format:file.
+  vector<std::string> interval_outputs_;
+  // Has the kernel timestamp packets, to measure latency on the wire.
+  bool kernel_timestamps_;
+  // Where to serve Prometheus metrics, as [host:]port. Empty if they
+  // aren't served.
+  std::string metrics_address_;
   int multiget_n_gets_;
   int n_cpus_;
   int n_connections_per_worker_;
   int n_worker_threads_;
-  std::string server_ip_address_;
+  // Counts each worker's cycles, instructions, cache misses, context
+  // switches and CPU time with perf_event_open.
+  bool perf_counters_;
+  // Built from |servers_| once the arguments have been parsed.
+  KetamaContinuum* ketama_continuum_;
+  vector<Server> servers_;
   float runtime_;
   float rps_;
   SizeKeyDistribution* size_key_distribution_;
+  // Responses slower than this many seconds count towards the slow keys
+  // and connections, if it's positive.
+  float slow_key_threshold_;
+  // Times each request's stages on the client.
+  bool stage_timestamps_;
   double stat_print_interval_;
+  // Samples TCP_INFO of every connection, kTcpInfoSamplesPerInterval
+  // times a stats interval.
+  bool tcp_info_;
+  // How many of the hottest and slowest keys to report each interval, or 0
+  // not to track keys.
+  int top_keys_;
+  // Where to trace requests to, or empty if they aren't traced. One in
+  // every |trace_sample_every_| responses is traced, and every response
+  // slower than |trace_latency_threshold_| seconds if that is positive.
+  std::string trace_output_;
+  int trace_sample_every_;
+  float trace_latency_threshold_;
+  // Item TTLs in seconds, for keys whose class has no TTL in the size/key
+  // distribution file. Items never expire if neither gives one.
+  Distribution* ttl_distribution_;
   bool use_naggles_;
+  // Checks that GET hits return |flags_|.
+  bool validate_flags_;
   WarmupSequence* warmup_sequence_;
 
   Config();
+  bool IsHedgingEnabled() const;
+  void ParseStorageMix(const std::string& storage_mix);
   void Print();
 };
 
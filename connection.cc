@@ -35,8 +35,11 @@
 #include <netdb.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 #include <net/if.h>
 #include <netinet/tcp.h>
 #include <netinet/in.h>
@@ -44,6 +47,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include "cachebash/probes.h"
 #include "cachebash/request.h"
 #include "cachebash/response.h"
 #include "cachebash/scoped_ptr.h"
@@ -154,14 +158,154 @@ void ReadBlock(int fd, char* buffer, int buffer_size, bool debug_packets) {
   }
 }
 
-Connection::Connection(ConnectionType connection_type, bool debug_packets)
+// Space for the control messages carrying a packet's timestamps.
+static const int kTimestampControlSize = 512;
+
+// Returns the packet timestamps in the control messages of |message|, or
+// zeroed timestamps if there are none.
+static PacketTimestamp ParsePacketTimestamp(struct msghdr* message) {
+  PacketTimestamp packet_timestamp;
+  memset(&packet_timestamp, 0, sizeof(packet_timestamp));
+  for (struct cmsghdr* control = CMSG_FIRSTHDR(message);
+       control != NULL;
+       control = CMSG_NXTHDR(message, control)) {
+    if (control->cmsg_level == SOL_SOCKET
+        && control->cmsg_type == SCM_TIMESTAMPING) {
+      struct scm_timestamping timestamping;
+      memcpy(&timestamping, CMSG_DATA(control), sizeof(timestamping));
+      packet_timestamp.software = timestamping.ts[0];
+      packet_timestamp.hardware = timestamping.ts[2];
+    }
+  }
+  return packet_timestamp;
+}
+
+// Reads a block like ReadBlock(), setting |timestamp| to the kernel's
+// receive timestamp for the first bytes of it.
+static void ReadBlockWithTimestamp(int fd,
+                                   char* buffer,
+                                   int buffer_size,
+                                   bool debug_packets,
+                                   PacketTimestamp* timestamp) {
+  struct iovec iov;
+  iov.iov_base = buffer;
+  iov.iov_len = buffer_size;
+  char control[kTimestampControlSize];
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  int bytes_read = recvmsg(fd, &message, 0);
+  if (bytes_read < 0) {
+    string sys_error = string(strerror(errno));
+    LOG_FATAL("Read syscall failed: " + sys_error);
+  }
+  *timestamp = ParsePacketTimestamp(&message);
+  ReadBlock(fd, buffer + bytes_read, buffer_size - bytes_read, false);
+  if (debug_packets) {
+    printf("Read:\n");
+    PrintBuffer(buffer, buffer_size, true);
+  }
+}
+
+static bool IsTimestamped(const struct timespec& timestamp) {
+  return timestamp.tv_sec != 0 || timestamp.tv_nsec != 0;
+}
+
+static double GetSeconds(const struct timespec& start,
+                         const struct timespec& end) {
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+double GetWireLatency(const PacketTimestamp& sent,
+                      const PacketTimestamp& received) {
+  if (IsTimestamped(sent.hardware) && IsTimestamped(received.hardware)) {
+    return GetSeconds(sent.hardware, received.hardware);
+  }
+  if (IsTimestamped(sent.software) && IsTimestamped(received.software)) {
+    return GetSeconds(sent.software, received.software);
+  }
+  return -1.0;
+}
+
+Connection::Connection(ConnectionType connection_type,
+                       bool debug_packets,
+                       int server_index,
+                       int pool_index)
     : connection_type_(connection_type),
-      debug_packets_(debug_packets) {}
+      debug_packets_(debug_packets),
+      pool_index_(pool_index),
+      server_index_(server_index),
+      bytes_sent_(0),
+      timestamping_(false) {}
+
+// Asks for software timestamps on the way out and in, and for hardware
+// ones if the NIC takes them. Transmit timestamps are keyed by byte
+// offset and carry no copy of the packet.
+void Connection::EnableTimestamping() {
+  int flags = SOF_TIMESTAMPING_TX_SOFTWARE
+              | SOF_TIMESTAMPING_RX_SOFTWARE
+              | SOF_TIMESTAMPING_SOFTWARE
+              | SOF_TIMESTAMPING_TX_HARDWARE
+              | SOF_TIMESTAMPING_RX_HARDWARE
+              | SOF_TIMESTAMPING_RAW_HARDWARE
+              | SOF_TIMESTAMPING_OPT_ID
+              | SOF_TIMESTAMPING_OPT_TSONLY;
+  if (setsockopt(sock_, SOL_SOCKET, SO_TIMESTAMPING,
+                 &flags, sizeof(flags)) < 0) {
+    LOG_FATAL("Couldn't enable SO_TIMESTAMPING: "
+              + string(strerror(errno)));
+  }
+  bytes_sent_ = 0;
+  timestamping_ = true;
+}
 
 int Connection::GetSocketFd() {
   return sock_;
 }
 
+bool Connection::HasResponse() {
+  if (!timestamping_) {
+    return true;
+  }
+  ReadTransmitTimestamps();
+  char byte;
+  // A closed connection counts, so reading it fails as it would have.
+  return recv(sock_, &byte, 1, MSG_PEEK | MSG_DONTWAIT) >= 0;
+}
+
+// Collects the transmit timestamps waiting in the socket's error queue.
+void Connection::ReadTransmitTimestamps() {
+  while (true) {
+    char control[kTimestampControlSize];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(sock_, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      return;
+    }
+    PacketTimestamp timestamp = ParsePacketTimestamp(&message);
+    for (struct cmsghdr* control_message = CMSG_FIRSTHDR(&message);
+         control_message != NULL;
+         control_message = CMSG_NXTHDR(&message, control_message)) {
+      if (control_message->cmsg_level != SOL_IP
+          || control_message->cmsg_type != IP_RECVERR) {
+        continue;
+      }
+      struct sock_extended_err error;
+      memcpy(&error, CMSG_DATA(control_message), sizeof(error));
+      if (error.ee_origin == SO_EE_ORIGIN_TIMESTAMPING
+          && error.ee_info == SCM_TSTAMP_SND) {
+        transmit_timestamps_.push_back(std::make_pair(error.ee_data,
+                                                      timestamp));
+      }
+    }
+  }
+}
+
 // Opens a TCP socket to the specified address for the connection
 // on the specified port. If |disable_nagels| is true, will
 // prevent TCP batching.
@@ -209,13 +353,22 @@ void Connection::OpenTcpSocket(const string& ip_address,
   }
 }
 
-// Receive a response over the connection.
-Response* Connection::ReceiveResponse() {
+// Reads one response packet off the socket, noting when it was |received|
+// if that isn't NULL.
+Response* Connection::ReadResponsePacket(PacketTimestamp* received) {
   ResponseHeader response_header;
-  ReadBlock(sock_,
-            reinterpret_cast<char*>(&response_header),
-            sizeof(ResponseHeader),
-            debug_packets_);
+  if (received != NULL) {
+    ReadBlockWithTimestamp(sock_,
+                           reinterpret_cast<char*>(&response_header),
+                           sizeof(ResponseHeader),
+                           debug_packets_,
+                           received);
+  } else {
+    ReadBlock(sock_,
+              reinterpret_cast<char*>(&response_header),
+              sizeof(ResponseHeader),
+              debug_packets_);
+  }
   if (response_header.magic != kMagicResponse) {
     LOG_FATAL("On read Incorrect magic number.");
   }
@@ -239,14 +392,64 @@ Response* Connection::ReceiveResponse() {
   ReadBlock(sock_, extras.Get(), extras_size, debug_packets_);
   ReadBlock(sock_, key.Get(), key_size, debug_packets_);
   ReadBlock(sock_, value.Get(), value_size, debug_packets_);
+  CACHEBASH_PROBE_RESPONSE_RECEIVE(response_header.opcode,
+                                   ((response_header.status[0] & 0xff) << 8)
+                                   | (response_header.status[1] & 0xff),
+                                   key_size, value_size);
 
   Response* response = Response::CreateResponseFromHeader(response_header);
+  response->ParseExtras(extras.Get(), extras_size);
+  response->set_size(sizeof(ResponseHeader) + body_size);
+  response->set_value_size(value_size);
+  return response;
+}
+
+// Receive a response over the connection. The response is matched to the
+// oldest outstanding request, which it takes ownership of. A multiget's
+// hits are read through to the NOOP that ends it, and the response counts
+// them and their bytes.
+Response* Connection::ReceiveResponse() {
+  PacketTimestamp received;
+  Response* response = ReadResponsePacket(timestamping_ ? &received : NULL);
+  if (outstanding_requests_.empty()) {
+    LOG_FATAL("Received a response without an outstanding request");
+  }
+  uint32_t opaque = outstanding_requests_.front()->opaque();
+  int n_hits = 0;
+  int size = 0;
+  int value_size = 0;
+  while (response->op_code() == OPCODE_GETKQ) {
+    if (response->opaque() != opaque) {
+      LOG_FATAL("Response opaque does not match the outstanding request");
+    }
+    if (response->status() == kNoError) {
+      n_hits++;
+    }
+    size += response->size();
+    value_size += response->value_size();
+    delete response;
+    response = ReadResponsePacket(NULL);
+  }
+  if (response->op_code() == OPCODE_NOOP) {
+    response->set_n_hits(n_hits);
+    response->set_size(response->size() + size);
+    response->set_value_size(value_size);
+  }
+
+  response->set_request(outstanding_requests_.front());
+  outstanding_requests_.pop();
+  if (response->opaque() != response->request()->opaque()) {
+    LOG_FATAL("Response opaque does not match the outstanding request");
+  }
+  if (timestamping_) {
+    response->set_wire_latency(GetRequestWireLatency(received));
+  }
 
   return response;
 }
 
-// Send a request over the connection.
-void Connection::SendRequest(Request* request) {
+// Send a request over the connection, returning how many bytes it took.
+int Connection::SendRequest(Request* request) {
   int request_size_bytes;
   scoped_array<char> request_buffer(
                      request->ConstructRequestPacket(&request_size_bytes));
@@ -254,6 +457,38 @@ void Connection::SendRequest(Request* request) {
              request_buffer.Get(),
              request_size_bytes,
              debug_packets_);
+  outstanding_requests_.push(request);
+  CACHEBASH_PROBE_REQUEST_SEND(request->op_code(), request->key().size(),
+                               request->value_size(), request_size_bytes,
+                               server_index_);
+  if (timestamping_) {
+    bytes_sent_ += request_size_bytes;
+    outstanding_timestamp_keys_.push(bytes_sent_ - 1);
+    ReadTransmitTimestamps();
+  }
+  return request_size_bytes;
+}
+
+// Returns the wire latency of the oldest outstanding request, whose
+// response was |received|, and stops waiting for its transmit timestamp.
+double Connection::GetRequestWireLatency(const PacketTimestamp& received) {
+  ReadTransmitTimestamps();
+  uint32_t key = outstanding_timestamp_keys_.front();
+  outstanding_timestamp_keys_.pop();
+  // Keys wrap, so compare them by distance. Partial writes leave
+  // timestamps for keys that no request has.
+  while (!transmit_timestamps_.empty()
+         && static_cast<int32_t>(transmit_timestamps_.front().first - key)
+            < 0) {
+    transmit_timestamps_.pop_front();
+  }
+  if (transmit_timestamps_.empty()
+      || transmit_timestamps_.front().first != key) {
+    return -1.0;
+  }
+  PacketTimestamp sent = transmit_timestamps_.front().second;
+  transmit_timestamps_.pop_front();
+  return GetWireLatency(sent, received);
 }
 
 }  // namespace cachebash
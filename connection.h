@@ -32,10 +32,18 @@
 #ifndef CONNECTION_H_
 #define CONNECTION_H_
 
+#include <stdint.h>
+#include <time.h>
+
+#include <deque>
+#include <queue>
 #include <string>
+#include <utility>
 
 #include "cachebash/util.h"
 
+using std::deque;
+using std::queue;
 using std::string;
 
 namespace cachebash {
@@ -48,18 +56,65 @@ enum ConnectionType {
   UDP,
 };
 
+// The kernel's timestamps for a packet. The hardware one is zero unless
+// the NIC has been set up to take it.
+struct PacketTimestamp {
+  struct timespec software;
+  struct timespec hardware;
+};
+
+// Returns the seconds between the kernel sending |sent| and receiving
+// |received|, or a negative number if either wasn't timestamped. Hardware
+// timestamps are used only if both packets have one, since the NIC's clock
+// isn't the system's.
+double GetWireLatency(const PacketTimestamp& sent,
+                      const PacketTimestamp& received);
+
 // A class to represent a connection to a server
 class Connection {
  public:
-  Connection(ConnectionType connection_type, bool debug_packets_);
+  Connection(ConnectionType connection_type,
+             bool debug_packets_,
+             int server_index,
+             int pool_index);
+  // Has the kernel timestamp the packets of the connection, so responses
+  // carry their wire latency.
+  void EnableTimestamping();
   int GetSocketFd();
+  // Whether a response is waiting to be read. With timestamping, the
+  // socket also wakes up its reader for transmit timestamps, which this
+  // collects.
+  bool HasResponse();
+  int n_outstanding_requests() const { return outstanding_requests_.size(); }
   void OpenTcpSocket(const string& ip_address, int port, bool disable_nagles);
   Response* ReceiveResponse();
-  void SendRequest(Request* request);
+  // Returns the bytes written.
+  int SendRequest(Request* request);
+  // Which of the worker's connections to the server this is.
+  int pool_index() const { return pool_index_; }
+  int server_index() const { return server_index_; }
+
  private:
   ConnectionType connection_type_;
   bool debug_packets_;
+  // Requests that have been sent but not yet answered, in the order they
+  // were sent. memcached answers requests on a connection in order.
+  queue<Request*> outstanding_requests_;
+  int pool_index_;
+  int server_index_;
   int sock_;
+
+  double GetRequestWireLatency(const PacketTimestamp& received);
+  Response* ReadResponsePacket(PacketTimestamp* received);
+  void ReadTransmitTimestamps();
+  // Bytes written since timestamping was enabled, which is how the kernel
+  // keys transmit timestamps: by the offset of a write's last byte.
+  uint32_t bytes_sent_;
+  // The transmit timestamp key of each outstanding request, in order.
+  queue<uint32_t> outstanding_timestamp_keys_;
+  // Transmit timestamps not yet matched to a response, in key order.
+  deque<std::pair<uint32_t, PacketTimestamp> > transmit_timestamps_;
+  bool timestamping_;
   DISALLOW_COPY_AND_ASSIGN(Connection);
 };
 
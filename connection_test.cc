@@ -0,0 +1,185 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+//  connection_test.cc
+//
+
+#include "cachebash/connection.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "cachebash/request.h"
+#include "cachebash/response.h"
+#include "cachebash/scoped_ptr.h"
+#include "gtest/gtest.h"
+
+using cachebash::Connection;
+using cachebash::GetRequest;
+using cachebash::MultiGetRequest;
+using cachebash::PacketTimestamp;
+using cachebash::Response;
+using std::string;
+using std::vector;
+
+namespace {
+
+PacketTimestamp MakePacketTimestamp(int software_sec, int hardware_sec) {
+  PacketTimestamp packet_timestamp;
+  memset(&packet_timestamp, 0, sizeof(packet_timestamp));
+  packet_timestamp.software.tv_sec = software_sec;
+  packet_timestamp.hardware.tv_sec = hardware_sec;
+  return packet_timestamp;
+}
+
+// Opens |connection| to a server listening on loopback, and returns the
+// server's end of it. |listen_fd| is set to the listening socket.
+int ConnectOverLoopback(Connection* connection, int* listen_fd) {
+  *listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = 0;
+  inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+  if (bind(*listen_fd, reinterpret_cast<struct sockaddr*>(&address),
+           sizeof(address)) != 0
+      || listen(*listen_fd, 1) != 0) {
+    return -1;
+  }
+  socklen_t address_size = sizeof(address);
+  getsockname(*listen_fd, reinterpret_cast<struct sockaddr*>(&address),
+              &address_size);
+  connection->OpenTcpSocket("127.0.0.1", ntohs(address.sin_port), true);
+  return accept(*listen_fd, NULL, NULL);
+}
+
+// Reads the |size| bytes of a request off |server_fd|.
+void ReadRequest(int server_fd, int size) {
+  char request[256];
+  int n_read = 0;
+  while (n_read < size) {
+    n_read += read(server_fd, request + n_read, size - n_read);
+  }
+}
+
+TEST(ConnectionTest, GetWireLatency) {
+  // Software timestamps are used unless both packets have hardware ones.
+  EXPECT_DOUBLE_EQ(2.0, cachebash::GetWireLatency(MakePacketTimestamp(1, 0),
+                                                  MakePacketTimestamp(3, 7)));
+  EXPECT_DOUBLE_EQ(4.0, cachebash::GetWireLatency(MakePacketTimestamp(1, 3),
+                                                  MakePacketTimestamp(3, 7)));
+  EXPECT_GT(0, cachebash::GetWireLatency(MakePacketTimestamp(0, 0),
+                                         MakePacketTimestamp(3, 0)));
+
+  PacketTimestamp sent = MakePacketTimestamp(1, 0);
+  sent.software.tv_nsec = 999999000;
+  PacketTimestamp received = MakePacketTimestamp(2, 0);
+  received.software.tv_nsec = 1000;
+  EXPECT_NEAR(2e-6, cachebash::GetWireLatency(sent, received), 1e-12);
+}
+
+// Test that a response over loopback carries its wire latency, from the
+// kernel's software timestamps.
+TEST(ConnectionTest, TimestampingOnLoopback) {
+  Connection connection(cachebash::TCP, false, 0, 0);
+  int listen_fd = -1;
+  int server_fd = ConnectOverLoopback(&connection, &listen_fd);
+  connection.EnableTimestamping();
+  ASSERT_LE(0, server_fd);
+
+  ReadRequest(server_fd, connection.SendRequest(new GetRequest("foo")));
+  // Nothing to read yet, just the transmit timestamp.
+  EXPECT_FALSE(connection.HasResponse());
+
+  // A miss, with no body.
+  char response[24];
+  memset(response, 0, sizeof(response));
+  response[0] = static_cast<char>(0x81);
+  response[7] = 0x01;
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(response)),
+            write(server_fd, response, sizeof(response)));
+
+  EXPECT_TRUE(connection.HasResponse());
+  scoped_ptr<Response> received(connection.ReceiveResponse());
+  EXPECT_EQ(cachebash::kKeyNotFound, received->status());
+  EXPECT_LE(0.0, received->wire_latency());
+  EXPECT_GT(1.0, received->wire_latency());
+
+  close(server_fd);
+  close(listen_fd);
+  close(connection.GetSocketFd());
+}
+
+// Test that a multiget's hits are read through to its NOOP, which completes
+// it, and that the keys that missed need no response.
+TEST(ConnectionTest, MultiGetCompletesOnNoop) {
+  Connection connection(cachebash::TCP, false, 0, 0);
+  int listen_fd = -1;
+  int server_fd = ConnectOverLoopback(&connection, &listen_fd);
+  ASSERT_LE(0, server_fd);
+
+  vector<string> keys;
+  keys.push_back("foo");
+  keys.push_back("bar");
+  keys.push_back("baz");
+  MultiGetRequest* request = new MultiGetRequest(keys);
+  request->set_opaque(7);
+  ReadRequest(server_fd, connection.SendRequest(request));
+
+  // A hit on "bar" with 4 bytes of flags and a 2 byte value, then the NOOP.
+  char response[24 + 4 + 3 + 2 + 24];
+  memset(response, 0, sizeof(response));
+  response[0] = static_cast<char>(0x81);
+  response[1] = 0x0d;
+  response[3] = 3;
+  response[4] = 4;
+  response[11] = 4 + 3 + 2;
+  response[15] = 7;
+  memcpy(response + 28, "barxy", 5);
+  response[33] = static_cast<char>(0x81);
+  response[34] = 0x0a;
+  response[48] = 7;
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(response)),
+            write(server_fd, response, sizeof(response)));
+
+  scoped_ptr<Response> received(connection.ReceiveResponse());
+  EXPECT_EQ(request, received->request());
+  EXPECT_EQ(1, received->n_hits());
+  EXPECT_EQ(static_cast<int>(sizeof(response)), received->size());
+  EXPECT_EQ(2, received->value_size());
+  EXPECT_EQ(0, connection.n_outstanding_requests());
+
+  close(server_fd);
+  close(listen_fd);
+  close(connection.GetSocketFd());
+}
+}  // namespace
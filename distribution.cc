@@ -0,0 +1,112 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// distribution.cc
+//
+
+#include "cachebash/distribution.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using std::vector;
+
+namespace cachebash {
+
+// A uniform random number in [0.0, 1.0). Unlike RandomFloat(), every value
+// is equally likely, which the distributions' moments depend on.
+static double RandomUnit() {
+  return rand() / (RAND_MAX + 1.0);
+}
+
+// Creates the distribution described by |specification|. The caller owns
+// the returned distribution.
+Distribution* Distribution::Parse(const string& specification) {
+  vector<string> fields;
+  size_t start = 0;
+  while (true) {
+    size_t end = specification.find(':', start);
+    fields.push_back(specification.substr(start, end - start));
+    if (end == string::npos) {
+      break;
+    }
+    start = end + 1;
+  }
+
+  if (fields[0] == "fixed" && fields.size() == 2) {
+    return new FixedDistribution(atof(fields[1].c_str()));
+  } else if (fields[0] == "uniform" && fields.size() == 3) {
+    return new UniformDistribution(atof(fields[1].c_str()),
+                                   atof(fields[2].c_str()));
+  } else if (fields[0] == "exp" && fields.size() == 2) {
+    return new ExponentialDistribution(atof(fields[1].c_str()));
+  }
+  LOG_FATAL("Unknown distribution: " + specification);
+  return NULL;
+}
+
+FixedDistribution::FixedDistribution(double value) : value_(value) {}
+
+void FixedDistribution::Print() const {
+  printf("fixed(%f)", value_);
+}
+
+double FixedDistribution::Sample() {
+  return value_;
+}
+
+UniformDistribution::UniformDistribution(double min, double max)
+    : min_(min),
+      max_(max) {
+  if (max_ < min_) {
+    LOG_FATAL("Uniform distribution has max < min");
+  }
+}
+
+void UniformDistribution::Print() const {
+  printf("uniform(%f, %f)", min_, max_);
+}
+
+double UniformDistribution::Sample() {
+  return min_ + (max_ - min_) * RandomUnit();
+}
+
+ExponentialDistribution::ExponentialDistribution(double mean)
+    : mean_(mean) {}
+
+void ExponentialDistribution::Print() const {
+  printf("exp(%f)", mean_);
+}
+
+// Inverse transform sampling.
+double ExponentialDistribution::Sample() {
+  return -mean_ * log(1.0 - RandomUnit());
+}
+
+}  // namespace cachebash
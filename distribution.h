@@ -0,0 +1,99 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// distribution.h
+//
+// Random distributions used to draw simulated delays and item lifetimes.
+// Distributions are described on the command line as
+//   fixed:<value>
+//   uniform:<min>:<max>
+//   exp:<mean>
+//
+
+#ifndef DISTRIBUTION_H_
+#define DISTRIBUTION_H_
+
+#include <string>
+
+#include "cachebash/util.h"
+
+using std::string;
+
+namespace cachebash {
+
+class Distribution {
+ public:
+  Distribution() {}
+  virtual ~Distribution() {}
+  static Distribution* Parse(const string& specification);
+  virtual void Print() const = 0;
+  virtual double Sample() = 0;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(Distribution);
+};
+
+class FixedDistribution : public Distribution {
+ public:
+  explicit FixedDistribution(double value);
+  virtual void Print() const;
+  virtual double Sample();
+
+ private:
+  double value_;
+
+  DISALLOW_COPY_AND_ASSIGN(FixedDistribution);
+};
+
+class UniformDistribution : public Distribution {
+ public:
+  UniformDistribution(double min, double max);
+  virtual void Print() const;
+  virtual double Sample();
+
+ private:
+  double min_;
+  double max_;
+
+  DISALLOW_COPY_AND_ASSIGN(UniformDistribution);
+};
+
+class ExponentialDistribution : public Distribution {
+ public:
+  explicit ExponentialDistribution(double mean);
+  virtual void Print() const;
+  virtual double Sample();
+
+ private:
+  double mean_;
+
+  DISALLOW_COPY_AND_ASSIGN(ExponentialDistribution);
+};
+
+}  // namespace cachebash
+
+#endif  // DISTRIBUTION_H_
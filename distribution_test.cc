@@ -0,0 +1,73 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+//  distribution_test.cc
+//
+
+#include "cachebash/distribution.h"
+
+#include "cachebash/scoped_ptr.h"
+#include "gtest/gtest.h"
+
+using cachebash::Distribution;
+
+namespace {
+
+TEST(DistributionTest, Fixed) {
+  scoped_ptr<Distribution> distribution(Distribution::Parse("fixed:0.25"));
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(0.25, distribution->Sample());
+  }
+}
+
+TEST(DistributionTest, Uniform) {
+  scoped_ptr<Distribution> distribution(
+                             Distribution::Parse("uniform:1:3"));
+  double sum = 0.0;
+  const int kSamples = 10000;
+  for (int i = 0; i < kSamples; i++) {
+    double sample = distribution->Sample();
+    EXPECT_LE(1.0, sample);
+    EXPECT_GE(3.0, sample);
+    sum += sample;
+  }
+  EXPECT_NEAR(2.0, sum / kSamples, 0.05);
+}
+
+TEST(DistributionTest, Exponential) {
+  scoped_ptr<Distribution> distribution(Distribution::Parse("exp:0.005"));
+  double sum = 0.0;
+  const int kSamples = 100000;
+  for (int i = 0; i < kSamples; i++) {
+    double sample = distribution->Sample();
+    EXPECT_LE(0.0, sample);
+    sum += sample;
+  }
+  EXPECT_NEAR(0.005, sum / kSamples, 0.0002);
+}
+
+}  // namespace
@@ -0,0 +1,111 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// fanout_request.cc
+//
+
+#include "cachebash/fanout_request.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "cachebash/ketama.h"
+#include "cachebash/request.h"
+
+namespace cachebash {
+
+FanoutRequest::FanoutRequest(const vector<string>& keys)
+    : keys_(keys),
+      n_outstanding_shards_(0) {
+  timerclear(&start_time_);
+}
+
+// Groups the keys into shards by the server that owns them, and batches
+// each shard's keys into one MultiGetRequest. The requests are appended to
+// |requests| in shard order; the caller takes ownership of them.
+void FanoutRequest::CreateShardRequests(const KetamaContinuum& continuum,
+                                        vector<Request*>* requests) {
+  vector<vector<string> > shard_keys;
+  for (vector<string>::const_iterator it = keys_.begin();
+       it != keys_.end();
+       it++) {
+    int server_index = continuum.GetServerIndex(*it);
+    int shard_index = 0;
+    while (shard_index < n_shards()
+           && shards_[shard_index].server_index != server_index) {
+      shard_index++;
+    }
+    if (shard_index == n_shards()) {
+      FanoutShard shard;
+      shard.server_index = server_index;
+      shard.latency = 0.0;
+      shards_.push_back(shard);
+      shard_keys.push_back(vector<string>());
+    }
+    shard_keys[shard_index].push_back(*it);
+  }
+
+  for (int i = 0; i < n_shards(); i++) {
+    Request* request = new MultiGetRequest(shard_keys[i]);
+    request->set_fanout(this, i);
+    requests->push_back(request);
+  }
+  n_outstanding_shards_ = n_shards();
+}
+
+// Records that |request|, one shard's batch, completed at |timestamp|, when
+// the NOOP ending it was answered. Returns true once every shard has.
+bool FanoutRequest::CompleteShardRequest(Request* request,
+                                         const struct timeval& timestamp) {
+  FanoutShard& shard = shards_[request->fanout_shard()];
+  struct timeval time_diff;
+  timersub(&timestamp, &start_time_, &time_diff);
+  shard.latency = time_diff.tv_usec * 1e-6 + time_diff.tv_sec;
+  n_outstanding_shards_--;
+  return n_outstanding_shards_ == 0;
+}
+
+// The fan-out completes when its slowest shard does.
+float FanoutRequest::GetCompletionLatency() const {
+  float latency = 0.0;
+  for (vector<FanoutShard>::const_iterator it = shards_.begin();
+       it != shards_.end();
+       it++) {
+    latency = std::max(latency, it->latency);
+  }
+  return latency;
+}
+
+// Completion latency is also broken down by the number of shards the
+// fan-out touched, which gives the tail latency curve as K grows.
+string FanoutRequest::GetLatencyStatisticName(int n_shards) {
+  char name[64];
+  snprintf(name, sizeof(name), "fanout_latency/%02d_shards", n_shards);
+  return string(name);
+}
+
+}  // namespace cachebash
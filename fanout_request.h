@@ -0,0 +1,86 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// fanout_request.h
+//
+// A multiget that is split across the servers that own its keys, the way a
+// single page view turns into one batch of gets per shard. Each shard's keys
+// go out as a single MultiGetRequest, and the fan-out only completes once
+// the slowest shard has answered.
+//
+
+#ifndef FANOUT_REQUEST_H_
+#define FANOUT_REQUEST_H_
+
+#include <sys/time.h>
+#include <string>
+#include <vector>
+
+#include "cachebash/util.h"
+
+using std::string;
+using std::vector;
+
+namespace cachebash {
+
+class KetamaContinuum;
+class Request;
+
+struct FanoutShard {
+  int server_index;
+  // Time from the start of the fan-out until the shard's batch completed.
+  float latency;
+};
+
+class FanoutRequest {
+ public:
+  explicit FanoutRequest(const vector<string>& keys);
+  bool CompleteShardRequest(Request* request,
+                            const struct timeval& timestamp);
+  void CreateShardRequests(const KetamaContinuum& continuum,
+                           vector<Request*>* requests);
+  float GetCompletionLatency() const;
+  static string GetLatencyStatisticName(int n_shards);
+  const FanoutShard& GetShard(int shard_index) const {
+    return shards_[shard_index];
+  }
+  int n_keys() const { return keys_.size(); }
+  int n_shards() const { return shards_.size(); }
+  void set_start_time(struct timeval start_time) { start_time_ = start_time; }
+
+ private:
+  vector<string> keys_;
+  int n_outstanding_shards_;
+  vector<FanoutShard> shards_;
+  struct timeval start_time_;
+
+  DISALLOW_COPY_AND_ASSIGN(FanoutRequest);
+};
+
+}  // namespace cachebash
+
+#endif  // FANOUT_REQUEST_H_
@@ -30,9 +30,13 @@
 
 #include "cachebash/generator.h"
 
+#include <algorithm>
 #include <string>
 
 #include "cachebash/config.h"
+#include "cachebash/distribution.h"
+#include "cachebash/fanout_request.h"
+#include "cachebash/probes.h"
 #include "cachebash/request.h"
 #include "cachebash/size_key_distribution.h"
 #include "cachebash/util.h"
@@ -56,28 +60,107 @@ string Generator::GenerateRandomString(int max_length) {
     return s;
 }
 
-Request* Generator::GenerateNextRequest() {
-  Request* request = NULL;
-  string key = "";
-  string value = "";
+// Picks the next key, the size of the value stored under it and the TTL
+// of its key class (-1 if it has none).
+void Generator::GenerateKey(string* key, int* value_size, int* key_ttl) {
   // Check if we've been provided a size/key distribution file.
   if (config_->size_key_distribution_ != NULL) {
     SizeKeyEntry* size_key_entry
       = config_->size_key_distribution_->GetRandomEntry(RandomInt());
-    key = size_key_entry->key;
-    value = Generator::GenerateRandomString(size_key_entry->size);
+    *key = size_key_entry->key;
+    *value_size = size_key_entry->size;
+    *key_ttl = size_key_entry->ttl;
   } else {
-    key = Generator::GenerateRandomString(MAX_KEY_SIZE);
-    value = Generator::GenerateRandomString(MAX_VALUE_SIZE);
+    *key = Generator::GenerateRandomString(MAX_KEY_SIZE);
+    *value_size = MAX_VALUE_SIZE;
+    *key_ttl = -1;
   }
+}
 
-  float random = RandomFloat();
-  if (random < config_->fraction_gets_) {
-    request = new GetRequest(key);
-  } else {
-    request = new SetRequest(key, value);
+// Returns the expiry to store a key with, preferring the TTL of its key
+// class over the configured TTL distribution. 0 means never expire. TTLs
+// are capped at kMaxRelativeExpiry, past which memcached would take them
+// for a time that has already gone.
+uint32_t Generator::GenerateExpiry(int key_ttl) {
+  if (key_ttl >= 0) {
+    return std::min(static_cast<uint32_t>(key_ttl), kMaxRelativeExpiry);
   }
+  if (config_->ttl_distribution_ != NULL) {
+    double ttl = config_->ttl_distribution_->Sample();
+    // memcached reads 0 as never expire, so round up to a second.
+    if (ttl < 1.0) {
+      return 1;
+    }
+    if (ttl >= kMaxRelativeExpiry) {
+      return kMaxRelativeExpiry;
+    }
+    return static_cast<uint32_t>(ttl + 0.5);
+  }
+  return 0;
+}
+
+// Generates a multiget of |multiget_n_gets_| keys to be fanned out
+// across the servers.
+FanoutRequest* Generator::GenerateFanoutRequest() {
+  vector<string> keys;
+  for (int i = 0; i < config_->multiget_n_gets_; i++) {
+    string key = "";
+    int value_size = 0;
+    int key_ttl = -1;
+    GenerateKey(&key, &value_size, &key_ttl);
+    keys.push_back(key);
+  }
+  return new FanoutRequest(keys);
+}
+
+// Generates the SET a cache-aside client issues to fill the cache after
+// a GET of |key| misses.
+Request* Generator::GenerateFillRequest(const string& key, int value_size,
+                                        uint32_t expiry) {
+  return new SetRequest(key, Generator::GenerateRandomString(value_size),
+                        config_->flags_, expiry);
+}
+
+// Fires the generation probe for |request|, and returns it.
+static Request* Generated(Request* request) {
+  CACHEBASH_PROBE_REQUEST_GENERATE(request->op_code(), request->key().size(),
+                                   request->value_size());
   return request;
 }
 
+Request* Generator::GenerateNextRequest() {
+  string key = "";
+  int value_size = 0;
+  int key_ttl = -1;
+  GenerateKey(&key, &value_size, &key_ttl);
+  uint32_t expiry = GenerateExpiry(key_ttl);
+
+  // Cache-aside clients only write to fill misses.
+  float random = RandomFloat();
+  if (config_->backend_delay_distribution_ != NULL
+      || random < config_->fraction_gets_) {
+    GetRequest* get_request = new GetRequest(key);
+    get_request->set_fill_expiry(expiry);
+    get_request->set_fill_value_size(value_size);
+    return Generated(get_request);
+  }
+
+  // Split the rest between the storage commands.
+  random = RandomFloat();
+  if (random < config_->fraction_touches_) {
+    return Generated(new TouchRequest(key, expiry));
+  }
+  random -= config_->fraction_touches_;
+  string value = Generator::GenerateRandomString(value_size);
+  if (random < config_->fraction_adds_) {
+    return Generated(new AddRequest(key, value, config_->flags_, expiry));
+  }
+  random -= config_->fraction_adds_;
+  if (random < config_->fraction_replaces_) {
+    return Generated(new ReplaceRequest(key, value, config_->flags_,
+                                        expiry));
+  }
+  return Generated(new SetRequest(key, value, config_->flags_, expiry));
+}
+
 }  // namespace cachebash
@@ -37,23 +37,31 @@
 // #define MAX_VALUE_SIZE (1024*1023)
 #define MAX_VALUE_SIZE (10)
 
+#include <stdint.h>
 #include <string>
 
 using std::string;
 
 namespace cachebash {
 
-class Request;
 class Config;
+class FanoutRequest;
+class Request;
 class SizeKeyDistribution;
 
 class Generator {
  public:
   explicit Generator(Config* config);
+  FanoutRequest* GenerateFanoutRequest();
+  Request* GenerateFillRequest(const string& key, int value_size,
+                               uint32_t expiry);
   Request* GenerateNextRequest();
   static string GenerateRandomString(int max_length);
 
  private:
+  uint32_t GenerateExpiry(int key_ttl);
+  void GenerateKey(string* key, int* value_size, int* key_ttl);
+
   Config* config_;
 };
 
@@ -0,0 +1,408 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// histogram_log.cc
+//
+
+#include "cachebash/histogram_log.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "cachebash/statistic.h"
+
+using std::vector;
+
+namespace cachebash {
+
+// The cookies HdrHistogram's V2 encoding starts with, for 8 byte counts.
+static const uint32_t kEncodingCookie = 0x1c849303 | 0x10;
+static const uint32_t kCompressedEncodingCookie = 0x1c849304 | 0x10;
+static const uint32_t kCookieWordSizeMask = 0xf0;
+static const size_t kEncodingHeaderSize = 40;
+
+static const char kBase64Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+string Base64Encode(const string& data) {
+  string encoded;
+  for (size_t i = 0; i < data.size(); i += 3) {
+    uint32_t word = static_cast<uint8_t>(data[i]) << 16;
+    if (i + 1 < data.size()) {
+      word |= static_cast<uint8_t>(data[i + 1]) << 8;
+    }
+    if (i + 2 < data.size()) {
+      word |= static_cast<uint8_t>(data[i + 2]);
+    }
+    encoded.push_back(kBase64Alphabet[(word >> 18) & 0x3f]);
+    encoded.push_back(kBase64Alphabet[(word >> 12) & 0x3f]);
+    encoded.push_back(i + 1 < data.size() ? kBase64Alphabet[(word >> 6) & 0x3f]
+                                          : '=');
+    encoded.push_back(i + 2 < data.size() ? kBase64Alphabet[word & 0x3f]
+                                          : '=');
+  }
+  return encoded;
+}
+
+bool Base64Decode(const string& encoded, string* data) {
+  if (encoded.size() % 4 != 0) {
+    return false;
+  }
+  data->clear();
+  for (size_t i = 0; i < encoded.size(); i += 4) {
+    uint32_t word = 0;
+    int n_padding = 0;
+    for (int j = 0; j < 4; j++) {
+      char c = encoded[i + j];
+      const char* position = strchr(kBase64Alphabet, c);
+      if (c == '=' && i + 4 == encoded.size() && j >= 2) {
+        n_padding++;
+      } else if (c == '\0' || position == NULL || n_padding > 0) {
+        return false;
+      }
+      word = (word << 6) | (c == '=' ? 0 : position - kBase64Alphabet);
+    }
+    data->push_back((word >> 16) & 0xff);
+    if (n_padding < 2) {
+      data->push_back((word >> 8) & 0xff);
+    }
+    if (n_padding < 1) {
+      data->push_back(word & 0xff);
+    }
+  }
+  return true;
+}
+
+// HdrHistogram encodes everything big-endian.
+static void PutInt32(string* buffer, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    buffer->push_back((value >> shift) & 0xff);
+  }
+}
+
+static void PutInt64(string* buffer, uint64_t value) {
+  PutInt32(buffer, value >> 32);
+  PutInt32(buffer, value & 0xffffffff);
+}
+
+static uint32_t GetInt32(const string& buffer, size_t offset) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value = (value << 8) | static_cast<uint8_t>(buffer[offset + i]);
+  }
+  return value;
+}
+
+static uint64_t GetInt64(const string& buffer, size_t offset) {
+  return (static_cast<uint64_t>(GetInt32(buffer, offset)) << 32)
+         | GetInt32(buffer, offset + 4);
+}
+
+// Zigzag LEB128 as HdrHistogram writes it: seven bits per byte for up to
+// eight bytes, then a ninth byte holding the last eight bits.
+static void PutZigZag(string* buffer, int64_t value) {
+  uint64_t zigzag = (static_cast<uint64_t>(value) << 1)
+                    ^ static_cast<uint64_t>(value >> 63);
+  for (int i = 0; i < 8; i++) {
+    if (zigzag < 0x80) {
+      buffer->push_back(zigzag);
+      return;
+    }
+    buffer->push_back((zigzag & 0x7f) | 0x80);
+    zigzag >>= 7;
+  }
+  buffer->push_back(zigzag);
+}
+
+static bool GetZigZag(const string& buffer, size_t end, size_t* offset,
+                      int64_t* value) {
+  uint64_t zigzag = 0;
+  for (int i = 0; i < 9; i++) {
+    if (*offset >= end) {
+      return false;
+    }
+    uint8_t byte = buffer[(*offset)++];
+    if (i == 8) {
+      zigzag |= static_cast<uint64_t>(byte) << 56;
+      break;
+    }
+    zigzag |= static_cast<uint64_t>(byte & 0x7f) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      break;
+    }
+  }
+  *value = static_cast<int64_t>(zigzag >> 1)
+           ^ -static_cast<int64_t>(zigzag & 1);
+  return true;
+}
+
+// Runs of more than one zero count are written as their negated length.
+string EncodeHistogram(const Histogram& histogram) {
+  const vector<int64_t>& counts = histogram.counts();
+  int counts_limit = counts.size();
+  while (counts_limit > 0 && counts[counts_limit - 1] == 0) {
+    counts_limit--;
+  }
+  string payload;
+  for (int i = 0; i < counts_limit;) {
+    int64_t count = counts[i++];
+    if (count == 0) {
+      int64_t n_zeros = 1;
+      while (i < counts_limit && counts[i] == 0) {
+        n_zeros++;
+        i++;
+      }
+      if (n_zeros > 1) {
+        PutZigZag(&payload, -n_zeros);
+        continue;
+      }
+    }
+    PutZigZag(&payload, count);
+  }
+
+  string encoding;
+  double conversion_ratio = 1.0;
+  uint64_t conversion_ratio_bits;
+  memcpy(&conversion_ratio_bits, &conversion_ratio, sizeof(conversion_ratio));
+  PutInt32(&encoding, kEncodingCookie);
+  PutInt32(&encoding, payload.size());
+  // The normalizing index offset, which is only used by shifted histograms.
+  PutInt32(&encoding, 0);
+  PutInt32(&encoding, histogram.significant_digits());
+  // The lowest discernible value.
+  PutInt64(&encoding, 1);
+  PutInt64(&encoding, kHistogramHighestTrackableValue);
+  PutInt64(&encoding, conversion_ratio_bits);
+  encoding += payload;
+
+  uLongf compressed_size = compressBound(encoding.size());
+  vector<Bytef> compressed(compressed_size);
+  if (compress(&compressed[0], &compressed_size,
+               reinterpret_cast<const Bytef*>(encoding.data()),
+               encoding.size()) != Z_OK) {
+    LOG_FATAL("Couldn't compress histogram");
+  }
+  string compressed_encoding;
+  PutInt32(&compressed_encoding, kCompressedEncodingCookie);
+  PutInt32(&compressed_encoding, compressed_size);
+  compressed_encoding.append(reinterpret_cast<const char*>(&compressed[0]),
+                             compressed_size);
+  return Base64Encode(compressed_encoding);
+}
+
+// Inflates |compressed| into |data|, whose size isn't known up front.
+static bool Inflate(const string& compressed, string* data) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit(&stream) != Z_OK) {
+    return false;
+  }
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(
+                                              compressed.data()));
+  stream.avail_in = compressed.size();
+  char buffer[16384];
+  int rc;
+  do {
+    stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    stream.avail_out = sizeof(buffer);
+    rc = inflate(&stream, Z_NO_FLUSH);
+    if (rc != Z_OK && rc != Z_STREAM_END) {
+      inflateEnd(&stream);
+      return false;
+    }
+    data->append(buffer, sizeof(buffer) - stream.avail_out);
+  } while (rc != Z_STREAM_END && stream.avail_out == 0);
+  inflateEnd(&stream);
+  return rc == Z_STREAM_END;
+}
+
+Histogram* DecodeHistogram(const string& encoded) {
+  string compressed_encoding;
+  if (!Base64Decode(encoded, &compressed_encoding)
+      || compressed_encoding.size() < 8
+      || (GetInt32(compressed_encoding, 0) & ~kCookieWordSizeMask)
+         != (kCompressedEncodingCookie & ~kCookieWordSizeMask)) {
+    LOG_FATAL("Not a compressed histogram");
+  }
+  uint32_t compressed_size = GetInt32(compressed_encoding, 4);
+  string encoding;
+  if (compressed_size > compressed_encoding.size() - 8
+      || !Inflate(compressed_encoding.substr(8, compressed_size),
+                  &encoding)) {
+    LOG_FATAL("Couldn't decompress histogram");
+  }
+  if (encoding.size() < kEncodingHeaderSize
+      || (GetInt32(encoding, 0) & ~kCookieWordSizeMask)
+         != (kEncodingCookie & ~kCookieWordSizeMask)) {
+    LOG_FATAL("Unsupported histogram encoding");
+  }
+  uint32_t payload_size = GetInt32(encoding, 4);
+  if (payload_size > encoding.size() - kEncodingHeaderSize) {
+    LOG_FATAL("Truncated histogram");
+  }
+  if (GetInt32(encoding, 8) != 0 || GetInt64(encoding, 16) != 1) {
+    LOG_FATAL("Only histograms of unit resolution can be decoded");
+  }
+  Histogram* histogram = new Histogram(GetInt32(encoding, 12));
+  size_t offset = kEncodingHeaderSize;
+  size_t end = kEncodingHeaderSize + payload_size;
+  int index = 0;
+  while (offset < end) {
+    int64_t count = 0;
+    if (!GetZigZag(encoding, end, &offset, &count)) {
+      LOG_FATAL("Truncated histogram");
+    }
+    if (count < 0) {
+      index -= count;
+    } else {
+      if (count > 0) {
+        histogram->AddCount(index, count);
+      }
+      index++;
+    }
+  }
+  return histogram;
+}
+
+void WriteHistogramLogHeader(FILE* file, double start_time) {
+  time_t start_seconds = static_cast<time_t>(start_time);
+  char date[64];
+  strftime(date, sizeof(date), "%a %b %d %H:%M:%S %Z %Y",
+           localtime(&start_seconds));
+  fprintf(file, "#[Logged with cachebash]\n"
+                "#[Histogram log format version 1.3]\n"
+                "#[StartTime: %.3f (seconds since epoch), %s]\n"
+                "#[BaseTime: %.3f (seconds since epoch)]\n"
+                "\"StartTimestamp\",\"Interval_Length\",\"Interval_Max\","
+                "\"Interval_Compressed_Histogram\"\n",
+          start_time, date, start_time);
+}
+
+void WriteHistogramLogEntry(FILE* file, const string& tag, double start_time,
+                            double length, double max,
+                            const string& encoded_histogram) {
+  fprintf(file, "Tag=%s,%.3f,%.3f,%.3f,%s\n", tag.c_str(), start_time,
+          length, max * 1e3, encoded_histogram.c_str());
+}
+
+void MergeHistogramLog(const string& filename, const string& tag_prefix,
+                       MergedHistogramMap* histograms) {
+  FILE* file = fopen(filename.c_str(), "r");
+  if (file == NULL) {
+    LOG_FATAL("Couldn't open histogram log " + filename);
+  }
+  HistogramLogReader reader(file);
+  HistogramLogEntry entry;
+  while (reader.ReadEntry(&entry)) {
+    if (entry.tag.compare(0, tag_prefix.size(), tag_prefix) != 0) {
+      delete entry.histogram;
+      continue;
+    }
+    double end_time = entry.start_time + entry.length;
+    MergedHistogramMap::iterator it = histograms->find(entry.tag);
+    if (it == histograms->end()) {
+      MergedHistogram merged = { entry.histogram, entry.start_time,
+                                 end_time };
+      (*histograms)[entry.tag] = merged;
+      continue;
+    }
+    it->second.histogram->MergeWithHistogram(*entry.histogram);
+    it->second.start_time = std::min(it->second.start_time,
+                                     entry.start_time);
+    it->second.end_time = std::max(it->second.end_time, end_time);
+    delete entry.histogram;
+  }
+  fclose(file);
+}
+
+void DeleteMergedHistograms(MergedHistogramMap* histograms) {
+  for (MergedHistogramMap::iterator it = histograms->begin();
+       it != histograms->end();
+       it++) {
+    delete it->second.histogram;
+  }
+  histograms->clear();
+}
+
+HistogramLogReader::HistogramLogReader(FILE* file)
+    : file_(file),
+      base_time_(0.0) {}
+
+bool HistogramLogReader::ReadEntry(HistogramLogEntry* entry) {
+  char* line = NULL;
+  size_t line_capacity = 0;
+  ssize_t line_size;
+  while ((line_size = getline(&line, &line_capacity, file_)) != -1) {
+    string fields(line, line_size);
+    while (!fields.empty()
+           && (fields[fields.size() - 1] == '\n'
+               || fields[fields.size() - 1] == '\r')) {
+      fields.erase(fields.size() - 1);
+    }
+    double time;
+    if (sscanf(fields.c_str(), "#[StartTime: %lf", &time) == 1) {
+      if (base_time_ == 0.0) {
+        base_time_ = time;
+      }
+      continue;
+    }
+    if (sscanf(fields.c_str(), "#[BaseTime: %lf", &time) == 1) {
+      base_time_ = time;
+      continue;
+    }
+    if (fields.empty() || fields[0] == '#' || fields[0] == '"') {
+      continue;
+    }
+
+    entry->tag.clear();
+    if (fields.compare(0, 4, "Tag=") == 0) {
+      size_t tag_end = fields.find(',');
+      entry->tag = fields.substr(4, tag_end - 4);
+      fields.erase(0, tag_end == string::npos ? fields.size() : tag_end + 1);
+    }
+    double max;
+    int n_consumed = 0;
+    if (sscanf(fields.c_str(), "%lf,%lf,%lf,%n", &entry->start_time,
+               &entry->length, &max, &n_consumed) != 3 || n_consumed == 0) {
+      free(line);
+      LOG_FATAL("Malformed histogram log line: " + fields);
+    }
+    entry->start_time += base_time_;
+    entry->histogram = DecodeHistogram(fields.substr(n_consumed));
+    free(line);
+    return true;
+  }
+  free(line);
+  return false;
+}
+
+}  // namespace cachebash
@@ -0,0 +1,116 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// histogram_log.h
+//
+// Histograms serialized the way HdrHistogram logs them, so that runs and
+// load generator hosts can be merged exactly, and HdrHistogram's own tools
+// can read them. A histogram is encoded in HdrHistogram's compressed V2
+// format (zigzag LEB128 counts with runs of zeros collapsed, deflated with
+// zlib) and then base64. Values are in nanoseconds. A log is
+//   #[Histogram log format version 1.3]
+//   #[StartTime: <seconds since epoch> ...]
+//   #[BaseTime: <seconds since epoch> ...]
+//   "StartTimestamp","Interval_Length","Interval_Max",...
+//   Tag=<statistic>,<start>,<length>,<max>,<encoded histogram>
+//   ...
+// with start times relative to the base time, and maxima in milliseconds.
+//
+
+#ifndef HISTOGRAM_LOG_H_
+#define HISTOGRAM_LOG_H_
+
+#include <stdio.h>
+#include <map>
+#include <string>
+
+#include "cachebash/util.h"
+
+using std::string;
+
+namespace cachebash {
+
+class Histogram;
+
+string Base64Encode(const string& data);
+// Returns false if |encoded| isn't valid base64.
+bool Base64Decode(const string& encoded, string* data);
+
+// Returns the base64 compressed encoding of |histogram|.
+string EncodeHistogram(const Histogram& histogram);
+// Decodes what EncodeHistogram() returns. The caller owns the returned
+// histogram.
+Histogram* DecodeHistogram(const string& encoded);
+
+void WriteHistogramLogHeader(FILE* file, double start_time);
+// |start_time| is in seconds since the log's start time, which is also its
+// base time, and |max| is in seconds.
+void WriteHistogramLogEntry(FILE* file, const string& tag, double start_time,
+                            double length, double max,
+                            const string& encoded_histogram);
+
+struct HistogramLogEntry {
+  string tag;
+  // In seconds since the epoch.
+  double start_time;
+  double length;
+  Histogram* histogram;
+};
+
+// Everything logged under one tag.
+struct MergedHistogram {
+  Histogram* histogram;
+  double start_time;
+  double end_time;
+};
+
+typedef std::map<string, MergedHistogram> MergedHistogramMap;
+
+// Merges the histograms in the log |filename| whose tags start with
+// |tag_prefix| into |histograms|, by tag. The caller owns the histograms.
+void MergeHistogramLog(const string& filename, const string& tag_prefix,
+                       MergedHistogramMap* histograms);
+void DeleteMergedHistograms(MergedHistogramMap* histograms);
+
+class HistogramLogReader {
+ public:
+  // Doesn't take ownership of |file|.
+  explicit HistogramLogReader(FILE* file);
+  // Reads the next histogram, skipping the header. Returns false at the
+  // end of the log. The caller owns |entry->histogram|.
+  bool ReadEntry(HistogramLogEntry* entry);
+
+ private:
+  FILE* file_;
+  double base_time_;
+
+  DISALLOW_COPY_AND_ASSIGN(HistogramLogReader);
+};
+
+}  // namespace cachebash
+
+#endif  // HISTOGRAM_LOG_H_
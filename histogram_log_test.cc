@@ -0,0 +1,123 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+//  histogram_log_test.cc
+//
+
+#include "cachebash/histogram_log.h"
+
+#include <stdio.h>
+#include <string>
+
+#include "cachebash/scoped_ptr.h"
+#include "cachebash/statistic.h"
+#include "gtest/gtest.h"
+
+using cachebash::Base64Decode;
+using cachebash::Base64Encode;
+using cachebash::DecodeHistogram;
+using cachebash::EncodeHistogram;
+using cachebash::Histogram;
+using cachebash::HistogramLogEntry;
+using cachebash::HistogramLogReader;
+
+namespace {
+
+TEST(HistogramLogTest, Base64) {
+  EXPECT_EQ("TWFu", Base64Encode("Man"));
+  EXPECT_EQ("TWE=", Base64Encode("Ma"));
+  EXPECT_EQ("TQ==", Base64Encode("M"));
+  string data;
+  EXPECT_TRUE(Base64Decode("TWFuTWE=", &data));
+  EXPECT_EQ("ManMa", data);
+  string binary("\x00\xff\x10", 3);
+  EXPECT_TRUE(Base64Decode(Base64Encode(binary), &data));
+  EXPECT_EQ(binary, data);
+  EXPECT_FALSE(Base64Decode("TWF", &data));
+  EXPECT_FALSE(Base64Decode("T=Fu", &data));
+}
+
+// Decoding gives back exactly the counts that were encoded, including
+// runs of zeros and counts too large for a single LEB128 byte.
+TEST(HistogramLogTest, EncodeAndDecode) {
+  for (int significant_digits = 1; significant_digits <= 3;
+       significant_digits++) {
+    Histogram histogram(significant_digits);
+    histogram.AddSample(1e-6);
+    histogram.AddSample(2e-3);
+    histogram.AddSample(2e-3);
+    histogram.AddSample(3600);
+    histogram.AddCount(5, 1LL << 40);
+    string encoded = EncodeHistogram(histogram);
+    // What HdrHistogram's compressed V2 cookie looks like in base64.
+    EXPECT_EQ("HISTF", encoded.substr(0, 5));
+
+    scoped_ptr<Histogram> decoded(DecodeHistogram(encoded));
+    EXPECT_EQ(significant_digits, decoded->significant_digits());
+    EXPECT_EQ(histogram.n_samples(), decoded->n_samples());
+    EXPECT_TRUE(histogram.counts() == decoded->counts());
+  }
+
+  Histogram empty_histogram(2);
+  scoped_ptr<Histogram> decoded(DecodeHistogram(
+                                  EncodeHistogram(empty_histogram)));
+  EXPECT_EQ(0, decoded->n_samples());
+}
+
+TEST(HistogramLogTest, WriteAndRead) {
+  Histogram histogram(2);
+  histogram.AddSample(1e-3);
+  histogram.AddSample(5e-3);
+  string encoded = EncodeHistogram(histogram);
+
+  FILE* file = tmpfile();
+  cachebash::WriteHistogramLogHeader(file, 1000.0);
+  cachebash::WriteHistogramLogEntry(file, "latency", 0.0, 1.0, 5e-3, encoded);
+  cachebash::WriteHistogramLogEntry(file, "run/latency", 1.0, 2.5, 5e-3,
+                                    encoded);
+  rewind(file);
+
+  HistogramLogReader reader(file);
+  HistogramLogEntry entry;
+  ASSERT_TRUE(reader.ReadEntry(&entry));
+  scoped_ptr<Histogram> first_histogram(entry.histogram);
+  EXPECT_EQ("latency", entry.tag);
+  EXPECT_EQ(1000.0, entry.start_time);
+  EXPECT_EQ(1.0, entry.length);
+  EXPECT_TRUE(histogram.counts() == first_histogram->counts());
+
+  ASSERT_TRUE(reader.ReadEntry(&entry));
+  scoped_ptr<Histogram> second_histogram(entry.histogram);
+  EXPECT_EQ("run/latency", entry.tag);
+  EXPECT_EQ(1001.0, entry.start_time);
+  EXPECT_EQ(2.5, entry.length);
+
+  EXPECT_FALSE(reader.ReadEntry(&entry));
+  fclose(file);
+}
+
+}  // namespace
@@ -0,0 +1,329 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// interval_writer.cc
+//
+
+#include "cachebash/interval_writer.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "cachebash/histogram_log.h"
+#include "cachebash/statistic.h"
+
+namespace cachebash {
+
+IntervalWriter::IntervalWriter(IntervalFormat format, FILE* file)
+    : format_(format),
+      file_(file),
+      header_written_(false),
+      base_time_(0.0),
+      started_(false),
+      stopping_(false) {
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&records_available_, NULL);
+}
+
+IntervalWriter::~IntervalWriter() {
+  Stop();
+  fclose(file_);
+  pthread_cond_destroy(&records_available_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+IntervalWriter* IntervalWriter::Parse(const string& specification) {
+  size_t colon = specification.find(':');
+  if (colon == string::npos) {
+    LOG_FATAL("Interval output must be csv:FILE, jsonl:FILE, binary:FILE "
+              "or hlog:FILE");
+  }
+  string format_name = specification.substr(0, colon);
+  string filename = specification.substr(colon + 1);
+  IntervalFormat format = kCsvIntervalFormat;
+  if (format_name == "csv") {
+    format = kCsvIntervalFormat;
+  } else if (format_name == "jsonl") {
+    format = kJsonLinesIntervalFormat;
+  } else if (format_name == "binary") {
+    format = kBinaryIntervalFormat;
+  } else if (format_name == "hlog") {
+    format = kHistogramLogIntervalFormat;
+  } else {
+    LOG_FATAL("Unknown interval output format: " + format_name);
+  }
+  FILE* file = fopen(filename.c_str(), format == kBinaryIntervalFormat ? "wb"
+                                                                       : "w");
+  if (file == NULL) {
+    LOG_FATAL("Couldn't open interval output " + filename);
+  }
+  return new IntervalWriter(format, file);
+}
+
+// Statistics without samples this interval are left out.
+IntervalRecord* IntervalWriter::NewIntervalRecord(
+                  StatisticsCollection* collection,
+                  const struct timeval& start_time,
+                  const struct timeval& end_time,
+                  bool encode_histograms) {
+  IntervalRecord* record = new IntervalRecord();
+  record->start_time = start_time.tv_sec + start_time.tv_usec * 1e-6;
+  record->end_time = end_time.tv_sec + end_time.tv_usec * 1e-6;
+  double duration = record->end_time - record->start_time;
+  vector<float> quantiles(kRecordedQuantiles,
+                          kRecordedQuantiles + kNumRecordedQuantiles);
+  for (StatisticId id = 0; id < collection->n_statistics(); id++) {
+    Statistic* statistic = collection->GetStatistic(id);
+    if (statistic->GetCount() == 0) {
+      continue;
+    }
+    record->statistics.push_back(StatisticRecord());
+    StatisticRecord* statistic_record = &record->statistics.back();
+    statistic_record->name = statistic->GetName();
+    statistic_record->count = statistic->GetCount();
+    statistic_record->throughput = duration > 0.0
+                                   ? statistic_record->count / duration
+                                   : 0.0;
+    statistic_record->average = statistic->GetAverage();
+    statistic_record->standard_deviation = statistic->GetStandardDeviation();
+    statistic_record->min = statistic->GetMin();
+    statistic_record->max = statistic->GetMax();
+    statistic->GetQuantiles(quantiles, &statistic_record->quantile_values);
+    // Sketches have no HdrHistogram encoding.
+    if (encode_histograms && statistic->backend() == kHistogramBackend) {
+      statistic_record->encoded_histogram
+        = EncodeHistogram(statistic->histogram());
+    }
+  }
+  return record;
+}
+
+void IntervalWriter::Start() {
+  started_ = true;
+  int rc = pthread_create(&thread_, NULL, WriterLoopHook, this);
+  if (rc) {
+    LOG_FATAL("Interval writer thread failed to start");
+  }
+}
+
+void IntervalWriter::Stop() {
+  if (!started_) {
+    return;
+  }
+  pthread_mutex_lock(&mutex_);
+  stopping_ = true;
+  pthread_cond_signal(&records_available_);
+  pthread_mutex_unlock(&mutex_);
+  pthread_join(thread_, NULL);
+  started_ = false;
+}
+
+void IntervalWriter::Write(IntervalRecord* record) {
+  pthread_mutex_lock(&mutex_);
+  records_.push_back(record);
+  pthread_cond_signal(&records_available_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+// Records are taken off the queue one at a time, and written with the
+// lock released.
+void IntervalWriter::WriterLoop() {
+  while (true) {
+    pthread_mutex_lock(&mutex_);
+    while (records_.empty() && !stopping_) {
+      pthread_cond_wait(&records_available_, &mutex_);
+    }
+    if (records_.empty()) {
+      pthread_mutex_unlock(&mutex_);
+      return;
+    }
+    IntervalRecord* record = records_.front();
+    records_.pop_front();
+    pthread_mutex_unlock(&mutex_);
+
+    WriteRecord(*record);
+    delete record;
+  }
+}
+
+void IntervalWriter::WriteRecord(const IntervalRecord& record) {
+  if (!header_written_) {
+    WriteHeader(record);
+    header_written_ = true;
+  }
+  switch (format_) {
+    case kCsvIntervalFormat:
+      WriteCsv(record);
+      break;
+    case kJsonLinesIntervalFormat:
+      WriteJsonLines(record);
+      break;
+    case kBinaryIntervalFormat:
+      WriteBinary(record);
+      break;
+    case kHistogramLogIntervalFormat:
+      WriteHistogramLog(record);
+      break;
+  }
+  // Readers tailing the output see every interval as soon as it's written.
+  if (fflush(file_) != 0) {
+    LOG_FATAL("Couldn't write interval output");
+  }
+}
+
+void IntervalWriter::WriteHeader(const IntervalRecord& record) {
+  if (format_ == kCsvIntervalFormat) {
+    fprintf(file_, "start_time,end_time,statistic,count,throughput,"
+                   "average,standard_deviation,min,max");
+    for (int i = 0; i < kNumRecordedQuantiles; i++) {
+      fprintf(file_, ",p%g", kRecordedQuantiles[i] * 100.0);
+    }
+    fprintf(file_, "\n");
+  } else if (format_ == kBinaryIntervalFormat) {
+    uint32_t n_quantiles = kNumRecordedQuantiles;
+    fwrite("CBIV", 1, 4, file_);
+    fwrite(&kIntervalLogVersion, sizeof(kIntervalLogVersion), 1, file_);
+    fwrite(&n_quantiles, sizeof(n_quantiles), 1, file_);
+    fwrite(kRecordedQuantiles, sizeof(kRecordedQuantiles[0]),
+           kNumRecordedQuantiles, file_);
+  } else if (format_ == kHistogramLogIntervalFormat) {
+    base_time_ = record.start_time;
+    WriteHistogramLogHeader(file_, base_time_);
+  }
+}
+
+void IntervalWriter::WriteCsv(const IntervalRecord& record) {
+  for (vector<StatisticRecord>::const_iterator it = record.statistics.begin();
+       it != record.statistics.end();
+       it++) {
+    fprintf(file_, "%.6f,%.6f,%s,%lld,%.3f,%.9g,%.9g,%.9g,%.9g",
+            record.start_time, record.end_time, it->name.c_str(),
+            static_cast<long long>(it->count), it->throughput,
+            it->average, it->standard_deviation, it->min, it->max);
+    for (int i = 0; i < kNumRecordedQuantiles; i++) {
+      fprintf(file_, ",%.9g", it->quantile_values[i]);
+    }
+    fprintf(file_, "\n");
+  }
+}
+
+// JSON has no representation of NaN or infinity.
+static void WriteJsonNumber(FILE* file, double value) {
+  if (isfinite(value)) {
+    fprintf(file, "%.9g", value);
+  } else {
+    fprintf(file, "null");
+  }
+}
+
+// Statistic names are server addresses and plain identifiers, so only
+// quotes and backslashes need escaping.
+static void WriteJsonString(FILE* file, const string& value) {
+  fputc('"', file);
+  for (size_t i = 0; i < value.size(); i++) {
+    if (value[i] == '"' || value[i] == '\\') {
+      fputc('\\', file);
+    }
+    fputc(value[i], file);
+  }
+  fputc('"', file);
+}
+
+void IntervalWriter::WriteJsonLines(const IntervalRecord& record) {
+  fprintf(file_, "{\"start_time\":%.6f,\"end_time\":%.6f,\"statistics\":{",
+          record.start_time, record.end_time);
+  for (vector<StatisticRecord>::const_iterator it = record.statistics.begin();
+       it != record.statistics.end();
+       it++) {
+    if (it != record.statistics.begin()) {
+      fputc(',', file_);
+    }
+    WriteJsonString(file_, it->name);
+    fprintf(file_, ":{\"count\":%lld,\"throughput\":",
+            static_cast<long long>(it->count));
+    WriteJsonNumber(file_, it->throughput);
+    fprintf(file_, ",\"average\":");
+    WriteJsonNumber(file_, it->average);
+    fprintf(file_, ",\"standard_deviation\":");
+    WriteJsonNumber(file_, it->standard_deviation);
+    fprintf(file_, ",\"min\":");
+    WriteJsonNumber(file_, it->min);
+    fprintf(file_, ",\"max\":");
+    WriteJsonNumber(file_, it->max);
+    fprintf(file_, ",\"quantiles\":{");
+    for (int i = 0; i < kNumRecordedQuantiles; i++) {
+      fprintf(file_, "%s\"%g\":", i == 0 ? "" : ",", kRecordedQuantiles[i]);
+      WriteJsonNumber(file_, it->quantile_values[i]);
+    }
+    fprintf(file_, "}}");
+  }
+  fprintf(file_, "}}\n");
+}
+
+void IntervalWriter::WriteBinary(const IntervalRecord& record) {
+  uint32_t n_statistics = record.statistics.size();
+  fwrite(&record.start_time, sizeof(record.start_time), 1, file_);
+  fwrite(&record.end_time, sizeof(record.end_time), 1, file_);
+  fwrite(&n_statistics, sizeof(n_statistics), 1, file_);
+  for (vector<StatisticRecord>::const_iterator it = record.statistics.begin();
+       it != record.statistics.end();
+       it++) {
+    uint16_t name_length = it->name.size();
+    fwrite(&name_length, sizeof(name_length), 1, file_);
+    fwrite(it->name.data(), 1, name_length, file_);
+    fwrite(&it->count, sizeof(it->count), 1, file_);
+    fwrite(&it->throughput, sizeof(it->throughput), 1, file_);
+    float moments[] = { it->average, it->standard_deviation, it->min,
+                        it->max };
+    fwrite(moments, sizeof(moments[0]), 4, file_);
+    fwrite(&it->quantile_values[0], sizeof(float), kNumRecordedQuantiles,
+           file_);
+  }
+}
+
+// Statistics that only recorded negative samples have empty histograms,
+// which aren't worth logging.
+void IntervalWriter::WriteHistogramLog(const IntervalRecord& record) {
+  for (vector<StatisticRecord>::const_iterator it = record.statistics.begin();
+       it != record.statistics.end();
+       it++) {
+    if (it->encoded_histogram.empty() || it->max < 0.0) {
+      continue;
+    }
+    WriteHistogramLogEntry(file_, it->name, record.start_time - base_time_,
+                           record.end_time - record.start_time, it->max,
+                           it->encoded_histogram);
+  }
+}
+
+void* WriterLoopHook(void* arg) {
+  IntervalWriter* interval_writer = static_cast<IntervalWriter*>(arg);
+  interval_writer->WriterLoop();
+  return NULL;
+}
+
+}  // namespace cachebash
@@ -0,0 +1,166 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// interval_writer.h
+//
+// Machine-readable output of every stats interval. Each interval becomes
+// one record holding, for every statistic with samples, its count,
+// throughput, moments, extremes and kRecordedQuantiles. Records are
+// formatted and written by a separate thread, so a slow disk never holds
+// up the stats loop. The output is described on the command line as
+//   csv:<file>     one row per statistic per interval, after a header row
+//   jsonl:<file>   one JSON object per interval
+//   binary:<file>  the compact log below
+//   hlog:<file>    an HdrHistogram log of every statistic's histogram (see
+//                  histogram_log.h), which cachebash-merge can combine
+//                  across runs and hosts
+//
+// The binary log is in the machine's byte order. It starts with
+//   char magic[4] = "CBIV", uint32 version, uint32 n_quantiles,
+//   float quantiles[n_quantiles]
+// and each interval is then
+//   double start_time, double end_time, uint32 n_statistics,
+// followed by n_statistics of
+//   uint16 name_length, char name[name_length], int64 count,
+//   double throughput, float average, float standard_deviation,
+//   float min, float max, float quantile_values[n_quantiles]
+// Times are in seconds since the epoch.
+//
+
+#ifndef INTERVAL_WRITER_H_
+#define INTERVAL_WRITER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "cachebash/util.h"
+
+using std::string;
+using std::vector;
+
+namespace cachebash {
+
+static const float kRecordedQuantiles[] = { 0.5, 0.9, 0.95, 0.99, 0.999,
+                                            0.9999 };
+static const int kNumRecordedQuantiles = 6;
+static const uint32_t kIntervalLogVersion = 1;
+
+enum IntervalFormat {
+  kCsvIntervalFormat,
+  kJsonLinesIntervalFormat,
+  kBinaryIntervalFormat,
+  kHistogramLogIntervalFormat
+};
+
+class StatisticsCollection;
+
+// A statistic's summary over one interval.
+struct StatisticRecord {
+  string name;
+  int64_t count;
+  // Samples per second.
+  double throughput;
+  float average;
+  float standard_deviation;
+  float min;
+  float max;
+  // Indexed like kRecordedQuantiles.
+  vector<float> quantile_values;
+  // The statistic's histogram, encoded by EncodeHistogram(), if asked for
+  // and the statistic keeps one.
+  string encoded_histogram;
+};
+
+struct IntervalRecord {
+  double start_time;
+  double end_time;
+  vector<StatisticRecord> statistics;
+};
+
+class IntervalWriter {
+ public:
+  // Takes ownership of |file|.
+  IntervalWriter(IntervalFormat format, FILE* file);
+  // Writes out every record still queued first.
+  ~IntervalWriter();
+  // Opens the output described by |specification|. The caller owns the
+  // returned writer.
+  static IntervalWriter* Parse(const string& specification);
+  // Summarizes the statistics of |collection| over an interval, encoding
+  // their histograms if |encode_histograms|. The caller owns the returned
+  // record.
+  static IntervalRecord* NewIntervalRecord(StatisticsCollection* collection,
+                                           const struct timeval& start_time,
+                                           const struct timeval& end_time,
+                                           bool encode_histograms);
+  IntervalFormat format() const { return format_; }
+  void Start();
+  // Writes out every record still queued and stops the writer thread.
+  void Stop();
+  // Queues |record| to be written and takes ownership of it. Never waits
+  // on the output.
+  void Write(IntervalRecord* record);
+  // Formats |record| to the output. Only the writer thread, or a writer
+  // that was never started, calls this.
+  void WriteRecord(const IntervalRecord& record);
+  void WriterLoop();
+
+ private:
+  void WriteBinary(const IntervalRecord& record);
+  void WriteCsv(const IntervalRecord& record);
+  void WriteHeader(const IntervalRecord& record);
+  void WriteHistogramLog(const IntervalRecord& record);
+  void WriteJsonLines(const IntervalRecord& record);
+
+  IntervalFormat format_;
+  FILE* file_;
+  bool header_written_;
+  // What the times in a histogram log are relative to.
+  double base_time_;
+  // Records waiting for the writer thread, guarded by |mutex_|.
+  std::deque<IntervalRecord*> records_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t records_available_;
+  bool started_;
+  bool stopping_;
+  pthread_t thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(IntervalWriter);
+};
+
+// Interfaces between pthread's thread creation callback and the writer
+// thread's loop.
+void* WriterLoopHook(void* arg);
+
+}  // namespace cachebash
+
+#endif  // INTERVAL_WRITER_H_
@@ -0,0 +1,193 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+//  interval_writer_test.cc
+//
+
+#include "cachebash/interval_writer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "cachebash/histogram_log.h"
+#include "cachebash/scoped_ptr.h"
+#include "cachebash/statistic.h"
+#include "gtest/gtest.h"
+
+using cachebash::Histogram;
+using cachebash::IntervalRecord;
+using cachebash::IntervalWriter;
+using cachebash::StatisticRecord;
+using cachebash::StatisticsCollection;
+
+namespace {
+
+// An interval holding one latency statistic.
+IntervalRecord* NewLatencyRecord(double start_time) {
+  IntervalRecord* record = new IntervalRecord();
+  record->start_time = start_time;
+  record->end_time = start_time + 1.0;
+  StatisticRecord statistic;
+  statistic.name = "latency";
+  statistic.count = 100;
+  statistic.throughput = 100.0;
+  statistic.average = 0.5;
+  statistic.standard_deviation = 0.25;
+  statistic.min = 0.125;
+  statistic.max = 2.0;
+  statistic.quantile_values.assign(cachebash::kNumRecordedQuantiles, 1.0);
+  record->statistics.push_back(statistic);
+  return record;
+}
+
+// Everything written to |file| so far.
+string ReadFile(FILE* file) {
+  string contents;
+  char buffer[4096];
+  rewind(file);
+  size_t n_read;
+  while ((n_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    contents.append(buffer, n_read);
+  }
+  return contents;
+}
+
+TEST(IntervalWriterTest, Csv) {
+  FILE* file = tmpfile();
+  IntervalWriter writer(cachebash::kCsvIntervalFormat, file);
+  scoped_ptr<IntervalRecord> record(NewLatencyRecord(10.0));
+  writer.WriteRecord(*record.Get());
+  EXPECT_EQ("start_time,end_time,statistic,count,throughput,average,"
+            "standard_deviation,min,max,p50,p90,p95,p99,p99.9,p99.99\n"
+            "10.000000,11.000000,latency,100,100.000,0.5,0.25,0.125,2,"
+            "1,1,1,1,1,1\n", ReadFile(file));
+}
+
+TEST(IntervalWriterTest, JsonLines) {
+  FILE* file = tmpfile();
+  IntervalWriter writer(cachebash::kJsonLinesIntervalFormat, file);
+  scoped_ptr<IntervalRecord> record(NewLatencyRecord(10.0));
+  writer.WriteRecord(*record.Get());
+  EXPECT_EQ("{\"start_time\":10.000000,\"end_time\":11.000000,"
+            "\"statistics\":{\"latency\":{\"count\":100,\"throughput\":100,"
+            "\"average\":0.5,\"standard_deviation\":0.25,\"min\":0.125,"
+            "\"max\":2,\"quantiles\":{\"0.5\":1,\"0.9\":1,\"0.95\":1,"
+            "\"0.99\":1,\"0.999\":1,\"0.9999\":1}}}}\n", ReadFile(file));
+}
+
+TEST(IntervalWriterTest, Binary) {
+  FILE* file = tmpfile();
+  IntervalWriter writer(cachebash::kBinaryIntervalFormat, file);
+  scoped_ptr<IntervalRecord> record(NewLatencyRecord(10.0));
+  writer.WriteRecord(*record.Get());
+  string contents = ReadFile(file);
+
+  size_t header_size = 4 + 4 + 4 + 4 * cachebash::kNumRecordedQuantiles;
+  size_t statistic_size = 2 + strlen("latency") + 8 + 8 + 4 * 4
+                          + 4 * cachebash::kNumRecordedQuantiles;
+  ASSERT_EQ(header_size + 8 + 8 + 4 + statistic_size, contents.size());
+  EXPECT_EQ("CBIV", contents.substr(0, 4));
+  double start_time;
+  memcpy(&start_time, contents.data() + header_size, sizeof(start_time));
+  EXPECT_EQ(10.0, start_time);
+  EXPECT_EQ("latency", contents.substr(header_size + 8 + 8 + 4 + 2, 7));
+}
+
+TEST(IntervalWriterTest, HistogramLog) {
+  FILE* file = tmpfile();
+  IntervalWriter writer(cachebash::kHistogramLogIntervalFormat, file);
+  Histogram histogram(2);
+  histogram.AddSample(0.5);
+  for (int i = 0; i < 2; i++) {
+    scoped_ptr<IntervalRecord> record(NewLatencyRecord(10.0 + i));
+    record->statistics[0].encoded_histogram
+      = cachebash::EncodeHistogram(histogram);
+    writer.WriteRecord(*record.Get());
+  }
+  rewind(file);
+
+  // Times are relative to the first interval.
+  cachebash::HistogramLogReader reader(file);
+  cachebash::HistogramLogEntry entry;
+  for (int i = 0; i < 2; i++) {
+    ASSERT_TRUE(reader.ReadEntry(&entry));
+    scoped_ptr<Histogram> logged_histogram(entry.histogram);
+    EXPECT_EQ("latency", entry.tag);
+    EXPECT_EQ(10.0 + i, entry.start_time);
+    EXPECT_EQ(1, logged_histogram->n_samples());
+  }
+  EXPECT_FALSE(reader.ReadEntry(&entry));
+}
+
+// Records queued with Write() are all written by the time the writer
+// stops.
+TEST(IntervalWriterTest, WriterThread) {
+  FILE* file = tmpfile();
+  IntervalWriter writer(cachebash::kJsonLinesIntervalFormat, file);
+  writer.Start();
+  for (int i = 0; i < 10; i++) {
+    writer.Write(NewLatencyRecord(i));
+  }
+  writer.Stop();
+  string contents = ReadFile(file);
+  int n_lines = 0;
+  for (size_t i = 0; i < contents.size(); i++) {
+    n_lines += contents[i] == '\n' ? 1 : 0;
+  }
+  EXPECT_EQ(10, n_lines);
+}
+
+TEST(IntervalWriterTest, NewIntervalRecord) {
+  StatisticsCollection collection(NULL);
+  collection.RegisterStandardStatistics();
+  for (int i = 1; i <= 100; i++) {
+    collection.AddSample(cachebash::kLatencyStatistic, i * 1e-3);
+  }
+  struct timeval start_time = { 10, 0 };
+  struct timeval end_time = { 12, 0 };
+  scoped_ptr<IntervalRecord> record(IntervalWriter::NewIntervalRecord(
+                                      &collection, start_time, end_time,
+                                      true));
+  // Statistics without samples are left out.
+  ASSERT_EQ(1u, record->statistics.size());
+  const StatisticRecord& latency = record->statistics[0];
+  EXPECT_EQ("latency", latency.name);
+  EXPECT_EQ(100, latency.count);
+  EXPECT_EQ(50.0, latency.throughput);
+  EXPECT_NEAR(0.0505, latency.average, 1e-6);
+  EXPECT_NEAR(0.001, latency.min, 1e-6);
+  EXPECT_NEAR(0.1, latency.max, 1e-6);
+  ASSERT_EQ(cachebash::kNumRecordedQuantiles,
+            static_cast<int>(latency.quantile_values.size()));
+  EXPECT_NEAR(0.05, latency.quantile_values[0], 1e-3);
+  scoped_ptr<Histogram> histogram(cachebash::DecodeHistogram(
+                                    latency.encoded_histogram));
+  EXPECT_EQ(100, histogram->n_samples());
+}
+
+}  // namespace
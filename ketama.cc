@@ -0,0 +1,139 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// ketama.cc
+//
+
+#include "cachebash/ketama.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include "cachebash/config.h"
+#include "cachebash/md5.h"
+
+namespace cachebash {
+
+namespace {
+
+bool ContinuumPointLess(const ContinuumPoint& a, const ContinuumPoint& b) {
+  return a.hash < b.hash;
+}
+
+// Extracts the |h|th little-endian 32 bit word from an md5 digest.
+uint32_t DigestWord(const unsigned char digest[kMd5DigestSize], int h) {
+  return (static_cast<uint32_t>(digest[3 + h * 4]) << 24)
+         | (static_cast<uint32_t>(digest[2 + h * 4]) << 16)
+         | (static_cast<uint32_t>(digest[1 + h * 4]) << 8)
+         | static_cast<uint32_t>(digest[h * 4]);
+}
+
+}  // namespace
+
+KetamaContinuum::KetamaContinuum(const vector<Server>& servers)
+    : n_servers_(servers.size()) {
+  if (servers.empty()) {
+    LOG_FATAL("Can't build a ketama continuum without any servers");
+  }
+  int total_weight = 0;
+  for (int i = 0; i < n_servers_; i++) {
+    total_weight += servers[i].weight;
+  }
+
+  for (int i = 0; i < n_servers_; i++) {
+    float fraction = static_cast<float>(servers[i].weight) / total_weight;
+    int n_digests = static_cast<int>(
+        floorf(fraction * kKetamaDigestsPerServer * n_servers_));
+    for (int k = 0; k < n_digests; k++) {
+      char point_name[512];
+      snprintf(point_name, sizeof(point_name), "%s-%d",
+               servers[i].GetName().c_str(), k);
+      unsigned char digest[kMd5DigestSize];
+      Md5Digest(string(point_name), digest);
+      for (int h = 0; h < 4; h++) {
+        ContinuumPoint point;
+        point.hash = DigestWord(digest, h);
+        point.server_index = i;
+        points_.push_back(point);
+      }
+    }
+  }
+  if (points_.empty()) {
+    LOG_FATAL("Server weights left the ketama continuum empty");
+  }
+  std::sort(points_.begin(), points_.end(), ContinuumPointLess);
+}
+
+// Returns the index (into the server list the continuum was built from)
+// of the server that owns |key|.
+int KetamaContinuum::GetServerIndex(const string& key) const {
+  if (n_servers_ == 1) {
+    return 0;
+  }
+  return points_[FindPoint(HashKey(key))].server_index;
+}
+
+// Returns the server that would own |key| if its owner were removed from
+// the pool, i.e. the next distinct server along the continuum. With a
+// single server this is the owner itself.
+int KetamaContinuum::GetReplicaServerIndex(const string& key) const {
+  if (n_servers_ == 1) {
+    return 0;
+  }
+  int point = FindPoint(HashKey(key));
+  int owner = points_[point].server_index;
+  for (int i = 1; i < n_points(); i++) {
+    int server_index = points_[(point + i) % n_points()].server_index;
+    if (server_index != owner) {
+      return server_index;
+    }
+  }
+  return owner;
+}
+
+uint32_t KetamaContinuum::HashKey(const string& key) {
+  unsigned char digest[kMd5DigestSize];
+  Md5Digest(key, digest);
+  return DigestWord(digest, 0);
+}
+
+// Finds the first point at or after |hash|, wrapping around the continuum.
+int KetamaContinuum::FindPoint(uint32_t hash) const {
+  ContinuumPoint target;
+  target.hash = hash;
+  target.server_index = 0;
+  vector<ContinuumPoint>::const_iterator it
+    = std::lower_bound(points_.begin(), points_.end(), target,
+                       ContinuumPointLess);
+  if (it == points_.end()) {
+    return 0;
+  }
+  return it - points_.begin();
+}
+
+}  // namespace cachebash
@@ -0,0 +1,80 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// ketama.h
+//
+// Maps keys onto a weighted set of servers using ketama consistent hashing.
+// The continuum is built the same way as libketama so that a key lands on
+// the same server here as it does with production clients.
+//
+
+#ifndef KETAMA_H_
+#define KETAMA_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "cachebash/util.h"
+
+using std::string;
+using std::vector;
+
+namespace cachebash {
+
+struct Server;
+
+// Number of md5 digests computed per server for an evenly weighted pool.
+// Each digest contributes four points to the continuum.
+static const int kKetamaDigestsPerServer = 40;
+
+struct ContinuumPoint {
+  uint32_t hash;
+  int server_index;
+};
+
+class KetamaContinuum {
+ public:
+  explicit KetamaContinuum(const vector<Server>& servers);
+  int GetReplicaServerIndex(const string& key) const;
+  int GetServerIndex(const string& key) const;
+  static uint32_t HashKey(const string& key);
+  int n_points() const { return points_.size(); }
+  int n_servers() const { return n_servers_; }
+
+ private:
+  int FindPoint(uint32_t hash) const;
+
+  vector<ContinuumPoint> points_;
+  int n_servers_;
+
+  DISALLOW_COPY_AND_ASSIGN(KetamaContinuum);
+};
+
+}  // namespace cachebash
+
+#endif  // KETAMA_H_
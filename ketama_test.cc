@@ -0,0 +1,140 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+//  ketama_test.cc
+//
+
+#include "cachebash/ketama.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "cachebash/config.h"
+#include "cachebash/md5.h"
+#include "gtest/gtest.h"
+
+using cachebash::KetamaContinuum;
+using cachebash::Md5Digest;
+using cachebash::Server;
+using cachebash::kMd5DigestSize;
+using std::string;
+using std::vector;
+
+namespace {
+
+string Md5Hex(const string& data) {
+  unsigned char digest[kMd5DigestSize];
+  Md5Digest(data, digest);
+  char hex[2 * kMd5DigestSize + 1];
+  for (int i = 0; i < kMd5DigestSize; i++) {
+    snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+  }
+  return string(hex);
+}
+
+Server MakeServer(string hostname, int port, int weight) {
+  Server server;
+  server.hostname = hostname;
+  server.ip_address = hostname;
+  server.port = port;
+  server.weight = weight;
+  return server;
+}
+
+string MakeKey(int i) {
+  char key[32];
+  snprintf(key, sizeof(key), "key:%d", i);
+  return string(key);
+}
+
+// Test vectors from RFC 1321.
+TEST(Md5Test, Digest) {
+  EXPECT_EQ("d41d8cd98f00b204e9800998ecf8427e", Md5Hex(""));
+  EXPECT_EQ("0cc175b9c0f1b6a831c399e269772661", Md5Hex("a"));
+  EXPECT_EQ("900150983cd24fb0d6963f7d28e17f72", Md5Hex("abc"));
+  EXPECT_EQ("f96b697d7cb7938d525a2f31aaf161d0", Md5Hex("message digest"));
+  EXPECT_EQ("57edf4a22be3c955ac49da2e2107b67a",
+            Md5Hex("1234567890123456789012345678901234567890"
+                   "1234567890123456789012345678901234567890"));
+}
+
+TEST(KetamaContinuumTest, SingleServer) {
+  vector<Server> servers;
+  servers.push_back(MakeServer("10.0.0.1", 11211, 1));
+  KetamaContinuum continuum(servers);
+  EXPECT_EQ(160, continuum.n_points());
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(0, continuum.GetServerIndex(MakeKey(i)));
+  }
+}
+
+// Keys should be spread over the servers in proportion to their weights.
+TEST(KetamaContinuumTest, Weights) {
+  vector<Server> servers;
+  servers.push_back(MakeServer("10.0.0.1", 11211, 1));
+  servers.push_back(MakeServer("10.0.0.2", 11211, 1));
+  servers.push_back(MakeServer("10.0.0.3", 11211, 2));
+  KetamaContinuum continuum(servers);
+  EXPECT_EQ(3, continuum.n_servers());
+
+  const int kKeys = 100000;
+  int counts[3] = { 0, 0, 0 };
+  for (int i = 0; i < kKeys; i++) {
+    counts[continuum.GetServerIndex(MakeKey(i))]++;
+  }
+  EXPECT_NEAR(0.25, counts[0] / static_cast<float>(kKeys), 0.05);
+  EXPECT_NEAR(0.25, counts[1] / static_cast<float>(kKeys), 0.05);
+  EXPECT_NEAR(0.50, counts[2] / static_cast<float>(kKeys), 0.05);
+}
+
+// Adding a server should only move keys onto the new server.
+TEST(KetamaContinuumTest, Consistency) {
+  vector<Server> servers;
+  for (int i = 0; i < 4; i++) {
+    char hostname[32];
+    snprintf(hostname, sizeof(hostname), "10.0.0.%d", i + 1);
+    servers.push_back(MakeServer(hostname, 11211, 1));
+  }
+  KetamaContinuum before(servers);
+  servers.push_back(MakeServer("10.0.0.5", 11211, 1));
+  KetamaContinuum after(servers);
+
+  const int kKeys = 10000;
+  int n_moved = 0;
+  for (int i = 0; i < kKeys; i++) {
+    int old_index = before.GetServerIndex(MakeKey(i));
+    int new_index = after.GetServerIndex(MakeKey(i));
+    if (old_index != new_index) {
+      EXPECT_EQ(4, new_index);
+      n_moved++;
+    }
+  }
+  EXPECT_NEAR(0.2, n_moved / static_cast<float>(kKeys), 0.05);
+}
+
+}  // namespace
@@ -0,0 +1,207 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// latency_breakdown.cc
+//
+
+#include "cachebash/latency_breakdown.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "cachebash/config.h"
+#include "cachebash/generator.h"
+#include "cachebash/request.h"
+#include "cachebash/size_key_distribution.h"
+
+namespace cachebash {
+
+static const char* kBreakdownOpcodeNames[kNumBreakdownOpcodes] = {
+  "get", "set", "add", "replace", "touch"
+};
+
+int GetBreakdownOpcode(char op_code) {
+  switch (op_code) {
+    case OPCODE_GET:
+      return kGetBreakdownOpcode;
+    case OPCODE_SET:
+      return kSetBreakdownOpcode;
+    case OPCODE_ADD:
+      return kAddBreakdownOpcode;
+    case OPCODE_REP:
+      return kReplaceBreakdownOpcode;
+    case OPCODE_TOUCH:
+      return kTouchBreakdownOpcode;
+    default:
+      return -1;
+  }
+}
+
+int GetValueSizeBucket(int value_size) {
+  int bucket = 0;
+  while (value_size > 1 && bucket < kNumValueSizeBuckets - 1) {
+    value_size >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+string GetBreakdownStatisticName(const Server& server, int opcode,
+                                 int value_size_bucket) {
+  char name[64];
+  snprintf(name, sizeof(name), "latency/%s/size_2^%02d",
+           kBreakdownOpcodeNames[opcode], value_size_bucket);
+  return server.GetStatisticName(name);
+}
+
+string GetConnectionStatisticName(const Server& server, int worker_index,
+                                  int connection_index) {
+  char name[64];
+  snprintf(name, sizeof(name), "latency/worker_%02d/connection_%02d",
+           worker_index, connection_index);
+  return server.GetStatisticName(name);
+}
+
+// Marks which value size buckets requests of each opcode can fall in.
+// Sizes come from the size/key distribution, or are MAX_VALUE_SIZE
+// without one, and the multiget shards' GETs don't know their sizes so
+// use MAX_VALUE_SIZE too. Stored values are random strings up to the
+// size, so may be any smaller. TOUCHes carry no value.
+static void GetPossibleBuckets(const Config& config,
+                               vector<vector<bool> >* possible) {
+  possible->assign(kNumBreakdownOpcodes,
+                   vector<bool>(kNumValueSizeBuckets, false));
+  int max_bucket = GetValueSizeBucket(MAX_VALUE_SIZE);
+  if (config.size_key_distribution_ != NULL) {
+    if (config.fraction_multiget_ <= 0) {
+      max_bucket = 0;
+    }
+    SizeKeyEntry** entries = config.size_key_distribution_->size_key_entries();
+    for (int i = 0; i < config.size_key_distribution_->n_entries(); i++) {
+      max_bucket = std::max(max_bucket, GetValueSizeBucket(entries[i]->size));
+    }
+  }
+  vector<bool> value_buckets(kNumValueSizeBuckets, false);
+  for (int i = 0; i <= max_bucket; i++) {
+    value_buckets[i] = true;
+  }
+
+  (*possible)[kGetBreakdownOpcode] = value_buckets;
+  (*possible)[kSetBreakdownOpcode] = value_buckets;
+  if (config.fraction_adds_ > 0) {
+    (*possible)[kAddBreakdownOpcode] = value_buckets;
+  }
+  if (config.fraction_replaces_ > 0) {
+    (*possible)[kReplaceBreakdownOpcode] = value_buckets;
+  }
+  if (config.fraction_touches_ > 0) {
+    (*possible)[kTouchBreakdownOpcode][0] = true;
+  }
+}
+
+LatencyBreakdown::LatencyBreakdown(const Config& config,
+                                   const StatisticsCollection& collection,
+                                   int worker_index) {
+  if (config.latency_breakdown_) {
+    for (size_t i = 0; i < config.servers_.size(); i++) {
+      for (int j = 0; j < kNumBreakdownOpcodes; j++) {
+        for (int k = 0; k < kNumValueSizeBuckets; k++) {
+          statistic_ids_.push_back(collection.FindStatisticId(
+              GetBreakdownStatisticName(config.servers_[i], j, k)));
+        }
+      }
+    }
+  }
+  if (config.connection_latency_) {
+    connection_statistic_ids_.resize(config.servers_.size());
+    for (size_t i = 0; i < config.servers_.size(); i++) {
+      for (int j = 0; j < config.n_connections_per_worker_; j++) {
+        connection_statistic_ids_[i].push_back(collection.GetStatisticId(
+            GetConnectionStatisticName(config.servers_[i], worker_index, j)));
+      }
+    }
+  }
+}
+
+// Registers one breakdown latency statistic, printed like the per-server
+// latency.
+static void RegisterLatencyStatistic(const string& name,
+                                     const Config& config,
+                                     StatisticsCollection* collection) {
+  collection->RegisterStatistic(name, false, config.breakdown_backend_);
+  collection->AddStatisticPrinter(name, new AveragePrinter());
+  collection->AddStatisticPrinter(name, new QuantilePrinter(0.50));
+  collection->AddStatisticPrinter(name, new QuantilePrinter(0.99));
+}
+
+void LatencyBreakdown::RegisterStatistics(const Config& config,
+                                          StatisticsCollection* collection) {
+  vector<vector<bool> > possible;
+  GetPossibleBuckets(config, &possible);
+  int n_combinations = 0;
+  if (config.latency_breakdown_) {
+    for (int i = 0; i < kNumBreakdownOpcodes; i++) {
+      for (int j = 0; j < kNumValueSizeBuckets; j++) {
+        n_combinations += possible[i][j] ? 1 : 0;
+      }
+    }
+  }
+  int n_statistics = n_combinations * config.servers_.size();
+  if (config.connection_latency_) {
+    n_statistics += config.servers_.size() * config.n_worker_threads_
+                    * config.n_connections_per_worker_;
+  }
+  if (n_statistics > kMaxLatencyBreakdownStatistics) {
+    LOG_FATAL("Latency breakdown needs too many statistics; "
+              "use fewer servers, workers or connections");
+  }
+
+  for (vector<Server>::const_iterator it = config.servers_.begin();
+       it != config.servers_.end();
+       it++) {
+    if (config.latency_breakdown_) {
+      for (int i = 0; i < kNumBreakdownOpcodes; i++) {
+        for (int j = 0; j < kNumValueSizeBuckets; j++) {
+          if (possible[i][j]) {
+            RegisterLatencyStatistic(GetBreakdownStatisticName(*it, i, j),
+                                     config, collection);
+          }
+        }
+      }
+    }
+    if (config.connection_latency_) {
+      for (int i = 0; i < config.n_worker_threads_; i++) {
+        for (int j = 0; j < config.n_connections_per_worker_; j++) {
+          RegisterLatencyStatistic(GetConnectionStatisticName(*it, i, j),
+                                   config, collection);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace cachebash
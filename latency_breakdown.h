@@ -0,0 +1,125 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// latency_breakdown.h
+//
+// Breaks latency down by server, opcode and log2 bucket of value size, and
+// optionally by connection. The statistics are registered up front in the
+// base collection, since every worker's copy must agree on the ids, so
+// only the combinations the configured mix can produce are registered.
+//
+
+#ifndef LATENCY_BREAKDOWN_H_
+#define LATENCY_BREAKDOWN_H_
+
+#include <string>
+#include <vector>
+
+#include "cachebash/statistic.h"
+#include "cachebash/util.h"
+
+using std::string;
+using std::vector;
+
+namespace cachebash {
+
+class Config;
+struct Server;
+
+// Value sizes are bucketed by their log2, up to memcached's 1MB item limit.
+// Larger values are counted in the last bucket.
+static const int kNumValueSizeBuckets = 21;
+// More statistics than this are too many to merge each interval, and too
+// fine grained to read.
+static const int kMaxLatencyBreakdownStatistics = 4096;
+
+// The opcodes latency is broken down by.
+enum BreakdownOpcode {
+  kGetBreakdownOpcode,
+  kSetBreakdownOpcode,
+  kAddBreakdownOpcode,
+  kReplaceBreakdownOpcode,
+  kTouchBreakdownOpcode,
+  kNumBreakdownOpcodes
+};
+
+// Returns the BreakdownOpcode of |op_code|, or -1 if it isn't broken down.
+int GetBreakdownOpcode(char op_code);
+// floor(log2(|value_size|)), so bucket b holds sizes in [2^b, 2^(b+1)).
+// Empty values fall in bucket 0.
+int GetValueSizeBucket(int value_size);
+// The name of the latency statistic for one combination, like
+// "host:11211/latency/get/size_2^10".
+string GetBreakdownStatisticName(const Server& server, int opcode,
+                                 int value_size_bucket);
+// The name of the latency statistic of connection |connection_index| of
+// worker |worker_index| to |server|.
+string GetConnectionStatisticName(const Server& server, int worker_index,
+                                  int connection_index);
+
+class LatencyBreakdown {
+ public:
+  // Looks up the statistics RegisterStatistics registered in |collection|.
+  LatencyBreakdown(const Config& config,
+                   const StatisticsCollection& collection,
+                   int worker_index);
+  // Registers the breakdown statistics |config| asks for. Fails if there
+  // would be more than kMaxLatencyBreakdownStatistics of them.
+  static void RegisterStatistics(const Config& config,
+                                 StatisticsCollection* collection);
+  // Returns -1 if the combination wasn't registered.
+  StatisticId GetStatisticId(int server_index, char op_code,
+                             int value_size) const {
+    int opcode = GetBreakdownOpcode(op_code);
+    if (opcode < 0 || statistic_ids_.empty()) {
+      return -1;
+    }
+    int index = (server_index * kNumBreakdownOpcodes + opcode)
+                * kNumValueSizeBuckets + GetValueSizeBucket(value_size);
+    return statistic_ids_[index];
+  }
+  // Returns -1 if per-connection latency isn't recorded.
+  StatisticId GetConnectionStatisticId(int server_index,
+                                       int connection_index) const {
+    if (connection_statistic_ids_.empty()) {
+      return -1;
+    }
+    return connection_statistic_ids_[server_index][connection_index];
+  }
+
+ private:
+  // Indexed by server, then BreakdownOpcode, then value size bucket.
+  vector<StatisticId> statistic_ids_;
+  // Indexed by server, then the connection's index in its pool.
+  vector<vector<StatisticId> > connection_statistic_ids_;
+
+  DISALLOW_COPY_AND_ASSIGN(LatencyBreakdown);
+};
+
+}  // namespace cachebash
+
+#endif  // LATENCY_BREAKDOWN_H_
@@ -0,0 +1,131 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+//  latency_breakdown_test.cc
+//
+
+#include "cachebash/latency_breakdown.h"
+
+#include <string>
+
+#include "cachebash/config.h"
+#include "cachebash/generator.h"
+#include "cachebash/request.h"
+#include "cachebash/statistic.h"
+#include "gtest/gtest.h"
+
+using cachebash::Config;
+using cachebash::GetBreakdownStatisticName;
+using cachebash::GetConnectionStatisticName;
+using cachebash::GetValueSizeBucket;
+using cachebash::LatencyBreakdown;
+using cachebash::Server;
+using cachebash::StatisticId;
+using cachebash::StatisticsCollection;
+
+namespace {
+
+void AddServer(const string& hostname, Config* config) {
+  Server server;
+  server.hostname = hostname;
+  server.ip_address = hostname;
+  server.port = 11211;
+  server.weight = 1;
+  config->servers_.push_back(server);
+}
+
+TEST(LatencyBreakdownTest, GetValueSizeBucket) {
+  EXPECT_EQ(0, GetValueSizeBucket(0));
+  EXPECT_EQ(0, GetValueSizeBucket(1));
+  EXPECT_EQ(1, GetValueSizeBucket(2));
+  EXPECT_EQ(1, GetValueSizeBucket(3));
+  EXPECT_EQ(10, GetValueSizeBucket(1024));
+  EXPECT_EQ(10, GetValueSizeBucket(2047));
+  EXPECT_EQ(20, GetValueSizeBucket(1 << 20));
+  // Anything past memcached's item limit shares the last bucket.
+  EXPECT_EQ(cachebash::kNumValueSizeBuckets - 1,
+            GetValueSizeBucket(1 << 30));
+}
+
+TEST(LatencyBreakdownTest, Names) {
+  Config config;
+  AddServer("10.0.0.1", &config);
+  EXPECT_EQ("10.0.0.1:11211/latency/get/size_2^10",
+            GetBreakdownStatisticName(config.servers_[0],
+                                      cachebash::kGetBreakdownOpcode, 10));
+  EXPECT_EQ("10.0.0.1:11211/latency/worker_01/connection_02",
+            GetConnectionStatisticName(config.servers_[0], 1, 2));
+}
+
+// Only the opcodes in the mix and the sizes values can have are registered.
+TEST(LatencyBreakdownTest, RegistersOnlyPossibleCombinations) {
+  Config config;
+  AddServer("10.0.0.1", &config);
+  AddServer("10.0.0.2", &config);
+  config.latency_breakdown_ = true;
+  config.fraction_touches_ = 0.1;
+
+  StatisticsCollection collection(NULL);
+  LatencyBreakdown::RegisterStatistics(config, &collection);
+  // For each server, GETs and SETs of the sizes up to MAX_VALUE_SIZE,
+  // and TOUCHes, which have no value.
+  int bucket = GetValueSizeBucket(MAX_VALUE_SIZE);
+  EXPECT_EQ(2 * (2 * (bucket + 1) + 1), collection.n_statistics());
+
+  LatencyBreakdown breakdown(config, collection, 0);
+  StatisticId get_id = breakdown.GetStatisticId(1, OPCODE_GET,
+                                                MAX_VALUE_SIZE);
+  EXPECT_EQ(collection.GetStatisticId(GetBreakdownStatisticName(
+                config.servers_[1], cachebash::kGetBreakdownOpcode, bucket)),
+            get_id);
+  EXPECT_LE(0, breakdown.GetStatisticId(0, OPCODE_SET, 1));
+  EXPECT_LE(0, breakdown.GetStatisticId(0, OPCODE_TOUCH, 0));
+  EXPECT_EQ(-1, breakdown.GetStatisticId(0, OPCODE_ADD, MAX_VALUE_SIZE));
+  EXPECT_EQ(-1, breakdown.GetStatisticId(0, OPCODE_SET, 1 << 20));
+  EXPECT_EQ(-1, breakdown.GetStatisticId(0, OPCODE_INCR, MAX_VALUE_SIZE));
+  EXPECT_EQ(-1, breakdown.GetConnectionStatisticId(0, 0));
+}
+
+TEST(LatencyBreakdownTest, ConnectionStatistics) {
+  Config config;
+  AddServer("10.0.0.1", &config);
+  config.connection_latency_ = true;
+  config.n_worker_threads_ = 2;
+  config.n_connections_per_worker_ = 3;
+
+  StatisticsCollection collection(NULL);
+  LatencyBreakdown::RegisterStatistics(config, &collection);
+  EXPECT_EQ(6, collection.n_statistics());
+
+  LatencyBreakdown breakdown(config, collection, 1);
+  EXPECT_EQ(collection.GetStatisticId(GetConnectionStatisticName(
+                config.servers_[0], 1, 2)),
+            breakdown.GetConnectionStatisticId(0, 2));
+  EXPECT_EQ(-1, breakdown.GetStatisticId(0, OPCODE_GET, MAX_VALUE_SIZE));
+}
+
+}  // namespace
@@ -0,0 +1,151 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// md5.cc
+//
+
+#include "cachebash/md5.h"
+
+#include <string.h>
+
+namespace cachebash {
+
+namespace {
+
+// Per-round shift amounts.
+const uint32_t kShifts[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+// floor(abs(sin(i + 1)) * 2^32)
+const uint32_t kSines[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+  0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+  0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+  0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+  0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+  0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+uint32_t RotateLeft(uint32_t x, uint32_t c) {
+  return (x << c) | (x >> (32 - c));
+}
+
+// Processes one 64 byte block of input, updating |state|.
+void Md5Block(const unsigned char* block, uint32_t state[4]) {
+  uint32_t words[16];
+  for (int i = 0; i < 16; i++) {
+    words[i] = static_cast<uint32_t>(block[i * 4])
+               | (static_cast<uint32_t>(block[i * 4 + 1]) << 8)
+               | (static_cast<uint32_t>(block[i * 4 + 2]) << 16)
+               | (static_cast<uint32_t>(block[i * 4 + 3]) << 24);
+  }
+
+  uint32_t a = state[0];
+  uint32_t b = state[1];
+  uint32_t c = state[2];
+  uint32_t d = state[3];
+  for (int i = 0; i < 64; i++) {
+    uint32_t f;
+    int g;
+    if (i < 16) {
+      f = (b & c) | (~b & d);
+      g = i;
+    } else if (i < 32) {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) % 16;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) % 16;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7 * i) % 16;
+    }
+    uint32_t temp = d;
+    d = c;
+    c = b;
+    b = b + RotateLeft(a + f + kSines[i] + words[g], kShifts[i]);
+    a = temp;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
+
+}  // namespace
+
+void Md5Digest(const string& data, unsigned char digest[kMd5DigestSize]) {
+  uint32_t state[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+
+  // Process all of the complete blocks in place.
+  const unsigned char* input
+    = reinterpret_cast<const unsigned char*>(data.data());
+  size_t length = data.size();
+  size_t offset = 0;
+  for (; offset + 64 <= length; offset += 64) {
+    Md5Block(input + offset, state);
+  }
+
+  // Pad the remainder with a single 1 bit, zeros and the message length
+  // in bits. This takes either one or two more blocks.
+  unsigned char tail[128];
+  memset(tail, 0, sizeof(tail));
+  size_t remaining = length - offset;
+  memcpy(tail, input + offset, remaining);
+  tail[remaining] = 0x80;
+  size_t tail_size = (remaining < 56) ? 64 : 128;
+  uint64_t bit_length = static_cast<uint64_t>(length) * 8;
+  for (int i = 0; i < 8; i++) {
+    tail[tail_size - 8 + i] = static_cast<unsigned char>(bit_length >> (8 * i));
+  }
+  for (size_t i = 0; i < tail_size; i += 64) {
+    Md5Block(tail + i, state);
+  }
+
+  for (int i = 0; i < 4; i++) {
+    digest[i * 4] = state[i] & 0xff;
+    digest[i * 4 + 1] = (state[i] >> 8) & 0xff;
+    digest[i * 4 + 2] = (state[i] >> 16) & 0xff;
+    digest[i * 4 + 3] = (state[i] >> 24) & 0xff;
+  }
+}
+
+}  // namespace cachebash
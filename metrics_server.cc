@@ -0,0 +1,436 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// metrics_server.cc
+//
+
+#include "cachebash/metrics_server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "cachebash/config.h"
+#include "cachebash/latency_breakdown.h"
+#include "cachebash/statistic.h"
+
+namespace cachebash {
+
+// The upper bounds of the latency histograms' buckets, in seconds.
+static const double kLatencyBucketBounds[] = {
+  50e-6, 100e-6, 250e-6, 500e-6, 1e-3, 2.5e-3, 5e-3, 10e-3, 25e-3, 50e-3,
+  100e-3, 250e-3, 500e-3, 1.0, 2.5, 5.0, 10.0
+};
+static const int kNumLatencyBucketBounds = 17;
+
+static const size_t kMaxRequestSize = 8192;
+// Scrapes are served one at a time, so a client that stalls is dropped
+// after this many seconds rather than holding up the ones behind it.
+static const double kClientTimeout = 1.0;
+
+static void AppendFamily(const char* name, const char* type,
+                         const char* help, string* metrics) {
+  char line[512];
+  snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n",
+           name, help, name, type);
+  metrics->append(line);
+}
+
+// |labels| is either empty or a comma separated list of label="value".
+// |number| is the sample's value, formatted.
+static void AppendFormattedSample(const string& name, const string& labels,
+                                  const char* number, string* metrics) {
+  metrics->append(name);
+  if (!labels.empty()) {
+    metrics->append("{" + labels + "}");
+  }
+  metrics->append(" ");
+  metrics->append(number);
+  metrics->append("\n");
+}
+
+static void AppendSample(const string& name, const string& labels,
+                         double value, string* metrics) {
+  char number[64];
+  snprintf(number, sizeof(number), "%.9g", value);
+  AppendFormattedSample(name, labels, number, metrics);
+}
+
+// Counters and sums keep every digit, so they never appear to go back.
+static void AppendCount(const string& name, const string& labels,
+                        int64_t count, string* metrics) {
+  char number[32];
+  snprintf(number, sizeof(number), "%lld", static_cast<long long>(count));
+  AppendFormattedSample(name, labels, number, metrics);
+}
+
+static void AppendSum(const string& name, const string& labels,
+                      double sum, string* metrics) {
+  char number[64];
+  snprintf(number, sizeof(number), "%.17g", sum);
+  AppendFormattedSample(name, labels, number, metrics);
+}
+
+static string Label(const string& name, const string& value) {
+  string label = name + "=\"";
+  for (size_t i = 0; i < value.size(); i++) {
+    if (value[i] == '"' || value[i] == '\\') {
+      label.push_back('\\');
+    }
+    label.push_back(value[i]);
+  }
+  return label + "\"";
+}
+
+// Bucket counts are exact to the statistic's precision: a sample counts
+// as at or below a bound if its histogram count or sketch bin holds the
+// bound.
+static void AppendHistogram(const string& name, const string& labels,
+                            Statistic* statistic, string* metrics) {
+  int64_t count = statistic->GetCount();
+  string separator = labels.empty() ? "" : ",";
+  for (int i = 0; i < kNumLatencyBucketBounds; i++) {
+    char bound[32];
+    snprintf(bound, sizeof(bound), "%g", kLatencyBucketBounds[i]);
+    AppendCount(name + "_bucket", labels + separator + Label("le", bound),
+                statistic->GetCountAtOrBelow(kLatencyBucketBounds[i]),
+                metrics);
+  }
+  AppendCount(name + "_bucket", labels + separator + Label("le", "+Inf"),
+              count, metrics);
+  AppendSum(name + "_sum", labels, statistic->GetSum(), metrics);
+  AppendCount(name + "_count", labels, count, metrics);
+}
+
+// Only the combinations the configured mix can produce were registered.
+static void AppendBreakdownHistograms(const Config& config,
+                                      StatisticsCollection* run_collection,
+                                      string* metrics) {
+  const char* opcodes[] = { "get", "set", "add", "replace", "touch" };
+  AppendFamily("cachebash_breakdown_latency_seconds", "histogram",
+               "Latency of requests, by server, opcode and value size "
+               "rounded down to a power of two.", metrics);
+  for (vector<Server>::const_iterator it = config.servers_.begin();
+       it != config.servers_.end();
+       it++) {
+    for (int i = 0; i < kNumBreakdownOpcodes; i++) {
+      for (int j = 0; j < kNumValueSizeBuckets; j++) {
+        StatisticId id = run_collection->FindStatisticId(
+                           GetBreakdownStatisticName(*it, i, j));
+        if (id < 0) {
+          continue;
+        }
+        char value_size[16];
+        snprintf(value_size, sizeof(value_size), "%d", j == 0 ? 0 : 1 << j);
+        AppendHistogram("cachebash_breakdown_latency_seconds",
+                        Label("server", it->GetName()) + ","
+                        + Label("opcode", opcodes[i]) + ","
+                        + Label("value_size", value_size),
+                        run_collection->GetStatistic(id), metrics);
+      }
+    }
+  }
+}
+
+static void AppendConnectionHistograms(const Config& config,
+                                       StatisticsCollection* run_collection,
+                                       string* metrics) {
+  AppendFamily("cachebash_connection_latency_seconds", "histogram",
+               "Latency of requests, by server, worker and connection.",
+               metrics);
+  for (vector<Server>::const_iterator it = config.servers_.begin();
+       it != config.servers_.end();
+       it++) {
+    for (int i = 0; i < config.n_worker_threads_; i++) {
+      for (int j = 0; j < config.n_connections_per_worker_; j++) {
+        char worker[16];
+        char connection[16];
+        snprintf(worker, sizeof(worker), "%d", i);
+        snprintf(connection, sizeof(connection), "%d", j);
+        AppendHistogram("cachebash_connection_latency_seconds",
+                        Label("server", it->GetName()) + ","
+                        + Label("worker", worker) + ","
+                        + Label("connection", connection),
+                        run_collection->GetStatistic(
+                          GetConnectionStatisticName(*it, i, j)),
+                        metrics);
+      }
+    }
+  }
+}
+
+string FormatPrometheusMetrics(const Config& config,
+                               StatisticsCollection* run_collection,
+                               StatisticsCollection* interval_collection,
+                               double interval_length) {
+  string metrics;
+  AppendFamily("cachebash_requests_total", "counter",
+               "Requests sent, by opcode.", &metrics);
+  const char* opcodes[] = { "get", "set", "add", "replace", "touch" };
+  const StatisticId request_ids[] = {
+    kGetRequestsStatistic, kSetRequestsStatistic, kAddRequestsStatistic,
+    kReplaceRequestsStatistic, kTouchRequestsStatistic
+  };
+  for (int i = 0; i < 5; i++) {
+    AppendCount("cachebash_requests_total", Label("opcode", opcodes[i]),
+                run_collection->GetStatistic(request_ids[i])->GetCount(),
+                &metrics);
+  }
+
+  AppendFamily("cachebash_bytes_total", "counter",
+               "Bytes on the wire, by direction, and the bytes of values "
+               "received.", &metrics);
+  const char* directions[] = { "sent", "received", "received_values" };
+  const StatisticId byte_ids[] = {
+    kRequestBytesStatistic, kResponseBytesStatistic,
+    kResponseValueBytesStatistic
+  };
+  for (int i = 0; i < 3; i++) {
+    AppendSum("cachebash_bytes_total", Label("direction", directions[i]),
+              run_collection->GetStatistic(byte_ids[i])->GetSum(), &metrics);
+  }
+
+  AppendFamily("cachebash_latency_seconds", "histogram",
+               "Latency of every request.", &metrics);
+  AppendHistogram("cachebash_latency_seconds", "",
+                  run_collection->GetStatistic(kLatencyStatistic), &metrics);
+
+  AppendFamily("cachebash_server_requests_total", "counter",
+               "Requests sent, by server.", &metrics);
+  for (vector<Server>::const_iterator it = config.servers_.begin();
+       it != config.servers_.end();
+       it++) {
+    AppendCount("cachebash_server_requests_total",
+                Label("server", it->GetName()),
+                run_collection->GetStatistic(
+                  it->GetStatisticName("requests"))->GetCount(),
+                &metrics);
+  }
+  AppendFamily("cachebash_server_latency_seconds", "histogram",
+               "Latency of requests, by server.", &metrics);
+  for (vector<Server>::const_iterator it = config.servers_.begin();
+       it != config.servers_.end();
+       it++) {
+    AppendHistogram("cachebash_server_latency_seconds",
+                    Label("server", it->GetName()),
+                    run_collection->GetStatistic(
+                      it->GetStatisticName("latency")),
+                    &metrics);
+  }
+  if (config.latency_breakdown_) {
+    AppendBreakdownHistograms(config, run_collection, &metrics);
+  }
+  if (config.connection_latency_) {
+    AppendConnectionHistograms(config, run_collection, &metrics);
+  }
+
+  AppendFamily("cachebash_throughput_requests_per_second", "gauge",
+               "Responses per second over the last stats interval.",
+               &metrics);
+  AppendSample("cachebash_throughput_requests_per_second", "",
+               interval_length > 0.0
+               ? interval_collection->GetStatistic(
+                   kLatencyStatistic)->GetCount() / interval_length
+               : 0.0,
+               &metrics);
+  if (config.rps_ > 0) {
+    AppendFamily("cachebash_target_throughput_requests_per_second", "gauge",
+                 "The request rate asked for with -r.", &metrics);
+    AppendSample("cachebash_target_throughput_requests_per_second", "",
+                 config.rps_, &metrics);
+  }
+  AppendFamily("cachebash_hit_ratio", "gauge",
+               "GET hit ratio over the last stats interval.", &metrics);
+  AppendSample("cachebash_hit_ratio", "",
+               interval_collection->GetStatistic(
+                 kHitRatioStatistic)->GetAverage(),
+               &metrics);
+  AppendFamily("cachebash_server_hit_ratio", "gauge",
+               "GET hit ratio over the last stats interval, by server.",
+               &metrics);
+  for (vector<Server>::const_iterator it = config.servers_.begin();
+       it != config.servers_.end();
+       it++) {
+    AppendSample("cachebash_server_hit_ratio",
+                 Label("server", it->GetName()),
+                 interval_collection->GetStatistic(
+                   it->GetStatisticName("hit_ratio"))->GetAverage(),
+                 &metrics);
+  }
+  AppendFamily("cachebash_outstanding_requests", "gauge",
+               "Average requests in flight per worker when sending, over "
+               "the last stats interval.", &metrics);
+  AppendSample("cachebash_outstanding_requests", "",
+               interval_collection->GetStatistic(
+                 kOutstandingRequestsStatistic)->GetAverage(),
+               &metrics);
+  AppendFamily("cachebash_send_lag_seconds", "gauge",
+               "Average lateness of sends on the request rate's schedule, "
+               "over the last stats interval.", &metrics);
+  AppendSample("cachebash_send_lag_seconds", "",
+               interval_collection->GetStatistic(
+                 kSendLagStatistic)->GetAverage(),
+               &metrics);
+  return metrics;
+}
+
+MetricsServer::MetricsServer(const string& address)
+    : started_(false) {
+  string host = "127.0.0.1";
+  string port = address;
+  size_t colon = address.rfind(':');
+  if (colon != string::npos) {
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+  }
+  struct sockaddr_in socket_address;
+  memset(&socket_address, 0, sizeof(socket_address));
+  socket_address.sin_family = AF_INET;
+  socket_address.sin_port = htons(atoi(port.c_str()));
+  if (inet_pton(AF_INET, nslookup(host).c_str(),
+                &socket_address.sin_addr) != 1) {
+    LOG_FATAL("Invalid metrics address " + address);
+  }
+
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse_address = 1;
+  if (listen_fd_ < 0
+      || setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse_address,
+                    sizeof(reuse_address)) < 0
+      || bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&socket_address),
+              sizeof(socket_address)) < 0
+      || listen(listen_fd_, 16) < 0) {
+    LOG_FATAL("Couldn't listen for metrics scrapes on " + address);
+  }
+  socklen_t socket_address_size = sizeof(socket_address);
+  getsockname(listen_fd_, reinterpret_cast<struct sockaddr*>(&socket_address),
+              &socket_address_size);
+  port_ = ntohs(socket_address.sin_port);
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+// Shutting the listening socket down wakes the server thread up.
+MetricsServer::~MetricsServer() {
+  shutdown(listen_fd_, SHUT_RDWR);
+  if (started_) {
+    pthread_join(thread_, NULL);
+  }
+  close(listen_fd_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+void MetricsServer::Publish(const string& metrics) {
+  pthread_mutex_lock(&mutex_);
+  metrics_ = metrics;
+  pthread_mutex_unlock(&mutex_);
+}
+
+void MetricsServer::Start() {
+  started_ = true;
+  int rc = pthread_create(&thread_, NULL, ServeLoopHook, this);
+  if (rc) {
+    LOG_FATAL("Metrics server thread failed to start");
+  }
+}
+
+// Scrapes are rare enough to serve one at a time. Reads and writes time
+// out, so a stalled client only holds the others up for a moment.
+void MetricsServer::ServeLoop() {
+  while (true) {
+    int client_fd = accept(listen_fd_, NULL, NULL);
+    if (client_fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;
+    }
+    struct timeval timeout = SecondsToTimeval(kClientTimeout);
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+               sizeof(timeout));
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+               sizeof(timeout));
+    Serve(client_fd);
+    close(client_fd);
+  }
+}
+
+// Answers a single request and closes the connection.
+void MetricsServer::Serve(int client_fd) {
+  string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == string::npos
+         && request.size() < kMaxRequestSize) {
+    ssize_t n_read = read(client_fd, buffer, sizeof(buffer));
+    if (n_read <= 0) {
+      return;
+    }
+    request.append(buffer, n_read);
+  }
+
+  string status = "404 Not Found";
+  string body = "Metrics are served at /metrics\n";
+  if (request.compare(0, 13, "GET /metrics ") == 0
+      || request.compare(0, 13, "GET /metrics?") == 0) {
+    status = "200 OK";
+    pthread_mutex_lock(&mutex_);
+    body = metrics_;
+    pthread_mutex_unlock(&mutex_);
+  }
+  char header[256];
+  snprintf(header, sizeof(header),
+           "HTTP/1.0 %s\r\n"
+           "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+           "Content-Length: %zu\r\n"
+           "Connection: close\r\n\r\n",
+           status.c_str(), body.size());
+  string response = string(header) + body;
+  size_t n_sent = 0;
+  while (n_sent < response.size()) {
+    ssize_t n_written = send(client_fd, response.data() + n_sent,
+                             response.size() - n_sent, MSG_NOSIGNAL);
+    if (n_written <= 0) {
+      return;
+    }
+    n_sent += n_written;
+  }
+}
+
+void* ServeLoopHook(void* arg) {
+  MetricsServer* metrics_server = static_cast<MetricsServer*>(arg);
+  metrics_server->ServeLoop();
+  return NULL;
+}
+
+}  // namespace cachebash
@@ -0,0 +1,92 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// metrics_server.h
+//
+// Serves the load generator's view of a run over HTTP in the Prometheus
+// text exposition format, at /metrics. The stats loop formats a snapshot
+// once per interval from the merged collections and publishes it; scrapes
+// only ever read the last published snapshot, never the workers' data.
+//
+
+#ifndef METRICS_SERVER_H_
+#define METRICS_SERVER_H_
+
+#include <pthread.h>
+#include <string>
+
+#include "cachebash/util.h"
+
+using std::string;
+
+namespace cachebash {
+
+class Config;
+class StatisticsCollection;
+
+// Formats the metrics of a run. Counters and histograms come from
+// |run_collection|, which holds everything since the start of the run, and
+// gauges from |interval_collection|, which holds the last |interval_length|
+// seconds.
+string FormatPrometheusMetrics(const Config& config,
+                               StatisticsCollection* run_collection,
+                               StatisticsCollection* interval_collection,
+                               double interval_length);
+
+class MetricsServer {
+ public:
+  // Listens on |address|, given as [host:]port. The host defaults to
+  // 127.0.0.1, and port 0 picks any free port.
+  explicit MetricsServer(const string& address);
+  ~MetricsServer();
+  int port() const { return port_; }
+  // Replaces the snapshot that scrapes are answered with.
+  void Publish(const string& metrics);
+  void ServeLoop();
+  void Start();
+
+ private:
+  void Serve(int client_fd);
+
+  int listen_fd_;
+  int port_;
+  // The last published snapshot, guarded by |mutex_|.
+  string metrics_;
+  pthread_mutex_t mutex_;
+  bool started_;
+  pthread_t thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(MetricsServer);
+};
+
+// Interfaces between pthread's thread creation callback and the metrics
+// server's loop.
+void* ServeLoopHook(void* arg);
+
+}  // namespace cachebash
+
+#endif  // METRICS_SERVER_H_
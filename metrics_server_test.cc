@@ -0,0 +1,175 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+//  metrics_server_test.cc
+//
+
+#include "cachebash/metrics_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+
+#include "cachebash/config.h"
+#include "cachebash/scoped_ptr.h"
+#include "cachebash/statistic.h"
+#include "gtest/gtest.h"
+
+using cachebash::Config;
+using cachebash::MetricsServer;
+using cachebash::Server;
+using cachebash::StatisticsCollection;
+
+namespace {
+
+// Sends |request| to the metrics server on |port| and returns the whole
+// response.
+string Fetch(int port, const string& request) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+  EXPECT_EQ(0, connect(fd, reinterpret_cast<struct sockaddr*>(&address),
+                       sizeof(address)));
+  EXPECT_EQ(static_cast<ssize_t>(request.size()),
+            write(fd, request.data(), request.size()));
+  string response;
+  char buffer[1024];
+  ssize_t n_read;
+  while ((n_read = read(fd, buffer, sizeof(buffer))) > 0) {
+    response.append(buffer, n_read);
+  }
+  close(fd);
+  return response;
+}
+
+TEST(MetricsServerTest, FormatPrometheusMetrics) {
+  Config config;
+  Server server;
+  server.hostname = "127.0.0.1";
+  server.ip_address = "127.0.0.1";
+  server.port = 11211;
+  server.weight = 1;
+  config.servers_.push_back(server);
+
+  StatisticsCollection run_collection(NULL);
+  run_collection.RegisterStandardStatistics();
+  run_collection.RegisterStatistic(server.GetStatisticName("latency"), false);
+  run_collection.RegisterStatistic(server.GetStatisticName("requests"),
+                                   false);
+  run_collection.RegisterStatistic(server.GetStatisticName("hit_ratio"),
+                                   false);
+  run_collection.AddSample(cachebash::kGetRequestsStatistic, 1);
+  run_collection.AddSample(cachebash::kLatencyStatistic, 0.0008);
+  run_collection.AddSample(cachebash::kLatencyStatistic, 0.003);
+  run_collection.AddSample(cachebash::kLatencyStatistic, 20);
+  run_collection.AddSample(cachebash::kRequestBytesStatistic, 34);
+  run_collection.AddSample(cachebash::kRequestBytesStatistic, 1058);
+  run_collection.AddSample(cachebash::kResponseBytesStatistic, 24);
+  config.rps_ = 1000;
+  scoped_ptr<StatisticsCollection> interval_collection(run_collection.Copy());
+  interval_collection->AddSample(cachebash::kHitRatioStatistic, 1);
+  interval_collection->AddSample(cachebash::kHitRatioStatistic, 0);
+
+  string metrics = cachebash::FormatPrometheusMetrics(
+                     config, &run_collection, interval_collection.Get(), 2.0);
+  EXPECT_NE(string::npos,
+            metrics.find("# TYPE cachebash_requests_total counter\n"));
+  EXPECT_NE(string::npos,
+            metrics.find("cachebash_requests_total{opcode=\"get\"} 1\n"));
+  EXPECT_NE(string::npos, metrics.find(
+              "cachebash_latency_seconds_bucket{le=\"0.0005\"} 0\n"));
+  EXPECT_NE(string::npos, metrics.find(
+              "cachebash_latency_seconds_bucket{le=\"0.001\"} 1\n"));
+  EXPECT_NE(string::npos, metrics.find(
+              "cachebash_latency_seconds_bucket{le=\"10\"} 2\n"));
+  EXPECT_NE(string::npos, metrics.find(
+              "cachebash_latency_seconds_bucket{le=\"+Inf\"} 3\n"));
+  EXPECT_NE(string::npos, metrics.find("cachebash_latency_seconds_count 3\n"));
+  EXPECT_NE(string::npos, metrics.find(
+              "cachebash_server_latency_seconds_count"
+              "{server=\"127.0.0.1:11211\"} 0\n"));
+  EXPECT_NE(string::npos, metrics.find(
+              "cachebash_throughput_requests_per_second 1.5\n"));
+  EXPECT_NE(string::npos, metrics.find("cachebash_hit_ratio 0.5\n"));
+  EXPECT_NE(string::npos, metrics.find(
+              "cachebash_bytes_total{direction=\"sent\"} 1092\n"));
+  EXPECT_NE(string::npos, metrics.find(
+              "cachebash_bytes_total{direction=\"received_values\"} 0\n"));
+  EXPECT_NE(string::npos, metrics.find(
+              "cachebash_target_throughput_requests_per_second 1000\n"));
+}
+
+TEST(MetricsServerTest, Serve) {
+  MetricsServer metrics_server("127.0.0.1:0");
+  metrics_server.Start();
+  EXPECT_LT(0, metrics_server.port());
+
+  metrics_server.Publish("cachebash_up 1\n");
+  string response = Fetch(metrics_server.port(),
+                          "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  EXPECT_EQ(0u, response.find("HTTP/1.0 200 OK\r\n"));
+  EXPECT_NE(string::npos, response.find("Content-Length: 15\r\n"));
+  EXPECT_NE(string::npos, response.find("\r\n\r\ncachebash_up 1\n"));
+
+  // Scrapes see whatever was published last.
+  metrics_server.Publish("cachebash_up 2\n");
+  response = Fetch(metrics_server.port(), "GET /metrics HTTP/1.0\r\n\r\n");
+  EXPECT_NE(string::npos, response.find("\r\n\r\ncachebash_up 2\n"));
+
+  response = Fetch(metrics_server.port(), "GET / HTTP/1.0\r\n\r\n");
+  EXPECT_EQ(0u, response.find("HTTP/1.0 404 Not Found\r\n"));
+}
+
+// A client that connects and never sends a request is dropped, rather
+// than holding up every scrape after it.
+TEST(MetricsServerTest, StalledClient) {
+  MetricsServer metrics_server("127.0.0.1:0");
+  metrics_server.Start();
+  metrics_server.Publish("cachebash_up 1\n");
+
+  int stalled_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(metrics_server.port());
+  inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+  ASSERT_EQ(0, connect(stalled_fd,
+                       reinterpret_cast<struct sockaddr*>(&address),
+                       sizeof(address)));
+  string response = Fetch(metrics_server.port(),
+                          "GET /metrics HTTP/1.0\r\n\r\n");
+  EXPECT_NE(string::npos, response.find("\r\n\r\ncachebash_up 1\n"));
+  close(stalled_fd);
+}
+
+}  // namespace
@@ -0,0 +1,211 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// perf_counters.cc
+//
+
+#include "cachebash/perf_counters.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "cachebash/config.h"
+#include "cachebash/tcp_info.h"
+
+namespace cachebash {
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} kPerfCounterEvents[kNumPerfCounters] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK }
+};
+
+static const char* kPerfMetricNames[kNumPerfMetrics] = {
+  "perf_cycles_per_request", "perf_instructions_per_cycle",
+  "perf_cache_misses_per_request", "perf_context_switches",
+  "perf_cpu_time_per_request", "perf_cpu_utilization"
+};
+
+// The counters each metric is worked out from.
+static const int kPerfMetricCounters[kNumPerfMetrics][2] = {
+  { kCyclesPerfCounter, kCyclesPerfCounter },
+  { kCyclesPerfCounter, kInstructionsPerfCounter },
+  { kCacheMissesPerfCounter, kCacheMissesPerfCounter },
+  { kContextSwitchesPerfCounter, kContextSwitchesPerfCounter },
+  { kTaskClockPerfCounter, kTaskClockPerfCounter },
+  { kTaskClockPerfCounter, kTaskClockPerfCounter }
+};
+
+// Opens |counter| for the calling thread on whichever CPU it runs, or
+// returns -1. Where the kernel only lets us count user space, which is
+// what perf_event_paranoid 2 allows, that is counted instead.
+static int OpenPerfCounter(int counter) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = kPerfCounterEvents[counter].type;
+  attr.config = kPerfCounterEvents[counter].config;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                     | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.exclude_hv = 1;
+  int fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+    attr.exclude_kernel = 1;
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  return fd;
+}
+
+PerfCounters::PerfCounters() {
+  for (int i = 0; i < kNumPerfCounters; i++) {
+    fds_[i] = OpenPerfCounter(i);
+  }
+}
+
+PerfCounters::~PerfCounters() {
+  for (int i = 0; i < kNumPerfCounters; i++) {
+    if (fds_[i] >= 0) {
+      close(fds_[i]);
+    }
+  }
+}
+
+bool PerfCounters::IsAvailable(int counter) {
+  int fd = OpenPerfCounter(counter);
+  if (fd < 0) {
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+void PerfCounters::Read(uint64_t* counts) const {
+  for (int i = 0; i < kNumPerfCounters; i++) {
+    counts[i] = 0;
+    // The count, then the time enabled and the time running.
+    uint64_t values[3];
+    if (fds_[i] < 0
+        || read(fds_[i], values, sizeof(values)) != sizeof(values)) {
+      continue;
+    }
+    if (values[2] > 0 && values[2] < values[1]) {
+      counts[i] = static_cast<uint64_t>(
+                    static_cast<double>(values[0]) * values[1] / values[2]);
+    } else {
+      counts[i] = values[0];
+    }
+  }
+}
+
+string GetPerfStatisticName(int worker_index, int metric) {
+  return GetWorkerStatisticPrefix(worker_index) + "/"
+         + kPerfMetricNames[metric];
+}
+
+PerfCounterSampler::PerfCounterSampler(
+    const Config& config, const StatisticsCollection& collection)
+    : last_counts_(config.n_worker_threads_,
+                   vector<uint64_t>(kNumPerfCounters, 0)) {
+  for (int i = 0; i < config.n_worker_threads_; i++) {
+    vector<StatisticId> ids;
+    for (int j = 0; j < kNumPerfMetrics; j++) {
+      ids.push_back(collection.FindStatisticId(GetPerfStatisticName(i, j)));
+    }
+    statistic_ids_.push_back(ids);
+  }
+}
+
+void PerfCounterSampler::RegisterStatistics(
+    const Config& config, StatisticsCollection* collection) {
+  bool available[kNumPerfCounters];
+  for (int i = 0; i < kNumPerfCounters; i++) {
+    available[i] = PerfCounters::IsAvailable(i);
+  }
+  if (!available[kCyclesPerfCounter]) {
+    printf("Hardware performance counters are unavailable: reporting CPU "
+           "time and context switches only.\n");
+  }
+  for (int i = 0; i < config.n_worker_threads_; i++) {
+    for (int j = 0; j < kNumPerfMetrics; j++) {
+      if (!available[kPerfMetricCounters[j][0]]
+          || !available[kPerfMetricCounters[j][1]]) {
+        continue;
+      }
+      string name = GetPerfStatisticName(i, j);
+      collection->RegisterStatistic(name, false);
+      collection->AddStatisticPrinter(name, new AveragePrinter());
+    }
+  }
+}
+
+void PerfCounterSampler::Sample(int worker_index, const uint64_t* counts,
+                                int64_t n_responses, double interval_length,
+                                StatisticsCollection* collection) {
+  vector<uint64_t>& last_counts = last_counts_[worker_index];
+  double deltas[kNumPerfCounters];
+  for (int i = 0; i < kNumPerfCounters; i++) {
+    deltas[i] = counts[i] - last_counts[i];
+    last_counts[i] = counts[i];
+  }
+  double values[kNumPerfMetrics];
+  values[kCyclesPerRequestMetric] = deltas[kCyclesPerfCounter] / n_responses;
+  values[kInstructionsPerCycleMetric] = deltas[kInstructionsPerfCounter]
+                                        / deltas[kCyclesPerfCounter];
+  values[kCacheMissesPerRequestMetric] = deltas[kCacheMissesPerfCounter]
+                                         / n_responses;
+  values[kContextSwitchesMetric] = deltas[kContextSwitchesPerfCounter]
+                                   / interval_length;
+  values[kCpuTimePerRequestMetric] = deltas[kTaskClockPerfCounter] * 1e-9
+                                     / n_responses;
+  values[kCpuUtilizationMetric] = deltas[kTaskClockPerfCounter] * 1e-9
+                                  / interval_length;
+
+  const vector<StatisticId>& ids = statistic_ids_[worker_index];
+  for (int i = 0; i < kNumPerfMetrics; i++) {
+    // Per request metrics mean nothing in an interval without any.
+    bool per_request = i == kCyclesPerRequestMetric
+                       || i == kCacheMissesPerRequestMetric
+                       || i == kCpuTimePerRequestMetric;
+    if (ids[i] < 0 || (per_request && n_responses == 0)
+        || (i == kInstructionsPerCycleMetric
+            && deltas[kCyclesPerfCounter] == 0)) {
+      continue;
+    }
+    collection->AddSample(ids[i], values[i]);
+  }
+}
+
+}  // namespace cachebash
@@ -0,0 +1,131 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// perf_counters.h
+//
+// Counts what each worker thread costs the client through perf_event_open:
+// cycles, instructions and cache misses where the hardware counters are
+// available, and always the context switches and CPU time the kernel
+// counts in software. Per interval, they become the cycles and CPU time
+// per request and the instructions per cycle of each worker.
+//
+
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "cachebash/statistic.h"
+#include "cachebash/util.h"
+
+using std::string;
+using std::vector;
+
+namespace cachebash {
+
+class Config;
+
+enum PerfCounter {
+  // Hardware counters, which virtual machines and containers often don't
+  // expose.
+  kCyclesPerfCounter,
+  kInstructionsPerfCounter,
+  kCacheMissesPerfCounter,
+  // Software counters. The task clock counts nanoseconds on the CPU.
+  kContextSwitchesPerfCounter,
+  kTaskClockPerfCounter,
+  kNumPerfCounters
+};
+
+enum PerfMetric {
+  kCyclesPerRequestMetric,
+  kInstructionsPerCycleMetric,
+  kCacheMissesPerRequestMetric,
+  // Per second.
+  kContextSwitchesMetric,
+  // Seconds.
+  kCpuTimePerRequestMetric,
+  // The fraction of the interval the worker spent on a CPU.
+  kCpuUtilizationMetric,
+  kNumPerfMetrics
+};
+
+// The counters of the thread that constructs it, which any thread may
+// read. Counters the kernel won't open are left out.
+class PerfCounters {
+ public:
+  PerfCounters();
+  ~PerfCounters();
+  // Whether |counter| can be opened for the calling thread.
+  static bool IsAvailable(int counter);
+  bool is_open(int counter) const { return fds_[counter] >= 0; }
+  // Sets |counts|, indexed by PerfCounter, to what each counter has counted
+  // since it was opened, scaled up for any time the kernel multiplexed it
+  // off the hardware. Counters that aren't open read 0.
+  void Read(uint64_t* counts) const;
+
+ private:
+  int fds_[kNumPerfCounters];
+
+  DISALLOW_COPY_AND_ASSIGN(PerfCounters);
+};
+
+// The name of |metric| for worker |worker_index|, like
+// "worker_01/perf_cycles_per_request".
+string GetPerfStatisticName(int worker_index, int metric);
+
+class PerfCounterSampler {
+ public:
+  // Looks up the statistics RegisterStatistics registered in |collection|.
+  PerfCounterSampler(const Config& config,
+                     const StatisticsCollection& collection);
+  // Registers and prints the statistics of every worker whose counters
+  // can be opened here, and says which can't.
+  static void RegisterStatistics(const Config& config,
+                                 StatisticsCollection* collection);
+  // Records into |collection| what worker |worker_index| cost over an
+  // interval of |interval_length| seconds in which it received
+  // |n_responses|, given what its counters read at the end of it.
+  void Sample(int worker_index, const uint64_t* counts, int64_t n_responses,
+              double interval_length, StatisticsCollection* collection);
+
+ private:
+  // Indexed by worker, then PerfMetric. -1 for metrics whose counters
+  // aren't available.
+  vector<vector<StatisticId> > statistic_ids_;
+  // What each worker's counters read at the end of the last interval.
+  vector<vector<uint64_t> > last_counts_;
+
+  DISALLOW_COPY_AND_ASSIGN(PerfCounterSampler);
+};
+
+}  // namespace cachebash
+
+#endif  // PERF_COUNTERS_H_
@@ -0,0 +1,111 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+//  perf_counters_test.cc
+//
+
+#include "cachebash/perf_counters.h"
+
+#include "cachebash/config.h"
+#include "gtest/gtest.h"
+
+using cachebash::Config;
+using cachebash::GetPerfStatisticName;
+using cachebash::PerfCounterSampler;
+using cachebash::PerfCounters;
+using cachebash::StatisticsCollection;
+
+namespace {
+
+TEST(PerfCountersTest, StatisticNames) {
+  EXPECT_EQ("worker_01/perf_cycles_per_request",
+            GetPerfStatisticName(1, cachebash::kCyclesPerRequestMetric));
+  EXPECT_EQ("worker_00/perf_cpu_utilization",
+            GetPerfStatisticName(0, cachebash::kCpuUtilizationMetric));
+}
+
+// Hardware counters may well be missing where this runs, and even the
+// software ones if perf_event_open is filtered out.
+TEST(PerfCountersTest, CountsCallingThread) {
+  PerfCounters perf_counters;
+  volatile uint64_t sum = 0;
+  for (int i = 0; i < 10000000; i++) {
+    sum += i;
+  }
+  uint64_t counts[cachebash::kNumPerfCounters];
+  perf_counters.Read(counts);
+  for (int i = 0; i < cachebash::kNumPerfCounters; i++) {
+    EXPECT_EQ(PerfCounters::IsAvailable(i), perf_counters.is_open(i));
+    if (!perf_counters.is_open(i)) {
+      EXPECT_EQ(0u, counts[i]);
+    }
+  }
+  if (perf_counters.is_open(cachebash::kTaskClockPerfCounter)) {
+    EXPECT_LT(0u, counts[cachebash::kTaskClockPerfCounter]);
+  }
+  if (perf_counters.is_open(cachebash::kInstructionsPerfCounter)) {
+    EXPECT_LT(10000000u, counts[cachebash::kInstructionsPerfCounter]);
+  }
+}
+
+// Each sample works out the metrics from what was counted since the last.
+TEST(PerfCountersTest, SampleCountsSinceLastSample) {
+  Config config;
+  config.n_worker_threads_ = 2;
+  StatisticsCollection collection(NULL);
+  for (int i = 0; i < cachebash::kNumPerfMetrics; i++) {
+    collection.RegisterStatistic(GetPerfStatisticName(1, i), false);
+  }
+  PerfCounterSampler sampler(config, collection);
+
+  uint64_t counts[] = { 20000, 30000, 100, 10, 5000000 };
+  sampler.Sample(1, counts, 10, 2.0, &collection);
+  uint64_t more_counts[] = { 60000, 50000, 100, 10, 7000000 };
+  sampler.Sample(1, more_counts, 0, 2.0, &collection);
+
+  EXPECT_FLOAT_EQ(2000.0, collection.GetStatistic(GetPerfStatisticName(
+                      1, cachebash::kCyclesPerRequestMetric))->GetAverage());
+  EXPECT_EQ(2, collection.GetStatistic(GetPerfStatisticName(
+                   1, cachebash::kInstructionsPerCycleMetric))->GetCount());
+  EXPECT_FLOAT_EQ(1.0, collection.GetStatistic(GetPerfStatisticName(
+                      1, cachebash::kInstructionsPerCycleMetric))
+                      ->GetAverage());
+  EXPECT_FLOAT_EQ(10.0, collection.GetStatistic(GetPerfStatisticName(
+                      1, cachebash::kCacheMissesPerRequestMetric))
+                      ->GetAverage());
+  EXPECT_FLOAT_EQ(2.5, collection.GetStatistic(GetPerfStatisticName(
+                      1, cachebash::kContextSwitchesMetric))->GetAverage());
+  EXPECT_FLOAT_EQ(5e-4, collection.GetStatistic(GetPerfStatisticName(
+                      1, cachebash::kCpuTimePerRequestMetric))->GetAverage());
+  EXPECT_FLOAT_EQ(0.00175, collection.GetStatistic(GetPerfStatisticName(
+                      1, cachebash::kCpuUtilizationMetric))->GetAverage());
+  // No responses in the second interval, so no per request metrics.
+  EXPECT_EQ(1, collection.GetStatistic(GetPerfStatisticName(
+                   1, cachebash::kCpuTimePerRequestMetric))->GetCount());
+}
+
+}  // namespace
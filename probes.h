@@ -0,0 +1,86 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// probes.h
+//
+// Static tracepoints (USDT) on the request path, so bpftrace and perf can
+// line cachebash's events up with the kernel's scheduling and networking
+// events. They are compiled in by building with "make USDT=1", which needs
+// sys/sdt.h (systemtap-sdt-dev). Each is then a nop until a tracer
+// attaches, plus setting up its arguments. Otherwise they compile to
+// nothing, arguments included.
+//
+// The provider is "cachebash", and the probes are
+//   request__generate(opcode, key_length, value_length)
+//   request__send(opcode, key_length, value_length, bytes, server_index)
+//   response__receive(opcode, status, key_length, value_length)
+//   response__parse(opcode, key_length, value_length, latency_ns)
+//   stats__flush(worker_index)
+// where opcodes are memcached's binary protocol opcodes. For example:
+//   bpftrace -e 'usdt:./cachebash:cachebash:response__parse
+//                { @latency_us = hist(arg3 / 1000); }'
+//
+
+#ifndef PROBES_H_
+#define PROBES_H_
+
+#ifdef CACHEBASH_USDT
+
+#include <sys/sdt.h>
+
+#define CACHEBASH_PROBE_REQUEST_GENERATE(op_code, key_length, value_length) \
+  DTRACE_PROBE3(cachebash, request__generate, op_code, key_length, \
+                value_length)
+#define CACHEBASH_PROBE_REQUEST_SEND(op_code, key_length, value_length, \
+                                     bytes, server_index) \
+  DTRACE_PROBE5(cachebash, request__send, op_code, key_length, \
+                value_length, bytes, server_index)
+#define CACHEBASH_PROBE_RESPONSE_RECEIVE(op_code, status, key_length, \
+                                         value_length) \
+  DTRACE_PROBE4(cachebash, response__receive, op_code, status, key_length, \
+                value_length)
+#define CACHEBASH_PROBE_RESPONSE_PARSE(op_code, key_length, value_length, \
+                                       latency_ns) \
+  DTRACE_PROBE4(cachebash, response__parse, op_code, key_length, \
+                value_length, latency_ns)
+#define CACHEBASH_PROBE_STATS_FLUSH(worker_index) \
+  DTRACE_PROBE1(cachebash, stats__flush, worker_index)
+
+#else
+
+#define CACHEBASH_PROBE_REQUEST_GENERATE(op_code, key_length, value_length)
+#define CACHEBASH_PROBE_REQUEST_SEND(op_code, key_length, value_length, \
+                                     bytes, server_index)
+#define CACHEBASH_PROBE_RESPONSE_RECEIVE(op_code, status, key_length, \
+                                         value_length)
+#define CACHEBASH_PROBE_RESPONSE_PARSE(op_code, key_length, value_length, \
+                                       latency_ns)
+#define CACHEBASH_PROBE_STATS_FLUSH(worker_index)
+
+#endif  // CACHEBASH_USDT
+
+#endif  // PROBES_H_
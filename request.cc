@@ -34,6 +34,7 @@
 #include <string.h>
 #include <string>
 
+#include "cachebash/generator.h"
 #include "cachebash/util.h"
 
 namespace cachebash {
@@ -41,8 +42,17 @@ namespace cachebash {
 Request::Request(string key, string value)
     : extras_(NULL),
       extras_size_(0),
+      fanout_(NULL),
+      fanout_shard_(-1),
+      fill_(false),
+      has_stage_times_(false),
+      hedge_(false),
       key_(key),
-      value_(value) {}
+      opaque_(0),
+      replica_(false),
+      value_(value) {
+  timerclear(&application_start_time_);
+}
 
 Request::~Request() {
   if (extras_size_ != 0) {
@@ -50,6 +60,62 @@ Request::~Request() {
   }
 }
 
+static float GetSeconds(const struct timeval& start,
+                        const struct timeval& end) {
+  struct timeval time_diff;
+  timersub(&end, &start, &time_diff);
+  return time_diff.tv_usec * 1e-6 + time_diff.tv_sec;
+}
+
+void RecordStageTimes(const StageTimes& stage_times,
+                      StatisticsCollection* statistics_collection) {
+  statistics_collection->AddSample(
+      kStageGenerateStatistic,
+      GetSeconds(stage_times.scheduled, stage_times.generated));
+  statistics_collection->AddSample(
+      kStageWriteStatistic,
+      GetSeconds(stage_times.generated, stage_times.written));
+  statistics_collection->AddSample(
+      kStageWaitStatistic,
+      GetSeconds(stage_times.written, stage_times.first_byte));
+  statistics_collection->AddSample(
+      kStageReadStatistic,
+      GetSeconds(stage_times.first_byte, stage_times.parsed));
+}
+
+// Fills in |request_header| for a request with |op_code| whose body is
+// |extras_size| bytes of extras, |key_size| of key and |value_size| of
+// value.
+static void SetRequestHeader(char op_code, int extras_size, int key_size,
+                             int value_size, uint32_t opaque,
+                             struct RequestHeader* request_header) {
+  int body_size = extras_size + key_size + value_size;
+
+  // All requests have the same magic byte.
+  request_header->magic = MAGIC_REQUEST;
+  request_header->opcode = op_code;
+  request_header->key_size[0] = ((unsigned int)(key_size & 0xff00)) >> 8;
+  request_header->key_size[1] = (key_size & 0xff);
+  request_header->extras_size = extras_size;
+  request_header->data_type = 0;  // Reserved for future use. Just set to 0.
+  request_header->reserved[0] = 0;
+  request_header->reserved[1] = 0;
+  request_header->total_body_size[3] = (body_size & 0xff);
+  request_header->total_body_size[2]
+    = ((unsigned int)(body_size & 0xff00)) >> 8;
+  request_header->total_body_size[1]
+    = ((unsigned int)(body_size & 0xff0000)) >> 16;
+  request_header->total_body_size[0]
+    = ((unsigned int)(body_size & 0xff000000)) >> 24;
+  request_header->opaque[0] = (opaque >> 24) & 0xff;
+  request_header->opaque[1] = (opaque >> 16) & 0xff;
+  request_header->opaque[2] = (opaque >> 8) & 0xff;
+  request_header->opaque[3] = opaque & 0xff;
+  for (int i = 0; i < 8; i++) {
+    request_header->cas[i] = 0;
+  }
+}
+
 // Creates a buffer with the binary formatted request for memcached.
 // Sets |request_size_bytes| to the size of the buffer in bytes.
 // Returns |request_buffer| to point to the buffer.
@@ -59,39 +125,11 @@ char* Request::ConstructRequestPacket(int* request_size_bytes) {
   // to use the Request class information.
   int key_size = key_.size();
   int value_size = value_.size();
-  int body_size = extras_size_ + key_size + value_size;
 
   // Construct the request header.
   struct RequestHeader request_header;
-
-  // All requests have the same magic byte.
-  request_header.magic = MAGIC_REQUEST;
-  request_header.opcode = this->op_code();
-  request_header.key_size[0] = ((unsigned int)(key_size & 0xff00)) >> 8;
-  request_header.key_size[1] = (key_size & 0xff);
-  request_header.extras_size = extras_size_;
-  request_header.data_type = 0;  // Reserved for future use. Just set to 0.
-  request_header.reserved[0] = 0;
-  request_header.reserved[1] = 0;
-  request_header.total_body_size[3] = (body_size & 0xff);
-  request_header.total_body_size[2]
-    = ((unsigned int)(body_size & 0xff00)) >> 8;
-  request_header.total_body_size[1]
-    = ((unsigned int)(body_size & 0xff0000)) >> 16;
-  request_header.total_body_size[0]
-    = ((unsigned int)(body_size & 0xff000000)) >> 24;
-  request_header.opaque[0] = 0;
-  request_header.opaque[1] = 0;
-  request_header.opaque[2] = 0;
-  request_header.opaque[3] = 0;
-  request_header.cas[0] = 0;
-  request_header.cas[1] = 0;
-  request_header.cas[2] = 0;
-  request_header.cas[3] = 0;
-  request_header.cas[4] = 0;
-  request_header.cas[5] = 0;
-  request_header.cas[6] = 0;
-  request_header.cas[7] = 0;
+  SetRequestHeader(this->op_code(), extras_size_, key_size, value_size,
+                   opaque_, &request_header);
 
   // Allocate the request buffer and copy the data over.
   *request_size_bytes = sizeof(struct RequestHeader)
@@ -109,17 +147,32 @@ char* Request::ConstructRequestPacket(int* request_size_bytes) {
   return request_buffer;
 }
 
+// Sets the extras of a storage command: the flags followed by the expiry,
+// both big endian.
+void Request::SetStorageExtras(uint32_t flags, uint32_t expiry) {
+  extras_ = new char[8];
+  for (int i = 0; i < 4; i++) {
+    extras_[i] = (flags >> (24 - 8 * i)) & 0xff;
+    extras_[4 + i] = (expiry >> (24 - 8 * i)) & 0xff;
+  }
+  extras_size_ = 8;
+}
+
 int Request::CalculateRequestSize() const {
   int request_size_bytes = sizeof(struct RequestHeader) + extras_size_
                            + key_.size() + value_.size();
   return request_size_bytes;
 }
 
-GetRequest::GetRequest(string key) : Request(key, "") {}
+GetRequest::GetRequest(string key)
+    : Request(key, ""),
+      fill_expiry_(0),
+      fill_value_size_(MAX_VALUE_SIZE) {}
 
 void GetRequest::UpdateStatistics(StatisticsCollection* statistics_collection) {
-  statistics_collection->AddSample("get_requests", 1);
-  statistics_collection->AddSample("get_request_size", CalculateRequestSize());
+  statistics_collection->AddSample(kGetRequestsStatistic, 1);
+  statistics_collection->AddSample(kGetRequestSizeStatistic,
+                                   CalculateRequestSize());
 }
 
 void GetRequest::Print() {
@@ -127,28 +180,124 @@ void GetRequest::Print() {
   printf("  Key: %s\n", key_.c_str());
 }
 
-SetRequest::SetRequest(string key, string value) : Request(key, value) {
-  extras_ = new char[8];
-  extras_[0] = 0xde;
-  extras_[1] = 0xad;
-  extras_[2] = 0xbe;
-  extras_[3] = 0xef;
-  extras_[4] = 0x00;
-  extras_[5] = 0x00;
-  extras_[6] = 0x00;
-  extras_[7] = 0x00;
-  extras_size_ = 8;
+// The batch goes to the server that owns its first key, which the caller
+// makes sure owns the rest too.
+MultiGetRequest::MultiGetRequest(const vector<string>& keys)
+    : Request(keys.front(), ""),
+      keys_(keys) {}
+
+// Builds one buffer holding a GETKQ for each key and the closing NOOP, all
+// carrying the batch's opaque, so the batch goes out in a single write.
+char* MultiGetRequest::ConstructRequestPacket(int* request_size_bytes) {
+  *request_size_bytes = (keys_.size() + 1) * sizeof(struct RequestHeader);
+  for (vector<string>::const_iterator it = keys_.begin();
+       it != keys_.end();
+       it++) {
+    *request_size_bytes += it->size();
+  }
+  char* request_buffer = new char[*request_size_bytes];
+  char* ptr = request_buffer;
+  struct RequestHeader request_header;
+  for (vector<string>::const_iterator it = keys_.begin();
+       it != keys_.end();
+       it++) {
+    SetRequestHeader(OPCODE_GETKQ, 0, it->size(), 0, opaque_,
+                     &request_header);
+    memcpy(ptr, &request_header, sizeof(struct RequestHeader));
+    ptr += sizeof(struct RequestHeader);
+    memcpy(ptr, it->c_str(), it->size());
+    ptr += it->size();
+  }
+  SetRequestHeader(OPCODE_NOOP, 0, 0, 0, opaque_, &request_header);
+  memcpy(ptr, &request_header, sizeof(struct RequestHeader));
+
+  return request_buffer;
+}
+
+// Each key counts as a GET of its own.
+void MultiGetRequest::UpdateStatistics(
+                        StatisticsCollection* statistics_collection) {
+  for (vector<string>::const_iterator it = keys_.begin();
+       it != keys_.end();
+       it++) {
+    statistics_collection->AddSample(kGetRequestsStatistic, 1);
+    statistics_collection->AddSample(kGetRequestSizeStatistic,
+                                     sizeof(struct RequestHeader)
+                                     + it->size());
+  }
+}
+
+void MultiGetRequest::Print() {
+  printf("Multiget Request:\n");
+  for (vector<string>::const_iterator it = keys_.begin();
+       it != keys_.end();
+       it++) {
+    printf("  Key: %s\n", it->c_str());
+  }
+}
+
+SetRequest::SetRequest(string key, string value,
+                       uint32_t flags, uint32_t expiry)
+    : Request(key, value),
+      expiry_(expiry),
+      flags_(flags) {
+  SetStorageExtras(flags, expiry);
 }
 
 void SetRequest::UpdateStatistics(StatisticsCollection* statistics_collection) {
-  statistics_collection->AddSample("set_requests", 1);
-  statistics_collection->AddSample("set_request_size", CalculateRequestSize());
+  statistics_collection->AddSample(kSetRequestsStatistic, 1);
+  statistics_collection->AddSample(kSetRequestSizeStatistic,
+                                   CalculateRequestSize());
 }
 
 void SetRequest::Print() {
   printf("Set Request:\n");
   printf("  Key: %s\n", key_.c_str());
   printf("  Value: %s\n", value_.c_str());
+  printf("  Flags: 0x%08x\n", flags_);
+  printf("  Expiry: %u\n", expiry_);
+}
+
+AddRequest::AddRequest(string key, string value,
+                       uint32_t flags, uint32_t expiry)
+    : SetRequest(key, value, flags, expiry) {}
+
+void AddRequest::UpdateStatistics(StatisticsCollection* statistics_collection) {
+  statistics_collection->AddSample(kAddRequestsStatistic, 1);
+  statistics_collection->AddSample(kSetRequestSizeStatistic,
+                                   CalculateRequestSize());
+}
+
+ReplaceRequest::ReplaceRequest(string key, string value,
+                               uint32_t flags, uint32_t expiry)
+    : SetRequest(key, value, flags, expiry) {}
+
+void ReplaceRequest::UpdateStatistics(
+                       StatisticsCollection* statistics_collection) {
+  statistics_collection->AddSample(kReplaceRequestsStatistic, 1);
+  statistics_collection->AddSample(kSetRequestSizeStatistic,
+                                   CalculateRequestSize());
+}
+
+TouchRequest::TouchRequest(string key, uint32_t expiry)
+    : Request(key, ""),
+      expiry_(expiry) {
+  extras_ = new char[4];
+  for (int i = 0; i < 4; i++) {
+    extras_[i] = (expiry >> (24 - 8 * i)) & 0xff;
+  }
+  extras_size_ = 4;
+}
+
+void TouchRequest::UpdateStatistics(
+                     StatisticsCollection* statistics_collection) {
+  statistics_collection->AddSample(kTouchRequestsStatistic, 1);
+}
+
+void TouchRequest::Print() {
+  printf("Touch Request:\n");
+  printf("  Key: %s\n", key_.c_str());
+  printf("  Expiry: %u\n", expiry_);
 }
 
 }  // namespace cachebash
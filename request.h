@@ -32,7 +32,9 @@
 #ifndef REQUEST_H_
 #define REQUEST_H_
 
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "cachebash/statistic.h"
 
@@ -42,13 +44,42 @@
 #define OPCODE_GET     static_cast<char>(0x00)
 #define OPCODE_SET     static_cast<char>(0x01)
 #define OPCODE_GETQ    static_cast<char>(0x09)
+#define OPCODE_NOOP    static_cast<char>(0x0a)
+#define OPCODE_GETKQ   static_cast<char>(0x0d)
 #define OPCODE_INCR    static_cast<char>(0x05)
 #define OPCODE_DEL     static_cast<char>(0x04)
 #define OPCODE_ADD     static_cast<char>(0x02)
 #define OPCODE_REP     static_cast<char>(0x03)
+#define OPCODE_TOUCH   static_cast<char>(0x1c)
 
 namespace cachebash {
 
+// The flags stored with items unless configured otherwise.
+static const uint32_t kDefaultFlags = 0xdeadbeef;
+// The longest expiry memcached takes as seconds from now: 30 days. It
+// reads anything longer as a Unix time, which would be long past.
+static const uint32_t kMaxRelativeExpiry = 60 * 60 * 24 * 30;
+
+class FanoutRequest;
+
+// When a request passed each stage on the client, to tell how much of its
+// latency is the client's own.
+struct StageTimes {
+  // When it was due on the request rate's schedule, or when the worker
+  // got to it without a rate.
+  struct timeval scheduled;
+  struct timeval generated;
+  struct timeval written;
+  // When its response became readable. This includes the time the event
+  // loop took to get to the connection.
+  struct timeval first_byte;
+  struct timeval parsed;
+};
+
+// Records the time |stage_times| spent in each stage, in seconds.
+void RecordStageTimes(const StageTimes& stage_times,
+                      StatisticsCollection* statistics_collection);
+
 struct RequestHeader {
   char magic;
   char opcode;
@@ -68,43 +99,160 @@ class Request {
   Request(string key, string value);
   virtual ~Request();
   int CalculateRequestSize() const;
-  char* ConstructRequestPacket(int* request_size_bytes);
+  virtual char* ConstructRequestPacket(int* request_size_bytes);
   char* extras() const { return extras_; }
+  // The fan-out this request is one shard's sub-request of, if any.
+  FanoutRequest* fanout() const { return fanout_; }
+  int fanout_shard() const { return fanout_shard_; }
+  // True for a SET that fills the cache after a miss.
+  bool fill() const { return fill_; }
+  // When the application operation this request is part of began. For a
+  // fill, that's when the GET that missed was sent.
+  struct timeval application_start_time() const {
+    return application_start_time_;
+  }
+  // True for the backup copy of a hedged request.
+  bool hedge() const { return hedge_; }
+  // Whether the request's stages are being timed, which starts with the
+  // first call to mutable_stage_times().
+  bool has_stage_times() const { return has_stage_times_; }
 
   string key() const { return key_; }
 
   virtual char op_code() = 0;
+  // A value the server reflects back in its response.
+  uint32_t opaque() const { return opaque_; }
   virtual void Print() = 0;
+  // True for the copy of a write that keeps the key's replica server in
+  // step for hedged GETs.
+  bool replica() const { return replica_; }
   struct timeval send_time() const { return send_time_; }
 
+  void set_fanout(FanoutRequest* fanout, int fanout_shard) {
+    fanout_ = fanout;
+    fanout_shard_ = fanout_shard;
+  }
+  void set_fill(struct timeval application_start_time) {
+    fill_ = true;
+    application_start_time_ = application_start_time;
+  }
+  void set_hedge(bool hedge) { hedge_ = hedge; }
+  void set_opaque(uint32_t opaque) { opaque_ = opaque; }
+  void set_replica(bool replica) { replica_ = replica; }
   void set_send_time(struct timeval send_time) { send_time_ = send_time; }
+  const StageTimes& stage_times() const { return stage_times_; }
+  StageTimes* mutable_stage_times() {
+    has_stage_times_ = true;
+    return &stage_times_;
+  }
 
   virtual void UpdateStatistics(StatisticsCollection* statistic_collection) = 0;
   string value() const { return value_; }
+  // The size of the value the request stores or expects.
+  virtual int value_size() const { return value_.size(); }
 
  protected:
+  void SetStorageExtras(uint32_t flags, uint32_t expiry);
+
+  struct timeval application_start_time_;
   char* extras_;
   int extras_size_;
+  FanoutRequest* fanout_;
+  int fanout_shard_;
+  bool fill_;
+  bool has_stage_times_;
+  bool hedge_;
   string key_;
   char op_code_;
+  uint32_t opaque_;
+  bool replica_;
   struct timeval send_time_;
+  StageTimes stage_times_;
   string value_;
 };
 
+// Stores |value| with |flags| for |expiry| seconds, or forever if 0.
 class SetRequest : public Request {
  public:
-  SetRequest(string key, string value);
+  SetRequest(string key, string value,
+             uint32_t flags = kDefaultFlags, uint32_t expiry = 0);
+  uint32_t expiry() const { return expiry_; }
+  uint32_t flags() const { return flags_; }
   virtual char op_code() { return OPCODE_SET; }
   virtual void UpdateStatistics(StatisticsCollection* statistic_collection);
   virtual void Print();
+
+ private:
+  uint32_t expiry_;
+  uint32_t flags_;
+};
+
+// A SET that only stores the item if the key isn't already cached.
+class AddRequest : public SetRequest {
+ public:
+  AddRequest(string key, string value, uint32_t flags, uint32_t expiry);
+  virtual char op_code() { return OPCODE_ADD; }
+  virtual void UpdateStatistics(StatisticsCollection* statistic_collection);
+};
+
+// A SET that only stores the item if the key is already cached.
+class ReplaceRequest : public SetRequest {
+ public:
+  ReplaceRequest(string key, string value, uint32_t flags, uint32_t expiry);
+  virtual char op_code() { return OPCODE_REP; }
+  virtual void UpdateStatistics(StatisticsCollection* statistic_collection);
+};
+
+// Resets the expiry of a cached item without fetching it.
+class TouchRequest : public Request {
+ public:
+  TouchRequest(string key, uint32_t expiry);
+  uint32_t expiry() const { return expiry_; }
+  virtual char op_code() { return OPCODE_TOUCH; }
+  virtual void UpdateStatistics(StatisticsCollection* statistic_collection);
+  virtual void Print();
+
+ private:
+  uint32_t expiry_;
 };
 
 class GetRequest : public Request {
  public:
   explicit GetRequest(string key);
+  // The expiry of the value to fill the cache with if the GET misses.
+  uint32_t fill_expiry() const { return fill_expiry_; }
+  // The size of the value to fill the cache with if the GET misses.
+  int fill_value_size() const { return fill_value_size_; }
   virtual char op_code() { return OPCODE_GET; }
+  void set_fill_expiry(uint32_t fill_expiry) { fill_expiry_ = fill_expiry; }
+  void set_fill_value_size(int fill_value_size) {
+    fill_value_size_ = fill_value_size;
+  }
   virtual void UpdateStatistics(StatisticsCollection* statistic_collection);
+  virtual int value_size() const { return fill_value_size_; }
   virtual void Print();
+
+ private:
+  uint32_t fill_expiry_;
+  int fill_value_size_;
+};
+
+// A batch of GETs for keys on one server, sent as a GETKQ per key and then
+// a NOOP. memcached stays silent on the keys that miss and answers the
+// NOOP only after every key before it, so the NOOP's response completes
+// the batch.
+class MultiGetRequest : public Request {
+ public:
+  explicit MultiGetRequest(const vector<string>& keys);
+  virtual char* ConstructRequestPacket(int* request_size_bytes);
+  const vector<string>& keys() const { return keys_; }
+  int n_keys() const { return keys_.size(); }
+  virtual char op_code() { return OPCODE_GETKQ; }
+  virtual void UpdateStatistics(StatisticsCollection* statistic_collection);
+  virtual void Print();
+
+ private:
+  vector<string> keys_;
 };
 
 }  // namespace cachebash
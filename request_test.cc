@@ -32,12 +32,20 @@
 #include "cachebash/request.h"
 
 #include <string>
+#include <vector>
 
+#include "cachebash/statistic.h"
 #include "gtest/gtest.h"
 
 using cachebash::GetRequest;
+using cachebash::MultiGetRequest;
+using cachebash::StageTimes;
+using cachebash::Statistic;
+using cachebash::StatisticsCollection;
 using cachebash::SetRequest;
+using cachebash::TouchRequest;
 using std::string;
+using std::vector;
 
 namespace {
 
@@ -80,25 +88,32 @@ TEST_F(SetRequestTest, Accessors) {
   EXPECT_STREQ(value.c_str(), request.value().c_str());
 }
 
+// Checks that |packet| is |expected_header| followed by |body|.
+void ExpectPacket(const unsigned char* expected_header, int header_size,
+                  const string& body, const char* packet, int packet_size) {
+  ASSERT_EQ(header_size + static_cast<int>(body.size()), packet_size);
+  for (int i = 0; i < header_size; i++) {
+    EXPECT_EQ(expected_header[i], static_cast<unsigned char>(packet[i]))
+        << i << "th packet is wrong";
+  }
+  EXPECT_EQ(body, string(packet + header_size, body.size()));
+}
+
 // Test formatting of get request packet.
 TEST_F(GetRequestTest, RequestPacketConstruction) {
   string key = "foo";
   GetRequest request(key);
   int packet_size = 0;
   char* packet = request.ConstructRequestPacket(&packet_size);
-  char expected_packet[] =
+  unsigned char expected_header[] =
   { 0x80, 0x00, 0x00, 0x3,   // 0-3   magic, type, key length(2)
     0x00, 0x00, 0x00, 0x00,  // 4-7   extra_length, data type, reserved(2)
     0x00, 0x00, 0x00, 0x03,  // 8-11  total body (4)
     0x00, 0x00, 0x00, 0x00,  // 12-15 opaque (4)
     0x00, 0x00, 0x00, 0x00,  // 16-19 CAS (8)
-    0x00, 0x00, 0x00, 0x00,  // 20-13
-    key[0],   key[1],   key[2] };  // Key and value variable length
-
-  EXPECT_EQ(static_cast<int>(sizeof(expected_packet)), packet_size);
-  for (int i = 0; i < static_cast<int>(sizeof(expected_packet)); i++) {
-    EXPECT_EQ(expected_packet[i], packet[i]) << i << "th packet is wrong";
-  }
+    0x00, 0x00, 0x00, 0x00 };  // 20-23
+  ExpectPacket(expected_header, sizeof(expected_header), key, packet,
+               packet_size);
 }
 
 // Test getter and setter methods.
@@ -108,6 +123,44 @@ TEST_F(GetRequestTest, Accessors) {
   EXPECT_STREQ(key.c_str(), request.key().c_str());
 }
 
+// A multiget is a GETKQ per key and a NOOP, all with the batch's opaque.
+TEST(MultiGetRequestTest, RequestPacketConstruction) {
+  vector<string> keys;
+  keys.push_back("foo");
+  keys.push_back("quux");
+  MultiGetRequest request(keys);
+  request.set_opaque(0x01020304);
+  int packet_size = 0;
+  char* packet = request.ConstructRequestPacket(&packet_size);
+  unsigned char first_header[] =
+  { 0x80, 0x0d, 0x00, 0x03,  // 0-3   magic, type, key length(2)
+    0x00, 0x00, 0x00, 0x00,  // 4-7   extra_length, data type, reserved(2)
+    0x00, 0x00, 0x00, 0x03,  // 8-11  total body (4)
+    0x01, 0x02, 0x03, 0x04,  // 12-15 opaque (4)
+    0x00, 0x00, 0x00, 0x00,  // 16-19 CAS (8)
+    0x00, 0x00, 0x00, 0x00 };  // 20-23
+  unsigned char second_header[] =
+  { 0x80, 0x0d, 0x00, 0x04,
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x04,
+    0x01, 0x02, 0x03, 0x04,
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00 };
+  unsigned char noop_header[] =
+  { 0x80, 0x0a, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x01, 0x02, 0x03, 0x04,
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00 };
+  ASSERT_EQ(3 * 24 + 7, packet_size);
+  ExpectPacket(first_header, sizeof(first_header), "foo", packet, 27);
+  ExpectPacket(second_header, sizeof(second_header), "quux", packet + 27,
+               28);
+  ExpectPacket(noop_header, sizeof(noop_header), "", packet + 55, 24);
+  delete[] packet;
+}
+
 // Test formatting of set packet.
 TEST_F(SetRequestTest, RequestPacketConstruction) {
   string key = "foo";
@@ -115,20 +168,134 @@ TEST_F(SetRequestTest, RequestPacketConstruction) {
   SetRequest request(key, value);
   int packet_size = 0;
   char* packet = request.ConstructRequestPacket(&packet_size);
-  char expected_packet[] =
+  unsigned char expected_header[] =
   { 0x80, 0x01, 0x00, 0x3,   // 0-3   magic, type, key length(2)
     0x08, 0x00, 0x00, 0x00,  // 4-7   extra_length, data type, reserved(2)
     0x00, 0x00, 0x00, 0x0E,  // 8-11  total body (4)
     0x00, 0x00, 0x00, 0x00,  // 12-15 opaque (4)
     0x00, 0x00, 0x00, 0x00,  // 16-19 CAS (8)
-    0x00, 0x00, 0x00, 0x00,  // 20-13
+    0x00, 0x00, 0x00, 0x00,  // 20-23
     0xde, 0xad, 0xbe, 0xef,  // 24-27 Extras(8) (4 for flags)
-    0x00, 0x00, 0x00, 0x00,  // 28-31 (4 for expir)
-    key[0],   key[1],   key[2],  // Key and value variable length
-    value[0], value[1], value[2]    };
-  EXPECT_EQ(static_cast<int>(sizeof(expected_packet)), packet_size);
-  for (int i = 0; i < static_cast<int>(sizeof(expected_packet)); i++) {
-    EXPECT_EQ(expected_packet[i], packet[i]) << i << "th packet is wrong";
+    0x00, 0x00, 0x00, 0x00 };  // 28-31 (4 for expir)
+  ExpectPacket(expected_header, sizeof(expected_header), key + value, packet,
+               packet_size);
+}
+
+// Test that flags and expiry are written big endian into the extras.
+TEST_F(SetRequestTest, FlagsAndExpiry) {
+  SetRequest request("foo", "bar", 0x01020304, 3600);
+  EXPECT_EQ(0x01020304u, request.flags());
+  EXPECT_EQ(3600u, request.expiry());
+  int packet_size = 0;
+  char* packet = request.ConstructRequestPacket(&packet_size);
+  char expected_extras[] =
+  { 0x01, 0x02, 0x03, 0x04,  // 24-27 flags
+    0x00, 0x00, 0x0e, 0x10 };  // 28-31 expiry
+  for (int i = 0; i < static_cast<int>(sizeof(expected_extras)); i++) {
+    EXPECT_EQ(expected_extras[i], packet[24 + i]) << i << "th extra is wrong";
   }
+  delete[] packet;
+}
+
+// ADDs and REPLACEs are storage traffic, sized with the SETs.
+TEST(AddRequestTest, UpdateStatistics) {
+  StatisticsCollection collection(NULL);
+  collection.RegisterStandardStatistics();
+  cachebash::AddRequest add_request("foo", "bar", 0, 0);
+  add_request.UpdateStatistics(&collection);
+  cachebash::ReplaceRequest replace_request("foo", "barbaz", 0, 0);
+  replace_request.UpdateStatistics(&collection);
+  EXPECT_EQ(1, collection.GetStatistic("add_requests")->GetCount());
+  EXPECT_EQ(1, collection.GetStatistic("replace_requests")->GetCount());
+  Statistic* request_size = collection.GetStatistic("set_request_size");
+  EXPECT_EQ(2, request_size->GetCount());
+  EXPECT_EQ(add_request.CalculateRequestSize()
+            + replace_request.CalculateRequestSize(),
+            request_size->GetSum());
+}
+
+// Test formatting of touch packet.
+TEST(TouchRequestTest, RequestPacketConstruction) {
+  TouchRequest request("foo", 60);
+  int packet_size = 0;
+  char* packet = request.ConstructRequestPacket(&packet_size);
+  unsigned char expected_header[] =
+  { 0x80, 0x1c, 0x00, 0x03,  // 0-3   magic, type, key length(2)
+    0x04, 0x00, 0x00, 0x00,  // 4-7   extra_length, data type, reserved(2)
+    0x00, 0x00, 0x00, 0x07,  // 8-11  total body (4)
+    0x00, 0x00, 0x00, 0x00,  // 12-15 opaque (4)
+    0x00, 0x00, 0x00, 0x00,  // 16-19 CAS (8)
+    0x00, 0x00, 0x00, 0x00,  // 20-23
+    0x00, 0x00, 0x00, 0x3c };  // 24-27 Extras(4) (expiry)
+  ExpectPacket(expected_header, sizeof(expected_header), "foo", packet,
+               packet_size);
+  delete[] packet;
+}
+
+// Test formatting of add packet.
+TEST(AddRequestTest, RequestPacketConstruction) {
+  cachebash::AddRequest request("foo", "bar", 0xdeadbeef, 60);
+  int packet_size = 0;
+  char* packet = request.ConstructRequestPacket(&packet_size);
+  unsigned char expected_header[] =
+  { 0x80, 0x02, 0x00, 0x03,  // 0-3   magic, type, key length(2)
+    0x08, 0x00, 0x00, 0x00,  // 4-7   extra_length, data type, reserved(2)
+    0x00, 0x00, 0x00, 0x0e,  // 8-11  total body (4)
+    0x00, 0x00, 0x00, 0x00,  // 12-15 opaque (4)
+    0x00, 0x00, 0x00, 0x00,  // 16-19 CAS (8)
+    0x00, 0x00, 0x00, 0x00,  // 20-23
+    0xde, 0xad, 0xbe, 0xef,  // 24-27 Extras(8) (4 for flags)
+    0x00, 0x00, 0x00, 0x3c };  // 28-31 (4 for expiry)
+  ExpectPacket(expected_header, sizeof(expected_header), "foobar", packet,
+               packet_size);
+  delete[] packet;
+}
+
+// Test formatting of replace packet.
+TEST(ReplaceRequestTest, RequestPacketConstruction) {
+  cachebash::ReplaceRequest request("foo", "bar", 0xdeadbeef, 60);
+  int packet_size = 0;
+  char* packet = request.ConstructRequestPacket(&packet_size);
+  unsigned char expected_header[] =
+  { 0x80, 0x03, 0x00, 0x03,  // 0-3   magic, type, key length(2)
+    0x08, 0x00, 0x00, 0x00,  // 4-7   extra_length, data type, reserved(2)
+    0x00, 0x00, 0x00, 0x0e,  // 8-11  total body (4)
+    0x00, 0x00, 0x00, 0x00,  // 12-15 opaque (4)
+    0x00, 0x00, 0x00, 0x00,  // 16-19 CAS (8)
+    0x00, 0x00, 0x00, 0x00,  // 20-23
+    0xde, 0xad, 0xbe, 0xef,  // 24-27 Extras(8) (4 for flags)
+    0x00, 0x00, 0x00, 0x3c };  // 28-31 (4 for expiry)
+  ExpectPacket(expected_header, sizeof(expected_header), "foobar", packet,
+               packet_size);
+  delete[] packet;
+}
+
+// Test that each stage is recorded as the time since the one before it.
+TEST(StageTimesTest, RecordStageTimes) {
+  GetRequest request("foo");
+  EXPECT_FALSE(request.has_stage_times());
+  StageTimes* stage_times = request.mutable_stage_times();
+  EXPECT_TRUE(request.has_stage_times());
+  stage_times->scheduled.tv_sec = 10;
+  stage_times->scheduled.tv_usec = 0;
+  stage_times->generated.tv_sec = 10;
+  stage_times->generated.tv_usec = 100;
+  stage_times->written.tv_sec = 10;
+  stage_times->written.tv_usec = 300;
+  stage_times->first_byte.tv_sec = 11;
+  stage_times->first_byte.tv_usec = 300;
+  stage_times->parsed.tv_sec = 11;
+  stage_times->parsed.tv_usec = 700;
+
+  StatisticsCollection collection(NULL);
+  collection.RegisterStandardStatistics();
+  cachebash::RecordStageTimes(request.stage_times(), &collection);
+  EXPECT_NEAR(100e-6, collection.GetStatistic("stage_generate")->GetAverage(),
+              1e-7);
+  EXPECT_NEAR(200e-6, collection.GetStatistic("stage_write")->GetAverage(),
+              1e-7);
+  EXPECT_NEAR(1.0, collection.GetStatistic("stage_wait")->GetAverage(), 1e-6);
+  EXPECT_NEAR(400e-6, collection.GetStatistic("stage_read")->GetAverage(),
+              1e-7);
 }
 }  // namespace
@@ -35,7 +35,17 @@
 
 namespace cachebash {
 
-Response::Response() : request_(NULL) {}
+Response::Response()
+    : request_(NULL),
+      size_(0),
+      status_(kNoError),
+      flags_(0),
+      has_flags_(false),
+      n_hits_(0),
+      op_code_(0),
+      opaque_(0),
+      value_size_(0),
+      wire_latency_(-1.0) {}
 
 Response::~Response() {
   delete request_;
@@ -44,7 +54,27 @@ Response::~Response() {
 Response* Response::CreateResponseFromHeader(
                       const ResponseHeader& response_header) {
   Response* response = new Response();
+  response->op_code_ = response_header.opcode;
+  response->status_ = ((response_header.status[0] & 0xff) << 8)
+                      | (response_header.status[1] & 0xff);
+  response->opaque_
+    = (static_cast<uint32_t>(response_header.opaque[0] & 0xff) << 24)
+      | (static_cast<uint32_t>(response_header.opaque[1] & 0xff) << 16)
+      | (static_cast<uint32_t>(response_header.opaque[2] & 0xff) << 8)
+      | static_cast<uint32_t>(response_header.opaque[3] & 0xff);
   return response;
 }
 
+// GET hits carry the item's flags as their only extras.
+void Response::ParseExtras(const char* extras, int extras_size) {
+  if (extras_size != 4) {
+    return;
+  }
+  flags_ = (static_cast<uint32_t>(extras[0] & 0xff) << 24)
+           | (static_cast<uint32_t>(extras[1] & 0xff) << 16)
+           | (static_cast<uint32_t>(extras[2] & 0xff) << 8)
+           | static_cast<uint32_t>(extras[3] & 0xff);
+  has_flags_ = true;
+}
+
 }  // namespace
@@ -32,6 +32,8 @@
 #ifndef RESPONSE_H_
 #define RESPONSE_H_
 
+#include <stdint.h>
+
 #include "cachebash/util.h"
 
 namespace cachebash {
@@ -69,14 +71,44 @@ class Response {
   virtual ~Response();
   static Response* CreateResponseFromHeader(
                      const ResponseHeader& response_header);
+  // The flags a GET hit returns with the item, if the response has them.
+  uint32_t flags() const { return flags_; }
+  bool has_flags() const { return has_flags_; }
+  // For a multiget, how many of its keys hit.
+  int n_hits() const { return n_hits_; }
+  char op_code() const { return op_code_; }
+  void ParseExtras(const char* extras, int extras_size);
+  void set_n_hits(int n_hits) { n_hits_ = n_hits; }
   void set_request(Request* request) { request_ = request; }
   Request* request() const { return request_; }
   void set_request_latency(float latency) { response_latency_ = latency; }
   float request_latency() const { return response_latency_; }
+  // Bytes on the wire, header included.
+  int size() const { return size_; }
+  void set_size(int size) { size_ = size; }
+  void set_value_size(int value_size) { value_size_ = value_size; }
+  int status() const { return status_; }
+  uint32_t opaque() const { return opaque_; }
+  // Bytes of the value the response carries, if any.
+  int value_size() const { return value_size_; }
+  // Seconds from the kernel sending the request's last byte to it
+  // receiving the response's first, or negative if the kernel didn't
+  // timestamp both.
+  void set_wire_latency(float latency) { wire_latency_ = latency; }
+  float wire_latency() const { return wire_latency_; }
 
  private:
   Request* request_;
   float response_latency_;
+  int size_;
+  int status_;
+  uint32_t flags_;
+  bool has_flags_;
+  int n_hits_;
+  char op_code_;
+  uint32_t opaque_;
+  int value_size_;
+  float wire_latency_;
 
   DISALLOW_COPY_AND_ASSIGN(Response);
 };
@@ -112,6 +112,8 @@ SizeKeyDistribution* SizeKeyDistribution::LoadFile(string filename) {
     entry->size = atoi(pch);
     pch = strtok_r(NULL, ", ", &save_ptr);
     entry->key = string(pch);
+    pch = strtok_r(NULL, ", ", &save_ptr);
+    entry->ttl = (pch != NULL) ? atoi(pch) : -1;
     size_key_entries[i] = entry;
     delete[] line_str;
     i++;
@@ -32,7 +32,8 @@
 // Loads distributions with the format (cdf, size, key) where cdf is
 // the cdf value of the popularity distribution for a given object
 // size/key pair. Size is the size of the object and key is a string
-// representing the object's key.
+// representing the object's key. An optional fourth column gives the
+// TTL in seconds of the object's key class.
 
 
 #ifndef SIZE_KEY_DISTRIBUTION_H_
@@ -50,6 +51,8 @@ struct SizeKeyEntry {
   float cdf;
   int size;
   string key;
+  // The TTL in seconds, or -1 if the file doesn't give one.
+  int ttl;
 };
 
 class SizeKeyDistribution {
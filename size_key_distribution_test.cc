@@ -31,11 +31,76 @@
 
 #include "cachebash/size_key_distribution.h"
 
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+
+#include "cachebash/config.h"
+#include "cachebash/generator.h"
+#include "cachebash/request.h"
+#include "cachebash/scoped_ptr.h"
 #include "gtest/gtest.h"
 
+using cachebash::Config;
+using cachebash::Generator;
+using cachebash::Request;
+using cachebash::SetRequest;
+using cachebash::SizeKeyDistribution;
+using cachebash::SizeKeyEntry;
+
 namespace {
 
+// Writes |contents| to a new temporary file, and returns its name.
+string WriteTemporaryFile(const string& contents) {
+  char filename[] = "/tmp/size_key_distribution_test_XXXXXX";
+  int fd = mkstemp(filename);
+  EXPECT_LE(0, fd);
+  EXPECT_EQ(static_cast<ssize_t>(contents.size()),
+            write(fd, contents.data(), contents.size()));
+  close(fd);
+  return filename;
+}
+
+// Loads a one key distribution from |contents|, and returns the expiry
+// of the SET the generator makes for its key.
+uint32_t GetGeneratedExpiry(const string& contents) {
+  string filename = WriteTemporaryFile(contents);
+  Config config;
+  config.size_key_distribution_ = SizeKeyDistribution::LoadFile(filename);
+  unlink(filename.c_str());
+  config.fraction_gets_ = 0.0;
+  Generator generator(&config);
+  scoped_ptr<Request> request(generator.GenerateNextRequest());
+  EXPECT_EQ(OPCODE_SET, request->op_code());
+  return static_cast<SetRequest*>(request.Get())->expiry();
+}
+
 TEST(SizeKeyDistributionTest, LoadFile) {
+  string filename = WriteTemporaryFile("0.25, 100, foo\n"
+                                       "1.0, 2000, bar, 60\n");
+  scoped_ptr<SizeKeyDistribution> distribution(
+      SizeKeyDistribution::LoadFile(filename));
+  unlink(filename.c_str());
+  ASSERT_EQ(2, distribution->n_entries());
+  SizeKeyEntry* foo = distribution->size_key_entries()[0];
+  EXPECT_FLOAT_EQ(0.25, foo->cdf);
+  EXPECT_EQ(100, foo->size);
+  EXPECT_EQ("foo", foo->key);
+  EXPECT_EQ(-1, foo->ttl);
+  SizeKeyEntry* bar = distribution->size_key_entries()[1];
+  EXPECT_FLOAT_EQ(1.0, bar->cdf);
+  EXPECT_EQ(2000, bar->size);
+  EXPECT_EQ("bar", bar->key);
+  EXPECT_EQ(60, bar->ttl);
+}
+
+// The TTL column sets the expiry of the key's SETs, and without it they
+// fall back to the configured TTL, which defaults to never expiring.
+TEST(SizeKeyDistributionTest, TtlReachesGeneratedSet) {
+  EXPECT_EQ(60u, GetGeneratedExpiry("1.0, 100, foo, 60\n"));
+  EXPECT_EQ(0u, GetGeneratedExpiry("1.0, 100, foo\n"));
+  EXPECT_EQ(cachebash::kMaxRelativeExpiry,
+            GetGeneratedExpiry("1.0, 100, foo, 31536000\n"));
 }
 
 }  // namespace
@@ -31,12 +31,17 @@
 #include "cachebash/statistic.h"
 
 #include <math.h>
+#include <string.h>
 #include <sys/time.h>
 #include <algorithm>
+#include <functional>
 #include <limits>
 #include <map>
 #include <string>
 #include <utility>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "cachebash/config.h"
 #include "cachebash/scoped_ptr.h"
@@ -69,6 +74,10 @@ StatisticPrinter* QuantilePrinter::Copy() {
   return new QuantilePrinter(quantile_);
 }
 
+void QuantilePrinter::AddQuantiles(vector<float>* quantiles) const {
+  quantiles->push_back(quantile_);
+}
+
 MaxPrinter::MaxPrinter() {}
 
 void MaxPrinter::Print(Statistic* statistic) {
@@ -92,7 +101,7 @@ StatisticPrinter* MinPrinter::Copy() {
 CountPrinter::CountPrinter() {}
 
 void CountPrinter::Print(Statistic* statistic) {
-  printf("Count: %d ", statistic->GetCount());
+  printf("Count: %lld ", static_cast<long long>(statistic->GetCount()));
 }
 
 StatisticPrinter* CountPrinter::Copy() {
@@ -101,19 +110,28 @@ StatisticPrinter* CountPrinter::Copy() {
 
 // Statistic functions.
 
-Statistic::Statistic(string name, bool cummulative)
+Statistic::Statistic(string name, bool cummulative, int significant_digits,
+                     StatisticBackend backend)
     : name_(name),
-      s0_(0.0),
+      s0_(0),
       s1_(0.0),
       s2_(0.0),
       min_(std::numeric_limits<float>::max()),
       max_(-std::numeric_limits<float>::max()),
       cummulative_(cummulative),
-      microsecond_histogram_(new Histogram(0.0, 1e-3, kBinsPerHistogram)),
-      millisecond_histogram_(new Histogram(1e-3, 1.0, kBinsPerHistogram)),
-      second_histogram_(new Histogram(1.0, 1000, kBinsPerHistogram)) {}
+      histogram_(NULL),
+      sketch_(NULL),
+      n_pending_samples_(0) {
+  if (backend == kDDSketchBackend) {
+    sketch_ = new DDSketch(kDefaultRelativeAccuracy);
+  } else {
+    histogram_ = new Histogram(significant_digits);
+  }
+}
 
 Statistic::~Statistic() {
+  delete histogram_;
+  delete sketch_;
   for (vector<StatisticPrinter*>::iterator it = statistic_printers_.begin();
        it != statistic_printers_.end();
        it++) {
@@ -123,150 +141,179 @@ Statistic::~Statistic() {
 
 void Statistic::AddStatisticPrinter(StatisticPrinter* statistic_printer) {
   statistic_printers_.push_back(statistic_printer);
+  statistic_printer->AddQuantiles(&printed_quantiles_);
 }
 
 void Statistic::Reset() {
-  s0_ = 0.0;
+  s0_ = 0;
   s1_ = 0.0;
   s2_ = 0.0;
   min_ = std::numeric_limits<float>::max();
   max_ = -std::numeric_limits<float>::max();
-  microsecond_histogram_->Reset();
-  millisecond_histogram_->Reset();
-  second_histogram_->Reset();
+  if (histogram_ != NULL) {
+    histogram_->Reset();
+  } else {
+    sketch_->Reset();
+  }
+  n_pending_samples_ = 0;
 }
 
 bool Statistic::IsCummulative() {
   return cummulative_;
 }
 
+// All the quantiles the printers want are computed up front, in a single
+// pass over the histogram, and GetQuantile() answers from them meanwhile.
 void Statistic::Print() {
   printf("%s - ", name_.c_str());
+  if (!printed_quantiles_.empty()) {
+    GetQuantiles(printed_quantiles_, &printed_quantile_values_);
+  }
   for (vector<StatisticPrinter*>::iterator it = statistic_printers_.begin();
        it != statistic_printers_.end();
        it++) {
     (*it)->Print(this);
   }
+  printed_quantile_values_.clear();
 }
 
+// Records the buffered samples. The moments and extremes are accumulated
+// over the whole batch before being folded in.
 // Distributions currently do not support negative numbers.
-void Statistic::AddSample(float value) {
-  s0_ += 1.0;
-  s1_ += value;
-  s2_ += value * value;
-  min_ = min(min_, value);
-  max_ = max(max_, value);
-
-  // TODO(davidmax@gmail.com) Support negative numbers.
-  if ( value < 0.0 ) {
+void Statistic::FlushSamples() {
+  if (n_pending_samples_ == 0) {
     return;
   }
-  // TODO(davidmax@gmail.com) Add tracking for dropped samples?
-  // I.e., too big, too small.
-  // TODO(davidmax@gmail.com) Consider replacing with InRange(value).
-  if (value < 1e-3) {
-    microsecond_histogram_->AddSample(value);
-  } else if (value >= 1e-3 && value < 1.0) {
-    millisecond_histogram_->AddSample(value);
-  } else if (value >= 1.0 && value < 1000) {
-    second_histogram_->AddSample(value);
+  double s1 = 0.0;
+  double s2 = 0.0;
+  float batch_min = min_;
+  float batch_max = max_;
+  for (int i = 0; i < n_pending_samples_; i++) {
+    float value = pending_samples_[i];
+    s1 += value;
+    s2 += static_cast<double>(value) * value;
+    batch_min = min(batch_min, value);
+    batch_max = max(batch_max, value);
+  }
+  s0_ += n_pending_samples_;
+  s1_ += s1;
+  s2_ += s2;
+  min_ = batch_min;
+  max_ = batch_max;
+
+  // TODO(davidmax@gmail.com) Support negative numbers.
+  if (histogram_ != NULL) {
+    histogram_->AddSamples(pending_samples_, n_pending_samples_);
   } else {
-    // TODO(davidmax@gmail.com) Remove this.
-    printf("value: %f\n", value);
-    LOG_FATAL("Unhandled Statistic value");
+    sketch_->AddSamples(pending_samples_, n_pending_samples_);
   }
+  n_pending_samples_ = 0;
 }
 
 
 // Create a deep copy of the Statistic.
 Statistic* Statistic::Copy() const {
-  Statistic* statistic = new Statistic(name_, cummulative_);
+  int significant_digits = histogram_ != NULL
+                           ? histogram_->significant_digits()
+                           : kDefaultSignificantDigits;
+  Statistic* statistic = new Statistic(name_, cummulative_,
+                                       significant_digits, backend());
   statistic->s0_ = s0_;
   statistic->s1_ = s1_;
   statistic->s2_ = s2_;
   statistic->min_ = min_;
   statistic->max_ = max_;
 
-  statistic->microsecond_histogram_ = microsecond_histogram_->Copy();
-  statistic->millisecond_histogram_ = millisecond_histogram_->Copy();
-  statistic->second_histogram_ = second_histogram_->Copy();
+  if (histogram_ != NULL) {
+    statistic->histogram_->MergeWithHistogram(*histogram_);
+  } else {
+    statistic->sketch_->MergeWithSketch(*sketch_);
+  }
+  memcpy(statistic->pending_samples_, pending_samples_,
+         n_pending_samples_ * sizeof(pending_samples_[0]));
+  statistic->n_pending_samples_ = n_pending_samples_;
 
   for (vector<StatisticPrinter*>::const_iterator
          it = statistic_printers_.begin();
        it != statistic_printers_.end();
        it++) {
-    statistic->statistic_printers_.push_back((*it)->Copy());
+    statistic->AddStatisticPrinter((*it)->Copy());
   }
   return statistic;
 }
 
-int Statistic::GetCount() {
+int64_t Statistic::GetCount() {
+  FlushSamples();
   return s0_;
 }
 
+int64_t Statistic::GetCountAtOrBelow(double value) {
+  FlushSamples();
+  if (histogram_ == NULL) {
+    return sketch_->GetCountAtOrBelow(value);
+  }
+  int64_t units = static_cast<int64_t>(value / kHistogramUnit + 0.5);
+  return histogram_->GetCountAtOrBelow(units);
+}
+
+float Statistic::GetMax() {
+  FlushSamples();
+  return max_;
+}
+
+float Statistic::GetMin() {
+  FlushSamples();
+  return min_;
+}
+
+// The histogram's estimate is kept within the exactly tracked extremes,
+// so the 0th and 100th percentiles are the min and max.
 float Statistic::GetQuantile(float quantile) {
-  // TODO(davidmax@gmail.com) Need better testing of quantile code.
-  // Still not convinced this is exactly correct.
   if (quantile < 0.0 || quantile > 1.0) {
     LOG_FATAL("Invalid quantile argument");
   }
-  int n_samples_needed = quantile * s0_;
-  // We can bypass a histogram if we know we need more samples than it has.
-  int n_samples = 0;
-
-  // Look at the microsecond histogram.
-  // We still need more samples even after adding this histogram's.
-  if (n_samples_needed > n_samples + microsecond_histogram_->n_samples()) {
-    n_samples += microsecond_histogram_->n_samples();
-  // The quantile falls in this histogram.
-  } else {
-    for (int i = 0; i < microsecond_histogram_->n_bins(); i++) {
-      n_samples += microsecond_histogram_->histogram()[i];
-      if (n_samples >= n_samples_needed) {
-        return i * microsecond_histogram_->max()
-               / static_cast<float>(microsecond_histogram_->n_bins());
-      }
+  for (size_t i = 0; i < printed_quantile_values_.size(); i++) {
+    if (printed_quantiles_[i] == quantile) {
+      return printed_quantile_values_[i];
     }
   }
-  // Look at the millisecond histogram.
-  // We still need more samples even after adding this histogram's.
-  if (n_samples_needed > n_samples + millisecond_histogram_->n_samples()) {
-    n_samples += millisecond_histogram_->n_samples();
-  // The quantile falls in this histogram.
+  vector<float> quantiles(1, quantile);
+  vector<float> values;
+  GetQuantiles(quantiles, &values);
+  return values[0];
+}
+
+void Statistic::GetQuantiles(const vector<float>& quantiles,
+                             vector<float>* values) {
+  FlushSamples();
+  int64_t n_samples = 0;
+  if (histogram_ != NULL) {
+    histogram_->GetQuantiles(quantiles, values);
+    n_samples = histogram_->n_samples();
   } else {
-    for (int i = 0; i < millisecond_histogram_->n_bins(); i++) {
-      n_samples += millisecond_histogram_->histogram()[i];
-      if (n_samples >= n_samples_needed) {
-        return i * millisecond_histogram_->max()
-               / static_cast<float>(millisecond_histogram_->n_bins());
-      }
-    }
+    sketch_->GetQuantiles(quantiles, values);
+    n_samples = sketch_->n_samples();
   }
-  // Look at the second histogram.
-  // We still need more samples even after adding this histogram's.
-  if (n_samples_needed > n_samples + second_histogram_->n_samples()) {
-    n_samples += second_histogram_->n_samples();
-  // The quantile falls in this histogram.
-  } else {
-    for (int i = 0; i < second_histogram_->n_bins(); i++) {
-      n_samples += second_histogram_->histogram()[i];
-      if (n_samples >= n_samples_needed) {
-        return i * second_histogram_->max()
-               / static_cast<float>(second_histogram_->n_bins());
-      }
-    }
+  if (n_samples == 0) {
+    return;
+  }
+  for (size_t i = 0; i < values->size(); i++) {
+    (*values)[i] = min(max((*values)[i], max(min_, 0.0f)), max_);
   }
-
-  return (second_histogram_->n_bins() - 1) * second_histogram_->max()
-           / static_cast<float>(second_histogram_->n_bins());
 }
 
 string Statistic::GetName() {
   return name_;
 }
 
+double Statistic::GetSum() {
+  FlushSamples();
+  return s1_;
+}
+
 // Calculates the average values of the statistic.
 float Statistic::GetAverage() {
+  FlushSamples();
   if (s0_ == 0) {
     return 0.0;
   } else {
@@ -275,13 +322,17 @@ float Statistic::GetAverage() {
 }
 
 float Statistic::GetSampleStandardDeviation() {
-  return sqrt((s0_ * s2_ - s1_ * s1_) / (s0_ * (s0_ - 1)));
+  FlushSamples();
+  double n = s0_;
+  return sqrt((n * s2_ - s1_ * s1_) / (n * (n - 1)));
 }
 
 // Calculates the standard deviation of the statistc.
 // Method from http://en.wikipedia.org/wiki/Standard_deviation
 float Statistic::GetStandardDeviation() {
-  return sqrt(s0_ * s2_ - s1_ * s1_) / s0_;
+  FlushSamples();
+  double n = s0_;
+  return sqrt(n * s2_ - s1_ * s1_) / n;
 }
 
 void Statistic::MergeWithStatistic(const Statistic& statistic) {
@@ -291,118 +342,702 @@ void Statistic::MergeWithStatistic(const Statistic& statistic) {
   s2_ = s2_ + statistic.s2_;
   min_ = min(min_, statistic.min_);
   max_ = max(max_, statistic.max_);
-  microsecond_histogram_->MergeWithHistogram(*statistic.microsecond_histogram_);
-  millisecond_histogram_->MergeWithHistogram(*statistic.millisecond_histogram_);
-  second_histogram_->MergeWithHistogram(*statistic.microsecond_histogram_);
-}
-
-Histogram::Histogram(float min, float max, int n_bins)
-  : histogram_(new int[n_bins]),
-    max_(max),
-    min_(min),
-    n_bins_(n_bins),
-    n_samples_(0) {
-      memset(histogram_, 0, sizeof(int) * n_bins);
-    }
+  if (backend() != statistic.backend()) {
+    LOG_FATAL("Can't merge statistics with different backends: " + name_);
+  }
+  if (histogram_ != NULL) {
+    histogram_->MergeWithHistogram(*statistic.histogram_);
+  } else {
+    sketch_->MergeWithSketch(*statistic.sketch_);
+  }
+  // Samples |statistic| hasn't recorded yet are buffered here instead.
+  for (int i = 0; i < statistic.n_pending_samples_; i++) {
+    AddSample(statistic.pending_samples_[i]);
+  }
+}
 
-Histogram::~Histogram() {
-  delete[] histogram_;
+// Sizes the sub-buckets so that adjacent values within a bucket differ
+// by at most one part in 10^|significant_digits|, following HdrHistogram
+// with a lowest discernible value of one unit.
+Histogram::Histogram(int significant_digits)
+    : n_samples_(0),
+      significant_digits_(significant_digits) {
+  if (significant_digits < 1 || significant_digits > kMaxSignificantDigits) {
+    LOG_FATAL("Histograms support 1 to 5 significant digits");
+  }
+  int64_t largest_value_with_single_unit_resolution = 2;
+  for (int i = 0; i < significant_digits; i++) {
+    largest_value_with_single_unit_resolution *= 10;
+  }
+  int sub_bucket_count_magnitude = static_cast<int>(
+      ceil(log(static_cast<double>(largest_value_with_single_unit_resolution))
+           / log(2.0)));
+  sub_bucket_half_count_magnitude_ = sub_bucket_count_magnitude - 1;
+  sub_bucket_count_ = 1 << sub_bucket_count_magnitude;
+  sub_bucket_half_count_ = sub_bucket_count_ / 2;
+  sub_bucket_mask_ = static_cast<int64_t>(sub_bucket_count_) - 1;
+}
+
+Histogram::~Histogram() {}
+
+void Histogram::AddCount(int index, int64_t count) {
+  if (index < 0 || count < 0) {
+    LOG_FATAL("Histograms can't hold negative counts");
+  }
+  if (index >= static_cast<int>(counts_.size())) {
+    counts_.resize(index + 1, 0);
+  }
+  counts_[index] += count;
+  n_samples_ += count;
 }
 
 Histogram* Histogram::Copy() const {
-  Histogram* histogram = new Histogram(min_, max_, n_bins_);
+  Histogram* histogram = new Histogram(significant_digits_);
   histogram->MergeWithHistogram(*this);
   return histogram;
 }
 
-void Histogram::AddSample(float value) {
-  // Add the sample to the historgram.
-  // Histograms are organized as follows:
-  // Assume we have 10 bins and cover the interval [1e-3, 1).
-  // Each bin might cover 999e-3/10 = 9.99e-2 = .0999 of space.
-  // However, it's much easier to understand if we have each
-  // cover .100 of space and truncate the first bin by .001.
-  // i.e.,
-  // bin  values
-  // 0    [.001, .100)
-  // 1    [.100, .200)
-  // 2    [.200, .300)
-  // ...
-  // 9    [.900, 1.0)
-  // With this scheme, the appropriate bin can be determined by:
-  // bin = int(value / .100)
-  //     = int(value / (max / num_bins))
-  // Assuming 1e-3 <= value < 1.
-  //
-  // Another example:
-  // 10 bins range [1e-6, 1e-3)
-  // bin  values
-  // 0    [1e-6, 1e-4)
-  // 1    [1e-4, 2e-4)
-  // 2    [2e-4, 3e-4)
-  // ...
-  // 9    [9e-4, 1e-3)
-  // bin = int(value / 1e-3/10)
-  // TODO(davidmax@gmail.com) Explains what happens with min = 0.
-  if (value < min_ || value >= max_) {
-    printf("Value: %f\n", value);
-    LOG_FATAL("Unexpected value");
-  }
-  int bin = static_cast<int>(value / (max_ / static_cast<float>(n_bins_)));
-  histogram_[bin]++;
+void Histogram::AddSample(double value) {
+  // Round to the nearest unit, clamping what the histogram can't track.
+  double units = value / kHistogramUnit + 0.5;
+  if (units >= kHistogramHighestTrackableValue) {
+    RecordValue(kHistogramHighestTrackableValue);
+  } else {
+    RecordValue(static_cast<int64_t>(units));
+  }
+}
+
+// Sets |indices| to the counts indices of |values| seconds. Negative
+// values get index 0, and are left for the caller to skip. With AVX2 four
+// values are indexed at a time: the bucket of a value is the exponent of
+// its double, which truncating it to units doesn't change, and its
+// sub-bucket is found by multiplying by the bucket's inverse power of
+// two, built from the exponent too. Otherwise each value is indexed by
+// GetCountsIndex.
+void Histogram::GetCountsIndices(const float* values, int n_values,
+                                 int* indices) const {
+  const double kHighestTrackableUnits = kHistogramHighestTrackableValue;
+  int i = 0;
+#ifdef __AVX2__
+  const __m256d unit = _mm256_set1_pd(kHistogramUnit);
+  const __m256d half = _mm256_set1_pd(0.5);
+  const __m256d highest = _mm256_set1_pd(kHighestTrackableUnits);
+  const __m256d zero = _mm256_setzero_pd();
+  // Values below a whole sub-bucket count all fall in bucket 0.
+  const __m256i exponent_bias = _mm256_set1_epi64x(
+                                  1023 + sub_bucket_half_count_magnitude_);
+  const __m256i max_exponent = _mm256_set1_epi64x(1023);
+  const __m256i low_halves = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i half_count = _mm_set1_epi32(sub_bucket_half_count_);
+  const __m128i magnitude = _mm_cvtsi32_si128(
+                              sub_bucket_half_count_magnitude_);
+  for (; i + 4 <= n_values; i += 4) {
+    __m256d value = _mm256_add_pd(
+        _mm256_div_pd(_mm256_cvtps_pd(_mm_loadu_ps(values + i)), unit),
+        half);
+    value = _mm256_max_pd(_mm256_min_pd(value, highest), zero);
+    __m256i bucket_index = _mm256_sub_epi64(
+        _mm256_srli_epi64(_mm256_castpd_si256(value), 52), exponent_bias);
+    bucket_index = _mm256_and_si256(
+        bucket_index,
+        _mm256_cmpgt_epi64(bucket_index, _mm256_setzero_si256()));
+    __m256d scale = _mm256_castsi256_pd(_mm256_slli_epi64(
+        _mm256_sub_epi64(max_exponent, bucket_index), 52));
+    __m128i sub_bucket_index = _mm256_cvttpd_epi32(
+                                 _mm256_mul_pd(value, scale));
+    __m128i bucket_index32 = _mm256_castsi256_si128(
+        _mm256_permutevar8x32_epi32(bucket_index, low_halves));
+    __m128i index = _mm_add_epi32(
+        _mm_sll_epi32(_mm_add_epi32(bucket_index32, one), magnitude),
+        _mm_sub_epi32(sub_bucket_index, half_count));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(indices + i), index);
+  }
+#endif
+  for (; i < n_values; i++) {
+    double value = max(min(values[i] / kHistogramUnit + 0.5,
+                           kHighestTrackableUnits), 0.0);
+    indices[i] = GetCountsIndex(static_cast<int64_t>(value));
+  }
+}
+
+// Converts the whole batch to counts indices before touching the counts,
+// so the counts only need to grow once.
+void Histogram::AddSamples(const float* values, int n_values) {
+  int indices[kSampleBatchSize];
+  while (n_values > 0) {
+    int n_batch = min(n_values, kSampleBatchSize);
+    GetCountsIndices(values, n_batch, indices);
+    int max_index = -1;
+    for (int i = 0; i < n_batch; i++) {
+      max_index = max(max_index, (values[i] >= 0.0) ? indices[i] : -1);
+    }
+    if (max_index >= static_cast<int>(counts_.size())) {
+      counts_.resize(max_index + 1, 0);
+    }
+    for (int i = 0; i < n_batch; i++) {
+      if (values[i] >= 0.0) {
+        counts_[indices[i]]++;
+        n_samples_++;
+      }
+    }
+    values += n_batch;
+    n_values -= n_batch;
+  }
+}
+
+void Histogram::RecordValue(int64_t value) {
+  if (value < 0) {
+    LOG_FATAL("Histograms can't record negative values");
+  }
+  int index = GetCountsIndex(value);
+  if (index >= static_cast<int>(counts_.size())) {
+    counts_.resize(index + 1, 0);
+  }
+  counts_[index]++;
   n_samples_++;
 }
 
-// TODO(davidmax@gmail.com) Consider adding interpolation.
+// The first half of the sub-buckets of bucket 0 is laid out first, then
+// the upper half of every bucket in turn, since the lower half of each
+// bucket after the first overlaps the bucket before it.
+int Histogram::GetCountsIndex(int64_t value) const {
+  int bucket_index = 63 - sub_bucket_half_count_magnitude_
+                     - __builtin_clzll(value | sub_bucket_mask_);
+  int sub_bucket_index = static_cast<int>(value >> bucket_index);
+  return ((bucket_index + 1) << sub_bucket_half_count_magnitude_)
+         + (sub_bucket_index - sub_bucket_half_count_);
+}
+
+// The lowest value recorded in the count at |index|.
+int64_t Histogram::GetValueFromIndex(int index) const {
+  int bucket_index = (index >> sub_bucket_half_count_magnitude_) - 1;
+  int sub_bucket_index = (index & (sub_bucket_half_count_ - 1))
+                         + sub_bucket_half_count_;
+  if (bucket_index < 0) {
+    sub_bucket_index -= sub_bucket_half_count_;
+    bucket_index = 0;
+  }
+  return static_cast<int64_t>(sub_bucket_index) << bucket_index;
+}
+
+// How many distinct values are recorded in the count at |index|.
+int64_t Histogram::GetEquivalentRangeSize(int index) const {
+  int bucket_index = (index >> sub_bucket_half_count_magnitude_) - 1;
+  if (bucket_index < 0) {
+    bucket_index = 0;
+  }
+  return static_cast<int64_t>(1) << bucket_index;
+}
+
+int64_t Histogram::GetCountAtOrBelow(int64_t value) const {
+  int last_index = min(GetCountsIndex(value),
+                       static_cast<int>(counts_.size()) - 1);
+  int64_t n_samples = 0;
+  for (int i = 0; i <= last_index; i++) {
+    n_samples += counts_[i];
+  }
+  return n_samples;
+}
+
+int64_t Histogram::GetMaxValue() const {
+  for (int i = static_cast<int>(counts_.size()) - 1; i >= 0; i--) {
+    if (counts_[i] != 0) {
+      return GetValueFromIndex(i) + GetEquivalentRangeSize(i) - 1;
+    }
+  }
+  return 0;
+}
+
+// Interpolates linearly within the count the quantile falls into, as if
+// its samples were spread evenly over the values it covers.
 float Histogram::GetQuantile(float quantile) const {
-  if (quantile < 0.0 || quantile > 1.0) {
-    LOG_FATAL("Invalid quantile argument");
+  vector<float> quantiles(1, quantile);
+  vector<float> values;
+  GetQuantiles(quantiles, &values);
+  return values[0];
+}
+
+// The quantiles are answered in increasing order while keeping a running
+// sum of the counts, so the counts are only walked once however many
+// quantiles there are.
+void Histogram::GetQuantiles(const vector<float>& quantiles,
+                             vector<float>* values) const {
+  vector<std::pair<double, int> > ranks;
+  for (size_t i = 0; i < quantiles.size(); i++) {
+    if (quantiles[i] < 0.0 || quantiles[i] > 1.0) {
+      LOG_FATAL("Invalid quantile argument");
+    }
+    ranks.push_back(std::make_pair(quantiles[i] * n_samples_, i));
   }
-  int n_samples_needed = static_cast<int>(quantile * n_samples_);
-  int n_samples = 0;
-  int bin = 0;
-  for (int i = 0; i < n_bins_; i++) {
-    n_samples += histogram_[i];
-    if (n_samples >= n_samples_needed) {
-      bin = i;
-      break;
+  values->assign(quantiles.size(), 0.0);
+  if (n_samples_ == 0) {
+    return;
+  }
+  std::sort(ranks.begin(), ranks.end());
+
+  size_t next_rank = 0;
+  int64_t n_samples = 0;
+  int n_counts = counts_.size();
+  for (int i = 0; i < n_counts && next_rank < ranks.size(); i++) {
+    if (counts_[i] == 0) {
+      continue;
+    }
+    while (next_rank < ranks.size()
+           && n_samples + counts_[i] >= ranks[next_rank].first) {
+      double fraction = (ranks[next_rank].first - n_samples - 0.5)
+                        / counts_[i];
+      fraction = min(max(fraction, 0.0), 1.0);
+      double value = GetValueFromIndex(i)
+                     + fraction * (GetEquivalentRangeSize(i) - 1);
+      (*values)[ranks[next_rank].second] = value * kHistogramUnit;
+      next_rank++;
     }
+    n_samples += counts_[i];
+  }
+  for (; next_rank < ranks.size(); next_rank++) {
+    (*values)[ranks[next_rank].second] =
+        GetValueFromIndex(n_counts - 1) * kHistogramUnit;
   }
-  float x_value = bin * (max_ / static_cast<float>(n_bins_));
-  return x_value;
 }
 
+// Adds |other| to |counts| element-wise, four counts at a time with AVX2.
+static void AddCounts(int64_t* counts, const int64_t* other, int n_counts) {
+  int i = 0;
+#ifdef __AVX2__
+  for (; i + 4 <= n_counts; i += 4) {
+    __m256i sum = _mm256_add_epi64(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(counts + i)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(other + i)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(counts + i), sum);
+  }
+#endif
+  for (; i < n_counts; i++) {
+    counts[i] += other[i];
+  }
+}
+
+// Histograms with the same precision have the same layout, so merging is
+// exact.
 void Histogram::MergeWithHistogram(const Histogram& histogram) {
-  // TODO(davidmax@gmail.com) Make sure the histograms match.
-  for (int i = 0; i < n_bins_; i++) {
-    histogram_[i] += histogram.histogram()[i];
+  if (histogram.significant_digits_ != significant_digits_) {
+    LOG_FATAL("Tried to merge histograms of different precision");
+  }
+  if (histogram.n_samples_ == 0) {
+    return;
+  }
+  const vector<int64_t>& counts = histogram.counts_;
+  if (counts.size() > counts_.size()) {
+    counts_.resize(counts.size(), 0);
   }
-  n_samples_ += histogram.n_samples();
+  AddCounts(&counts_[0], &counts[0], counts.size());
+  n_samples_ += histogram.n_samples_;
+}
+
+// Both distributions are compared at the end of every count, which is as
+// fine as the histograms can resolve.
+double KolmogorovSmirnovStatistic(const Histogram& first,
+                                  const Histogram& second) {
+  if (first.significant_digits() != second.significant_digits()) {
+    LOG_FATAL("Tried to compare histograms of different precision");
+  }
+  if (first.n_samples() == 0 || second.n_samples() == 0) {
+    return 0.0;
+  }
+  const vector<int64_t>& first_counts = first.counts();
+  const vector<int64_t>& second_counts = second.counts();
+  size_t n_counts = max(first_counts.size(), second_counts.size());
+  int64_t first_n_samples = 0;
+  int64_t second_n_samples = 0;
+  double d = 0.0;
+  for (size_t i = 0; i < n_counts; i++) {
+    first_n_samples += i < first_counts.size() ? first_counts[i] : 0;
+    second_n_samples += i < second_counts.size() ? second_counts[i] : 0;
+    d = max(d, fabs(static_cast<double>(first_n_samples) / first.n_samples()
+                    - static_cast<double>(second_n_samples)
+                      / second.n_samples()));
+  }
+  return d;
+}
+
+// Uses the asymptotic Kolmogorov distribution, with Stephens' correction
+// for small samples.
+double KolmogorovSmirnovPValue(double d, int64_t n_first, int64_t n_second) {
+  if (n_first == 0 || n_second == 0) {
+    return 1.0;
+  }
+  double n = sqrt(static_cast<double>(n_first) * n_second
+                  / (n_first + n_second));
+  double lambda = (n + 0.12 + 0.11 / n) * d;
+  // The series converges too slowly to use here, where it is 1 anyway.
+  if (lambda < 0.2) {
+    return 1.0;
+  }
+  double p_value = 0.0;
+  double sign = 1.0;
+  for (int k = 1; k <= 100; k++) {
+    double term = sign * 2.0 * exp(-2.0 * k * k * lambda * lambda);
+    p_value += term;
+    if (fabs(term) < 1e-10) {
+      break;
+    }
+    sign = -sign;
+  }
+  return min(max(p_value, 0.0), 1.0);
 }
 
 void Histogram::Reset() {
-  memset(histogram_, 0, sizeof(int) * n_bins_);
+  counts_.assign(counts_.size(), 0);
   n_samples_ = 0;
 }
 
+DDSketch::DDSketch(double relative_accuracy)
+    : min_index_(0),
+      zero_count_(0),
+      n_samples_(0),
+      relative_accuracy_(relative_accuracy),
+      gamma_((1.0 + relative_accuracy) / (1.0 - relative_accuracy)),
+      inverse_log_gamma_(1.0 / log(gamma_)) {
+  if (relative_accuracy <= 0.0 || relative_accuracy >= 1.0) {
+    LOG_FATAL("DDSketch relative accuracy must be between 0 and 1");
+  }
+}
+
+void DDSketch::AddSamples(const float* values, int n_values) {
+  int indices[kSampleBatchSize];
+  while (n_values > 0) {
+    int n_batch = min(n_values, kSampleBatchSize);
+    int n_indexed = 0;
+    int low_index = std::numeric_limits<int>::max();
+    int high_index = std::numeric_limits<int>::min();
+    for (int i = 0; i < n_batch; i++) {
+      if (values[i] < 0.0) {
+        continue;
+      }
+      n_samples_++;
+      if (values[i] < kHistogramUnit) {
+        zero_count_++;
+        continue;
+      }
+      int index = GetIndex(values[i]);
+      indices[n_indexed++] = index;
+      low_index = min(low_index, index);
+      high_index = max(high_index, index);
+    }
+    if (n_indexed > 0) {
+      int kept_index = Extend(low_index, high_index);
+      for (int i = 0; i < n_indexed; i++) {
+        counts_[max(indices[i], kept_index) - min_index_]++;
+      }
+    }
+    values += n_batch;
+    n_values -= n_batch;
+  }
+}
+
+DDSketch* DDSketch::Copy() const {
+  DDSketch* sketch = new DDSketch(relative_accuracy_);
+  sketch->MergeWithSketch(*this);
+  return sketch;
+}
+
+int DDSketch::Extend(int low_index, int high_index) {
+  if (counts_.empty()) {
+    min_index_ = max(low_index, high_index - kMaxDDSketchBins + 1);
+    counts_.assign(high_index - min_index_ + 1, 0);
+    return min_index_;
+  }
+  int max_index = min_index_ + static_cast<int>(counts_.size()) - 1;
+  int new_max_index = max(max_index, high_index);
+  int new_min_index = max(min(min_index_, low_index),
+                          new_max_index - kMaxDDSketchBins + 1);
+  if (new_min_index != min_index_ || new_max_index != max_index) {
+    vector<int64_t> counts(new_max_index - new_min_index + 1, 0);
+    for (size_t i = 0; i < counts_.size(); i++) {
+      int index = max(min_index_ + static_cast<int>(i), new_min_index);
+      counts[index - new_min_index] += counts_[i];
+    }
+    counts_.swap(counts);
+    min_index_ = new_min_index;
+  }
+  return min_index_;
+}
+
+int64_t DDSketch::GetCountAtOrBelow(double value) const {
+  if (value < kHistogramUnit) {
+    return value < 0.0 ? 0 : zero_count_;
+  }
+  int last_index = min(GetIndex(value) - min_index_,
+                       static_cast<int>(counts_.size()) - 1);
+  int64_t n_samples = zero_count_;
+  for (int i = 0; i <= last_index; i++) {
+    n_samples += counts_[i];
+  }
+  return n_samples;
+}
+
+float DDSketch::GetQuantile(float quantile) const {
+  vector<float> quantiles(1, quantile);
+  vector<float> values;
+  GetQuantiles(quantiles, &values);
+  return values[0];
+}
+
+// Takes the same ranks as Histogram::GetQuantiles(), but answers with the
+// value whose relative error is the same to both ends of the bin.
+void DDSketch::GetQuantiles(const vector<float>& quantiles,
+                            vector<float>* values) const {
+  vector<std::pair<double, int> > ranks;
+  for (size_t i = 0; i < quantiles.size(); i++) {
+    if (quantiles[i] < 0.0 || quantiles[i] > 1.0) {
+      LOG_FATAL("Invalid quantile argument");
+    }
+    ranks.push_back(std::make_pair(quantiles[i] * n_samples_, i));
+  }
+  values->assign(quantiles.size(), 0.0);
+  if (n_samples_ == 0) {
+    return;
+  }
+  std::sort(ranks.begin(), ranks.end());
+
+  size_t next_rank = 0;
+  while (next_rank < ranks.size() && zero_count_ > 0
+         && zero_count_ >= ranks[next_rank].first) {
+    next_rank++;
+  }
+  int64_t n_samples = zero_count_;
+  int n_counts = counts_.size();
+  for (int i = 0; i < n_counts && next_rank < ranks.size(); i++) {
+    if (counts_[i] == 0) {
+      continue;
+    }
+    n_samples += counts_[i];
+    while (next_rank < ranks.size() && n_samples >= ranks[next_rank].first) {
+      (*values)[ranks[next_rank].second]
+        = GetValueFromIndex(min_index_ + i);
+      next_rank++;
+    }
+  }
+  for (; next_rank < ranks.size(); next_rank++) {
+    (*values)[ranks[next_rank].second]
+      = GetValueFromIndex(min_index_ + n_counts - 1);
+  }
+}
+
+double DDSketch::GetValueFromIndex(int index) const {
+  return 2.0 * pow(gamma_, index) / (gamma_ + 1.0);
+}
+
+void DDSketch::MergeWithSketch(const DDSketch& sketch) {
+  if (sketch.gamma_ != gamma_) {
+    LOG_FATAL("Can't merge DDSketches of different relative accuracy");
+  }
+  if (!sketch.counts_.empty()) {
+    int kept_index = Extend(sketch.min_index_,
+                            sketch.min_index_ + sketch.counts_.size() - 1);
+    for (size_t i = 0; i < sketch.counts_.size(); i++) {
+      int index = max(sketch.min_index_ + static_cast<int>(i), kept_index);
+      counts_[index - min_index_] += sketch.counts_[i];
+    }
+  }
+  zero_count_ += sketch.zero_count_;
+  n_samples_ += sketch.n_samples_;
+}
+
+void DDSketch::Reset() {
+  counts_.assign(counts_.size(), 0);
+  zero_count_ = 0;
+  n_samples_ = 0;
+}
+
+SpaceSaving::SpaceSaving(int capacity)
+    : capacity_(capacity),
+      n_added_(0) {
+  if (capacity <= 0) {
+    LOG_FATAL("Space-Saving needs at least one counter");
+  }
+}
+
+// A key without a counter takes over the smallest one, and inherits its
+// count as the bound on its error.
+void SpaceSaving::Add(const string& key, int64_t count) {
+  n_added_ += count;
+  map<string, Counter>::iterator it = counters_.find(key);
+  Counter counter = { 0, 0 };
+  if (it != counters_.end()) {
+    counter = it->second;
+  } else if (static_cast<int>(counters_.size()) == capacity_) {
+    set<pair<int64_t, string> >::iterator smallest
+      = counters_by_count_.begin();
+    counter.count = smallest->first;
+    counter.error = smallest->first;
+    counters_.erase(smallest->second);
+    counters_by_count_.erase(smallest);
+  }
+  counter.count += count;
+  SetCounter(key, counter);
+}
+
+int64_t SpaceSaving::GetUncountedBound() const {
+  if (static_cast<int>(counters_.size()) < capacity_) {
+    return 0;
+  }
+  return counters_by_count_.begin()->first;
+}
+
+void SpaceSaving::GetTop(int n, vector<KeyCount>* top) const {
+  top->clear();
+  for (set<pair<int64_t, string> >::const_reverse_iterator
+         it = counters_by_count_.rbegin();
+       it != counters_by_count_.rend() && static_cast<int>(top->size()) < n;
+       it++) {
+    KeyCount key_count;
+    key_count.key = it->second;
+    key_count.count = it->first;
+    key_count.error = counters_.find(it->second)->second.error;
+    top->push_back(key_count);
+  }
+}
+
+// Keys counted in only one summary may have been seen up to the other's
+// uncounted bound there, so that is added to their count and error. The
+// largest |capacity_| counts are kept.
+void SpaceSaving::MergeWithSpaceSaving(const SpaceSaving& space_saving) {
+  int64_t bound = GetUncountedBound();
+  int64_t other_bound = space_saving.GetUncountedBound();
+  map<string, Counter> merged;
+  for (map<string, Counter>::const_iterator it = counters_.begin();
+       it != counters_.end();
+       it++) {
+    Counter counter = it->second;
+    if (space_saving.counters_.count(it->first) == 0) {
+      counter.count += other_bound;
+      counter.error += other_bound;
+    }
+    merged[it->first] = counter;
+  }
+  for (map<string, Counter>::const_iterator
+         it = space_saving.counters_.begin();
+       it != space_saving.counters_.end();
+       it++) {
+    map<string, Counter>::iterator merged_it = merged.find(it->first);
+    if (merged_it != merged.end()) {
+      merged_it->second.count += it->second.count;
+      merged_it->second.error += it->second.error;
+    } else {
+      Counter counter = it->second;
+      counter.count += bound;
+      counter.error += bound;
+      merged[it->first] = counter;
+    }
+  }
+
+  vector<pair<int64_t, string> > by_count;
+  for (map<string, Counter>::const_iterator it = merged.begin();
+       it != merged.end();
+       it++) {
+    by_count.push_back(std::make_pair(it->second.count, it->first));
+  }
+  int n_kept = std::min(capacity_, static_cast<int>(by_count.size()));
+  std::partial_sort(by_count.begin(), by_count.begin() + n_kept,
+                    by_count.end(),
+                    std::greater<pair<int64_t, string> >());
+  counters_.clear();
+  counters_by_count_.clear();
+  for (int i = 0; i < n_kept; i++) {
+    SetCounter(by_count[i].second, merged[by_count[i].second]);
+  }
+  n_added_ += space_saving.n_added_;
+}
+
+void SpaceSaving::Reset() {
+  counters_.clear();
+  counters_by_count_.clear();
+  n_added_ = 0;
+}
+
+void SpaceSaving::SetCounter(const string& key, const Counter& counter) {
+  map<string, Counter>::iterator it = counters_.find(key);
+  if (it != counters_.end()) {
+    counters_by_count_.erase(std::make_pair(it->second.count, key));
+  }
+  counters_[key] = counter;
+  counters_by_count_.insert(std::make_pair(counter.count, key));
+}
+
+KeyTracker::KeyTracker(int capacity, float slow_threshold)
+    : hot_keys_(capacity),
+      slow_keys_(capacity),
+      slow_connections_(capacity),
+      slow_threshold_(slow_threshold) {}
+
+// Copies start empty, like the copies of statistics.
+KeyTracker* KeyTracker::Copy() const {
+  return new KeyTracker(hot_keys_.capacity(), slow_threshold_);
+}
+
+void KeyTracker::MergeWithKeyTracker(const KeyTracker& key_tracker) {
+  hot_keys_.MergeWithSpaceSaving(key_tracker.hot_keys_);
+  slow_keys_.MergeWithSpaceSaving(key_tracker.slow_keys_);
+  slow_connections_.MergeWithSpaceSaving(key_tracker.slow_connections_);
+}
+
+void KeyTracker::Reset() {
+  hot_keys_.Reset();
+  slow_keys_.Reset();
+  slow_connections_.Reset();
+}
+
+// The names of the standard statistics, indexed by StandardStatisticId.
+static const struct {
+  const char* name;
+  bool cummulative;
+} kStandardStatistics[kNumStandardStatistics] = {
+  { "add_requests", false },
+  { "application_latency", false },
+  { "cumulative_hit_ratio", true },
+  { "fanout_latency", false },
+  { "fanout_shard_latency", false },
+  { "fanout_shards", false },
+  { "fill_requests", false },
+  { "flag_mismatch_ratio", false },
+  { "get_request_size", false },
+  { "get_requests", false },
+  { "hedge_discarded_responses", false },
+  { "hedge_rate", false },
+  { "hedge_requests", false },
+  { "hedged_latency", false },
+  { "hit_ratio", false },
+  { "latency", false },
+  { "outstanding_requests", false },
+  { "replace_requests", false },
+  { "request_bytes", false },
+  { "response_bytes", false },
+  { "response_value_bytes", false },
+  { "send_lag", false },
+  { "set_request_size", false },
+  { "set_requests", false },
+  { "stage_generate", false },
+  { "stage_read", false },
+  { "stage_wait", false },
+  { "stage_write", false },
+  { "touch_requests", false },
+  { "unhedged_latency", false },
+  { "wire_latency", false },
+};
+
 StatisticsCollection::StatisticsCollection(Config* config)
-    : config_(config) {}
+    : config_(config),
+      key_tracker_(NULL) {}
 
 StatisticsCollection::~StatisticsCollection() {
   // Destroy all the statistics this StatisticsCollection was tracking.
-  for (map<string, Statistic*>::iterator it = statistics_.begin();
+  for (vector<Statistic*>::iterator it = statistics_.begin();
        it != statistics_.end();
        it++) {
-    delete it->second;
+    delete *it;
   }
-}
-
-void StatisticsCollection::AddSample(string name, float value) {
-  Statistic* statistic = statistics_.find(name)->second;
-  if (statistic == NULL) {
-    LOG_FATAL("Tried to access an unregistered statistic");
-  }
-  statistic->AddSample(value);
+  delete key_tracker_;
 }
 
 // TODO(davidmax@gmail.com) Probably should be moved to stats manager.
@@ -412,68 +1047,143 @@ void StatisticsCollection::AddStatisticPrinter(
   GetStatistic(name)->AddStatisticPrinter(statistic_printer);
 }
 
-// Creates a deep copy of the StatisticsManager object.
+// Creates a deep copy of the StatisticsManager object. The copy registers
+// the statistics in the same order, so it shares this collection's ids.
 StatisticsCollection* StatisticsCollection::Copy() const {
   StatisticsCollection* statistics_collection
       = new StatisticsCollection(config_);
-  for (map<string, Statistic*>::const_iterator it = statistics_.begin();
+  for (vector<Statistic*>::const_iterator it = statistics_.begin();
        it != statistics_.end();
        it++) {
-    statistics_collection->AddStatistic(it->second->Copy());
+    statistics_collection->AddStatistic((*it)->Copy());
+  }
+  if (key_tracker_ != NULL) {
+    statistics_collection->key_tracker_ = key_tracker_->Copy();
   }
   return statistics_collection;
 }
 
-Statistic* StatisticsCollection::GetStatistic(string name) const {
-  return statistics_.find(name)->second;
+StatisticId StatisticsCollection::FindStatisticId(const string& name) const {
+  map<string, StatisticId>::const_iterator it = statistic_ids_.find(name);
+  if (it == statistic_ids_.end()) {
+    return -1;
+  }
+  return it->second;
+}
+
+Statistic* StatisticsCollection::GetStatistic(const string& name) const {
+  return statistics_[GetStatisticId(name)];
 }
 
+StatisticId StatisticsCollection::GetStatisticId(const string& name) const {
+  StatisticId id = FindStatisticId(name);
+  if (id < 0) {
+    LOG_FATAL("Tried to access an unregistered statistic: " + name);
+  }
+  return id;
+}
+
+// Collections are only ever merged with copies of the same collection, so
+// statistics with the same id match.
 void StatisticsCollection::MergeWithStatisticsCollection(
                           const StatisticsCollection& statistics_collection) {
-  for (map<string, Statistic*>::iterator it = statistics_.begin();
-       it != statistics_.end();
-       it++) {
-    Statistic* statistic = statistics_collection.GetStatistic(it->first);
-    if (statistic == NULL) {
-      LOG_FATAL("Tried to merge statistic collection with non-matching"
-                " sets of statistics");
+  if (statistics_collection.statistics_.size() != statistics_.size()) {
+    LOG_FATAL("Tried to merge statistic collection with non-matching"
+              " sets of statistics");
+  }
+  for (size_t i = 0; i < statistics_.size(); i++) {
+    statistics_[i]->MergeWithStatistic(*statistics_collection.statistics_[i]);
+  }
+  if (key_tracker_ != NULL && statistics_collection.key_tracker_ != NULL) {
+    key_tracker_->MergeWithKeyTracker(*statistics_collection.key_tracker_);
+  }
+}
+
+// Merges only the cummulative statistics, which carry over from one
+// interval's collection to the next.
+void StatisticsCollection::MergeCummulativeStatistics(
+                          const StatisticsCollection& statistics_collection) {
+  if (statistics_collection.statistics_.size() != statistics_.size()) {
+    LOG_FATAL("Tried to merge statistic collection with non-matching"
+              " sets of statistics");
+  }
+  for (size_t i = 0; i < statistics_.size(); i++) {
+    if (statistics_[i]->IsCummulative()) {
+      statistics_[i]->MergeWithStatistic(
+                        *statistics_collection.statistics_[i]);
     }
-    it->second->MergeWithStatistic(*(statistic));
   }
 }
 
+// Prints the statistics in order of name.
 void StatisticsCollection::PrintStatInterval() {
   printf("==============================\n");
-  for (map<string, Statistic*>::iterator it = statistics_.begin();
-       it != statistics_.end();
+  for (map<string, StatisticId>::iterator it = statistic_ids_.begin();
+       it != statistic_ids_.end();
        it++) {
-    Statistic* statistic = it->second;
+    Statistic* statistic = statistics_[it->second];
+    if (!statistic->HasStatisticPrinters()) {
+      continue;
+    }
     statistic->Print();
     printf("\n");
   }
   printf("\n");
 }
 
-void StatisticsCollection::RegisterStatistic(string name, bool cummulative) {
-  statistics_.insert(pair<string, Statistic*>(name,
-                                              new Statistic(name,
-                                                            cummulative)));
+void StatisticsCollection::RegisterStandardStatistics() {
+  if (!statistics_.empty()) {
+    LOG_FATAL("Standard statistics must be registered first");
+  }
+  for (int i = 0; i < kNumStandardStatistics; i++) {
+    RegisterStatistic(kStandardStatistics[i].name,
+                      kStandardStatistics[i].cummulative);
+  }
+}
+
+StatisticId StatisticsCollection::RegisterStatistic(string name,
+                                                    bool cummulative,
+                                                    StatisticBackend backend) {
+  int significant_digits = kDefaultSignificantDigits;
+  if (config_ != NULL) {
+    significant_digits = config_->histogram_significant_digits_;
+  }
+  return AddStatistic(new Statistic(name, cummulative, significant_digits,
+                                    backend));
 }
 
-void StatisticsCollection::ResetNonCummulativeStatistics() {
-  for (map<string, Statistic*>::iterator it = statistics_.begin();
+void StatisticsCollection::FlushSamples() {
+  for (vector<Statistic*>::iterator it = statistics_.begin();
        it != statistics_.end();
        it++) {
-    Statistic* statistic = it->second;
-    if (!statistic->IsCummulative()) {
-      statistic->Reset();
-    }
+    (*it)->FlushSamples();
+  }
+}
+
+void StatisticsCollection::ResetStatistics() {
+  for (vector<Statistic*>::iterator it = statistics_.begin();
+       it != statistics_.end();
+       it++) {
+    (*it)->Reset();
+  }
+  if (key_tracker_ != NULL) {
+    key_tracker_->Reset();
   }
 }
 
-void StatisticsCollection::AddStatistic(Statistic* statistic) {
-  statistics_.insert(pair<string, Statistic*>(statistic->GetName(),
-                                             statistic));
+void StatisticsCollection::TrackKeys(int capacity, float slow_threshold) {
+  delete key_tracker_;
+  key_tracker_ = new KeyTracker(capacity, slow_threshold);
+}
+
+StatisticId StatisticsCollection::AddStatistic(Statistic* statistic) {
+  if (statistic_ids_.count(statistic->GetName()) != 0) {
+    LOG_FATAL("Statistic registered twice: " + statistic->GetName());
+  }
+  StatisticId id = statistics_.size();
+  statistics_.push_back(statistic);
+  statistic_ids_[statistic->GetName()] = id;
+  return id;
 }
 
 }  // namespace cachebash
@@ -32,7 +32,10 @@
 #ifndef STATISTIC_H_
 #define STATISTIC_H_
 
+#include <math.h>
+#include <stdint.h>
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -42,10 +45,77 @@ using std::string;
 using std::vector;
 using std::map;
 using std::pair;
+using std::set;
 
 namespace cachebash {
 
-static const int kBinsPerHistogram = 1000;
+// Histograms record values in units of nanoseconds.
+static const double kHistogramUnit = 1e-9;
+// About 116 days, or 10MB when a statistic counts bytes.
+static const int64_t kHistogramHighestTrackableValue = 10000000000000000LL;
+static const int kDefaultSignificantDigits = 2;
+static const int kMaxSignificantDigits = 5;
+// How many samples are recorded in bulk at a time.
+static const int kSampleBatchSize = 64;
+// How many samples a Statistic buffers. The workers record them every
+// kSampleBatchSize sends, or whenever they are idle, and only a full
+// buffer is recorded as a sample is added.
+static const int kSampleBufferSize = 4 * kSampleBatchSize;
+// DDSketch quantiles are within this fraction of the true value.
+static const double kDefaultRelativeAccuracy = 0.01;
+// The most bins a DDSketch keeps, which at 1% relative accuracy spans
+// over 17 orders of magnitude.
+static const int kMaxDDSketchBins = 2048;
+
+// How a statistic keeps the distribution of its samples.
+enum StatisticBackend {
+  // Exact to the configured significant digits over a fixed value range.
+  kHistogramBackend,
+  // Exact to kDefaultRelativeAccuracy in bounded memory.
+  kDDSketchBackend
+};
+
+// A handle to a statistic registered with a StatisticsCollection. Copies
+// of a collection share its handles.
+typedef int StatisticId;
+
+// Statistics with fixed names. RegisterStandardStatistics() registers
+// them first and in this order, so their handles are known at compile
+// time. Only the ones given printers are printed.
+enum StandardStatisticId {
+  kAddRequestsStatistic,
+  kApplicationLatencyStatistic,
+  kCumulativeHitRatioStatistic,
+  kFanoutLatencyStatistic,
+  kFanoutShardLatencyStatistic,
+  kFanoutShardsStatistic,
+  kFillRequestsStatistic,
+  kFlagMismatchRatioStatistic,
+  kGetRequestSizeStatistic,
+  kGetRequestsStatistic,
+  kHedgeDiscardedResponsesStatistic,
+  kHedgeRateStatistic,
+  kHedgeRequestsStatistic,
+  kHedgedLatencyStatistic,
+  kHitRatioStatistic,
+  kLatencyStatistic,
+  kOutstandingRequestsStatistic,
+  kReplaceRequestsStatistic,
+  kRequestBytesStatistic,
+  kResponseBytesStatistic,
+  kResponseValueBytesStatistic,
+  kSendLagStatistic,
+  kSetRequestSizeStatistic,
+  kSetRequestsStatistic,
+  kStageGenerateStatistic,
+  kStageReadStatistic,
+  kStageWaitStatistic,
+  kStageWriteStatistic,
+  kTouchRequestsStatistic,
+  kUnhedgedLatencyStatistic,
+  kWireLatencyStatistic,
+  kNumStandardStatistics
+};
 
 class Config;
 class Statistic;
@@ -53,66 +123,239 @@ class StatisticPrinter;
 class StatisticsManager;
 class WorkerManager;
 
+// A log-linear histogram with the semantics of HdrHistogram. Values are
+// bucketed by powers of two, and each bucket is split linearly into
+// enough sub-buckets that any value is recorded to |significant_digits|
+// decimal digits. Counts only grow as far as the largest recorded value.
 class Histogram {
  public:
-  Histogram(float min, float max, int n_bins);
+  explicit Histogram(int significant_digits);
   virtual ~Histogram();
+  // Adds |count| to the count at |index|, as when decoding a histogram.
+  void AddCount(int index, int64_t count);
   Histogram* Copy() const;
-  void AddSample(float value);
+  // Records |value| seconds.
+  void AddSample(double value);
+  // Records |n_values| samples of seconds, skipping negative ones.
+  void AddSamples(const float* values, int n_values);
+  const vector<int64_t>& counts() const { return counts_; }
+  // How many samples are in the counts up to the one holding |value|.
+  int64_t GetCountAtOrBelow(int64_t value) const;
+  int GetCountsIndex(int64_t value) const;
+  int64_t GetEquivalentRangeSize(int index) const;
+  // The highest value equivalent to the largest one recorded, or 0.
+  int64_t GetMaxValue() const;
   float GetQuantile(float quantile) const;
-  int* histogram() const { return histogram_; }
-  float max() const { return max_; }
+  // Answers all of |quantiles|, in any order, in one pass over the counts.
+  void GetQuantiles(const vector<float>& quantiles,
+                    vector<float>* values) const;
+  int64_t GetValueFromIndex(int index) const;
   void MergeWithHistogram(const Histogram& histogram);
-  float min() const { return min_; }
-  int n_bins() const { return n_bins_; }
-  int n_samples() const { return n_samples_; }
+  int64_t n_samples() const { return n_samples_; }
+  void RecordValue(int64_t value);
   void Reset();
+  int significant_digits() const { return significant_digits_; }
 
  private:
-  int* histogram_;
-  float max_;
-  float min_;
-  int n_bins_;
-  int n_samples_;
+  void GetCountsIndices(const float* values, int n_values,
+                        int* indices) const;
+
+  vector<int64_t> counts_;
+  int64_t n_samples_;
+  int significant_digits_;
+  int sub_bucket_count_;
+  int sub_bucket_half_count_;
+  int sub_bucket_half_count_magnitude_;
+  int64_t sub_bucket_mask_;
 
   DISALLOW_COPY_AND_ASSIGN(Histogram);
 };
 
+// The Kolmogorov-Smirnov statistic of two histograms of the same
+// precision: the largest difference between their cumulative
+// distributions.
+double KolmogorovSmirnovStatistic(const Histogram& first,
+                                  const Histogram& second);
+// The probability of a Kolmogorov-Smirnov statistic of at least |d| if
+// samples of |n_first| and |n_second| were drawn from one distribution.
+double KolmogorovSmirnovPValue(double d, int64_t n_first, int64_t n_second);
+
+// A relative-error quantile sketch (DDSketch, Masson et al. 2019). Sample
+// i lands in the bin (gamma^(i-1), gamma^i] with gamma = (1 + a) / (1 - a),
+// so every quantile is within a fraction a of the true one, whatever the
+// range of the samples. At most kMaxDDSketchBins bins are kept; past that
+// the lowest ones are collapsed together, which only costs accuracy at
+// the lowest quantiles. Sketches of the same accuracy merge exactly.
+class DDSketch {
+ public:
+  explicit DDSketch(double relative_accuracy);
+  // Records |n_values| samples of seconds, skipping negative ones.
+  void AddSamples(const float* values, int n_values);
+  DDSketch* Copy() const;
+  const vector<int64_t>& counts() const { return counts_; }
+  // How many samples are in the bins up to the one holding |value|.
+  int64_t GetCountAtOrBelow(double value) const;
+  int GetIndex(double value) const {
+    return static_cast<int>(ceil(log(value) * inverse_log_gamma_));
+  }
+  float GetQuantile(float quantile) const;
+  // Answers all of |quantiles|, in any order, in one pass over the bins.
+  void GetQuantiles(const vector<float>& quantiles,
+                    vector<float>* values) const;
+  double GetValueFromIndex(int index) const;
+  void MergeWithSketch(const DDSketch& sketch);
+  int min_index() const { return min_index_; }
+  int64_t n_samples() const { return n_samples_; }
+  double relative_accuracy() const { return relative_accuracy_; }
+  void Reset();
+
+ private:
+  // Makes room for bins |low_index| to |high_index|, collapsing the lowest
+  // bins if they don't all fit. Returns the lowest index that is kept.
+  int Extend(int low_index, int high_index);
+
+  // Counts of the bins from |min_index_| up.
+  vector<int64_t> counts_;
+  int min_index_;
+  // Samples below kHistogramUnit, which are counted as 0.
+  int64_t zero_count_;
+  int64_t n_samples_;
+  double relative_accuracy_;
+  double gamma_;
+  double inverse_log_gamma_;
+
+  DISALLOW_COPY_AND_ASSIGN(DDSketch);
+};
+
+// How often a key was seen, which may be overestimated by up to |error|.
+struct KeyCount {
+  string key;
+  int64_t count;
+  int64_t error;
+};
+
+// The most frequent keys of a stream in bounded memory (Space-Saving,
+// Metwally et al. 2005). With |capacity| counters, every key seen more
+// than n / capacity times in n adds is kept, and no count is more than
+// n / capacity too high. Summaries merge (Agarwal et al. 2012) with the
+// same guarantee over the combined stream.
+class SpaceSaving {
+ public:
+  explicit SpaceSaving(int capacity);
+  void Add(const string& key, int64_t count);
+  int capacity() const { return capacity_; }
+  // Sets |top| to the |n| most frequent keys, most frequent first.
+  void GetTop(int n, vector<KeyCount>* top) const;
+  void MergeWithSpaceSaving(const SpaceSaving& space_saving);
+  int64_t n_added() const { return n_added_; }
+  void Reset();
+
+ private:
+  struct Counter {
+    int64_t count;
+    int64_t error;
+  };
+  // How often a key without a counter may have been seen, which is 0
+  // until every counter is in use.
+  int64_t GetUncountedBound() const;
+  void SetCounter(const string& key, const Counter& counter);
+
+  int capacity_;
+  map<string, Counter> counters_;
+  // The counters in order of count, to find the one to evict.
+  set<pair<int64_t, string> > counters_by_count_;
+  int64_t n_added_;
+
+  DISALLOW_COPY_AND_ASSIGN(SpaceSaving);
+};
+
+// Tracks which keys are requested most, and which keys and connections
+// most often answer slower than a threshold.
+class KeyTracker {
+ public:
+  // Each summary keeps |capacity| counters.
+  KeyTracker(int capacity, float slow_threshold);
+  KeyTracker* Copy() const;
+  SpaceSaving* hot_keys() { return &hot_keys_; }
+  void MergeWithKeyTracker(const KeyTracker& key_tracker);
+  void Reset();
+  SpaceSaving* slow_connections() { return &slow_connections_; }
+  SpaceSaving* slow_keys() { return &slow_keys_; }
+  // Seconds, or negative if slow responses aren't tracked.
+  float slow_threshold() const { return slow_threshold_; }
+
+ private:
+  SpaceSaving hot_keys_;
+  SpaceSaving slow_keys_;
+  SpaceSaving slow_connections_;
+  float slow_threshold_;
+
+  DISALLOW_COPY_AND_ASSIGN(KeyTracker);
+};
+
 class Statistic {
  public:
-  Statistic(string name, bool cummulative);
+  Statistic(string name, bool cummulative,
+            int significant_digits = kDefaultSignificantDigits,
+            StatisticBackend backend = kHistogramBackend);
   virtual ~Statistic();
-  void AddSample(float value);
+  // Samples are buffered and recorded in batches. Everything that reads
+  // the statistic records the buffered samples first.
+  void AddSample(float value) {
+    pending_samples_[n_pending_samples_++] = value;
+    if (n_pending_samples_ == kSampleBufferSize) {
+      FlushSamples();
+    }
+  }
   void AddStatisticPrinter(StatisticPrinter* statistic_printer);
   Statistic* Copy() const;
+  void FlushSamples();
   float GetAverage();
-  int GetCount();
+  int64_t GetCount();
+  // How many samples are at or below |value|, to the backend's precision.
+  int64_t GetCountAtOrBelow(double value);
   float GetQuantile(float quantile);
-  float GetMin() const { return min_; }
-  float GetMax() const { return max_; }
+  void GetQuantiles(const vector<float>& quantiles, vector<float>* values);
+  float GetMin();
+  float GetMax();
   string GetName();
+  // The sum of every sample.
+  double GetSum();
   float GetSampleStandardDeviation();
   float GetStandardDeviation();
+  StatisticBackend backend() const {
+    return histogram_ != NULL ? kHistogramBackend : kDDSketchBackend;
+  }
+  // Only for kHistogramBackend statistics. Only reflects the buffered
+  // samples after FlushSamples().
+  const Histogram& histogram() const { return *histogram_; }
   void MergeWithStatistic(const Statistic& statistic);
+  bool HasStatisticPrinters() const { return !statistic_printers_.empty(); }
   bool IsCummulative();
   void Print();
   void Reset();
 
  protected:
   string name_;
-  float s0_;
-  float s1_;
-  float s2_;
+  // The number of samples, and the sums of them and their squares.
+  int64_t s0_;
+  double s1_;
+  double s2_;
   float min_;
   float max_;
   // TODO(davidmax@gmail.com) At some point,
   // should change this to a specialized subclass.
   bool cummulative_;
 
-  Histogram* microsecond_histogram_;
-  Histogram* millisecond_histogram_;
-  Histogram* second_histogram_;
+  // Exactly one of these is set, depending on the backend.
+  Histogram* histogram_;
+  DDSketch* sketch_;
   vector<StatisticPrinter*> statistic_printers_;
+  // The quantiles the printers ask for, and their values while printing.
+  vector<float> printed_quantiles_;
+  vector<float> printed_quantile_values_;
+  float pending_samples_[kSampleBufferSize];
+  int n_pending_samples_;
 
  private:
   DISALLOW_COPY_AND_ASSIGN(Statistic);
@@ -124,6 +367,9 @@ class StatisticPrinter {
   virtual ~StatisticPrinter() {}
   virtual void Print(Statistic* statistic) = 0;
   virtual StatisticPrinter* Copy() = 0;
+  // Adds the quantiles Print() will ask for, so they can be computed
+  // together beforehand.
+  virtual void AddQuantiles(vector<float>* /* quantiles */) const {}
 
  private:
   Statistic* statistic_;
@@ -145,6 +391,7 @@ class QuantilePrinter : public StatisticPrinter {
   explicit QuantilePrinter(float quantile);
   virtual void Print(Statistic* statistic);
   virtual StatisticPrinter* Copy();
+  virtual void AddQuantiles(vector<float>* quantiles) const;
 
  private:
   float quantile_;
@@ -185,23 +432,44 @@ class StatisticsCollection {
  public:
   explicit StatisticsCollection(Config* config);
   virtual ~StatisticsCollection();
-  void AddSample(string name, float value);
+  void AddSample(StatisticId id, float value) {
+    statistics_[id]->AddSample(value);
+  }
   void AddStatisticPrinter(string name,
                            StatisticPrinter* statistic_printer);
   StatisticsCollection* Copy() const;
-  Statistic* GetStatistic(string name) const;
+  void FlushSamples();
+  // Returns -1 if no statistic is called |name|.
+  StatisticId FindStatisticId(const string& name) const;
+  Statistic* GetStatistic(StatisticId id) const { return statistics_[id]; }
+  Statistic* GetStatistic(const string& name) const;
+  StatisticId GetStatisticId(const string& name) const;
+  // NULL unless TrackKeys() was called.
+  KeyTracker* key_tracker() const { return key_tracker_; }
+  void MergeCummulativeStatistics(
+          const StatisticsCollection& statistics_collection);
   void MergeWithStatisticsCollection(
           const StatisticsCollection& statistics_collection);
+  int n_statistics() const { return statistics_.size(); }
   void PrintStatInterval();
-  void RegisterStatistic(string name, bool cummulative);
-  void ResetNonCummulativeStatistics();
+  void RegisterStandardStatistics();
+  StatisticId RegisterStatistic(string name, bool cummulative,
+                                StatisticBackend backend = kHistogramBackend);
+  void ResetStatistics();
+  // Tracks keys, with |capacity| counters per summary, in this collection
+  // and its copies.
+  void TrackKeys(int capacity, float slow_threshold);
 
  protected:
-  void AddStatistic(Statistic* statistic);
+  StatisticId AddStatistic(Statistic* statistic);
 
  private:
   Config* config_;
-  map<string, Statistic*> statistics_;
+  // Indexed by StatisticId.
+  vector<Statistic*> statistics_;
+  // Names are only used to register, print and look up statistics.
+  map<string, StatisticId> statistic_ids_;
+  KeyTracker* key_tracker_;
 
   DISALLOW_COPY_AND_ASSIGN(StatisticsCollection);
 };
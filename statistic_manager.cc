@@ -31,44 +31,273 @@
 
 #include "cachebash/statistic_manager.h"
 
+#include <stdio.h>
 #include <sys/time.h>
 
 #include "cachebash/config.h"
-#include "cachebash/scoped_ptr.h"
+#include "cachebash/interval_writer.h"
+#include "cachebash/metrics_server.h"
+#include "cachebash/perf_counters.h"
 #include "cachebash/statistic.h"
+#include "cachebash/util.h"
 #include "cachebash/worker_manager.h"
 #include "cachebash/worker_thread.h"
 
 namespace cachebash {
 
+// Below this fraction of the -r target, the shortfall is explained.
+static const double kMinAchievedRatio = 0.95;
+// How long the statistics thread waits for the workers to hand over
+// their buffers at the end of an interval. A worker stuck in a callback
+// for longer is skipped, and its samples are merged into a later interval.
+static const double kStatisticsFlipTimeout = 0.5;
+
 StatisticManager::StatisticManager(StatisticsCollection* base_collection,
                                    Config* config,
                                    WorkerManager* worker_manager)
     : base_collection_(base_collection),
       config_(config),
-      worker_manager_(worker_manager) {}
+      encode_histograms_(false),
+      metrics_server_(NULL),
+      perf_counter_sampler_(NULL),
+      run_collection_(NULL),
+      last_interval_collection_(NULL),
+      worker_manager_(worker_manager) {
+  for (vector<string>::const_iterator
+         it = config_->interval_outputs_.begin();
+       it != config_->interval_outputs_.end();
+       it++) {
+    IntervalWriter* interval_writer = IntervalWriter::Parse(*it);
+    interval_writer->Start();
+    interval_writers_.push_back(interval_writer);
+    if (interval_writer->format() == kHistogramLogIntervalFormat) {
+      encode_histograms_ = true;
+    }
+  }
+  if (!config_->metrics_address_.empty()) {
+    metrics_server_ = new MetricsServer(config_->metrics_address_);
+    metrics_server_->Start();
+    printf("Serving metrics on port %d\n", metrics_server_->port());
+  }
+  if (config_->perf_counters_) {
+    perf_counter_sampler_ = new PerfCounterSampler(*config_,
+                                                   *base_collection_);
+  }
+}
+
+// Deleting the interval writers waits for the records they have queued.
+StatisticManager::~StatisticManager() {
+  for (vector<IntervalWriter*>::iterator it = interval_writers_.begin();
+       it != interval_writers_.end();
+       it++) {
+    delete *it;
+  }
+  delete metrics_server_;
+  delete perf_counter_sampler_;
+  delete run_collection_;
+  delete last_interval_collection_;
+}
+
+// Queues |collection| to every interval writer, with |name_prefix| in
+// front of the statistics' names.
+void StatisticManager::WriteInterval(StatisticsCollection* collection,
+                                     const struct timeval& start_time,
+                                     const struct timeval& end_time,
+                                     const string& name_prefix) {
+  if (interval_writers_.empty()) {
+    return;
+  }
+  IntervalRecord* record = IntervalWriter::NewIntervalRecord(
+                             collection, start_time, end_time,
+                             encode_histograms_);
+  for (size_t i = 0; i < record->statistics.size(); i++) {
+    record->statistics[i].name = name_prefix + record->statistics[i].name;
+  }
+  for (vector<IntervalWriter*>::iterator it = interval_writers_.begin();
+       it != interval_writers_.end();
+       it++) {
+    (*it)->Write(new IntervalRecord(*record));
+  }
+  delete record;
+}
+
+// Prints what was achieved over the interval, per second of the time it
+// actually took rather than of the nominal print interval, and warns if
+// the request rate falls short of -r because of the client itself. The
+// workers send on a schedule whatever the servers do, so a slow server
+// shows up as requests piling up on the connections. A worker that can't
+// keep up instead falls behind its schedule with little outstanding.
+void StatisticManager::PrintThroughput(
+       StatisticsCollection* interval_collection, double interval_length) {
+  if (interval_length <= 0.0) {
+    return;
+  }
+  Statistic* latency = interval_collection->GetStatistic(kLatencyStatistic);
+  Statistic* request_bytes
+    = interval_collection->GetStatistic(kRequestBytesStatistic);
+  Statistic* response_bytes
+    = interval_collection->GetStatistic(kResponseBytesStatistic);
+  Statistic* response_value_bytes
+    = interval_collection->GetStatistic(kResponseValueBytesStatistic);
+  double rps = latency->GetCount() / interval_length;
+  printf("throughput - Responses: %.1f/s ", rps);
+  printf("Sent: %.3f MB/s ",
+         request_bytes->GetSum() / interval_length / 1e6);
+  printf("Received: %.3f MB/s ",
+         response_bytes->GetSum() / interval_length / 1e6);
+  printf("Values: %.3f MB/s ",
+         response_value_bytes->GetSum() / interval_length / 1e6);
+  if (config_->rps_ <= 0) {
+    printf("\n\n");
+    return;
+  }
+  double achieved_ratio = rps / config_->rps_;
+  printf("Target: %.1f/s Achieved: %.1f%%\n", config_->rps_,
+         achieved_ratio * 100.0);
+
+  // Each worker samples the requests outstanding on all its connections.
+  int n_worker_connections = config_->servers_.size()
+                             * config_->n_connections_per_worker_;
+  float outstanding_per_connection = interval_collection->GetStatistic(
+      kOutstandingRequestsStatistic)->GetAverage() / n_worker_connections;
+  float send_lag
+    = interval_collection->GetStatistic(kSendLagStatistic)->GetAverage();
+  float intersend_time = config_->n_worker_threads_ / config_->rps_;
+  if (achieved_ratio < kMinAchievedRatio) {
+    if (outstanding_per_connection >= 1.0) {
+      printf("WARNING: the servers are the bottleneck: %.2f requests "
+             "outstanding per connection.\n", outstanding_per_connection);
+    } else if (send_lag > intersend_time) {
+      printf("WARNING: the client is the bottleneck: workers are %.3f ms "
+             "behind schedule with %.2f requests outstanding per "
+             "connection. Add workers (-w).\n",
+             send_lag * 1e3, outstanding_per_connection);
+    }
+  }
+  printf("\n");
+}
+
+// Records what |worker_thread|'s counters counted over the interval, per
+// response it received according to |worker_collection|, as soon as the
+// worker has flipped buffers, so the counts and responses line up.
+void StatisticManager::SamplePerfCounters(
+       int worker_index, const WorkerThread* worker_thread,
+       StatisticsCollection* worker_collection, double interval_length,
+       StatisticsCollection* interval_collection) {
+  const PerfCounters* perf_counters = worker_thread->perf_counters();
+  if (perf_counter_sampler_ == NULL || perf_counters == NULL) {
+    return;
+  }
+  uint64_t counts[kNumPerfCounters];
+  perf_counters->Read(counts);
+  int64_t n_responses
+    = worker_collection->GetStatistic(kLatencyStatistic)->GetCount();
+  perf_counter_sampler_->Sample(worker_index, counts, n_responses,
+                                interval_length, interval_collection);
+}
+
+// Prints the top |n| of |space_saving| on one line, with the share of
+// everything it counted each had.
+static void PrintTop(const char* name, const SpaceSaving& space_saving,
+                     int n) {
+  vector<KeyCount> top;
+  space_saving.GetTop(n, &top);
+  printf("%s -", name);
+  for (vector<KeyCount>::const_iterator it = top.begin();
+       it != top.end();
+       it++) {
+    printf(" %s: %lld (%.2f%%)", it->key.c_str(),
+           static_cast<long long>(it->count),
+           100.0 * it->count / space_saving.n_added());
+  }
+  printf("\n");
+}
+
+// Counts are upper bounds, too high by at most the number of requests
+// over the counters per summary.
+void StatisticManager::PrintTopKeys(StatisticsCollection* interval_collection) {
+  KeyTracker* key_tracker = interval_collection->key_tracker();
+  if (key_tracker == NULL) {
+    return;
+  }
+  PrintTop("hot_keys", *key_tracker->hot_keys(), config_->top_keys_);
+  if (key_tracker->slow_threshold() > 0) {
+    PrintTop("slow_keys", *key_tracker->slow_keys(), config_->top_keys_);
+    PrintTop("slow_connections", *key_tracker->slow_connections(),
+             config_->top_keys_);
+  }
+  printf("\n");
+}
 
 void StatisticManager::StatisticsLoop() {
-  struct timeval start_time;
+  struct timeval start_time, interval_start_time;
   gettimeofday(&start_time, NULL);
+  interval_start_time = start_time;
   while (1) {
     sleep(config_->stat_print_interval_);
+    // The interval ends as the workers are flipped.
+    struct timeval interval_end_time;
+    gettimeofday(&interval_end_time, NULL);
+    struct timeval interval_time;
+    timersub(&interval_end_time, &interval_start_time, &interval_time);
+    double interval_length = interval_time.tv_sec
+                             + interval_time.tv_usec * 1e-6;
 
-    // Combine all the worker threads' statistics collections.
-    scoped_ptr<StatisticsCollection> base_collection_copy(
-                                    base_collection_->Copy());
+    // Combine all the worker threads' statistics collections. Each worker
+    // hands over the buffer it wrote this interval's samples into, which
+    // it no longer touches, so it can be merged and reset safely. Samples
+    // still buffered in it are recorded here, off the workers' hot path.
+    StatisticsCollection* interval_collection = base_collection_->Copy();
+    if (run_collection_ == NULL
+        && (!interval_writers_.empty() || metrics_server_ != NULL)) {
+      run_collection_ = base_collection_->Copy();
+    }
+    if (last_interval_collection_ != NULL) {
+      interval_collection->MergeCummulativeStatistics(
+                             *last_interval_collection_);
+    }
+    struct timeval flip_timeout = SecondsToTimeval(kStatisticsFlipTimeout);
+    struct timeval flip_deadline;
+    timeradd(&interval_end_time, &flip_timeout, &flip_deadline);
     vector<WorkerThread*>* worker_threads = worker_manager_->worker_threads();
     for (vector<WorkerThread*>::const_iterator it = worker_threads->begin();
          it != worker_threads->end();
          it++) {
-           StatisticsCollection* current_statistics_collection
-                                = (*it)->GetStatisticsCollection();
-           base_collection_copy->MergeWithStatisticsCollection(
-                                      *current_statistics_collection);
-           current_statistics_collection->ResetNonCummulativeStatistics();
+           StatisticsCollection* retired_statistics_collection
+                                = (*it)->FlipStatisticsCollection(
+                                           flip_deadline);
+           if (retired_statistics_collection == NULL) {
+             printf("WARNING: worker %d is stalled; its samples will be "
+                    "counted in a later interval.\n",
+                    static_cast<int>(it - worker_threads->begin()));
+             continue;
+           }
+           retired_statistics_collection->FlushSamples();
+           SamplePerfCounters(it - worker_threads->begin(), *it,
+                              retired_statistics_collection,
+                              interval_length, interval_collection);
+           interval_collection->MergeWithStatisticsCollection(
+                                  *retired_statistics_collection);
+           if (run_collection_ != NULL) {
+             run_collection_->MergeWithStatisticsCollection(
+                                *retired_statistics_collection);
+           }
+           retired_statistics_collection->ResetStatistics();
          }
 
-    base_collection_copy->PrintStatInterval();
+    interval_collection->PrintStatInterval();
+    PrintTopKeys(interval_collection);
+    PrintThroughput(interval_collection, interval_length);
+    WriteInterval(interval_collection, interval_start_time,
+                  interval_end_time, "");
+    if (metrics_server_ != NULL) {
+      metrics_server_->Publish(FormatPrometheusMetrics(
+                                 *config_, run_collection_,
+                                 interval_collection, interval_length));
+    }
+    interval_start_time = interval_end_time;
+    delete last_interval_collection_;
+    last_interval_collection_ = interval_collection;
 
     // Check if we've loadtested for long enough.
     struct timeval timestamp, time_diff;
@@ -79,6 +308,11 @@ void StatisticManager::StatisticsLoop() {
       break;
     }
   }
+
+  // Then the whole run, under "run/" names.
+  if (run_collection_ != NULL) {
+    WriteInterval(run_collection_, start_time, interval_start_time, "run/");
+  }
 }
 
 }  // namespace
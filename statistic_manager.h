@@ -32,24 +32,60 @@
 #ifndef STATISTIC_MANAGER_H_
 #define STATISTIC_MANAGER_H_
 
+#include <sys/time.h>
+#include <vector>
+
 #include "cachebash/util.h"
 
 namespace cachebash {
 
 class Config;
+class IntervalWriter;
+class MetricsServer;
+class PerfCounterSampler;
 class StatisticsCollection;
 class WorkerManager;
+class WorkerThread;
 
 class StatisticManager {
  public:
   StatisticManager(StatisticsCollection* base_collection,
                    Config* config,
                    WorkerManager* worker_manager);
+  ~StatisticManager();
   void StatisticsLoop();
 
  private:
+  void PrintThroughput(StatisticsCollection* interval_collection,
+                       double interval_length);
+  void PrintTopKeys(StatisticsCollection* interval_collection);
+  void SamplePerfCounters(int worker_index,
+                          const WorkerThread* worker_thread,
+                          StatisticsCollection* worker_collection,
+                          double interval_length,
+                          StatisticsCollection* interval_collection);
+  void WriteInterval(StatisticsCollection* collection,
+                     const struct timeval& start_time,
+                     const struct timeval& end_time,
+                     const string& name_prefix);
+
   StatisticsCollection* base_collection_;
   Config* config_;
+  // Write each interval's statistics out.
+  std::vector<IntervalWriter*> interval_writers_;
+  // Whether any of them logs histograms.
+  bool encode_histograms_;
+  // Serves live metrics, or NULL.
+  MetricsServer* metrics_server_;
+  // Records what each worker costs, or NULL.
+  PerfCounterSampler* perf_counter_sampler_;
+  // Everything recorded since the start of the run, which is written out
+  // once the run ends and is what metrics are counted from. NULL when
+  // neither is asked for.
+  StatisticsCollection* run_collection_;
+  // The previous interval's statistics, which cummulative statistics
+  // carry over from.
+  StatisticsCollection* last_interval_collection_;
   WorkerManager* worker_manager_;
 
   DISALLOW_COPY_AND_ASSIGN(StatisticManager);
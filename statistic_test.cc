@@ -31,13 +31,27 @@
 
 #include "cachebash/statistic.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "cachebash/scoped_ptr.h"
 #include "gtest/gtest.h"
 
+using cachebash::DDSketch;
 using cachebash::Histogram;
+using cachebash::KeyCount;
+using cachebash::KeyTracker;
+using cachebash::kHistogramHighestTrackableValue;
+using cachebash::kHistogramUnit;
+using cachebash::SpaceSaving;
 using cachebash::Statistic;
+using cachebash::StatisticId;
+using cachebash::StatisticsCollection;
+using std::vector;
 
 namespace {
 
@@ -107,6 +121,61 @@ TEST_F(StatisticTest, Count) {
   EXPECT_EQ(3, statistic_.GetCount());
 }
 
+// Counts stay exact well past what a float can count to.
+TEST_F(StatisticTest, CountPastFloatPrecision) {
+  statistic_.AddSample(1.0);
+  for (int i = 0; i < 32; i++) {
+    scoped_ptr<Statistic> statistic_copy(statistic_.Copy());
+    statistic_.MergeWithStatistic(*statistic_copy);
+  }
+  statistic_.AddSample(1.0);
+  EXPECT_EQ((1LL << 32) + 1, statistic_.GetCount());
+  EXPECT_EQ((1LL << 32) + 1, statistic_.GetSum());
+  EXPECT_FLOAT_EQ(1.0, statistic_.GetAverage());
+}
+
+// Buffered samples are visible as soon as anything reads the statistic,
+// whether or not a batch has filled up.
+TEST_F(StatisticTest, BatchedSamples) {
+  Histogram histogram(cachebash::kDefaultSignificantDigits);
+  int n_samples = 3 * cachebash::kSampleBatchSize + 5;
+  for (int i = 0; i < n_samples; i++) {
+    statistic_.AddSample(i * 1e-4);
+    histogram.AddSample(i * 1e-4);
+  }
+  EXPECT_EQ(n_samples, statistic_.GetCount());
+  EXPECT_EQ(0, statistic_.GetMin());
+  EXPECT_NEAR((n_samples - 1) * 1e-4, statistic_.GetMax(), 1e-6);
+  EXPECT_NEAR(histogram.GetQuantile(0.9), statistic_.GetQuantile(0.9), 1e-6);
+
+  // So are the ones copied or merged before being recorded.
+  statistic_.AddSample(1.0);
+  scoped_ptr<Statistic> statistic_copy(statistic_.Copy());
+  EXPECT_EQ(n_samples + 1, statistic_copy->GetCount());
+  statistic_.AddSample(2.0);
+  statistic_copy->MergeWithStatistic(statistic_);
+  EXPECT_EQ(2 * n_samples + 3, statistic_copy->GetCount());
+  EXPECT_EQ(2.0, statistic_copy->GetMax());
+}
+
+// Recording each sample straight away or in batches records the same.
+// What each costs is timed by cachebash-bench.
+TEST_F(StatisticTest, ImmediateAndBatchedSamples) {
+  const int kNumSamples = 10 * cachebash::kSampleBatchSize + 3;
+  Statistic immediate_statistic("immediate", false);
+  Statistic batched_statistic("batched", false);
+  for (int i = 0; i < kNumSamples; i++) {
+    float sample = (rand() % 1000000) * 1e-9;
+    immediate_statistic.AddSample(sample);
+    immediate_statistic.FlushSamples();
+    batched_statistic.AddSample(sample);
+  }
+  EXPECT_EQ(kNumSamples, immediate_statistic.GetCount());
+  EXPECT_EQ(kNumSamples, batched_statistic.GetCount());
+  EXPECT_EQ(immediate_statistic.GetQuantile(0.5),
+            batched_statistic.GetQuantile(0.5));
+}
+
 TEST_F(StatisticTest, GetQuantile) {
   statistic_.AddSample(1);
   statistic_.AddSample(2);
@@ -116,8 +185,10 @@ TEST_F(StatisticTest, GetQuantile) {
   statistic_.AddSample(3);
   statistic_.AddSample(3);
   statistic_.AddSample(3);
-  EXPECT_NEAR(1, statistic_.GetQuantile(0.125), 1e-6);
-  EXPECT_NEAR(2, statistic_.GetQuantile(0.5), 1e-6);
+  // Quantiles are accurate to the histogram's 2 significant digits, apart
+  // from the 100th percentile, which is the exact max.
+  EXPECT_NEAR(1, statistic_.GetQuantile(0.125), 1e-2);
+  EXPECT_NEAR(2, statistic_.GetQuantile(0.5), 2e-2);
   EXPECT_NEAR(3, statistic_.GetQuantile(1.0), 1e-6);
 
   Statistic second_statistic("", false);
@@ -257,112 +328,459 @@ TEST_F(StatisticTest, Reset) {
   statistic_.AddSample(2);
   statistic_.AddSample(3);
   statistic_.AddSample(4);
-  EXPECT_EQ(3, statistic_.GetQuantile(.75));
+  EXPECT_NEAR(3, statistic_.GetQuantile(.75), 3e-2);
   EXPECT_EQ(4, statistic_.GetMax());
   EXPECT_EQ(4, statistic_.GetCount());
 }
 
 TEST(HistogramTest, AddSample) {
-  float min = 1e-3;
-  float max = 1.0;
-  int n_bins = 10;
-  Histogram histogram(min, max, n_bins);
-  histogram.AddSample(1e-3);
-  EXPECT_EQ(1, histogram.histogram()[0]);
-  histogram.AddSample(5e-3);
-  EXPECT_EQ(2, histogram.histogram()[0]);
-  histogram.AddSample(.101);
-  EXPECT_EQ(1, histogram.histogram()[1]);
-  histogram.AddSample(0.999999);
-  EXPECT_EQ(1, histogram.histogram()[n_bins - 1]);
+  Histogram histogram(2);
+  histogram.RecordValue(0);
+  histogram.RecordValue(1);
+  histogram.RecordValue(255);
+  EXPECT_EQ(1, histogram.counts()[0]);
+  EXPECT_EQ(1, histogram.counts()[1]);
+  EXPECT_EQ(1, histogram.counts()[255]);
+  // Values past the first bucket share counts with their neighbors.
+  histogram.RecordValue(256);
+  histogram.RecordValue(257);
+  EXPECT_EQ(2, histogram.counts()[histogram.GetCountsIndex(256)]);
+  histogram.AddSample(1e-6);
+  EXPECT_EQ(1, histogram.counts()[histogram.GetCountsIndex(1000)]);
 
   // Make sure the correct number of samples is recorded.
-  EXPECT_EQ(4, histogram.n_samples());
+  EXPECT_EQ(6, histogram.n_samples());
+}
+
+// Every value must be recorded to within the requested precision.
+TEST(HistogramTest, Precision) {
+  for (int digits = 1; digits <= 3; digits++) {
+    Histogram histogram(digits);
+    double resolution = 1.0;
+    for (int i = 0; i < digits; i++) {
+      resolution /= 10.0;
+    }
+    for (int64_t value = 1; value < (1LL << 40); value = value * 3 + 1) {
+      int index = histogram.GetCountsIndex(value);
+      int64_t lowest = histogram.GetValueFromIndex(index);
+      int64_t range = histogram.GetEquivalentRangeSize(index);
+      EXPECT_LE(lowest, value);
+      EXPECT_GT(lowest + range, value);
+      EXPECT_LE(range - 1, value * resolution) << value;
+    }
+  }
+}
+
+// A batch lands in the same counts as its samples added one at a time,
+// from below one unit up to past the highest trackable value.
+TEST(HistogramTest, AddSamples) {
+  for (int digits = 1; digits <= 3; digits++) {
+    Histogram histogram(digits);
+    Histogram batched_histogram(digits);
+    vector<float> values;
+    for (double value = 1e-10; value < 1e9; value = value * 1.7 + 1e-10) {
+      values.push_back(value);
+      histogram.AddSample(values.back());
+    }
+    batched_histogram.AddSamples(&values[0], values.size());
+    EXPECT_EQ(histogram.n_samples(), batched_histogram.n_samples());
+    EXPECT_TRUE(histogram.counts() == batched_histogram.counts()) << digits;
+  }
+
+  // Negative values aren't recorded.
+  Histogram histogram(2);
+  vector<float> negative_values(5, -1.0);
+  histogram.AddSamples(&negative_values[0], negative_values.size());
+  EXPECT_EQ(0, histogram.n_samples());
+  EXPECT_TRUE(histogram.counts().empty());
+}
+
+// Values too large to track are clamped rather than dropped.
+TEST(HistogramTest, Clamping) {
+  Histogram histogram(2);
+  histogram.AddSample(1e12);
+  EXPECT_EQ(1, histogram.n_samples());
+  EXPECT_NEAR(kHistogramHighestTrackableValue * kHistogramUnit,
+              histogram.GetQuantile(1.0),
+              kHistogramHighestTrackableValue * kHistogramUnit * 1e-2);
 }
 
 TEST(HistogramTest, Copy) {
-  float min = 1e-3;
-  float max = 1.0;
-  int n_bins = 10;
-  Histogram histogram(min, max, n_bins);
+  Histogram histogram(3);
   histogram.AddSample(1e-3);
   histogram.AddSample(5e-3);
   histogram.AddSample(.101);
-  histogram.AddSample(0.999999);
-  Histogram* histogram_copy = histogram.Copy();
-  for (int i = 0; i < n_bins; i++) {
-    EXPECT_EQ(histogram.histogram()[i], histogram_copy->histogram()[i]);
-  }
-  EXPECT_EQ(histogram.n_bins(), histogram_copy->n_bins());
-  EXPECT_EQ(histogram.min(), histogram_copy->min());
-  EXPECT_EQ(histogram.max(), histogram_copy->max());
+  histogram.AddSample(3600);
+  scoped_ptr<Histogram> histogram_copy(histogram.Copy());
+  EXPECT_TRUE(histogram.counts() == histogram_copy->counts());
+  EXPECT_EQ(histogram.significant_digits(),
+            histogram_copy->significant_digits());
   EXPECT_EQ(histogram.n_samples(), histogram_copy->n_samples());
 }
 
 TEST(HistogramTest, GetQuantile) {
-  float min = 1e-3;
-  float max = 1.0;
-  int n_bins = 10;
-  Histogram histogram(min, max, n_bins);
-  histogram.AddSample(1e-3);
-  histogram.AddSample(0.1);
-  histogram.AddSample(0.2);
-  histogram.AddSample(0.3);
-  // 1e-3 gets trucated.
-  EXPECT_NEAR(0.0, histogram.GetQuantile(0.25), 1e-6);
-  EXPECT_NEAR(0.1, histogram.GetQuantile(0.5), 1e-6);
-  EXPECT_NEAR(0.2, histogram.GetQuantile(0.75), 1e-6);
-  EXPECT_NEAR(0.3, histogram.GetQuantile(1.00), 1e-6);
-  histogram.AddSample(0.4);
-  histogram.AddSample(0.5);
-  histogram.AddSample(0.6);
-  histogram.AddSample(0.7);
-  histogram.AddSample(0.8);
-  histogram.AddSample(0.9);
-  // Again, 1e-3 gets truncated.
-  EXPECT_NEAR(0.0, histogram.GetQuantile(0.1), 1e-6);
-  EXPECT_NEAR(0.3, histogram.GetQuantile(0.4), 1e-6);
-  EXPECT_NEAR(0.6, histogram.GetQuantile(0.7), 1e-6);
-  EXPECT_NEAR(0.9, histogram.GetQuantile(1.0), 1e-6);
+  Histogram histogram(2);
+  for (int i = 1; i <= 1000; i++) {
+    histogram.AddSample(i * 1e-6);
+  }
+  EXPECT_NEAR(1e-6, histogram.GetQuantile(0.0), 1e-8);
+  EXPECT_NEAR(100e-6, histogram.GetQuantile(0.1), 1e-6);
+  EXPECT_NEAR(500e-6, histogram.GetQuantile(0.5), 5e-6);
+  EXPECT_NEAR(990e-6, histogram.GetQuantile(0.99), 10e-6);
+  EXPECT_NEAR(1000e-6, histogram.GetQuantile(1.0), 10e-6);
+
+  // Spans from nanoseconds to hours.
+  Histogram wide_histogram(2);
+  wide_histogram.AddSample(1e-9);
+  wide_histogram.AddSample(1e-6);
+  wide_histogram.AddSample(1.0);
+  wide_histogram.AddSample(7200);
+  EXPECT_NEAR(1e-9, wide_histogram.GetQuantile(0.25), 1e-11);
+  EXPECT_NEAR(1e-6, wide_histogram.GetQuantile(0.5), 1e-8);
+  EXPECT_NEAR(1.0, wide_histogram.GetQuantile(0.75), 1e-2);
+  EXPECT_NEAR(7200, wide_histogram.GetQuantile(1.0), 72);
+}
+
+TEST(HistogramTest, GetQuantiles) {
+  Histogram histogram(3);
+  for (int i = 1; i <= 1000; i++) {
+    histogram.AddSample(i * 1e-5);
+  }
+  // Any order, and duplicates, are fine.
+  float quantiles[] = { 0.99, 0.0, 0.5, 1.0, 0.5, 0.25 };
+  vector<float> quantile_vector(quantiles, quantiles + 6);
+  vector<float> values;
+  histogram.GetQuantiles(quantile_vector, &values);
+  ASSERT_EQ(6u, values.size());
+  for (int i = 0; i < 6; i++) {
+    EXPECT_EQ(histogram.GetQuantile(quantiles[i]), values[i])
+        << " quantile=" << quantiles[i];
+  }
+  EXPECT_NEAR(5e-3, values[2], 1e-5);
+
+  Histogram empty_histogram(3);
+  empty_histogram.GetQuantiles(quantile_vector, &values);
+  EXPECT_EQ(0.0, values[0]);
 }
 
 TEST(HistogramTest, MergeWithHistogram) {
-  float min = 1e-3;
-  float max = 1.0;
-  int n_bins = 10;
-  Histogram histogram(min, max, n_bins);
+  Histogram histogram(2);
   histogram.AddSample(1e-3);
   histogram.AddSample(5e-3);
   histogram.AddSample(.101);
   histogram.AddSample(0.999999);
 
-  Histogram second_histogram(min, max, n_bins);
+  Histogram second_histogram(2);
   second_histogram.AddSample(1e-3);
   second_histogram.AddSample(5e-3);
   second_histogram.AddSample(.101);
+  second_histogram.AddSample(3600);
 
+  // Merging is exact: it's the same as recording every sample in one.
+  Histogram expected_histogram(2);
+  expected_histogram.MergeWithHistogram(second_histogram);
+  expected_histogram.MergeWithHistogram(histogram);
   histogram.MergeWithHistogram(second_histogram);
 
-  EXPECT_EQ(4, histogram.histogram()[0]);
-  EXPECT_EQ(2, histogram.histogram()[1]);
-  EXPECT_EQ(1, histogram.histogram()[9]);
-  EXPECT_EQ(7, histogram.n_samples());
+  EXPECT_TRUE(expected_histogram.counts() == histogram.counts());
+  EXPECT_EQ(2, histogram.counts()[histogram.GetCountsIndex(1000000)]);
+  EXPECT_EQ(8, histogram.n_samples());
 }
 
 TEST(HistogramTest, Reset) {
-  float min = 1e-3;
-  float max = 1.0;
-  int n_bins = 10;
-  Histogram histogram(min, max, n_bins);
+  Histogram histogram(2);
   histogram.AddSample(1e-3);
   histogram.AddSample(5e-3);
   histogram.AddSample(.101);
   histogram.AddSample(0.999999);
   histogram.Reset();
-  for (int i = 0; i < n_bins; i++) {
-    EXPECT_EQ(0, histogram.histogram()[i]) << " i=" << i;
+  for (size_t i = 0; i < histogram.counts().size(); i++) {
+    EXPECT_EQ(0, histogram.counts()[i]) << " i=" << i;
   }
   EXPECT_EQ(histogram.n_samples(), 0);
 }
 
+TEST(HistogramTest, KolmogorovSmirnov) {
+  Histogram histogram(2);
+  Histogram same_histogram(2);
+  Histogram shifted_histogram(2);
+  for (int i = 0; i < 50; i++) {
+    histogram.AddSample(1e-3);
+    histogram.AddSample(2e-3);
+    same_histogram.AddSample(2e-3);
+    same_histogram.AddSample(1e-3);
+    shifted_histogram.AddSample(2e-3);
+    shifted_histogram.AddSample(2e-3);
+  }
+  EXPECT_EQ(0.0, cachebash::KolmogorovSmirnovStatistic(histogram,
+                                                       same_histogram));
+  EXPECT_EQ(1.0, cachebash::KolmogorovSmirnovPValue(0.0, 100, 100));
+
+  double d = cachebash::KolmogorovSmirnovStatistic(histogram,
+                                                   shifted_histogram);
+  EXPECT_DOUBLE_EQ(0.5, d);
+  // Q(lambda) with lambda = (sqrt(50) + 0.12 + 0.11 / sqrt(50)) * 0.5.
+  EXPECT_NEAR(1.055e-11, cachebash::KolmogorovSmirnovPValue(d, 100, 100),
+              1e-13);
+  EXPECT_NEAR(0.99, cachebash::KolmogorovSmirnovPValue(0.06, 100, 100),
+              0.01);
+}
+
+// Samples spread log-uniformly from 10us to 1s, as request latencies are.
+void GetLatencySamples(int n_samples, vector<float>* samples) {
+  srand(7);
+  for (int i = 0; i < n_samples; i++) {
+    samples->push_back(1e-5 * pow(1e5, rand() / (RAND_MAX + 1.0)));
+  }
+}
+
+// The sample the quantile ranks pick: the first whose cumulative count
+// reaches |quantile| of them.
+float GetExactQuantile(const vector<float>& sorted_samples, float quantile) {
+  int rank = static_cast<int>(ceil(quantile * sorted_samples.size()));
+  return sorted_samples[std::max(rank, 1) - 1];
+}
+
+TEST(DDSketchTest, QuantileErrorAgainstExact) {
+  vector<float> samples;
+  GetLatencySamples(100000, &samples);
+  DDSketch sketch(0.01);
+  sketch.AddSamples(&samples[0], samples.size());
+  Histogram histogram(2);
+  histogram.AddSamples(&samples[0], samples.size());
+  std::sort(samples.begin(), samples.end());
+
+  float quantiles[] = { 0.0, 0.1, 0.5, 0.9, 0.99, 0.999, 0.9999, 1.0 };
+  vector<float> quantile_vector(quantiles, quantiles + 8);
+  vector<float> sketch_values;
+  vector<float> histogram_values;
+  sketch.GetQuantiles(quantile_vector, &sketch_values);
+  histogram.GetQuantiles(quantile_vector, &histogram_values);
+  for (int i = 0; i < 8; i++) {
+    float exact = GetExactQuantile(samples, quantiles[i]);
+    // Floats carry about 1e-7 of error of their own.
+    EXPECT_NEAR(exact, sketch_values[i], exact * (0.01 + 1e-6))
+        << " quantile=" << quantiles[i];
+    EXPECT_NEAR(exact, histogram_values[i], exact * 0.01)
+        << " quantile=" << quantiles[i];
+  }
+  EXPECT_EQ(100000, sketch.n_samples());
+  // 5 decades at 1% take about 576 bins.
+  EXPECT_GT(600u, sketch.counts().size());
+}
+
+TEST(DDSketchTest, MergeWithSketch) {
+  vector<float> samples;
+  GetLatencySamples(1000, &samples);
+  samples.push_back(0.0);
+  DDSketch first_sketch(0.01);
+  first_sketch.AddSamples(&samples[0], 500);
+  DDSketch second_sketch(0.01);
+  second_sketch.AddSamples(&samples[500], samples.size() - 500);
+
+  // Merging is exact: it's the same as recording every sample in one.
+  DDSketch expected_sketch(0.01);
+  expected_sketch.AddSamples(&samples[0], samples.size());
+  first_sketch.MergeWithSketch(second_sketch);
+  EXPECT_EQ(expected_sketch.n_samples(), first_sketch.n_samples());
+  EXPECT_EQ(expected_sketch.min_index(), first_sketch.min_index());
+  EXPECT_TRUE(expected_sketch.counts() == first_sketch.counts());
+
+  scoped_ptr<DDSketch> copy(first_sketch.Copy());
+  EXPECT_TRUE(expected_sketch.counts() == copy->counts());
+  EXPECT_EQ(1, copy->GetCountAtOrBelow(0.0));
+  EXPECT_EQ(1001, copy->GetCountAtOrBelow(1.0));
+
+  copy->Reset();
+  EXPECT_EQ(0, copy->n_samples());
+  EXPECT_EQ(0, copy->GetCountAtOrBelow(1.0));
+}
+
+// Past kMaxDDSketchBins, the lowest bins are collapsed, so only the
+// lowest quantiles lose accuracy.
+TEST(DDSketchTest, BoundedBins) {
+  DDSketch sketch(0.01);
+  float samples[] = { 1e-8, 1e-3, 1e12 };
+  for (int i = 0; i < 100; i++) {
+    sketch.AddSamples(samples, 3);
+  }
+  EXPECT_EQ(cachebash::kMaxDDSketchBins,
+            static_cast<int>(sketch.counts().size()));
+  EXPECT_EQ(300, sketch.n_samples());
+  EXPECT_LT(1e-8, sketch.GetQuantile(0.0));
+  EXPECT_NEAR(1e-3, sketch.GetQuantile(0.5), 1e-5);
+  EXPECT_NEAR(1e12, sketch.GetQuantile(1.0), 1e10);
+
+  // Merging a sketch that reaches lower collapses it the same way.
+  DDSketch low_sketch(0.01);
+  low_sketch.AddSamples(samples, 1);
+  sketch.MergeWithSketch(low_sketch);
+  EXPECT_EQ(cachebash::kMaxDDSketchBins,
+            static_cast<int>(sketch.counts().size()));
+  EXPECT_EQ(301, sketch.n_samples());
+}
+
+TEST(DDSketchTest, StatisticBackend) {
+  Statistic statistic("test", false, 2, cachebash::kDDSketchBackend);
+  EXPECT_EQ(cachebash::kDDSketchBackend, statistic.backend());
+  for (int i = 1; i <= 1000; i++) {
+    statistic.AddSample(i * 1e-6);
+  }
+  scoped_ptr<Statistic> copy(statistic.Copy());
+  EXPECT_EQ(cachebash::kDDSketchBackend, copy->backend());
+  copy->MergeWithStatistic(statistic);
+  EXPECT_EQ(2000, copy->GetCount());
+  EXPECT_NEAR(500e-6, copy->GetQuantile(0.5), 5e-6);
+  // Quantiles are kept within the extremes.
+  EXPECT_NEAR(1e-6, copy->GetQuantile(0.0), 1e-8);
+  EXPECT_LE(copy->GetMin(), copy->GetQuantile(0.0));
+  EXPECT_NEAR(1000e-6, copy->GetQuantile(1.0), 1e-5);
+  EXPECT_GE(copy->GetMax(), copy->GetQuantile(1.0));
+  // The bin holding 100us holds the next couple of microseconds too.
+  EXPECT_NEAR(200, copy->GetCountAtOrBelow(100e-6), 6);
+
+  StatisticsCollection collection(NULL);
+  StatisticId id = collection.RegisterStatistic("sketched", false,
+                                                cachebash::kDDSketchBackend);
+  EXPECT_EQ(cachebash::kDDSketchBackend,
+            collection.GetStatistic(id)->backend());
+}
+
+TEST(StatisticsCollectionTest, StandardStatistics) {
+  StatisticsCollection collection(NULL);
+  collection.RegisterStandardStatistics();
+  EXPECT_EQ(cachebash::kNumStandardStatistics, collection.n_statistics());
+  EXPECT_EQ(cachebash::kLatencyStatistic,
+            collection.GetStatisticId("latency"));
+  EXPECT_EQ(cachebash::kGetRequestsStatistic,
+            collection.GetStatisticId("get_requests"));
+  EXPECT_EQ(cachebash::kUnhedgedLatencyStatistic,
+            collection.GetStatisticId("unhedged_latency"));
+  EXPECT_EQ(-1, collection.FindStatisticId("no_such_statistic"));
+}
+
+TEST(StatisticsCollectionTest, CopyAndMerge) {
+  StatisticsCollection collection(NULL);
+  collection.RegisterStandardStatistics();
+  StatisticId id = collection.RegisterStatistic("server/latency", false);
+  EXPECT_EQ(cachebash::kNumStandardStatistics, id);
+  collection.AddSample(id, 1.0);
+  collection.AddSample(cachebash::kLatencyStatistic, 2.0);
+
+  // Copies share ids, so they merge statistic by statistic.
+  scoped_ptr<StatisticsCollection> collection_copy(collection.Copy());
+  EXPECT_EQ(id, collection_copy->GetStatisticId("server/latency"));
+  collection_copy->AddSample(id, 3.0);
+  collection.MergeWithStatisticsCollection(*collection_copy);
+  EXPECT_EQ(3, collection.GetStatistic(id)->GetCount());
+  EXPECT_EQ(2, collection.GetStatistic("latency")->GetCount());
+
+  collection.ResetStatistics();
+  EXPECT_EQ(0, collection.GetStatistic(id)->GetCount());
+}
+
+// Test that counts are exact while every key has a counter.
+TEST(SpaceSavingTest, ExactUnderCapacity) {
+  SpaceSaving space_saving(4);
+  space_saving.Add("a", 3);
+  space_saving.Add("b", 1);
+  space_saving.Add("c", 2);
+  space_saving.Add("b", 4);
+  vector<KeyCount> top;
+  space_saving.GetTop(2, &top);
+  ASSERT_EQ(2u, top.size());
+  EXPECT_EQ("b", top[0].key);
+  EXPECT_EQ(5, top[0].count);
+  EXPECT_EQ(0, top[0].error);
+  EXPECT_EQ("a", top[1].key);
+  EXPECT_EQ(10, space_saving.n_added());
+
+  space_saving.Reset();
+  space_saving.GetTop(2, &top);
+  EXPECT_TRUE(top.empty());
+}
+
+// Test that heavy hitters are found among many more keys than counters,
+// with counts off by no more than n / capacity.
+TEST(SpaceSavingTest, HeavyHitters) {
+  const int kCapacity = 20;
+  SpaceSaving space_saving(kCapacity);
+  int n_added = 0;
+  for (int i = 0; i < 10000; i++) {
+    char key[16];
+    snprintf(key, sizeof(key), "key%d", i);
+    space_saving.Add(key, 1);
+    space_saving.Add(i % 2 == 0 ? "hot" : "warm", 1);
+    n_added += 2;
+    if (i % 4 == 0) {
+      space_saving.Add("warm", 1);
+      n_added++;
+    }
+  }
+  vector<KeyCount> top;
+  space_saving.GetTop(2, &top);
+  ASSERT_EQ(2u, top.size());
+  EXPECT_EQ("warm", top[0].key);
+  EXPECT_EQ("hot", top[1].key);
+  EXPECT_LE(7500, top[0].count);
+  EXPECT_GE(7500 + n_added / kCapacity, top[0].count);
+  EXPECT_LE(5000, top[1].count);
+  EXPECT_GE(5000 + n_added / kCapacity, top[1].count);
+}
+
+// Test that merging summaries keeps the combined stream's heavy hitters,
+// even when each summary saw a different part of it.
+TEST(SpaceSavingTest, MergeWithSpaceSaving) {
+  SpaceSaving first(3);
+  SpaceSaving second(3);
+  first.Add("a", 10);
+  first.Add("b", 6);
+  first.Add("c", 1);
+  second.Add("b", 7);
+  second.Add("d", 2);
+  second.Add("e", 1);
+  first.MergeWithSpaceSaving(second);
+
+  vector<KeyCount> top;
+  first.GetTop(3, &top);
+  ASSERT_EQ(3u, top.size());
+  EXPECT_EQ("b", top[0].key);
+  EXPECT_EQ(13, top[0].count);
+  EXPECT_EQ("a", top[1].key);
+  // "a" may have been one of the keys |second| evicted.
+  EXPECT_EQ(11, top[1].count);
+  EXPECT_EQ(1, top[1].error);
+  EXPECT_EQ(27, first.n_added());
+}
+
+// Test that copies of a collection track keys, and merge and reset them
+// with the statistics.
+TEST(SpaceSavingTest, KeyTrackerInCollection) {
+  StatisticsCollection collection(NULL);
+  collection.RegisterStandardStatistics();
+  EXPECT_TRUE(collection.key_tracker() == NULL);
+  collection.TrackKeys(8, 0.01);
+
+  scoped_ptr<StatisticsCollection> worker_collection(collection.Copy());
+  KeyTracker* key_tracker = worker_collection->key_tracker();
+  ASSERT_TRUE(key_tracker != NULL);
+  EXPECT_FLOAT_EQ(0.01, key_tracker->slow_threshold());
+  key_tracker->hot_keys()->Add("foo", 2);
+  key_tracker->slow_keys()->Add("foo", 1);
+
+  scoped_ptr<StatisticsCollection> interval_collection(collection.Copy());
+  interval_collection->MergeWithStatisticsCollection(*worker_collection);
+  vector<KeyCount> top;
+  interval_collection->key_tracker()->hot_keys()->GetTop(1, &top);
+  ASSERT_EQ(1u, top.size());
+  EXPECT_EQ("foo", top[0].key);
+  EXPECT_EQ(2, top[0].count);
+  interval_collection->key_tracker()->slow_keys()->GetTop(1, &top);
+  EXPECT_EQ(1u, top.size());
+
+  worker_collection->ResetStatistics();
+  worker_collection->key_tracker()->hot_keys()->GetTop(1, &top);
+  EXPECT_TRUE(top.empty());
+}
+
 }  // namespace
@@ -0,0 +1,163 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// tcp_info.cc
+//
+
+#include "cachebash/tcp_info.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "cachebash/config.h"
+#include "cachebash/connection.h"
+
+namespace cachebash {
+
+static const char* kTcpInfoMetricNames[kNumTcpInfoMetrics] = {
+  "tcp_rtt", "tcp_rttvar", "tcp_retransmits", "tcp_cwnd",
+  "tcp_bytes_in_flight"
+};
+
+bool ReadTcpInfo(int fd, TcpInfoSample* sample) {
+  struct tcp_info info;
+  socklen_t info_size = sizeof(info);
+  memset(&info, 0, sizeof(info));
+  if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &info_size) < 0) {
+    return false;
+  }
+  sample->rtt = info.tcpi_rtt * 1e-6;
+  sample->rttvar = info.tcpi_rttvar * 1e-6;
+  sample->total_retransmits = info.tcpi_total_retrans;
+  sample->cwnd = info.tcpi_snd_cwnd;
+  // The kernel counts what is in flight in segments.
+  sample->bytes_in_flight = info.tcpi_unacked * info.tcpi_snd_mss;
+  return true;
+}
+
+string GetTcpInfoStatisticName(const string& prefix, int metric) {
+  return prefix + "/" + kTcpInfoMetricNames[metric];
+}
+
+string GetWorkerStatisticPrefix(int worker_index) {
+  char prefix[32];
+  snprintf(prefix, sizeof(prefix), "worker_%02d", worker_index);
+  return prefix;
+}
+
+TcpInfoSampler::TcpInfoSampler(const Config& config,
+                               const StatisticsCollection& collection,
+                               int worker_index) {
+  for (size_t i = 0; i < config.servers_.size(); i++) {
+    vector<StatisticId> ids;
+    for (int j = 0; j < kNumTcpInfoMetrics; j++) {
+      ids.push_back(collection.GetStatisticId(
+          GetTcpInfoStatisticName(config.servers_[i].GetName(), j)));
+    }
+    server_statistic_ids_.push_back(ids);
+  }
+  for (int i = 0; i < kNumTcpInfoMetrics; i++) {
+    worker_statistic_ids_.push_back(collection.GetStatisticId(
+        GetTcpInfoStatisticName(GetWorkerStatisticPrefix(worker_index), i)));
+  }
+}
+
+void TcpInfoSampler::RegisterStatistics(const Config& config,
+                                        StatisticsCollection* collection) {
+  for (vector<Server>::const_iterator it = config.servers_.begin();
+       it != config.servers_.end();
+       it++) {
+    for (int i = 0; i < kNumTcpInfoMetrics; i++) {
+      collection->RegisterStatistic(
+          GetTcpInfoStatisticName(it->GetName(), i), false);
+    }
+    string prefix = it->GetName();
+    collection->AddStatisticPrinter(
+        GetTcpInfoStatisticName(prefix, kTcpRttMetric), new AveragePrinter());
+    collection->AddStatisticPrinter(
+        GetTcpInfoStatisticName(prefix, kTcpRttMetric), new MaxPrinter());
+    collection->AddStatisticPrinter(
+        GetTcpInfoStatisticName(prefix, kTcpRttVarMetric),
+        new AveragePrinter());
+    collection->AddStatisticPrinter(
+        GetTcpInfoStatisticName(prefix, kTcpRetransmitsMetric),
+        new CountPrinter());
+    collection->AddStatisticPrinter(
+        GetTcpInfoStatisticName(prefix, kTcpCwndMetric), new AveragePrinter());
+    collection->AddStatisticPrinter(
+        GetTcpInfoStatisticName(prefix, kTcpCwndMetric), new MinPrinter());
+    collection->AddStatisticPrinter(
+        GetTcpInfoStatisticName(prefix, kTcpBytesInFlightMetric),
+        new AveragePrinter());
+    collection->AddStatisticPrinter(
+        GetTcpInfoStatisticName(prefix, kTcpBytesInFlightMetric),
+        new MaxPrinter());
+  }
+  // Workers' statistics are only recorded with -O and -P.
+  for (int i = 0; i < config.n_worker_threads_; i++) {
+    for (int j = 0; j < kNumTcpInfoMetrics; j++) {
+      collection->RegisterStatistic(
+          GetTcpInfoStatisticName(GetWorkerStatisticPrefix(i), j), false);
+    }
+  }
+}
+
+void TcpInfoSampler::Sample(
+    const vector<vector<Connection*> >& connection_pools,
+    StatisticsCollection* collection) {
+  total_retransmits_.resize(connection_pools.size());
+  for (size_t i = 0; i < connection_pools.size(); i++) {
+    total_retransmits_[i].resize(connection_pools[i].size(), 0);
+    for (size_t j = 0; j < connection_pools[i].size(); j++) {
+      TcpInfoSample sample;
+      if (!ReadTcpInfo(connection_pools[i][j]->GetSocketFd(), &sample)) {
+        continue;
+      }
+      uint32_t retransmits = sample.total_retransmits
+                             - total_retransmits_[i][j];
+      total_retransmits_[i][j] = sample.total_retransmits;
+
+      const StatisticId* ids[] = { &server_statistic_ids_[i][0],
+                                   &worker_statistic_ids_[0] };
+      for (int k = 0; k < 2; k++) {
+        collection->AddSample(ids[k][kTcpRttMetric], sample.rtt);
+        collection->AddSample(ids[k][kTcpRttVarMetric], sample.rttvar);
+        for (uint32_t l = 0; l < retransmits; l++) {
+          collection->AddSample(ids[k][kTcpRetransmitsMetric], 1);
+        }
+        collection->AddSample(ids[k][kTcpCwndMetric], sample.cwnd);
+        collection->AddSample(ids[k][kTcpBytesInFlightMetric],
+                              sample.bytes_in_flight);
+      }
+    }
+  }
+}
+
+}  // namespace cachebash
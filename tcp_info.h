@@ -0,0 +1,118 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// tcp_info.h
+//
+// Samples the kernel's TCP_INFO for every connection: the smoothed round
+// trip time and its variation, retransmits, the congestion window and the
+// bytes in flight. Samples go in the worker's statistics collection, per
+// server and per worker, so they fall in the same intervals as the latency
+// they might explain.
+//
+
+#ifndef TCP_INFO_H_
+#define TCP_INFO_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "cachebash/statistic.h"
+#include "cachebash/util.h"
+
+using std::string;
+using std::vector;
+
+namespace cachebash {
+
+class Config;
+class Connection;
+
+// How many times a stats interval every connection is sampled.
+static const int kTcpInfoSamplesPerInterval = 10;
+
+enum TcpInfoMetric {
+  // Seconds.
+  kTcpRttMetric,
+  kTcpRttVarMetric,
+  // One sample per retransmitted segment, so they are counted.
+  kTcpRetransmitsMetric,
+  // Segments.
+  kTcpCwndMetric,
+  kTcpBytesInFlightMetric,
+  kNumTcpInfoMetrics
+};
+
+// What one TCP_INFO sample says about a connection.
+struct TcpInfoSample {
+  double rtt;
+  double rttvar;
+  // Segments retransmitted over the life of the connection.
+  uint32_t total_retransmits;
+  int cwnd;
+  int bytes_in_flight;
+};
+
+// Reads TCP_INFO of the socket |fd|. Returns false if the kernel wouldn't
+// give it.
+bool ReadTcpInfo(int fd, TcpInfoSample* sample);
+// The name of |metric| for the statistics named by |prefix|, like
+// "host:11211/tcp_rtt" or "worker_01/tcp_rtt".
+string GetTcpInfoStatisticName(const string& prefix, int metric);
+string GetWorkerStatisticPrefix(int worker_index);
+
+class TcpInfoSampler {
+ public:
+  // Looks up the statistics RegisterStatistics registered in |collection|.
+  TcpInfoSampler(const Config& config,
+                 const StatisticsCollection& collection,
+                 int worker_index);
+  // Registers the statistics of every server and worker, and prints the
+  // servers' each interval.
+  static void RegisterStatistics(const Config& config,
+                                 StatisticsCollection* collection);
+  // Samples each connection of |connection_pools|, which are indexed by
+  // server, into |collection|.
+  void Sample(const vector<vector<Connection*> >& connection_pools,
+              StatisticsCollection* collection);
+
+ private:
+  // Indexed by server, then TcpInfoMetric.
+  vector<vector<StatisticId> > server_statistic_ids_;
+  // Indexed by TcpInfoMetric.
+  vector<StatisticId> worker_statistic_ids_;
+  // The total retransmits of each connection when it was last sampled,
+  // indexed like the connection pools.
+  vector<vector<uint32_t> > total_retransmits_;
+
+  DISALLOW_COPY_AND_ASSIGN(TcpInfoSampler);
+};
+
+}  // namespace cachebash
+
+#endif  // TCP_INFO_H_
@@ -0,0 +1,144 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+//  tcp_info_test.cc
+//
+
+#include "cachebash/tcp_info.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "cachebash/config.h"
+#include "cachebash/connection.h"
+#include "gtest/gtest.h"
+
+using cachebash::Config;
+using cachebash::Connection;
+using cachebash::GetTcpInfoStatisticName;
+using cachebash::Server;
+using cachebash::StatisticsCollection;
+using cachebash::TcpInfoSample;
+using cachebash::TcpInfoSampler;
+
+namespace {
+
+// Listens on an ephemeral loopback port, returning the socket and setting
+// |port|.
+int Listen(int* port) {
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+  EXPECT_EQ(0, bind(listen_fd, reinterpret_cast<struct sockaddr*>(&address),
+                    sizeof(address)));
+  EXPECT_EQ(0, listen(listen_fd, 4));
+  socklen_t address_size = sizeof(address);
+  getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&address),
+              &address_size);
+  *port = ntohs(address.sin_port);
+  return listen_fd;
+}
+
+TEST(TcpInfoTest, StatisticNames) {
+  EXPECT_EQ("127.0.0.1:11211/tcp_rtt",
+            GetTcpInfoStatisticName("127.0.0.1:11211",
+                                    cachebash::kTcpRttMetric));
+  EXPECT_EQ("worker_01/tcp_bytes_in_flight",
+            GetTcpInfoStatisticName(cachebash::GetWorkerStatisticPrefix(1),
+                                    cachebash::kTcpBytesInFlightMetric));
+}
+
+TEST(TcpInfoTest, ReadTcpInfo) {
+  int port;
+  int listen_fd = Listen(&port);
+  Connection connection(cachebash::TCP, false, 0, 0);
+  connection.OpenTcpSocket("127.0.0.1", port, true);
+  TcpInfoSample sample;
+  ASSERT_TRUE(cachebash::ReadTcpInfo(connection.GetSocketFd(), &sample));
+  EXPECT_LT(0, sample.cwnd);
+  EXPECT_LE(0.0, sample.rtt);
+  EXPECT_EQ(0u, sample.total_retransmits);
+  EXPECT_EQ(0, sample.bytes_in_flight);
+  EXPECT_FALSE(cachebash::ReadTcpInfo(-1, &sample));
+  close(connection.GetSocketFd());
+  close(listen_fd);
+}
+
+// Every connection's sample counts towards both its server and the worker.
+TEST(TcpInfoTest, SamplePerServerAndWorker) {
+  int port;
+  int listen_fd = Listen(&port);
+  Config config;
+  config.n_worker_threads_ = 2;
+  vector<vector<Connection*> > connection_pools(2);
+  for (int i = 0; i < 2; i++) {
+    Server server;
+    server.hostname = "127.0.0.1";
+    server.ip_address = "127.0.0.1";
+    server.port = port + i;
+    server.weight = 1;
+    config.servers_.push_back(server);
+    for (int j = 0; j <= i; j++) {
+      Connection* connection = new Connection(cachebash::TCP, false, i, j);
+      connection->OpenTcpSocket("127.0.0.1", port, true);
+      connection_pools[i].push_back(connection);
+    }
+  }
+
+  StatisticsCollection collection(NULL);
+  TcpInfoSampler::RegisterStatistics(config, &collection);
+  EXPECT_EQ(4 * cachebash::kNumTcpInfoMetrics, collection.n_statistics());
+  TcpInfoSampler sampler(config, collection, 1);
+  sampler.Sample(connection_pools, &collection);
+  sampler.Sample(connection_pools, &collection);
+
+  string server_prefix = config.servers_[1].GetName();
+  EXPECT_EQ(4, collection.GetStatistic(GetTcpInfoStatisticName(
+                   server_prefix, cachebash::kTcpRttMetric))->GetCount());
+  EXPECT_EQ(6, collection.GetStatistic(GetTcpInfoStatisticName(
+                   "worker_01", cachebash::kTcpCwndMetric))->GetCount());
+  EXPECT_EQ(0, collection.GetStatistic(GetTcpInfoStatisticName(
+                   "worker_00", cachebash::kTcpCwndMetric))->GetCount());
+  EXPECT_EQ(0, collection.GetStatistic(GetTcpInfoStatisticName(
+                   "worker_01", cachebash::kTcpRetransmitsMetric))
+                   ->GetCount());
+
+  for (int i = 0; i < 2; i++) {
+    for (size_t j = 0; j < connection_pools[i].size(); j++) {
+      close(connection_pools[i][j]->GetSocketFd());
+      delete connection_pools[i][j];
+    }
+  }
+  close(listen_fd);
+}
+
+}  // namespace
@@ -0,0 +1,233 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// trace.cc
+//
+
+#include "cachebash/trace.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include "cachebash/request.h"
+
+namespace cachebash {
+
+static const char kTraceMagic[4] = { 'C', 'B', 'T', 'R' };
+// How long the drain thread sleeps when the rings are empty.
+static const int kTraceDrainIntervalMicroseconds = 10000;
+
+static const char* GetOpcodeName(uint8_t op_code) {
+  switch (static_cast<char>(op_code)) {
+    case OPCODE_GET:
+      return "get";
+    case OPCODE_SET:
+      return "set";
+    case OPCODE_ADD:
+      return "add";
+    case OPCODE_REP:
+      return "replace";
+    case OPCODE_TOUCH:
+      return "touch";
+    case OPCODE_GETKQ:
+      return "multiget";
+    default:
+      return "unknown";
+  }
+}
+
+// Microseconds from |start| to |end|, or -1 if either is untimed.
+static int64_t GetStageMicroseconds(int64_t start, int64_t end) {
+  return (start == 0 || end == 0) ? -1 : end - start;
+}
+
+string FormatTraceRecord(const TraceRecord& record) {
+  char line[512];
+  snprintf(line, sizeof(line),
+           "%.6f worker %d server %d %s %.*s status %d value %d "
+           "response %d/%d latency %.6f wire %.6f "
+           "stages(us) generate %lld write %lld wait %lld read %lld%s%s%s%s",
+           record.send_time * 1e-6, record.worker_index, record.server_index,
+           GetOpcodeName(record.op_code), record.key_size, record.key,
+           record.status, record.request_value_size, record.response_size,
+           record.response_value_size, record.latency, record.wire_latency,
+           static_cast<long long>(GetStageMicroseconds(
+               record.scheduled_time, record.generated_time)),
+           static_cast<long long>(GetStageMicroseconds(
+               record.generated_time, record.written_time)),
+           static_cast<long long>(GetStageMicroseconds(
+               record.written_time, record.first_byte_time)),
+           static_cast<long long>(GetStageMicroseconds(
+               record.first_byte_time, record.parsed_time)),
+           (record.flags & kTraceSlow) ? " slow" : "",
+           (record.flags & kTraceHedge) ? " hedge" : "",
+           (record.flags & kTraceFill) ? " fill" : "",
+           (record.flags & kTraceFanout) ? " fanout" : "");
+  return line;
+}
+
+bool ReadTraceHeader(FILE* file) {
+  char magic[4];
+  uint32_t version, record_size;
+  if (fread(magic, sizeof(magic), 1, file) != 1
+      || fread(&version, sizeof(version), 1, file) != 1
+      || fread(&record_size, sizeof(record_size), 1, file) != 1) {
+    return false;
+  }
+  return memcmp(magic, kTraceMagic, sizeof(magic)) == 0
+         && version == kTraceVersion
+         && record_size == sizeof(TraceRecord);
+}
+
+void WriteTraceHeader(FILE* file) {
+  uint32_t version = kTraceVersion;
+  uint32_t record_size = sizeof(TraceRecord);
+  fwrite(kTraceMagic, sizeof(kTraceMagic), 1, file);
+  fwrite(&version, sizeof(version), 1, file);
+  fwrite(&record_size, sizeof(record_size), 1, file);
+}
+
+TraceRing::TraceRing(int capacity)
+    : records_(capacity),
+      mask_(capacity - 1),
+      head_(0),
+      tail_(0),
+      n_dropped_(0) {
+  if (capacity <= 0 || (capacity & (capacity - 1)) != 0) {
+    LOG_FATAL("Trace ring capacity must be a power of two");
+  }
+}
+
+bool TraceRing::TryPush(const TraceRecord& record) {
+  uint32_t tail = tail_;
+  if (tail - head_ == records_.size()) {
+    n_dropped_++;
+    return false;
+  }
+  records_[tail & mask_] = record;
+  // The record must be visible before the reader can see the slot filled.
+  __sync_synchronize();
+  tail_ = tail + 1;
+  return true;
+}
+
+bool TraceRing::TryPop(TraceRecord* record) {
+  uint32_t head = head_;
+  if (head == tail_) {
+    return false;
+  }
+  // Don't read the record before seeing the slot filled.
+  __sync_synchronize();
+  *record = records_[head & mask_];
+  // Nor let the writer reuse the slot before it's been read.
+  __sync_synchronize();
+  head_ = head + 1;
+  return true;
+}
+
+TraceWriter::TraceWriter(const string& filename, int n_workers)
+    : n_written_(0),
+      stopping_(false),
+      started_(false) {
+  file_ = fopen(filename.c_str(), "wb");
+  if (file_ == NULL) {
+    LOG_FATAL("Couldn't open trace file " + filename);
+  }
+  WriteTraceHeader(file_);
+  for (int i = 0; i < n_workers; i++) {
+    rings_.push_back(new TraceRing(kTraceRingCapacity));
+  }
+}
+
+// Workers may still hold the rings, so they are only freed if nothing
+// started writing to them.
+TraceWriter::~TraceWriter() {
+  Stop();
+  if (!started_) {
+    for (size_t i = 0; i < rings_.size(); i++) {
+      delete rings_[i];
+    }
+  }
+}
+
+int64_t TraceWriter::n_dropped() const {
+  int64_t n_dropped = 0;
+  for (size_t i = 0; i < rings_.size(); i++) {
+    n_dropped += rings_[i]->n_dropped();
+  }
+  return n_dropped;
+}
+
+void TraceWriter::Start() {
+  started_ = true;
+  int rc = pthread_create(&thread_, NULL, DrainLoopHook, this);
+  if (rc) {
+    LOG_FATAL("Trace writer thread failed to start");
+  }
+}
+
+void TraceWriter::Stop() {
+  if (file_ == NULL) {
+    return;
+  }
+  if (started_) {
+    stopping_ = true;
+    pthread_join(thread_, NULL);
+  }
+  Drain();
+  fclose(file_);
+  file_ = NULL;
+}
+
+int TraceWriter::Drain() {
+  int n_drained = 0;
+  TraceRecord record;
+  for (size_t i = 0; i < rings_.size(); i++) {
+    while (rings_[i]->TryPop(&record)) {
+      fwrite(&record, sizeof(record), 1, file_);
+      n_drained++;
+    }
+  }
+  n_written_ += n_drained;
+  return n_drained;
+}
+
+void TraceWriter::DrainLoop() {
+  while (!stopping_) {
+    if (Drain() == 0) {
+      usleep(kTraceDrainIntervalMicroseconds);
+    }
+  }
+}
+
+void* DrainLoopHook(void* arg) {
+  TraceWriter* trace_writer = static_cast<TraceWriter*>(arg);
+  trace_writer->DrainLoop();
+  return NULL;
+}
+
+}  // namespace cachebash
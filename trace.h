@@ -0,0 +1,162 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+// trace.h
+//
+// Sampled request tracing. Workers write the lifecycle of one in every N
+// responses, and of every response slower than a threshold, to their own
+// single-producer single-consumer ring. A separate thread drains the rings
+// to a binary trace file, which cachebash-trace decodes. Workers never
+// wait on it: when a ring is full the record is dropped and counted.
+//
+// The trace file is in the machine's byte order. It starts with
+//   char magic[4] = "CBTR", uint32 version, uint32 record_size
+// followed by TraceRecords, each record_size bytes.
+//
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "cachebash/util.h"
+
+using std::string;
+using std::vector;
+
+namespace cachebash {
+
+static const uint32_t kTraceVersion = 1;
+// memcached's longest key.
+static const int kMaxTraceKeySize = 250;
+// Records each worker's ring holds before it drops them.
+static const int kTraceRingCapacity = 4096;
+
+// Why a record was traced, and what kind of request it was.
+enum TraceFlags {
+  kTraceSampled = 1,
+  kTraceSlow = 2,
+  kTraceHedge = 4,
+  kTraceFill = 8,
+  kTraceFanout = 16
+};
+
+// Everything about one request and its response. Times are microseconds
+// since the epoch; stage times are 0 unless stages were timed (-S).
+struct TraceRecord {
+  int64_t send_time;
+  int64_t scheduled_time;
+  int64_t generated_time;
+  int64_t written_time;
+  int64_t first_byte_time;
+  int64_t parsed_time;
+  float latency;
+  // Negative unless kernel timestamps were on (-K).
+  float wire_latency;
+  int32_t request_value_size;
+  int32_t response_size;
+  int32_t response_value_size;
+  uint16_t status;
+  uint16_t server_index;
+  uint16_t worker_index;
+  uint8_t op_code;
+  uint8_t flags;
+  uint8_t key_size;
+  char key[kMaxTraceKeySize];
+};
+
+// Formats |record| as one line of text.
+string FormatTraceRecord(const TraceRecord& record);
+// Reads the header of a trace file. Returns false if it isn't one this
+// version can read.
+bool ReadTraceHeader(FILE* file);
+void WriteTraceHeader(FILE* file);
+
+// A ring of records with one writer and one reader, which need no lock.
+class TraceRing {
+ public:
+  // |capacity| must be a power of two.
+  explicit TraceRing(int capacity);
+  // Only the writer may call this. Returns false, dropping |record|, if
+  // the ring is full.
+  bool TryPush(const TraceRecord& record);
+  // Only the reader may call this. Returns false if the ring is empty.
+  bool TryPop(TraceRecord* record);
+  int64_t n_dropped() const { return n_dropped_; }
+
+ private:
+  vector<TraceRecord> records_;
+  uint32_t mask_;
+  // The next record to read, advanced only by the reader.
+  volatile uint32_t head_;
+  // The next slot to write, advanced only by the writer.
+  volatile uint32_t tail_;
+  volatile int64_t n_dropped_;
+
+  DISALLOW_COPY_AND_ASSIGN(TraceRing);
+};
+
+class TraceWriter {
+ public:
+  // Writes the rings of |n_workers| workers to |filename|.
+  TraceWriter(const string& filename, int n_workers);
+  ~TraceWriter();
+  TraceRing* ring(int worker_index) { return rings_[worker_index]; }
+  int64_t n_dropped() const;
+  int64_t n_written() const { return n_written_; }
+  void Start();
+  // Drains what the rings hold and closes the file. Workers may keep
+  // pushing, but nothing more is written.
+  void Stop();
+  void DrainLoop();
+
+ private:
+  // Writes out everything the rings hold. Returns how many records that
+  // was.
+  int Drain();
+
+  FILE* file_;
+  vector<TraceRing*> rings_;
+  int64_t n_written_;
+  volatile bool stopping_;
+  bool started_;
+  pthread_t thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(TraceWriter);
+};
+
+// Interfaces between pthread's thread creation callback and the trace
+// writer's loop.
+void* DrainLoopHook(void* arg);
+
+}  // namespace cachebash
+
+#endif  // TRACE_H_
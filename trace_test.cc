@@ -0,0 +1,124 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+//  trace_test.cc
+//
+
+#include "cachebash/trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+#include "cachebash/request.h"
+#include "gtest/gtest.h"
+
+using cachebash::TraceRecord;
+using cachebash::TraceRing;
+using cachebash::TraceWriter;
+using std::string;
+
+namespace {
+
+TraceRecord MakeTraceRecord(int64_t send_time, const string& key) {
+  TraceRecord record;
+  memset(&record, 0, sizeof(record));
+  record.send_time = send_time;
+  record.latency = 0.25;
+  record.wire_latency = -1.0;
+  record.op_code = OPCODE_GET;
+  record.key_size = key.size();
+  memcpy(record.key, key.data(), key.size());
+  return record;
+}
+
+// Test that the ring keeps order across wrapping and drops when full.
+TEST(TraceRingTest, PushAndPop) {
+  TraceRing ring(4);
+  TraceRecord record;
+  EXPECT_FALSE(ring.TryPop(&record));
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 4; i++) {
+      EXPECT_TRUE(ring.TryPush(MakeTraceRecord(round * 4 + i, "foo")));
+    }
+    EXPECT_FALSE(ring.TryPush(MakeTraceRecord(-1, "foo")));
+    for (int i = 0; i < 4; i++) {
+      ASSERT_TRUE(ring.TryPop(&record));
+      EXPECT_EQ(round * 4 + i, record.send_time);
+    }
+    EXPECT_FALSE(ring.TryPop(&record));
+  }
+  EXPECT_EQ(3, ring.n_dropped());
+}
+
+TEST(TraceRingTest, FormatTraceRecord) {
+  TraceRecord record = MakeTraceRecord(1500000, "foo");
+  record.flags = cachebash::kTraceSlow | cachebash::kTraceHedge;
+  record.scheduled_time = 1000;
+  record.generated_time = 1010;
+  record.written_time = 1030;
+  record.first_byte_time = 1530;
+  record.parsed_time = 1535;
+  EXPECT_EQ("1.500000 worker 0 server 0 get foo status 0 value 0 "
+            "response 0/0 latency 0.250000 wire -1.000000 "
+            "stages(us) generate 10 write 20 wait 500 read 5 slow hedge",
+            cachebash::FormatTraceRecord(record));
+}
+
+// Test that what workers push ends up in the file, after its header.
+TEST(TraceWriterTest, WritesRings) {
+  char filename[] = "/tmp/trace_test_XXXXXX";
+  int fd = mkstemp(filename);
+  ASSERT_LE(0, fd);
+  close(fd);
+
+  TraceWriter trace_writer(filename, 2);
+  trace_writer.Start();
+  trace_writer.ring(0)->TryPush(MakeTraceRecord(1, "foo"));
+  trace_writer.ring(1)->TryPush(MakeTraceRecord(2, "barbaz"));
+  trace_writer.Stop();
+  EXPECT_EQ(2, trace_writer.n_written());
+  EXPECT_EQ(0, trace_writer.n_dropped());
+
+  FILE* file = fopen(filename, "rb");
+  ASSERT_TRUE(file != NULL);
+  EXPECT_TRUE(cachebash::ReadTraceHeader(file));
+  int64_t send_times = 0;
+  TraceRecord record;
+  int n_records = 0;
+  while (fread(&record, sizeof(record), 1, file) == 1) {
+    send_times += record.send_time;
+    n_records++;
+  }
+  EXPECT_EQ(2, n_records);
+  EXPECT_EQ(3, send_times);
+  fclose(file);
+  unlink(filename);
+}
+
+}  // namespace
@@ -94,4 +94,11 @@ float RandomFloat() {
   return random;
 }
 
+struct timeval SecondsToTimeval(double seconds) {
+  struct timeval time;
+  time.tv_sec = static_cast<time_t>(seconds);
+  time.tv_usec = static_cast<suseconds_t>((seconds - time.tv_sec) * 1e6);
+  return time;
+}
+
 }  // namespace cachebash
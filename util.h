@@ -43,6 +43,7 @@
 #define LOG_Info(msg) \
   LogInfo(msg)
 
+#include <sys/time.h>
 #include <string>
 
 using std::string;
@@ -57,6 +58,8 @@ string nslookup(string hostname);
 int RandomInt();
 float RandomFloat();
 
+struct timeval SecondsToTimeval(double seconds);
+
 }  // namespace cachebash
 
 #endif  // UTIL_H_
@@ -32,6 +32,7 @@
 #include "cachebash/worker_manager.h"
 
 #include "cachebash/config.h"
+#include "cachebash/trace.h"
 #include "cachebash/worker_thread.h"
 
 namespace cachebash {
@@ -42,7 +43,8 @@ WorkerManager::WorkerManager(Generator* generator,
       config_(config) {}
 
 void WorkerManager::CreateAndInitializeWorkerThreads(
-       const StatisticsCollection& base_collection) {
+       const StatisticsCollection& base_collection,
+       TraceWriter* trace_writer) {
 
   // TODO(davidmax@gmail.com) figure out CPU affinity.
   // #ifdef __gnu_linux__
@@ -56,13 +58,25 @@ void WorkerManager::CreateAndInitializeWorkerThreads(
     printf("Creating thread %d\n", i);
     WorkerThread* worker_thread = new WorkerThread(config_,
                                                    generator_,
-                                                   base_collection.Copy());
+                                                   base_collection.Copy(),
+                                                   i);
+    if (trace_writer != NULL) {
+      worker_thread->set_trace_ring(trace_writer->ring(i));
+    }
     worker_thread->Init();
     worker_threads_.push_back(worker_thread);
   }
 }
 
 void WorkerManager::Warmup() {
+  // Without a size/key distribution there is nothing to warm up.
+  if (config_->warmup_sequence_ == NULL) {
+    return;
+  }
+  // Cache-aside clients warm the cache themselves, starting cold.
+  if (config_->backend_delay_distribution_ != NULL) {
+    return;
+  }
   printf("Warming up...");
   WarmupWorkerThread warmup_worker_thread(config_, config_->warmup_sequence_);
   warmup_worker_thread.Init();
@@ -78,10 +92,6 @@ void WorkerManager::StartWorkerThreads() {
          i++;
          (*it)->Start();
        }
-  bool running = true;
-  while (running) {
-    sleep(1);
-  }
 }
 
 vector<WorkerThread*>* WorkerManager::worker_threads() {
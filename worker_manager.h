@@ -43,14 +43,17 @@ namespace cachebash {
 class Config;
 class Generator;
 class StatisticsCollection;
+class TraceWriter;
 class WorkerThread;
 
 class WorkerManager {
  public:
   // TODO(davidmax@gmail) can any of these be const refs?
   WorkerManager(Generator* generator, Config* config);
+  // Workers trace to |trace_writer|'s rings, if it isn't NULL.
   void CreateAndInitializeWorkerThreads(
-          const StatisticsCollection& base_collection);
+          const StatisticsCollection& base_collection,
+          TraceWriter* trace_writer);
   void StartWorkerThreads();
   vector<WorkerThread*>* worker_threads();
   void Warmup();
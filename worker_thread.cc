@@ -33,36 +33,126 @@
 
 #include <sched.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <limits>
 
 #include "cachebash/config.h"
 #include "cachebash/connection.h"
+#include "cachebash/distribution.h"
+#include "cachebash/fanout_request.h"
 #include "cachebash/generator.h"
+#include "cachebash/ketama.h"
+#include "cachebash/latency_breakdown.h"
+#include "cachebash/probes.h"
 #include "cachebash/request.h"
 #include "cachebash/response.h"
 #include "cachebash/statistic.h"
 #include "cachebash/scoped_ptr.h"
+#include "cachebash/perf_counters.h"
+#include "cachebash/tcp_info.h"
+#include "cachebash/trace.h"
 #include "cachebash/util.h"
 #include "cachebash/warmup_sequence.h"
 
 namespace cachebash {
 
+// How many primary GET latencies to observe between updates of a
+// percentile-based hedge delay.
+static const int kHedgeDelayUpdateInterval = 1000;
+
 // Construct a WorkerThread.
 // |cpu_id| - The cpu number (starting at 0) to bind the thread to.
+// |worker_index| - Which worker this is, to name per-connection statistics.
 WorkerThread::WorkerThread(Config* config,
                            Generator* generator,
-                           StatisticsCollection* statistics_collection)
+                           StatisticsCollection* statistics_collection,
+                           int worker_index)
     : config_(config),
       generator_(generator),
+      latency_breakdown_(NULL),
       statistics_collection_(statistics_collection),
+      tcp_info_sampler_(NULL),
       event_base_(event_base_new()),
-      connection_(new Connection(TCP, config->debug_)),
-      last_send_time_valid_(false),
-      thread_(new pthread_t()) {}
+      hedge_delay_(config->hedge_delay_),
+      hedge_reference_latency_(new Statistic("hedge_reference_latency",
+                                             true)),
+      next_opaque_(1),
+      worker_index_(worker_index),
+      statistics_epoch_(0),
+      acknowledged_statistics_epoch_(0),
+      collected_statistics_epoch_(0),
+      schedule_started_(false),
+      n_scheduled_sends_(0),
+      n_sends_since_flush_(0),
+      trace_ring_(NULL),
+      n_untraced_responses_(0),
+      perf_counters_(NULL),
+      thread_(new pthread_t()) {
+  statistics_collections_[0] = statistics_collection;
+  statistics_collections_[1] = NULL;
+  if (statistics_collection != NULL) {
+    statistics_collections_[1] = statistics_collection->Copy();
+    ResolveStatisticIds();
+  }
+  // Until enough latencies have been seen, don't hedge at all.
+  if (config->hedge_percentile_ > 0) {
+    hedge_delay_ = std::numeric_limits<float>::max();
+  }
+}
+
+// Looks up the ids of the statistics whose names depend on the
+// configuration, so recording them needs no lookups.
+void WorkerThread::ResolveStatisticIds() {
+  for (vector<Server>::const_iterator it = config_->servers_.begin();
+       it != config_->servers_.end();
+       it++) {
+    ServerStatisticIds ids;
+    ids.latency = statistics_collection_->GetStatisticId(
+                                            it->GetStatisticName("latency"));
+    ids.requests = statistics_collection_->GetStatisticId(
+                                             it->GetStatisticName("requests"));
+    ids.hit_ratio = statistics_collection_->GetStatisticId(
+                                             it->GetStatisticName("hit_ratio"));
+    server_statistic_ids_.push_back(ids);
+  }
+  latency_breakdown_ = new LatencyBreakdown(*config_, *statistics_collection_,
+                                            worker_index_);
+  if (config_->tcp_info_) {
+    tcp_info_sampler_ = new TcpInfoSampler(*config_, *statistics_collection_,
+                                           worker_index_);
+  }
+
+  // Indexed by the number of shards, which is at least 1.
+  if (config_->fraction_multiget_ > 0) {
+    int max_shards = std::min(static_cast<int>(config_->servers_.size()),
+                              config_->multiget_n_gets_);
+    fanout_latency_ids_.push_back(-1);
+    for (int i = 1; i <= max_shards; i++) {
+      fanout_latency_ids_.push_back(statistics_collection_->GetStatisticId(
+          FanoutRequest::GetLatencyStatisticName(i)));
+    }
+  }
+}
 
+// Opens a pool of |n_connections_per_worker_| connections to every server.
 void WorkerThread::Init() {
-  connection_->OpenTcpSocket(config_->server_ip_address_,
-                             11211,
-                             !config_->use_naggles_);
+  connection_pools_.resize(config_->servers_.size());
+  next_connection_.resize(config_->servers_.size(), 0);
+  for (size_t i = 0; i < config_->servers_.size(); i++) {
+    const Server& server = config_->servers_[i];
+    for (int j = 0; j < config_->n_connections_per_worker_; j++) {
+      Connection* connection = new Connection(TCP, config_->debug_, i, j);
+      connection->OpenTcpSocket(server.ip_address,
+                                server.port,
+                                !config_->use_naggles_);
+      if (config_->kernel_timestamps_) {
+        connection->EnableTimestamping();
+      }
+      connection_pools_[i].push_back(connection);
+    }
+  }
   // Set CPU affinity. This doesn't work on mac os x, so check
   // that we're running GNU Linux.
   // Can check macros with gcc -E -dM - </dev/null
@@ -78,12 +168,60 @@ void WorkerThread::Init() {
 }
 
 WorkerThread::~WorkerThread() {
-  delete connection_;
+  for (size_t i = 0; i < connection_pools_.size(); i++) {
+    for (size_t j = 0; j < connection_pools_[i].size(); j++) {
+      delete connection_pools_[i][j];
+    }
+  }
+  delete hedge_reference_latency_;
+  delete latency_breakdown_;
+  delete tcp_info_sampler_;
+  delete perf_counters_;
+  delete statistics_collections_[0];
+  delete statistics_collections_[1];
   delete thread_;
 }
 
-StatisticsCollection* WorkerThread::GetStatisticsCollection() {
-  return statistics_collection_;
+// Called by the statistics thread to take the buffer the worker has been
+// adding samples to. The worker switches to the other buffer at its next
+// callback; until then only the statistics thread waits, and only until
+// |deadline|. Returns NULL if the worker hasn't switched by then. The flip
+// stays pending, so the samples are handed over by a later call.
+StatisticsCollection* WorkerThread::FlipStatisticsCollection(
+                        const struct timeval& deadline) {
+  int epoch = statistics_epoch_;
+  // If the last flip timed out, its buffer is still owed. Flipping again
+  // instead would hand the worker back the buffer about to be merged.
+  if (collected_statistics_epoch_ == epoch) {
+    epoch++;
+    __sync_synchronize();
+    statistics_epoch_ = epoch;
+  }
+  while (acknowledged_statistics_epoch_ != epoch) {
+    struct timeval timestamp;
+    gettimeofday(&timestamp, NULL);
+    if (timercmp(&timestamp, &deadline, >)) {
+      return NULL;
+    }
+    usleep(100);
+  }
+  __sync_synchronize();
+  collected_statistics_epoch_ = epoch;
+  return statistics_collections_[(epoch - 1) & 1];
+}
+
+// Called by the worker at the start of every callback, so a callback's
+// samples all go to the same buffer.
+void WorkerThread::SwitchStatisticsCollection() {
+  int epoch = statistics_epoch_;
+  if (epoch == acknowledged_statistics_epoch_) {
+    return;
+  }
+  statistics_collection_ = statistics_collections_[epoch & 1];
+  // The samples added to the old buffer must be visible before the
+  // statistics thread is told it can have it.
+  __sync_synchronize();
+  acknowledged_statistics_epoch_ = epoch;
 }
 
 // Create and initiate a new thread represented by the WorkerThread object.
@@ -98,15 +236,28 @@ void WorkerThread::Start() {
 // object's send functionality.
 void SendCallbackHook(int fd, short event_type, void* args) {
   WorkerThread* worker_thread = static_cast<WorkerThread*>(args);
+  worker_thread->SwitchStatisticsCollection();
   worker_thread->SendCallback();
 }
 
 // Interfaces between libevent read callback and WorkerThread
 // object's receive functionality.
 void ReceiveCallbackHook(int fd, short event_type, void* args) {
-  //WorkerThread* worker_thread = static_cast<WorkerThread*>(args);
+  ConnectionEvent* connection_event = static_cast<ConnectionEvent*>(args);
+  if (!connection_event->connection->HasResponse()) {
+    return;
+  }
+  connection_event->worker_thread->SwitchStatisticsCollection();
+  connection_event->worker_thread->ReceiveCallback(
+                                     connection_event->connection);
+}
+
+// Interfaces between libevent's timer and the WorkerThread object's
+// TCP_INFO sampling.
+void TcpInfoCallbackHook(int fd, short event_type, void* args) {
   WorkerThread* worker_thread = static_cast<WorkerThread*>(args);
-  worker_thread->ReceiveCallback();
+  worker_thread->SwitchStatisticsCollection();
+  worker_thread->SampleTcpInfo();
 }
 
 // Interfaces between pthread's thread creation callback and WorkerThread
@@ -118,97 +269,690 @@ void* MainLoopHook(void* arg) {
 }
 
 void WorkerThread::SendCallback() {
+  // Backup requests go out regardless of the request rate.
+  if (!hedge_candidates_.empty()) {
+    IssueHedgedRequests();
+  }
+  // So do cache fills, which stand in for the application's own SETs.
+  if (!pending_fills_.empty()) {
+    IssueFillRequests();
+  }
+
   // If a rps value has not been specified,
   // send requests as quickly as possible.
-  float intersend_time = 0.0;
-  // Send requests equally far apart to meet a rps target.
+  double intersend_time = 0.0;
+  // Send requests equally far apart to meet a rps target, which the
+  // workers share.
   if (config_->rps_ > 0) {
-    intersend_time = (1 / config_->rps_) / config_->n_worker_threads_;
+    intersend_time = config_->n_worker_threads_ / config_->rps_;
   }
 
-  // Check if the inter-send time has been exceeded
-  struct timeval timestamp, time_diff;
-  gettimeofday(&timestamp, NULL);
-  timersub(&timestamp, &last_send_time_, &time_diff);
-  double time_since_last_call = time_diff.tv_usec * 1e-6  + time_diff.tv_sec;
+  // Sends are due on a fixed schedule, so a late send doesn't push back
+  // the ones after it and the rate doesn't drift below the target.
+  if (intersend_time > 0) {
+    struct timeval timestamp, time_diff;
+    gettimeofday(&timestamp, NULL);
+    if (!schedule_started_) {
+      schedule_start_time_ = timestamp;
+      schedule_started_ = true;
+    }
+    timersub(&timestamp, &schedule_start_time_, &time_diff);
+    double send_lag = time_diff.tv_usec * 1e-6  + time_diff.tv_sec
+                      - n_scheduled_sends_ * intersend_time;
+
+    // If the send isn't due yet just return, this function will soon be
+    // called again. Use the slack to record buffered samples rather than
+    // doing it on the receive path.
+    if (send_lag < 0) {
+      FlushStatistics();
+      return;
+    }
+
+    // How late this send is on the schedule.
+    statistics_collection_->AddSample(kSendLagStatistic, send_lag);
+    if (config_->stage_timestamps_) {
+      struct timeval due = SecondsToTimeval(n_scheduled_sends_
+                                            * intersend_time);
+      timeradd(&schedule_start_time_, &due, &scheduled_time_);
+    }
+    n_scheduled_sends_++;
+  } else if (config_->stage_timestamps_) {
+    gettimeofday(&scheduled_time_, NULL);
+  }
 
-  // If the time has not been exceeded just return,
-  // this function will soon be called again.
-  if (time_since_last_call < intersend_time && last_send_time_valid_) {
-    return;
+  // Without -r, or when behind schedule, there is no slack to record the
+  // buffered samples in, so record them every kSampleBatchSize sends.
+  // That still keeps them off the receive path.
+  n_sends_since_flush_++;
+  if (n_sends_since_flush_ >= kSampleBatchSize) {
+    FlushStatistics();
   }
 
+  // How deep the queues the send joins are.
+  statistics_collection_->AddSample(kOutstandingRequestsStatistic,
+                                    n_outstanding_requests());
+
   // We are now ready to generate and send a request.
+  if (config_->fraction_multiget_ > 0
+      && RandomFloat() < config_->fraction_multiget_) {
+    SendFanoutRequest(generator_->GenerateFanoutRequest());
+    return;
+  }
   Request* request  = generator_->GenerateNextRequest();
+  StartStageTimes(request);
   SendRequest(request);
 }
 
+// Records the samples buffered in the worker's statistics.
+void WorkerThread::FlushStatistics() {
+  statistics_collection_->FlushSamples();
+  CACHEBASH_PROBE_STATS_FLUSH(worker_index_);
+  n_sends_since_flush_ = 0;
+}
+
+// Starts timing the stages of |request|, which was due at
+// |scheduled_time_|, if asked to.
+void WorkerThread::StartStageTimes(Request* request) {
+  if (!config_->stage_timestamps_) {
+    return;
+  }
+  StageTimes* stage_times = request->mutable_stage_times();
+  stage_times->scheduled = scheduled_time_;
+  gettimeofday(&stage_times->generated, NULL);
+}
+
+// Sends every shard's batch without waiting for any of them to be
+// answered.
+void WorkerThread::SendFanoutRequest(FanoutRequest* fanout) {
+  vector<Request*> requests;
+  fanout->CreateShardRequests(*config_->ketama_continuum_, &requests);
+  struct timeval timestamp;
+  gettimeofday(&timestamp, NULL);
+  fanout->set_start_time(timestamp);
+  for (vector<Request*>::iterator it = requests.begin();
+       it != requests.end();
+       it++) {
+    StartStageTimes(*it);
+    SendRequest(*it);
+  }
+}
+
+// Sends |request| to the server that owns its key.
 void WorkerThread::SendRequest(Request* request) {
+  int server_index = config_->ketama_continuum_->GetServerIndex(request->key());
+  Connection* connection = PickConnection(server_index);
+  SendRequestOnConnection(request, connection);
+  MirrorToReplica(request);
+
+  // Plain GETs are tracked so they can be hedged.
+  if (config_->IsHedgingEnabled()
+      && request->op_code() == OPCODE_GET
+      && request->fanout() == NULL) {
+    HedgedGet hedged_get;
+    hedged_get.key = request->key();
+    hedged_get.send_time = request->send_time();
+    hedged_get.connection = connection;
+    hedged_get.completed = false;
+    hedged_get.hedged = false;
+    hedged_get.n_outstanding_requests = 1;
+    hedged_gets_[request->opaque()] = hedged_get;
+    hedge_candidates_.push_back(request->opaque());
+  }
+}
+
+// Hedged GETs go to the key's replica server when there is more than one
+// server, so every write is repeated there for them to find the item.
+void WorkerThread::MirrorToReplica(Request* request) {
+  if (!config_->IsHedgingEnabled() || config_->servers_.size() < 2) {
+    return;
+  }
+  Request* replica_request = NULL;
+  switch (request->op_code()) {
+    case OPCODE_SET: {
+      SetRequest* set_request = static_cast<SetRequest*>(request);
+      replica_request = new SetRequest(request->key(), request->value(),
+                                       set_request->flags(),
+                                       set_request->expiry());
+      break;
+    }
+    case OPCODE_ADD: {
+      SetRequest* add_request = static_cast<SetRequest*>(request);
+      replica_request = new AddRequest(request->key(), request->value(),
+                                       add_request->flags(),
+                                       add_request->expiry());
+      break;
+    }
+    case OPCODE_REP: {
+      SetRequest* replace_request = static_cast<SetRequest*>(request);
+      replica_request = new ReplaceRequest(request->key(), request->value(),
+                                           replace_request->flags(),
+                                           replace_request->expiry());
+      break;
+    }
+    case OPCODE_TOUCH:
+      replica_request = new TouchRequest(
+          request->key(), static_cast<TouchRequest*>(request)->expiry());
+      break;
+    default:
+      return;
+  }
+  replica_request->set_replica(true);
+  int replica = config_->ketama_continuum_->GetReplicaServerIndex(
+                                              request->key());
+  SendRequestOnConnection(replica_request, PickConnection(replica));
+}
+
+void WorkerThread::SendRequestOnConnection(Request* request,
+                                           Connection* connection) {
   struct timeval timestamp;
   gettimeofday(&timestamp, NULL);
   request->set_send_time(timestamp);
+  // Backup requests keep the opaque of the request they duplicate.
+  if (request->opaque() == 0) {
+    request->set_opaque(next_opaque_++);
+    if (next_opaque_ == 0) {
+      next_opaque_ = 1;
+    }
+  }
 
   if (config_->debug_) {
     request->Print();
   }
 
-  connection_->SendRequest(request);
-  request_queue_.push(request);
-  last_send_time_ = timestamp;
-  last_send_time_valid_ = true;
+  int request_bytes = connection->SendRequest(request);
+  if (request->has_stage_times()) {
+    gettimeofday(&request->mutable_stage_times()->written, NULL);
+  }
+  if (statistics_collection_ != NULL) {
+    statistics_collection_->AddSample(kRequestBytesStatistic, request_bytes);
+  }
+}
+
+// Re-issues every GET that has been outstanding for longer than the hedge
+// delay, to the key's replica server if there is more than one server and
+// to a different connection to the same server otherwise.
+void WorkerThread::IssueHedgedRequests() {
+  struct timeval timestamp;
+  gettimeofday(&timestamp, NULL);
+  while (!hedge_candidates_.empty()) {
+    uint32_t opaque = hedge_candidates_.front();
+    map<uint32_t, HedgedGet>::iterator it = hedged_gets_.find(opaque);
+    if (it == hedged_gets_.end() || it->second.completed) {
+      hedge_candidates_.pop_front();
+      continue;
+    }
+
+    HedgedGet& hedged_get = it->second;
+    struct timeval time_diff;
+    timersub(&timestamp, &hedged_get.send_time, &time_diff);
+    double outstanding_time = time_diff.tv_usec * 1e-6 + time_diff.tv_sec;
+    if (outstanding_time < hedge_delay_) {
+      break;
+    }
+    hedge_candidates_.pop_front();
+
+    Connection* connection = NULL;
+    if (config_->servers_.size() > 1) {
+      int replica = config_->ketama_continuum_->GetReplicaServerIndex(
+                                                  hedged_get.key);
+      connection = PickConnection(replica);
+    } else {
+      connection = PickOtherConnection(hedged_get.connection);
+    }
+    Request* request = new GetRequest(hedged_get.key);
+    request->set_opaque(opaque);
+    request->set_hedge(true);
+    SendRequestOnConnection(request, connection);
+    hedged_get.hedged = true;
+    hedged_get.n_outstanding_requests++;
+    statistics_collection_->AddSample(kHedgeRequestsStatistic, 1);
+  }
+}
+
+// Sends the SETs of every fill whose backend delay has elapsed. Fills do
+// not count against the request rate.
+void WorkerThread::IssueFillRequests() {
+  struct timeval timestamp;
+  gettimeofday(&timestamp, NULL);
+  while (!pending_fills_.empty()) {
+    const PendingFill& fill = pending_fills_.top();
+    if (timercmp(&fill.fill_time, &timestamp, >)) {
+      break;
+    }
+    Request* request = generator_->GenerateFillRequest(fill.key,
+                                                       fill.value_size,
+                                                       fill.expiry);
+    request->set_fill(fill.application_start_time);
+    int server_index = config_->ketama_continuum_->GetServerIndex(fill.key);
+    SendRequestOnConnection(request, PickConnection(server_index));
+    MirrorToReplica(request);
+    pending_fills_.pop();
+  }
+}
+
+// Round robins over the pool of connections to a server.
+Connection* WorkerThread::PickConnection(int server_index) {
+  vector<Connection*>& pool = connection_pools_[server_index];
+  int connection_index = next_connection_[server_index];
+  next_connection_[server_index] = (connection_index + 1) % pool.size();
+  return pool[connection_index];
+}
+
+// Round robins over the pool of connections to |connection|'s server,
+// skipping |connection| itself.
+Connection* WorkerThread::PickOtherConnection(Connection* connection) {
+  int server_index = connection->server_index();
+  for (size_t i = 0; i < connection_pools_[server_index].size(); i++) {
+    Connection* other = PickConnection(server_index);
+    if (other != connection) {
+      return other;
+    }
+  }
+  LOG_FATAL("No other connection to send a backup request on");
+  return NULL;
+}
+
+int WorkerThread::n_outstanding_requests() const {
+  int n_outstanding_requests = 0;
+  for (size_t i = 0; i < connection_pools_.size(); i++) {
+    for (size_t j = 0; j < connection_pools_[i].size(); j++) {
+      n_outstanding_requests
+        += connection_pools_[i][j]->n_outstanding_requests();
+    }
+  }
+  return n_outstanding_requests;
 }
 
 // void WorkerThread::HandleSendCallback() {
 //   SendCallback();
 // }
 
-Response* WorkerThread::ReceiveResponse() {
-  // Get the request that corresponds to this request.
-  Request* request = request_queue_.front();
-  request_queue_.pop();
-  Response* response = connection_->ReceiveResponse();
-  response->set_request(request);
+Response* WorkerThread::ReceiveResponse(Connection* connection) {
+  // Nothing has been read yet, but the response is readable.
+  struct timeval first_byte_time;
+  if (config_->stage_timestamps_) {
+    gettimeofday(&first_byte_time, NULL);
+  }
+  // The connection pairs the response with its request.
+  Response* response = connection->ReceiveResponse();
+  Request* request = response->request();
 
   // Determine how long the request took.
   struct timeval timestamp, time_diff;
   gettimeofday(&timestamp, NULL);
+  if (request->has_stage_times()) {
+    request->mutable_stage_times()->first_byte = first_byte_time;
+    request->mutable_stage_times()->parsed = timestamp;
+  }
   struct timeval send_time = request->send_time();
   timersub(&timestamp, &send_time, &time_diff);
   double request_latency = time_diff.tv_usec * 1e-6  + time_diff.tv_sec;
   response->set_request_latency(request_latency);
+  CACHEBASH_PROBE_RESPONSE_PARSE(
+      request->op_code(), request->key().size(), response->value_size(),
+      static_cast<int64_t>(time_diff.tv_sec) * 1000000000
+      + time_diff.tv_usec * 1000);
   return response;
 }
 
-void WorkerThread::ReceiveCallback() {
-  scoped_ptr<Response> response(ReceiveResponse());
-  statistics_collection_->AddSample("latency", response->request_latency());
+void WorkerThread::ReceiveCallback(Connection* connection) {
+  scoped_ptr<Response> response(ReceiveResponse(connection));
+  float latency = response->request_latency();
+  bool is_get = response->request()->op_code() == OPCODE_GET;
+  float hit = (response->status() == kNoError) ? 1.0 : 0.0;
+  // A multiget's keys each count towards the hit ratios.
+  int n_gets = is_get ? 1 : 0;
+  int n_hits = is_get ? static_cast<int>(hit) : 0;
+  if (response->request()->op_code() == OPCODE_GETKQ) {
+    n_gets
+      = static_cast<MultiGetRequest*>(response->request())->n_keys();
+    n_hits = response->n_hits();
+  }
+
+  // Break the request down by the server that handled it, and count the
+  // bytes it took. Every copy of a hedged request counts here, since every
+  // copy loads the server.
+  int server_index = connection->server_index();
+  const ServerStatisticIds& server_statistic_ids
+    = server_statistic_ids_[server_index];
+  statistics_collection_->AddSample(server_statistic_ids.latency, latency);
+  statistics_collection_->AddSample(server_statistic_ids.requests, 1);
+  AddHitRatioSamples(server_statistic_ids.hit_ratio, n_gets, n_hits);
+  statistics_collection_->AddSample(kResponseBytesStatistic,
+                                    response->size());
+  statistics_collection_->AddSample(kResponseValueBytesStatistic,
+                                    response->value_size());
+  if (response->wire_latency() >= 0) {
+    statistics_collection_->AddSample(kWireLatencyStatistic,
+                                      response->wire_latency());
+  }
+  if (trace_ring_ != NULL) {
+    TraceResponse(response.Get(), connection);
+  }
+  if (statistics_collection_->key_tracker() != NULL) {
+    TrackKey(response.Get(), connection);
+  }
+  if (response->request()->has_stage_times()) {
+    RecordStageTimes(response->request()->stage_times(),
+                     statistics_collection_);
+  }
+  Request* request = response->request();
+  StatisticId breakdown_id = latency_breakdown_->GetStatisticId(
+      server_index, request->op_code(), request->value_size());
+  if (breakdown_id >= 0) {
+    statistics_collection_->AddSample(breakdown_id, latency);
+  }
+  StatisticId connection_id = latency_breakdown_->GetConnectionStatisticId(
+      server_index, connection->pool_index());
+  if (connection_id >= 0) {
+    statistics_collection_->AddSample(connection_id, latency);
+  }
+
+  // Writes mirrored to a replica only load its server.
+  if (request->replica()) {
+    return;
+  }
+
+  // Only the first copy of a hedged GET to be answered counts, with its
+  // latency measured from when the primary was sent.
+  if (config_->IsHedgingEnabled()
+      && !CompleteHedgedGet(response.Get(), &latency)) {
+    return;
+  }
+
+  statistics_collection_->AddSample(kLatencyStatistic, latency);
   response->request()->UpdateStatistics(statistics_collection_);
+  AddHitRatioSamples(kHitRatioStatistic, n_gets, n_hits);
+  if (is_get) {
+    if (config_->validate_flags_ && response->has_flags()) {
+      float mismatch = (response->flags() != config_->flags_) ? 1.0 : 0.0;
+      statistics_collection_->AddSample(kFlagMismatchRatioStatistic, mismatch);
+    }
+  }
+
+  if (config_->backend_delay_distribution_ != NULL) {
+    CompleteCacheAsideRequest(response.Get(), latency);
+  }
+  if (response->request()->fanout() != NULL) {
+    CompleteFanoutRequest(response->request());
+  }
+}
+
+// Adds a sample of |n_hits| hits out of |n_gets| GETs to the hit ratio
+// |statistic_id|.
+void WorkerThread::AddHitRatioSamples(StatisticId statistic_id, int n_gets,
+                                      int n_hits) {
+  for (int i = 0; i < n_gets; i++) {
+    statistics_collection_->AddSample(statistic_id, i < n_hits ? 1.0 : 0.0);
+  }
+}
+
+// Counts the keys of |response| as requested, and them and |connection| as
+// slow if the response was. Every key of a multiget counts.
+void WorkerThread::TrackKey(Response* response, Connection* connection) {
+  KeyTracker* key_tracker = statistics_collection_->key_tracker();
+  Request* request = response->request();
+  vector<string> keys(1, request->key());
+  if (request->op_code() == OPCODE_GETKQ) {
+    keys = static_cast<MultiGetRequest*>(request)->keys();
+  }
+  for (vector<string>::const_iterator it = keys.begin();
+       it != keys.end();
+       it++) {
+    key_tracker->hot_keys()->Add(*it, 1);
+  }
+  if (key_tracker->slow_threshold() <= 0
+      || response->request_latency() < key_tracker->slow_threshold()) {
+    return;
+  }
+  for (vector<string>::const_iterator it = keys.begin();
+       it != keys.end();
+       it++) {
+    key_tracker->slow_keys()->Add(*it, 1);
+  }
+  char connection_name[64];
+  snprintf(connection_name, sizeof(connection_name),
+           "/worker_%02d/connection_%02d", worker_index_,
+           connection->pool_index());
+  key_tracker->slow_connections()->Add(
+      config_->servers_[connection->server_index()].GetName()
+      + connection_name, 1);
+}
+
+static int64_t GetMicroseconds(const struct timeval& time) {
+  return static_cast<int64_t>(time.tv_sec) * 1000000 + time.tv_usec;
+}
+
+// Traces |response| if it's sampled or slow. Every copy of a hedged
+// request can be traced, with its own latency.
+void WorkerThread::TraceResponse(Response* response, Connection* connection) {
+  int flags = 0;
+  if (config_->trace_sample_every_ > 0
+      && ++n_untraced_responses_ >= config_->trace_sample_every_) {
+    n_untraced_responses_ = 0;
+    flags |= kTraceSampled;
+  }
+  if (config_->trace_latency_threshold_ > 0
+      && response->request_latency() >= config_->trace_latency_threshold_) {
+    flags |= kTraceSlow;
+  }
+  if (flags == 0) {
+    return;
+  }
+
+  Request* request = response->request();
+  flags |= request->hedge() ? kTraceHedge : 0;
+  flags |= request->fill() ? kTraceFill : 0;
+  flags |= request->fanout() != NULL ? kTraceFanout : 0;
+  TraceRecord record;
+  memset(&record, 0, sizeof(record));
+  record.send_time = GetMicroseconds(request->send_time());
+  if (request->has_stage_times()) {
+    const StageTimes& stage_times = request->stage_times();
+    record.scheduled_time = GetMicroseconds(stage_times.scheduled);
+    record.generated_time = GetMicroseconds(stage_times.generated);
+    record.written_time = GetMicroseconds(stage_times.written);
+    record.first_byte_time = GetMicroseconds(stage_times.first_byte);
+    record.parsed_time = GetMicroseconds(stage_times.parsed);
+  }
+  record.latency = response->request_latency();
+  record.wire_latency = response->wire_latency();
+  record.request_value_size = request->value_size();
+  record.response_size = response->size();
+  record.response_value_size = response->value_size();
+  record.status = response->status();
+  record.server_index = connection->server_index();
+  record.worker_index = worker_index_;
+  record.op_code = request->op_code();
+  record.flags = flags;
+  string key = request->key();
+  record.key_size = std::min(static_cast<int>(key.size()), kMaxTraceKeySize);
+  memcpy(record.key, key.data(), record.key_size);
+  trace_ring_->TryPush(record);
+}
+
+// Accounts for a response to a hedged GET, setting |latency| to the latency
+// the client saw. Returns false if the GET had already been answered by
+// another copy, in which case the response should be discarded.
+bool WorkerThread::CompleteHedgedGet(Response* response, float* latency) {
+  Request* request = response->request();
+  map<uint32_t, HedgedGet>::iterator it = hedged_gets_.find(request->opaque());
+  if (it == hedged_gets_.end()) {
+    return true;
+  }
+  HedgedGet& hedged_get = it->second;
+  hedged_get.n_outstanding_requests--;
+
+  // What the latency would have been without hedging.
+  if (!request->hedge()) {
+    statistics_collection_->AddSample(kUnhedgedLatencyStatistic,
+                                      response->request_latency());
+    if (config_->hedge_percentile_ > 0) {
+      hedge_reference_latency_->AddSample(response->request_latency());
+      if (hedge_reference_latency_->GetCount()
+          % kHedgeDelayUpdateInterval == 0) {
+        hedge_delay_ = hedge_reference_latency_->GetQuantile(
+                                                   config_->hedge_percentile_);
+      }
+    }
+  }
+
+  // The replica may not have the item even though the primary does, so a
+  // backup's miss waits for the primary's answer.
+  bool first_response = !hedged_get.completed;
+  if (first_response && request->hedge()
+      && response->status() == kKeyNotFound
+      && hedged_get.n_outstanding_requests > 0) {
+    statistics_collection_->AddSample(kHedgeDiscardedResponsesStatistic, 1);
+    return false;
+  }
+  if (first_response) {
+    hedged_get.completed = true;
+    struct timeval send_time = request->send_time();
+    struct timeval time_diff;
+    timersub(&send_time, &hedged_get.send_time, &time_diff);
+    *latency = response->request_latency()
+               + time_diff.tv_usec * 1e-6 + time_diff.tv_sec;
+    statistics_collection_->AddSample(kHedgedLatencyStatistic, *latency);
+    statistics_collection_->AddSample(kHedgeRateStatistic,
+                                      hedged_get.hedged ? 1.0 : 0.0);
+  } else {
+    statistics_collection_->AddSample(kHedgeDiscardedResponsesStatistic, 1);
+  }
+
+  if (hedged_get.n_outstanding_requests == 0) {
+    hedged_gets_.erase(it);
+  }
+  return first_response;
+}
+
+// Plays the application's part in cache-aside: a GET hit is done, while a
+// GET miss goes to the backend and then fills the cache. The application
+// latency of a miss is only known once its fill has been answered.
+void WorkerThread::CompleteCacheAsideRequest(Response* response,
+                                             float latency) {
+  Request* request = response->request();
+  struct timeval timestamp;
+  gettimeofday(&timestamp, NULL);
+  if (request->fill()) {
+    struct timeval start_time = request->application_start_time();
+    struct timeval time_diff;
+    timersub(&timestamp, &start_time, &time_diff);
+    statistics_collection_->AddSample(kApplicationLatencyStatistic,
+                                      time_diff.tv_usec * 1e-6
+                                      + time_diff.tv_sec);
+    statistics_collection_->AddSample(kFillRequestsStatistic, 1);
+    return;
+  }
+  if (request->op_code() != OPCODE_GET || request->fanout() != NULL) {
+    return;
+  }
+
+  bool hit = response->status() == kNoError;
+  statistics_collection_->AddSample(kCumulativeHitRatioStatistic,
+                                    hit ? 1.0 : 0.0);
+  if (hit) {
+    statistics_collection_->AddSample(kApplicationLatencyStatistic, latency);
+    return;
+  }
+
+  PendingFill fill;
+  fill.key = request->key();
+  GetRequest* get_request = static_cast<GetRequest*>(request);
+  fill.value_size = get_request->fill_value_size();
+  fill.expiry = get_request->fill_expiry();
+  struct timeval latency_time = SecondsToTimeval(latency);
+  timersub(&timestamp, &latency_time, &fill.application_start_time);
+  struct timeval backend_delay = SecondsToTimeval(
+      config_->backend_delay_distribution_->Sample());
+  timeradd(&timestamp, &backend_delay, &fill.fill_time);
+  pending_fills_.push(fill);
+}
+
+// Accounts for the response to one of a fan-out's shard batches. Once the
+// last shard has answered, records the fan-out's latencies and frees it.
+void WorkerThread::CompleteFanoutRequest(Request* request) {
+  FanoutRequest* fanout = request->fanout();
+  struct timeval timestamp;
+  gettimeofday(&timestamp, NULL);
+  if (!fanout->CompleteShardRequest(request, timestamp)) {
+    return;
+  }
+
+  for (int i = 0; i < fanout->n_shards(); i++) {
+    statistics_collection_->AddSample(kFanoutShardLatencyStatistic,
+                                      fanout->GetShard(i).latency);
+  }
+  float latency = fanout->GetCompletionLatency();
+  statistics_collection_->AddSample(kFanoutLatencyStatistic, latency);
+  statistics_collection_->AddSample(fanout_latency_ids_[fanout->n_shards()],
+                                    latency);
+  statistics_collection_->AddSample(kFanoutShardsStatistic, fanout->n_shards());
+  delete fanout;
 }
 
 // void WorkerThread::HandleReceiveCallback() {
 //   ReceiveCallback();
 // }
 
+void WorkerThread::SampleTcpInfo() {
+  tcp_info_sampler_->Sample(connection_pools_, statistics_collection_);
+}
+
 void WorkerThread::MainLoop() {
-  // Register a send callback per Connection.
-  struct event* send_event = event_new(event_base_,
-                                       connection_->GetSocketFd(),
-                                       EV_WRITE | EV_PERSIST,
-                                       SendCallbackHook,
-                                       this);
-  // Lower priorities are serviced first.
-  // Give send less of a priority than receive.
-  event_priority_set(send_event, 2);
-  event_add(send_event, NULL);
-
-  // Register a receive callback per Connection.
-  struct event* receive_event = event_new(event_base_,
-                                          connection_->GetSocketFd(),
-                                          EV_READ | EV_PERSIST,
-                                          ReceiveCallbackHook,
-                                          this);
-  event_priority_set(receive_event, 1);
-  event_add(receive_event, NULL);
+  if (config_->perf_counters_) {
+    PerfCounters* perf_counters = new PerfCounters();
+    __sync_synchronize();
+    perf_counters_ = perf_counters;
+  }
+
+  // Connections are never added once the loop starts, so pointers into
+  // |connection_events_| stay valid.
+  connection_events_.clear();
+  for (size_t i = 0; i < connection_pools_.size(); i++) {
+    for (size_t j = 0; j < connection_pools_[i].size(); j++) {
+      ConnectionEvent connection_event;
+      connection_event.worker_thread = this;
+      connection_event.connection = connection_pools_[i][j];
+      connection_events_.push_back(connection_event);
+    }
+  }
+
+  // A single send callback for the whole worker, since it picks the
+  // connection each request goes out on itself. One per connection would
+  // run it once for every writable connection each time around the loop.
+  if (!connection_events_.empty()) {
+    struct event* send_event = event_new(
+        event_base_, connection_events_[0].connection->GetSocketFd(),
+        EV_WRITE | EV_PERSIST, SendCallbackHook, this);
+    // Lower priorities are serviced first.
+    // Give send less of a priority than receive.
+    event_priority_set(send_event, 2);
+    event_add(send_event, NULL);
+  }
+
+  for (size_t i = 0; i < connection_events_.size(); i++) {
+    int fd = connection_events_[i].connection->GetSocketFd();
+    // Register a receive callback per Connection.
+    struct event* receive_event = event_new(event_base_,
+                                            fd,
+                                            EV_READ | EV_PERSIST,
+                                            ReceiveCallbackHook,
+                                            &connection_events_[i]);
+    event_priority_set(receive_event, 1);
+    event_add(receive_event, NULL);
+  }
+
+  if (tcp_info_sampler_ != NULL) {
+    struct event* tcp_info_event = event_new(event_base_,
+                                             -1,
+                                             EV_PERSIST,
+                                             TcpInfoCallbackHook,
+                                             this);
+    struct timeval sample_interval = SecondsToTimeval(
+        config_->stat_print_interval_ / kTcpInfoSamplesPerInterval);
+    event_add(tcp_info_event, &sample_interval);
+  }
 
   // Start the main event loop.
   printf("starting receive base loop\n");
@@ -224,26 +968,29 @@ WarmupWorkerThread::WarmupWorkerThread(Config* config,
                                        WarmupSequence* warmup_sequence)
     : WorkerThread(config,
                    NULL,
-                   NULL),
+                   NULL,
+                   0),
                    warmup_sequence_(warmup_sequence) {}
 
 void WarmupWorkerThread::SendCallback() {
-  if (warmup_sequence_->HasNext()) {
+  if (!warmup_sequence_->HasNext()) {
     return;
   }
 
   SizeKeyEntry size_key_entry = warmup_sequence_->Next();
   string key = size_key_entry.key;
   string value = Generator::GenerateRandomString(size_key_entry.size);
-  Request* request = new SetRequest(key, value);
+  // Warmup items expire with their key class, if the file gives a TTL.
+  uint32_t expiry = size_key_entry.ttl > 0 ? size_key_entry.ttl : 0;
+  Request* request = new SetRequest(key, value, config_->flags_, expiry);
   printf("Generating request\n");
   SendRequest(request);
 }
 
-void WarmupWorkerThread::ReceiveCallback() {
-  scoped_ptr<Response> response(ReceiveResponse());
+void WarmupWorkerThread::ReceiveCallback(Connection* connection) {
+  scoped_ptr<Response> response(ReceiveResponse(connection));
   // Check if we are now down with warmup.
-  if (warmup_sequence_->HasNext() && request_queue_.empty()) {
+  if (!warmup_sequence_->HasNext() && n_outstanding_requests() == 0) {
     event_base_loopbreak(event_base_);
   }
 }
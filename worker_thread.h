@@ -35,55 +35,189 @@
 #include "cachebash/worker_thread.h"
 
 #include <pthread.h>
+#include <stdint.h>
 #include <event2/event.h>
+#include <deque>
+#include <map>
 #include <queue>
+#include <string>
+#include <vector>
 
 #include "cachebash/request.h"
 
-using std::queue;
+using std::deque;
+using std::map;
+using std::priority_queue;
+using std::string;
+using std::vector;
 
 namespace cachebash {
 
 class Config;
 class Connection;
+class FanoutRequest;
 class Generator;
+class LatencyBreakdown;
+class PerfCounters;
 class Response;
+class Statistic;
 class StatisticsCollection;
+class TcpInfoSampler;
+class TraceRing;
 
 enum WorkerThreadState {
   WARM_UP,
   STEADY_STATE_LOADING
 };
 
+class WorkerThread;
+
+// The argument libevent hands back to the callback hooks, identifying the
+// Connection whose socket became ready.
+struct ConnectionEvent {
+  WorkerThread* worker_thread;
+  Connection* connection;
+};
+
+// A GET that is re-issued if it takes too long. The primary request and
+// its backup share an opaque value, which is how the loser is recognized.
+struct HedgedGet {
+  string key;
+  // When the primary request was sent.
+  struct timeval send_time;
+  Connection* connection;
+  bool completed;
+  bool hedged;
+  int n_outstanding_requests;
+};
+
+// The ids of the statistics broken down per server.
+struct ServerStatisticIds {
+  StatisticId latency;
+  StatisticId requests;
+  StatisticId hit_ratio;
+};
+
+// A SET that refills the cache after a GET miss, once the simulated
+// backend has produced the value.
+struct PendingFill {
+  string key;
+  int value_size;
+  uint32_t expiry;
+  // When the backend delay has elapsed and the SET should be sent.
+  struct timeval fill_time;
+  // When the application first asked for the key.
+  struct timeval application_start_time;
+};
+
+// Orders the pending fills so the earliest one is on top.
+struct PendingFillLater {
+  bool operator()(const PendingFill& a, const PendingFill& b) const {
+    return timercmp(&a.fill_time, &b.fill_time, >);
+  }
+};
+
 class WorkerThread {
  public:
   WorkerThread(Config* config,
                Generator* generator,
-               StatisticsCollection* statistics_collection);
+               StatisticsCollection* statistics_collection,
+               int worker_index);
   virtual ~WorkerThread();
-  StatisticsCollection* GetStatisticsCollection();
+  StatisticsCollection* FlipStatisticsCollection(
+                          const struct timeval& deadline);
   void Init();
   // void WarmUpReceiveCallback();
   // void WarmUpSendCallback();
-  virtual void ReceiveCallback();
+  virtual void ReceiveCallback(Connection* connection);
   virtual void SendCallback();
+  void SendFanoutRequest(FanoutRequest* fanout);
   void SendRequest(Request* request);
-  Response* ReceiveResponse();
+  Response* ReceiveResponse(Connection* connection);
   void MainLoop();
+  void SwitchStatisticsCollection();
+  void SampleTcpInfo();
+  // Where to trace responses to, if anywhere.
+  void set_trace_ring(TraceRing* trace_ring) { trace_ring_ = trace_ring; }
+  int n_outstanding_requests() const;
+  // The worker's own counters, once it has opened them, or NULL.
+  const PerfCounters* perf_counters() const { return perf_counters_; }
   void Start();
 
  protected:
   Config* config_;
   Generator* generator_;
+  vector<ServerStatisticIds> server_statistic_ids_;
+  // The fan-out latency statistic for each number of shards.
+  vector<StatisticId> fanout_latency_ids_;
+  // Latency by opcode and value size, and by connection, if enabled.
+  LatencyBreakdown* latency_breakdown_;
+  // Whichever of |statistics_collections_| samples are being added to.
   StatisticsCollection* statistics_collection_;
-  queue<Request*> request_queue_;
+  // Samples the connections' TCP_INFO, if enabled.
+  TcpInfoSampler* tcp_info_sampler_;
   struct event_base* event_base_;
 
  private:
-  Connection* connection_;
+  void AddHitRatioSamples(StatisticId statistic_id, int n_gets, int n_hits);
+  bool CompleteHedgedGet(Response* response, float* latency);
+  void CompleteCacheAsideRequest(Response* response, float latency);
+  void CompleteFanoutRequest(Request* request);
+  void FlushStatistics();
+  void IssueFillRequests();
+  void IssueHedgedRequests();
+  void MirrorToReplica(Request* request);
+  Connection* PickConnection(int server_index);
+  Connection* PickOtherConnection(Connection* connection);
+  void ResolveStatisticIds();
+  void SendRequestOnConnection(Request* request, Connection* connection);
+  void StartStageTimes(Request* request);
+  void TraceResponse(Response* response, Connection* connection);
+  void TrackKey(Response* response, Connection* connection);
+
+  // One pool of connections per server, indexed like Config::servers_.
+  vector<vector<Connection*> > connection_pools_;
+  vector<ConnectionEvent> connection_events_;
+  // The pool index of the next connection to use for each server.
+  vector<int> next_connection_;
+  // GETs that are still outstanding or waiting on a late copy, by opaque.
+  map<uint32_t, HedgedGet> hedged_gets_;
+  // Opaques of hedged GETs in the order they were sent. Since the hedge
+  // delay is the same for all of them, they expire in this order too.
+  deque<uint32_t> hedge_candidates_;
+  float hedge_delay_;
+  // Primary GET latencies used to place the hedge delay at a percentile.
+  Statistic* hedge_reference_latency_;
+  uint32_t next_opaque_;
+  // Which of the WorkerManager's workers this is.
+  int worker_index_;
+  // Statistics are double buffered: the worker adds samples to one buffer
+  // while the statistics thread merges the other. Flipping the epoch asks
+  // the worker to switch buffers, and the worker acknowledges the epoch
+  // once it has. The statistics thread then collects the old buffer.
+  StatisticsCollection* statistics_collections_[2];
+  volatile int statistics_epoch_;
+  volatile int acknowledged_statistics_epoch_;
+  // Only touched by the statistics thread.
+  int collected_statistics_epoch_;
+  priority_queue<PendingFill, vector<PendingFill>, PendingFillLater>
+      pending_fills_;
   struct timeval last_receive_time_;
-  struct timeval last_send_time_;
-  bool last_send_time_valid_;
+  // The request rate's schedule: request n is due n inter-send times
+  // after the start.
+  struct timeval schedule_start_time_;
+  bool schedule_started_;
+  int64_t n_scheduled_sends_;
+  // Sends since the buffered samples were last recorded.
+  int n_sends_since_flush_;
+  // When the request being generated was due, if stages are timed.
+  struct timeval scheduled_time_;
+  TraceRing* trace_ring_;
+  // Responses seen since the last one sampled for tracing.
+  int n_untraced_responses_;
+  // Opened by the worker itself as its loop starts, since they count the
+  // thread that opens them.
+  PerfCounters* volatile perf_counters_;
   // Each WorkerThread has its own StatisticsCollection.
   pthread_t* thread_;
 
@@ -98,7 +232,7 @@ class WarmupWorkerThread : public WorkerThread {
                      WarmupSequence* warmup_sequence);
   //virtual ~WarmupWorkerThread();
   virtual void SendCallback();
-  virtual void ReceiveCallback();
+  virtual void ReceiveCallback(Connection* connection);
 
  private:
   WarmupSequence* warmup_sequence_;
@@ -0,0 +1,85 @@
+//  Redistributions of any form whatsoever must retain and/or include the
+//  following acknowledgment, notices and disclaimer:
+//
+//  This product includes software developed by the University of Michigan.
+//
+//  Copyright 2011 by David Meisner
+//  at the University of Michigan
+//
+//  You may not use the name "University of Michigan" or derivations
+//  thereof to endorse or promote products derived from this software.
+//
+//  If you modify the software you must place a notice on or within any
+//  modified version provided or made available to any third party stating
+//  that you have modified the software.  The notice shall include at least
+//  your name, address, phone number, email address and the date and purpose
+//  of the modification.
+//
+//  THE SOFTWARE IS PROVIDED "AS-IS" WITHOUT ANY WARRANTY OF ANY KIND, EITHER
+//  EXPRESS, IMPLIED OR STATUTORY, INCLUDING BUT NOT LIMITED TO ANY WARRANTY
+//  THAT THE SOFTWARE WILL CONFORM TO SPECIFICATIONS OR BE ERROR-FREE AND ANY
+//  IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE,
+//  TITLE, OR NON-INFRINGEMENT.  IN NO EVENT SHALL THE UNIVERSITY OF MICHIGAN
+//  BE LIABLE FOR ANY DAMAGES, INCLUDING BUT NOT LIMITED TO DIRECT, INDIRECT,
+//  SPECIAL OR CONSEQUENTIAL DAMAGES, ARISING OUT OF, RESULTING FROM, OR IN
+//  ANY WAY CONNECTED WITH THIS SOFTWARE (WHETHER OR NOT BASED UPON WARRANTY,
+//  CONTRACT, TORT OR OTHERWISE).
+//
+//  worker_thread_test.cc
+//
+
+#include "cachebash/worker_thread.h"
+
+#include <sys/time.h>
+
+#include "cachebash/config.h"
+#include "cachebash/statistic.h"
+#include "cachebash/util.h"
+#include "gtest/gtest.h"
+
+using cachebash::Config;
+using cachebash::StatisticsCollection;
+using cachebash::WorkerThread;
+
+namespace {
+
+// Returns the time |seconds| from now.
+struct timeval GetDeadline(double seconds) {
+  struct timeval timestamp;
+  gettimeofday(&timestamp, NULL);
+  struct timeval timeout = cachebash::SecondsToTimeval(seconds);
+  struct timeval deadline;
+  timeradd(&timestamp, &timeout, &deadline);
+  return deadline;
+}
+
+// A worker that never gets to a callback never acknowledges a flip, so
+// the statistics thread gives up on it rather than waiting forever, and
+// gets its buffer once it finally switches.
+TEST(WorkerThreadTest, FlipTimesOutOnStalledWorker) {
+  Config config;
+  StatisticsCollection* statistics_collection
+    = new StatisticsCollection(NULL);
+  statistics_collection->RegisterStandardStatistics();
+  WorkerThread worker_thread(&config, NULL, statistics_collection, 0);
+
+  struct timeval start_time;
+  gettimeofday(&start_time, NULL);
+  EXPECT_TRUE(worker_thread.FlipStatisticsCollection(GetDeadline(0.01))
+              == NULL);
+  struct timeval end_time, time_diff;
+  gettimeofday(&end_time, NULL);
+  timersub(&end_time, &start_time, &time_diff);
+  EXPECT_LT(time_diff.tv_sec, 1);
+
+  // Still stalled at the next interval, the flip stays pending rather
+  // than flipping back to the buffer the worker is using.
+  EXPECT_TRUE(worker_thread.FlipStatisticsCollection(GetDeadline(0.01))
+              == NULL);
+
+  worker_thread.SwitchStatisticsCollection();
+  EXPECT_EQ(statistics_collection,
+            worker_thread.FlipStatisticsCollection(GetDeadline(0.01)));
+}
+
+}  // namespace